@@ -1,7 +1,7 @@
 #ifndef BDE_BASEMENU_H
 #define BDE_BASEMENU_H
 
-#include "widget.h"
+#include "curses_widget.h"
 #include <cstring>
 
 struct MenuItem {
@@ -26,7 +26,7 @@ struct MenubarItem {
 
 typedef MenubarItem MenubarMenu[];
 
-class PopupMenu : public Widget {
+class PopupMenu : public CursesWidget {
 
 public:
     // The result of the user interaction:
@@ -90,7 +90,7 @@ public:
     virtual void update();
 };
 
-class Menubar : public Widget {
+class Menubar : public CursesWidget {
 
 protected:
 
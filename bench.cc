@@ -0,0 +1,512 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+// geresh-bench - benchmarks of libgeresh-core.
+//
+// It runs without a terminal: the EditBox never gets a canvas (see
+// canvas.h), just like in --log2vis mode. The text is generated from a
+// fixed seed, so runs are comparable. Each benchmark prints one line of
+// JSON:
+//
+//   {"name": "load/UTF-8", "reps": 5, "best_sec": 0.0123,
+//    "median_sec": 0.0131, "bytes": 1048576, "mb_per_sec": 81.3}
+//
+// ("bytes" and "mb_per_sec" only where a byte count makes sense.)
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <vector>
+#include <algorithm>
+
+#include "editbox.h"
+#include "geresh_io.h"
+#include "univalues.h"
+
+#define DEFAULT_TEXT_KB	1024
+#define DEFAULT_REPS	5
+// the number of edits the insert, delete and undo benchmarks do.
+#define EDIT_COUNT	10000
+#define TEXT_WIDTH	80
+// geresh's default undo size (see --undo-size).
+#define UNDO_SIZE	(50*1024)
+
+static const char *encodings[] = {
+    "UTF-8", "ISO-8859-8", "CP1255", "UTF-16", "UTF-32", NULL
+};
+
+static u8string tmp_dir;
+static u8string text_filename;	// the generated text, in UTF-8
+static size_t text_bytes;
+
+// Text generation {{{
+
+// We use our own generator, not rand(), so the text is the same
+// everywhere.
+static unsigned long seed = 12345;
+
+static int next_random(int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (int)((seed >> 16) % range);
+}
+
+static void append_word(unistring &str)
+{
+    int len = 2 + next_random(6);
+    bool hebrew = next_random(10) < 7;
+    for (int i = 0; i < len; i++) {
+	if (hebrew)
+	    str.push_back(UNI_HEB_ALEF + next_random(27));
+	else
+	    str.push_back('a' + next_random(26));
+    }
+    if (next_random(12) == 0)
+	str.push_back(next_random(2) ? ',' : '.');
+    else if (next_random(40) == 0) {
+	str.push_back(' ');
+	str.push_back('0' + next_random(10));
+	str.push_back('0' + next_random(10));
+    }
+}
+
+// generate_text() - generates "kb" kilobytes of mixed Hebrew and English
+// text (in UTF-8): blocks of a few lines separated by blank lines, so
+// justify() has something to do.
+
+static void generate_text(u8string &text, size_t kb)
+{
+    text.clear();
+    while (text.size() < kb * 1024) {
+	int lines = 1 + next_random(6);
+	for (int i = 0; i < lines; i++) {
+	    unistring line;
+	    int words = 4 + next_random(10);
+	    for (int j = 0; j < words; j++) {
+		if (j)
+		    line.push_back(' ');
+		append_word(line);
+	    }
+	    u8string u8line(line);
+	    text += u8line;
+	    text += '\n';
+	}
+	text += '\n';
+    }
+}
+
+// }}}
+
+// Benchmarks {{{
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void die(const char *what)
+{
+    fprintf(stderr, "geresh-bench: %s: %s\n", what, get_last_error());
+    exit(1);
+}
+
+static void load(EditBox &editbox, const char *filename,
+		 const char *encoding)
+{
+    u8string effective_encoding;
+    bool is_new;
+    if (!xload_file(&editbox, filename, encoding, "UTF-8",
+		    effective_encoding, is_new, true))
+	die(filename);
+}
+
+static void save(EditBox &editbox, const char *filename,
+		 const char *encoding)
+{
+    unichar offending_char;
+    if (!xsave_file(&editbox, filename, encoding, NULL, offending_char))
+	die(filename);
+}
+
+static u8string encoded_filename(const char *encoding)
+{
+    u8string filename = tmp_dir;
+    filename += "/text.";
+    filename += encoding;
+    return filename;
+}
+
+// A Benchmark times run(). setup() prepares the state for a single
+// run() and isn't timed.
+
+class Benchmark {
+public:
+    u8string name;
+    size_t bytes;   // the bytes a run() processes, or 0
+
+    Benchmark(const char *aName) { name = aName; bytes = 0; }
+    virtual ~Benchmark() {}
+    virtual void setup() {}
+    virtual void run() = 0;
+};
+
+// DocumentBenchmark works on a fresh copy of the generated text.
+
+class DocumentBenchmark : public Benchmark {
+protected:
+    EditBox *editbox;
+public:
+    DocumentBenchmark(const char *aName) : Benchmark(aName) {
+	editbox = NULL;
+    }
+    ~DocumentBenchmark() { delete editbox; }
+    virtual void setup() {
+	delete editbox;
+	editbox = new EditBox();
+	editbox->set_non_interactive_text_width(TEXT_WIDTH);
+	editbox->set_undo_size_limit(UNDO_SIZE);
+	load(*editbox, text_filename.c_str(), "UTF-8");
+    }
+    int last_para() const { return editbox->get_number_of_paragraphs() - 1; }
+};
+
+class LoadBenchmark : public Benchmark {
+    const char *encoding;
+    u8string filename;
+    EditBox editbox;
+public:
+    LoadBenchmark(const char *aName, const char *aEncoding)
+	: Benchmark(aName) {
+	encoding = aEncoding;
+	filename = encoded_filename(encoding);
+	struct stat st;
+	if (stat(filename.c_str(), &st) == 0)
+	    bytes = st.st_size;
+	editbox.set_non_interactive_text_width(TEXT_WIDTH);
+    }
+    virtual void run() { load(editbox, filename.c_str(), encoding); }
+};
+
+class SaveBenchmark : public DocumentBenchmark {
+    const char *encoding;
+    u8string filename;
+public:
+    SaveBenchmark(const char *aName, const char *aEncoding)
+	: DocumentBenchmark(aName) {
+	encoding = aEncoding;
+	filename = tmp_dir;
+	filename += "/saved";
+	bytes = text_bytes;
+    }
+    ~SaveBenchmark() { unlink(filename.c_str()); }
+    virtual void setup() {
+	if (!editbox)
+	    DocumentBenchmark::setup();
+    }
+    virtual void run() { save(*editbox, filename.c_str(), encoding); }
+};
+
+enum edit_position { atStart, atMiddle, atEnd };
+
+static Point edit_point(EditBox &editbox, edit_position where)
+{
+    int last = editbox.get_number_of_paragraphs() - 1;
+    switch (where) {
+    case atStart:
+	return Point(0, 0);
+    case atMiddle:
+	return Point(last / 2, 0);
+    default:
+	return Point(last, 0);
+    }
+}
+
+class InsertBenchmark : public DocumentBenchmark {
+    edit_position where;
+public:
+    InsertBenchmark(const char *aName, edit_position aWhere)
+	: DocumentBenchmark(aName) { where = aWhere; }
+    virtual void setup() {
+	DocumentBenchmark::setup();
+	editbox->set_cursor_position(edit_point(*editbox, where));
+    }
+    // like typing: words, and a new line every 60 characters.
+    virtual void run() {
+	for (int i = 0; i < EDIT_COUNT; i++) {
+	    if (i % 60 == 59)
+		editbox->insert_char('\n');
+	    else
+		editbox->insert_char(i % 6 ? UNI_HEB_ALEF + i % 27 : ' ');
+	}
+    }
+};
+
+class DeleteBenchmark : public DocumentBenchmark {
+    edit_position where;
+public:
+    DeleteBenchmark(const char *aName, edit_position aWhere)
+	: DocumentBenchmark(aName) { where = aWhere; }
+    virtual void setup() {
+	DocumentBenchmark::setup();
+	Point point = edit_point(*editbox, where);
+	// at the end there's nothing to delete forward.
+	if (where == atEnd)
+	    point.para = MAX(0, point.para - EDIT_COUNT / 40);
+	editbox->set_cursor_position(point);
+    }
+    virtual void run() {
+	for (int i = 0; i < EDIT_COUNT; i++)
+	    editbox->delete_forward_char();
+    }
+};
+
+class RewrapBenchmark : public DocumentBenchmark {
+public:
+    RewrapBenchmark(const char *aName) : DocumentBenchmark(aName) {
+	bytes = text_bytes;
+    }
+    virtual void setup() {
+	if (!editbox)
+	    DocumentBenchmark::setup();
+    }
+    // reformat() is rewrap_all() plus scrolling to the cursor.
+    virtual void run() { editbox->reformat(); }
+};
+
+class SearchBenchmark : public DocumentBenchmark {
+public:
+    SearchBenchmark(const char *aName) : DocumentBenchmark(aName) {
+	bytes = text_bytes;
+    }
+    virtual void setup() {
+	if (!editbox)
+	    DocumentBenchmark::setup();
+	editbox->set_cursor_position(Point(0, 0));
+    }
+    // the generated text never has a digit before a letter, so this
+    // scans all of it.
+    virtual void run() { editbox->search_forward(u8string("0a")); }
+};
+
+class JustifyBenchmark : public DocumentBenchmark {
+public:
+    JustifyBenchmark(const char *aName) : DocumentBenchmark(aName) {
+	bytes = text_bytes;
+    }
+    virtual void setup() {
+	DocumentBenchmark::setup();
+	editbox->set_justification_column(60);
+    }
+    virtual void run() {
+	Point prev(-1, 0), cursor;
+	editbox->get_cursor_position(cursor);
+	while (cursor.para < last_para() && prev.para != cursor.para) {
+	    prev = cursor;
+	    editbox->justify();
+	    editbox->get_cursor_position(cursor);
+	}
+    }
+};
+
+// Log2VisBenchmark times the --log2vis mode (xlog2vis_file()), from the
+// source file to the standard output, which we point at /dev/null.
+
+class Log2VisBenchmark : public Benchmark {
+    const char *options;
+    EditBox editbox;
+public:
+    Log2VisBenchmark(const char *aName, const char *aOptions)
+	: Benchmark(aName) {
+	options = aOptions;
+	bytes = text_bytes;
+	editbox.set_non_interactive_text_width(TEXT_WIDTH);
+    }
+    virtual void run() {
+	fflush(stdout);
+	int stdout_fd = dup(STDOUT_FILENO);
+	int null_fd = open("/dev/null", O_WRONLY);
+	dup2(null_fd, STDOUT_FILENO);
+	close(null_fd);
+	bool output_failed;
+	bool ok = xlog2vis_file(&editbox, text_filename.c_str(), "UTF-8",
+				"UTF-8", "UTF-8", options, output_failed);
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+	if (!ok)
+	    die(text_filename.c_str());
+    }
+};
+
+class UndoRedoBenchmark : public DocumentBenchmark {
+public:
+    UndoRedoBenchmark(const char *aName) : DocumentBenchmark(aName) {}
+    // we insert in different paragraphs, so the insertions aren't
+    // merged into a single undo operation. The undo stack must be big
+    // enough to hold them all.
+    virtual void setup() {
+	DocumentBenchmark::setup();
+	editbox->set_undo_size_limit(EDIT_COUNT * 1024);
+	int step = MAX(1, last_para() / EDIT_COUNT);
+	for (int i = 0; i < EDIT_COUNT; i++) {
+	    editbox->set_cursor_position(Point((i * step) % last_para(), 0));
+	    editbox->insert_char('x');
+	}
+    }
+    virtual void run() {
+	for (int i = 0; i < EDIT_COUNT; i++)
+	    editbox->undo();
+	for (int i = 0; i < EDIT_COUNT; i++)
+	    editbox->redo();
+    }
+};
+
+// }}}
+
+static void measure(Benchmark &bench, int reps)
+{
+    std::vector<double> times;
+    for (int i = 0; i < reps; i++) {
+	bench.setup();
+	double start = now();
+	bench.run();
+	times.push_back(now() - start);
+    }
+    std::sort(times.begin(), times.end());
+    double best = times[0];
+    double median = times[times.size() / 2];
+
+    printf("{\"name\": \"%s\", \"reps\": %d, \"best_sec\": %.6f, "
+	   "\"median_sec\": %.6f", bench.name.c_str(), reps, best, median);
+    if (bench.bytes)
+	printf(", \"bytes\": %lu, \"mb_per_sec\": %.2f",
+	       (unsigned long)bench.bytes,
+	       best > 0 ? bench.bytes / best / (1024 * 1024) : 0.0);
+    printf("}\n");
+    fflush(stdout);
+}
+
+static void usage()
+{
+    printf("Usage: geresh-bench [-s KB] [-r REPS] [PATTERN...]\n"
+	   "  -s KB     size of the generated text (default: %d)\n"
+	   "  -r REPS   runs of each benchmark (default: %d); the best\n"
+	   "            and the median are reported\n"
+	   "Only the benchmarks whose names contain one of the PATTERNs\n"
+	   "are run. The results are printed as JSON, one line each.\n",
+	   DEFAULT_TEXT_KB, DEFAULT_REPS);
+}
+
+static bool selected(const char *name, char **patterns, int npatterns)
+{
+    if (npatterns == 0)
+	return true;
+    for (int i = 0; i < npatterns; i++)
+	if (strstr(name, patterns[i]))
+	    return true;
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t kb = DEFAULT_TEXT_KB;
+    int reps = DEFAULT_REPS;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:r:h")) != -1) {
+	switch (c) {
+	case 's': kb = atol(optarg); break;
+	case 'r': reps = atoi(optarg); break;
+	default:
+	    usage();
+	    return c == 'h' ? 0 : 1;
+	}
+    }
+    if (kb == 0 || reps <= 0) {
+	usage();
+	return 1;
+    }
+    char **patterns = argv + optind;
+    int npatterns = argc - optind;
+
+    const char *tmp = getenv("TMPDIR");
+    tmp_dir = tmp ? tmp : "/tmp";
+    tmp_dir += "/geresh-bench.XXXXXX";
+    if (!mkdtemp(&tmp_dir[0])) {
+	perror("geresh-bench: mkdtemp");
+	return 1;
+    }
+
+    // write the text, and its encoded versions for the load benchmarks.
+    u8string text;
+    generate_text(text, kb);
+    text_bytes = text.size();
+    text_filename = encoded_filename("source");
+    int fd = open(text_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || write(fd, text.c_str(), text.size()) != (ssize_t)text.size()) {
+	perror("geresh-bench: write");
+	return 1;
+    }
+    close(fd);
+    EditBox master;
+    load(master, text_filename.c_str(), "UTF-8");
+    for (int i = 0; encodings[i]; i++)
+	save(master, encoded_filename(encodings[i]).c_str(), encodings[i]);
+
+    std::vector<Benchmark *> benchmarks;
+    for (int i = 0; encodings[i]; i++) {
+	u8string name;
+	name.cformat("load/%s", encodings[i]);
+	benchmarks.push_back(new LoadBenchmark(name.c_str(), encodings[i]));
+    }
+    for (int i = 0; encodings[i]; i++) {
+	u8string name;
+	name.cformat("save/%s", encodings[i]);
+	benchmarks.push_back(new SaveBenchmark(name.c_str(), encodings[i]));
+    }
+    benchmarks.push_back(new InsertBenchmark("insert/start", atStart));
+    benchmarks.push_back(new InsertBenchmark("insert/middle", atMiddle));
+    benchmarks.push_back(new InsertBenchmark("insert/end", atEnd));
+    benchmarks.push_back(new DeleteBenchmark("delete/start", atStart));
+    benchmarks.push_back(new DeleteBenchmark("delete/middle", atMiddle));
+    benchmarks.push_back(new DeleteBenchmark("delete/end", atEnd));
+    benchmarks.push_back(new RewrapBenchmark("rewrap_all"));
+    benchmarks.push_back(new SearchBenchmark("search_forward"));
+    benchmarks.push_back(new JustifyBenchmark("justify"));
+    benchmarks.push_back(new Log2VisBenchmark("log2vis", ""));
+    benchmarks.push_back(new Log2VisBenchmark("log2vis/bdo,emph", "bdo,emph"));
+    benchmarks.push_back(new UndoRedoBenchmark("undo_redo"));
+
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+	if (selected(benchmarks[i]->name.c_str(), patterns, npatterns))
+	    measure(*benchmarks[i], reps);
+	delete benchmarks[i];
+    }
+
+    for (int i = 0; encodings[i]; i++)
+	unlink(encoded_filename(encodings[i]).c_str());
+    unlink(text_filename.c_str());
+    rmdir(tmp_dir.c_str());
+    return 0;
+}
@@ -18,6 +18,7 @@
 
 #include "bidi.h"
 #include "dbg.h"
+#include "stats.h"
 
 static ctype_t fribidi_dir(direction_t dir)
 {
@@ -35,6 +36,9 @@ void BiDi::get_embedding_levels(unichar *str, idx_t len,
 				idx_t *line_breaks,
 				bool disable_bidi)
 {
+    PERF_COUNT(embedding_levels, 1);
+    PERF_COUNT(embedding_levels_chars, len);
+
     if (disable_bidi) {
 	for (idx_t i = len-1; i >= 0; i--)
 	    levels[i] = (dir == dirRTL) ? 1 :0;
@@ -0,0 +1,60 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_CANVAS_H
+#define BDE_CANVAS_H
+
+#include "types.h"
+
+typedef int attribute_t;
+
+// Canvas is the surface a widget draws on. It's all the core (EditBox and
+// the widgets it derives from) knows about the screen: the frontend
+// implements it with a curses window (see CursesCanvas), and hands out
+// canvases through Widget::canvas_factory. When there's no factory -- in
+// --log2vis mode and in geresh-bench -- widgets have no canvas; they still
+// lay out their contents, but they never draw them.
+//
+// Attributes are opaque to the core. It gets them from get_attr(), which
+// maps the identifiers of themes.h to whatever the canvas draws with, and
+// combines them with "|" only.
+
+class Canvas {
+public:
+    virtual ~Canvas() {}
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    virtual void resize(int lines, int columns, int y, int x) = 0;
+
+    virtual attribute_t get_attr(int ident) = 0;
+
+    // blank() - blanks the canvas and makes "attr" its background.
+    virtual void blank(attribute_t attr) = 0;
+    virtual void move_to(int line, int col) = 0;
+    virtual void set_attr(attribute_t attr) = 0;
+    // put_char() - draws a character, already converted to the terminal's
+    // repertoire (see Widget::put_unichar()), and advances.
+    virtual void put_char(unichar ch) = 0;
+    virtual void clear_to_eol() = 0;
+    // scroll_lines() - scrolls the contents "count" lines up (down, if
+    // negative). The lines scrolled in are blank.
+    virtual void scroll_lines(int count) = 0;
+    // flush() - marks the canvas for the next screen update.
+    virtual void flush() = 0;
+};
+
+#endif
@@ -17,9 +17,15 @@
 #include <config.h>
 
 #include <ctype.h> // toupper
+#include <string.h> // memset, memcpy
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define HAVE_SSE2_KERNEL 1
+#endif
 
 #include "converters.h"
-#include "iso88598.h"
+#include "univalues.h"
 #include "utf8.h"
 #include "dbg.h"
 
@@ -54,34 +60,20 @@ const char *guess_encoding(const char *buf, int len)
 	    return IS_UTF32; // BE
     }
 
-    // No BOM was found. Go through the string and check for
-    // UTF-8 sequences: if an illegal sequence was found, it's
-    // IS_NOT_UTF8, if all squences are legal, it's IS_UTF8, if
-    // it doesn't have characters with high bit set, return
-    // UNKNOWN. 
-
-    const char *result = UNKNOWN_TYPE;
-    int nbytes = 0;
-    for (int i = 0; i < len; i++) {
-	if (nbytes) {
-	    if ((buf[i] & 0xC0) != 0x80) {
-		return IS_NOT_UTF8;
-	    }
-	    if (! --nbytes)
-		result = IS_UTF8;
-	} else if (buf[i] & 0x80) {
-	    const char &c = buf[i];
-	    nbytes = (c & 0xE0) == 0xC0 ? 1 :
-		     (c & 0xF0) == 0xE0 ? 2 :
-		     (c & 0xF8) == 0xF0 ? 3 :
-		     (c & 0xFC) == 0xF8 ? 4 :
-		     (c & 0xFE) == 0xFC ? 5 : 0;
-	    if (nbytes == 0) {
-		return IS_NOT_UTF8;
-	    }
-	}
-    }
-    return result;
+    // No BOM was found. Validate the string as UTF-8: if an illegal
+    // sequence was found, it's IS_NOT_UTF8; if all sequences are legal,
+    // it's IS_UTF8; if it doesn't have characters with high bit set,
+    // return UNKNOWN. An incomplete sequence at the end of the buffer is
+    // not an error: the buffer is usually just the head of a file.
+
+    const char *problem;
+    bool illegal;
+    int nchars = utf8_to_unicode_strict(NULL, buf, len, &problem, illegal);
+    if (illegal)
+	return IS_NOT_UTF8;
+    int nbytes = problem ? problem - buf : len;
+    // every multi-byte sequence makes nchars smaller than nbytes.
+    return (nchars < nbytes) ? IS_UTF8 : UNKNOWN_TYPE;
 }
 
 #ifdef USE_ICONV
@@ -150,82 +142,479 @@ int IconvConverter::convert(char **dest, unichar **src, int len)
 }
 #endif
 
-int ISO88598Converter::convert(unichar **dest, char **src, int len)
+// {{{ Single-byte encodings
+
+// The upper halves of the single-byte encodings, as glibc's iconv maps
+// them. 0 marks a byte that isn't mapped.
+
+static const unichar cp1255_upper_half[128] = {
+    0x20AC, 0,      0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,  // 0x80
+    0x02C6, 0x2030, 0,      0x2039, 0,      0,      0,      0,       // 0x88
+    0,      0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,  // 0x90
+    0x02DC, 0x2122, 0,      0x203A, 0,      0,      0,      0,       // 0x98
+    0x00A0, 0x00A1, 0x00A2, 0x00A3, 0x20AA, 0x00A5, 0x00A6, 0x00A7,  // 0xA0
+    0x00A8, 0x00A9, 0x00D7, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,  // 0xA8
+    0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,  // 0xB0
+    0x00B8, 0x00B9, 0x00F7, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0x00BF,  // 0xB8
+    0x05B0, 0x05B1, 0x05B2, 0x05B3, 0x05B4, 0x05B5, 0x05B6, 0x05B7,  // 0xC0
+    0x05B8, 0x05B9, 0,      0x05BB, 0x05BC, 0x05BD, 0x05BE, 0x05BF,  // 0xC8
+    0x05C0, 0x05C1, 0x05C2, 0x05C3, 0x05F0, 0x05F1, 0x05F2, 0x05F3,  // 0xD0
+    0x05F4, 0,      0,      0,      0,      0,      0,      0,       // 0xD8
+    0x05D0, 0x05D1, 0x05D2, 0x05D3, 0x05D4, 0x05D5, 0x05D6, 0x05D7,  // 0xE0
+    0x05D8, 0x05D9, 0x05DA, 0x05DB, 0x05DC, 0x05DD, 0x05DE, 0x05DF,  // 0xE8
+    0x05E0, 0x05E1, 0x05E2, 0x05E3, 0x05E4, 0x05E5, 0x05E6, 0x05E7,  // 0xF0
+    0x05E8, 0x05E9, 0x05EA, 0,      0,      0x200E, 0x200F, 0,       // 0xF8
+};
+
+// ISO-8859-8 also has FriBiDi's "proposed extensions" (the LRE, RLE, PDF,
+// LRO and RLO codes), as iso88598.cc does.
+
+static const unichar iso88598_upper_half[128] = {
+    0x0080, 0x0081, 0x0082, 0x0083, 0x0084, 0x0085, 0x0086, 0x0087,  // 0x80
+    0x0088, 0x0089, 0x008A, 0x008B, 0x008C, 0x008D, 0x008E, 0x008F,  // 0x88
+    0x0090, 0x0091, 0x0092, 0x0093, 0x0094, 0x0095, 0x0096, 0x0097,  // 0x90
+    0x0098, 0x0099, 0x009A, 0x009B, 0x009C, 0x009D, 0x009E, 0x009F,  // 0x98
+    0x00A0, 0,      0x00A2, 0x00A3, 0x00A4, 0x00A5, 0x00A6, 0x00A7,  // 0xA0
+    0x00A8, 0x00A9, 0x00D7, 0x00AB, 0x00AC, 0x00AD, 0x00AE, 0x00AF,  // 0xA8
+    0x00B0, 0x00B1, 0x00B2, 0x00B3, 0x00B4, 0x00B5, 0x00B6, 0x00B7,  // 0xB0
+    0x00B8, 0x00B9, 0x00F7, 0x00BB, 0x00BC, 0x00BD, 0x00BE, 0,       // 0xB8
+    0,      0,      0,      0,      0,      0,      0,      0,       // 0xC0
+    0,      0,      0,      0,      0,      0,      0,      0,       // 0xC8
+    0,      0,      0,      0,      0,      0,      0,      0,       // 0xD0
+    0,      0,      0,      UNI_LRO,UNI_RLO,UNI_PDF,0,      0x2017,  // 0xD8
+    0x05D0, 0x05D1, 0x05D2, 0x05D3, 0x05D4, 0x05D5, 0x05D6, 0x05D7,  // 0xE0
+    0x05D8, 0x05D9, 0x05DA, 0x05DB, 0x05DC, 0x05DD, 0x05DE, 0x05DF,  // 0xE8
+    0x05E0, 0x05E1, 0x05E2, 0x05E3, 0x05E4, 0x05E5, 0x05E6, 0x05E7,  // 0xF0
+    0x05E8, 0x05E9, 0x05EA, UNI_LRE,UNI_RLE,UNI_LRM,UNI_RLM,0,       // 0xF8
+};
+
+static const unichar ascii_upper_half[128] = { 0 };
+
+// CP1255 has the niqqud, so we can save the Hebrew presentation forms
+// (which iconv produces when it loads CP1255 text) as letter + points.
+
+static const unichar cp1255_decompositions[][4] = {
+    { 0xFB1D, 0x05D9, 0x05B4, 0 },
+    { 0xFB1F, 0x05F2, 0x05B7, 0 },
+    { 0xFB2A, 0x05E9, 0x05C1, 0 },
+    { 0xFB2B, 0x05E9, 0x05C2, 0 },
+    { 0xFB2C, 0x05E9, 0x05BC, 0x05C1 },
+    { 0xFB2D, 0x05E9, 0x05BC, 0x05C2 },
+    { 0xFB2E, 0x05D0, 0x05B7, 0 },
+    { 0xFB2F, 0x05D0, 0x05B8, 0 },
+    { 0xFB30, 0x05D0, 0x05BC, 0 },
+    { 0xFB31, 0x05D1, 0x05BC, 0 },
+    { 0xFB32, 0x05D2, 0x05BC, 0 },
+    { 0xFB33, 0x05D3, 0x05BC, 0 },
+    { 0xFB34, 0x05D4, 0x05BC, 0 },
+    { 0xFB35, 0x05D5, 0x05BC, 0 },
+    { 0xFB36, 0x05D6, 0x05BC, 0 },
+    { 0xFB38, 0x05D8, 0x05BC, 0 },
+    { 0xFB39, 0x05D9, 0x05BC, 0 },
+    { 0xFB3A, 0x05DA, 0x05BC, 0 },
+    { 0xFB3B, 0x05DB, 0x05BC, 0 },
+    { 0xFB3C, 0x05DC, 0x05BC, 0 },
+    { 0xFB3E, 0x05DE, 0x05BC, 0 },
+    { 0xFB40, 0x05E0, 0x05BC, 0 },
+    { 0xFB41, 0x05E1, 0x05BC, 0 },
+    { 0xFB43, 0x05E3, 0x05BC, 0 },
+    { 0xFB44, 0x05E4, 0x05BC, 0 },
+    { 0xFB46, 0x05E6, 0x05BC, 0 },
+    { 0xFB47, 0x05E7, 0x05BC, 0 },
+    { 0xFB48, 0x05E8, 0x05BC, 0 },
+    { 0xFB49, 0x05E9, 0x05BC, 0 },
+    { 0xFB4A, 0x05EA, 0x05BC, 0 },
+    { 0xFB4B, 0x05D5, 0x05B9, 0 },
+    { 0xFB4C, 0x05D1, 0x05BF, 0 },
+    { 0xFB4D, 0x05DB, 0x05BF, 0 },
+    { 0xFB4E, 0x05E4, 0x05BF, 0 },
+    { 0 }
+};
+
+SingleByteConverter::SingleByteConverter(const unichar *upper_half,
+				const unichar (*decompositions)[4])
+{
+    this->decompositions = decompositions;
+    for (int i = 0; i < 256; i++)
+	from_unicode[i] = NULL;
+    for (int i = 0; i < 256; i++) {
+	unichar ch = (i < 0x80 || !upper_half) ? i : upper_half[i - 0x80];
+	to_unicode[i] = ch;
+	if (i < 0x80 || ch == 0 || ch >= 0x10000)
+	    continue;
+	unsigned char *&page = from_unicode[ch >> 8];
+	if (!page) {
+	    page = new unsigned char[256];
+	    memset(page, 0, 256);
+	}
+	page[ch & 0xFF] = i;
+    }
+}
+
+SingleByteConverter::~SingleByteConverter()
+{
+    for (int i = 0; i < 256; i++)
+	delete[] from_unicode[i];
+}
+
+int SingleByteConverter::convert(unichar **dest, char **src, int len)
 {
-    int count = 0;
     unichar * &d = *dest;
     char *    &s = *src;
-    while (len--) {
-	*d++ = iso88598_to_unicode(*s++);
-	count++;
+    const char *end = s + len;
+    while (s < end) {
+	int nascii = ascii_to_unicode(d, s, end - s);
+	d += nascii;
+	s += nascii;
+	while (s < end && (*s & 0x80)) {
+	    unichar ch = to_unicode[(unsigned char)*s];
+	    if (ch == 0) {
+		errno = EILSEQ;
+		return -1;
+	    }
+	    *d++ = ch;
+	    s++;
+	}
     }
-    return count;
+    return len;
 }
 
-int ISO88598Converter::convert(char **dest, unichar **src, int len)
+// decompose() - writes the components of 'ch', if it has a decomposition
+// and all its components can be encoded.
+
+bool SingleByteConverter::decompose(char *&dest, unichar ch) const
+{
+    if (!decompositions)
+	return false;
+    for (int i = 0; decompositions[i][0]; i++) {
+	if (decompositions[i][0] != ch)
+	    continue;
+	char buf[3];
+	int n = 0;
+	for (int j = 1; j < 4 && decompositions[i][j]; j++)
+	    if (!(buf[n++] = to_byte(decompositions[i][j])))
+		return false;
+	memcpy(dest, buf, n);
+	dest += n;
+	return true;
+    }
+    return false;
+}
+
+int SingleByteConverter::convert(char **dest, unichar **src, int len)
 {
-    int count = 0;
     char *    &d = *dest;
     unichar * &s = *src;
-    while (len--) {
-	int ich = unicode_to_iso88598(*s);
-	if (ich == EOF) {
-	    if (ilseq_repr) {
-		ich = '?';
-	    } else {
-		errno = EILSEQ;
-		return -1;
+    const unichar *end = s + len;
+    while (s < end) {
+	int nascii = unicode_to_ascii(d, s, end - s);
+	d += nascii;
+	s += nascii;
+	while (s < end && *s >= 0x80) {
+	    int ich = to_byte(*s);
+	    if (ich) {
+		*d++ = (char)ich;
+	    } else if (!decompose(d, *s)) {
+		if (ilseq_repr) {
+		    *d++ = '?';
+		} else {
+		    errno = EILSEQ;
+		    return -1;
+		}
 	    }
+	    s++;
+	}
+    }
+    return len;
+}
+
+// }}}
+
+// {{{ UTF-16 and UTF-32
+
+static bool host_is_big_endian()
+{
+    const unsigned short one = 1;
+    return *(const unsigned char *)&one == 0;
+}
+
+#define IS_SURROGATE(ch)  ((ch) >= 0xD800 && (ch) <= 0xDFFF)
+
+static inline unichar get16(const unsigned char *p, bool big_endian)
+{
+    return big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+static inline void put16(char *&d, unichar u, bool big_endian)
+{
+    if (big_endian) {
+	*d++ = (char)(u >> 8);
+	*d++ = (char)u;
+    } else {
+	*d++ = (char)u;
+	*d++ = (char)(u >> 8);
+    }
+}
+
+static inline unichar get32(const unsigned char *p, bool big_endian)
+{
+    return big_endian
+	? ((unichar)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]
+	: ((unichar)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+static inline void put32(char *&d, unichar u, bool big_endian)
+{
+    if (big_endian) {
+	*d++ = (char)(u >> 24);
+	*d++ = (char)(u >> 16);
+	*d++ = (char)(u >> 8);
+	*d++ = (char)u;
+    } else {
+	*d++ = (char)u;
+	*d++ = (char)(u >> 8);
+	*d++ = (char)(u >> 16);
+	*d++ = (char)(u >> 24);
+    }
+}
+
+// utf16_run_to_unicode() and unicode_to_utf16_run() convert, 8 code units
+// at a time, the leading characters that aren't surrogates (or, when
+// encoding, that are in the BMP). They return the number of characters
+// converted; without SSE2 they leave everything to the caller's loop.
+// (SSE2 implies a little-endian machine.)
+
+static inline int utf16_run_to_unicode(unichar *dest, const unsigned char *s,
+				       int nunits, bool big_endian)
+{
+    int n = 0;
+#ifdef HAVE_SSE2_KERNEL
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16((short)0xF800);
+    const __m128i surrogate = _mm_set1_epi16((short)0xD800);
+    while (nunits - n >= 8) {
+	__m128i v = _mm_loadu_si128((const __m128i *)(s + 2*n));
+	if (big_endian)
+	    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask),
+					      surrogate)))
+	    break;
+	_mm_storeu_si128((__m128i *)(dest + n),     _mm_unpacklo_epi16(v, zero));
+	_mm_storeu_si128((__m128i *)(dest + n + 4), _mm_unpackhi_epi16(v, zero));
+	n += 8;
+    }
+#endif
+    return n;
+}
+
+static inline int unicode_to_utf16_run(char *dest, const unichar *us,
+				       int len, bool big_endian)
+{
+    int n = 0;
+#ifdef HAVE_SSE2_KERNEL
+    const __m128i high = _mm_set1_epi32((int)0xFFFF0000);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi16((short)0xF800);
+    const __m128i surrogate = _mm_set1_epi16((short)0xD800);
+    while (len - n >= 8) {
+	__m128i a = _mm_loadu_si128((const __m128i *)(us + n));
+	__m128i b = _mm_loadu_si128((const __m128i *)(us + n + 4));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(
+			_mm_and_si128(_mm_or_si128(a, b), high), zero)) != 0xFFFF)
+	    break;
+	// sign-extend the low halves, so that the saturating pack is exact.
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	__m128i v = _mm_packs_epi32(a, b);
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, mask),
+					      surrogate)))
+	    break;
+	if (big_endian)
+	    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	_mm_storeu_si128((__m128i *)(dest + 2*n), v);
+	n += 8;
+    }
+#endif
+    return n;
+}
+
+UTF16Converter::UTF16Converter(bool big_endian, bool has_bom)
+{
+    this->big_endian = has_bom ? host_is_big_endian() : big_endian;
+    this->has_bom = has_bom;
+    bom_done = false;
+}
+
+int UTF16Converter::convert(unichar **dest, char **src, int len)
+{
+    unichar * &d = *dest;
+    const unsigned char *s   = (const unsigned char *)*src;
+    const unsigned char *end = s + len;
+    int count = 0;
+
+    if (has_bom && !bom_done && len >= 2) {
+	if (s[0] == 0xFF && s[1] == 0xFE) {
+	    big_endian = false;
+	    s += 2;
+	} else if (s[0] == 0xFE && s[1] == 0xFF) {
+	    big_endian = true;
+	    s += 2;
+	}
+	bom_done = true;
+    }
+
+    while (end - s >= 2) {
+	int n = utf16_run_to_unicode(d, s, (end - s) / 2, big_endian);
+	d += n;
+	s += 2*n;
+	count += n;
+	if (end - s < 2)
+	    break;
+
+	unichar u = get16(s, big_endian);
+	if (!IS_SURROGATE(u)) {
+	    *d++ = u;
+	    s += 2;
+	} else {
+	    if (u >= 0xDC00)
+		break; // illegal
+	    if (end - s < 4)
+		break; // incomplete
+	    unichar u2 = get16(s + 2, big_endian);
+	    if (u2 < 0xDC00 || u2 > 0xDFFF)
+		break; // illegal
+	    *d++ = 0x10000 + ((u - 0xD800) << 10) + (u2 - 0xDC00);
+	    s += 4;
 	}
-	*d++ = (char)ich;
-	s++;
 	count++;
     }
+
+    *src = (char *)s;
+    if (s < end) {
+	unichar u = (end - s >= 2) ? get16(s, big_endian) : 0;
+	errno = (end - s < 2 || (u < 0xDC00 && end - s < 4)) ? EINVAL : EILSEQ;
+	return -1;
+    }
     return count;
 }
 
-int Latin1Converter::convert(unichar **dest, char **src, int len)
+int UTF16Converter::convert(char **dest, unichar **src, int len)
+{
+    char *    &d = *dest;
+    unichar * &s = *src;
+    const unichar *end = s + len;
+
+    if (has_bom && !bom_done && len > 0) {
+	put16(d, UNI_BOM, big_endian);
+	bom_done = true;
+    }
+
+    while (s < end) {
+	int n = unicode_to_utf16_run(d, s, end - s, big_endian);
+	d += 2*n;
+	s += n;
+	if (s == end)
+	    break;
+
+	unichar ch = *s;
+	if (ch < 0x10000 && !IS_SURROGATE(ch)) {
+	    put16(d, ch, big_endian);
+	} else if (ch >= 0x10000 && ch <= 0x10FFFF) {
+	    put16(d, 0xD800 + ((ch - 0x10000) >> 10), big_endian);
+	    put16(d, 0xDC00 + ((ch - 0x10000) & 0x3FF), big_endian);
+	} else if (ilseq_repr) {
+	    put16(d, '?', big_endian);
+	} else {
+	    errno = EILSEQ;
+	    return -1;
+	}
+	s++;
+    }
+    return len;
+}
+
+UTF32Converter::UTF32Converter(bool big_endian, bool has_bom)
+{
+    this->big_endian = has_bom ? host_is_big_endian() : big_endian;
+    this->has_bom = has_bom;
+    bom_done = false;
+}
+
+int UTF32Converter::convert(unichar **dest, char **src, int len)
 {
-    int count = len;
     unichar * &d = *dest;
-    char *    &s = *src;
-    while (len--)
-	*d++ = (unsigned char)*s++;
+    const unsigned char *s   = (const unsigned char *)*src;
+    const unsigned char *end = s + len;
+    int count = 0;
+
+    if (has_bom && !bom_done && len >= 4) {
+	if (get32(s, false) == UNI_BOM) {
+	    big_endian = false;
+	    s += 4;
+	} else if (get32(s, true) == UNI_BOM) {
+	    big_endian = true;
+	    s += 4;
+	}
+	bom_done = true;
+    }
+
+    while (end - s >= 4) {
+	unichar u = get32(s, big_endian);
+	if (u > 0x10FFFF || IS_SURROGATE(u))
+	    break;
+	*d++ = u;
+	s += 4;
+	count++;
+    }
+
+    *src = (char *)s;
+    if (s < end) {
+	errno = (end - s < 4) ? EINVAL : EILSEQ;
+	return -1;
+    }
     return count;
 }
 
-int Latin1Converter::convert(char **dest, unichar **src, int len)
+int UTF32Converter::convert(char **dest, unichar **src, int len)
 {
-    int count = len;
     char *    &d = *dest;
     unichar * &s = *src;
-    while (len--) {
-	if (*s > 0xFF) {
-	    if (ilseq_repr) {
-		*d++ = '?';
-		s++;		
-	    } else {
-	    	errno = EILSEQ;
-	    	return -1;
+    const unichar *end = s + len;
+
+    if (has_bom && !bom_done && len > 0) {
+	put32(d, UNI_BOM, big_endian);
+	bom_done = true;
+    }
+
+    for (; s < end; s++) {
+	unichar ch = *s;
+	if (ch > 0x10FFFF || IS_SURROGATE(ch)) {
+	    if (!ilseq_repr) {
+		errno = EILSEQ;
+		return -1;
 	    }
-	} else {
-	    *d++ = (char)*s++;
+	    ch = '?';
 	}
+	put32(d, ch, big_endian);
     }
-    return count;
+    return len;
 }
 
+// }}}
+
 int UTF8Converter::convert(unichar **dest, char **src, int len)
 {
     int count = 0;
     unichar * &d = *dest;
     char *    &s = *src;
     const char *problem;
-    count = utf8_to_unicode(d, s, len, &problem);
+    bool illegal;
+    count = utf8_to_unicode_strict(d, s, len, &problem, illegal);
     if (problem) {
+	// like iconv, we report the head of the offending sequence.
 	d += count;
 	s = (char *)problem;
-	errno = EINVAL;
+	errno = illegal ? EILSEQ : EINVAL;
 	return -1;
     } else {
 	d += count;
@@ -244,27 +633,67 @@ int UTF8Converter::convert(char **dest, unichar **src, int len)
     return len;
 }
 
-Converter *ConverterFactory::get_internal_converter(const char *enc)
+// The native converters. ConverterFactory tries these first, and turns to
+// iconv only for the encodings not listed here: iconv's per-call overhead
+// dominates the load time of the encodings we use the most.
+
+static Converter *new_utf8()	 { return new UTF8Converter(); }
+static Converter *new_iso88598() { return new SingleByteConverter(iso88598_upper_half); }
+static Converter *new_cp1255()	 { return new SingleByteConverter(cp1255_upper_half,
+							cp1255_decompositions); }
+static Converter *new_latin1()	 { return new SingleByteConverter(NULL); }
+static Converter *new_ascii()	 { return new SingleByteConverter(ascii_upper_half); }
+static Converter *new_utf16()	 { return new UTF16Converter(false, true); }
+static Converter *new_utf16le()	 { return new UTF16Converter(false); }
+static Converter *new_utf16be()	 { return new UTF16Converter(true); }
+static Converter *new_utf32()	 { return new UTF32Converter(false, true); }
+static Converter *new_utf32le()	 { return new UTF32Converter(false); }
+static Converter *new_utf32be()	 { return new UTF32Converter(true); }
+
+struct native_converter_t {
+    const char *name;	// upper-case, no dashes.
+    Converter *(*create)();
+};
+
+static const native_converter_t native_converters[] = {
+    { "UTF8",	     new_utf8 },
+    { "ISO88598",    new_iso88598 },
+    { "88598",	     new_iso88598 },
+    { "CP1255",	     new_cp1255 },
+    { "WINDOWS1255", new_cp1255 },
+    { "ISO88591",    new_latin1 },
+    { "LATIN1",	     new_latin1 },
+    { "88591",	     new_latin1 },
+    { "ASCII",	     new_ascii },
+    { "USASCII",     new_ascii },
+    { "UTF16",	     new_utf16 },
+    { "UTF16LE",     new_utf16le },
+    { "UTF16BE",     new_utf16be },
+    { "UTF32",	     new_utf32 },
+    { "UTF32LE",     new_utf32le },
+    { "UTF32BE",     new_utf32be },
+    { NULL, NULL }
+};
+
+Converter *ConverterFactory::get_native_converter(const char *enc)
 {
     // canonize the encoding name: remove '-', and upperace.
     u8string encoding = u8string(enc).erase_char('-').toupper_ascii();
 
-    DBG(1, ("looking for internal '%s' converter\n", encoding.c_str()));
+    DBG(1, ("looking for native '%s' converter\n", encoding.c_str()));
 
-    if (encoding == "UTF8")
-	return new UTF8Converter();
-    if (encoding == "ISO88598" || encoding == "88598")
-	return new ISO88598Converter();
-    if (encoding == "ISO88591" || encoding == "LATIN1"
-	    || encoding == "88591" || encoding == "ASCII"
-	    || encoding == "USASCII")
-	return new Latin1Converter();
+    for (int i = 0; native_converters[i].name; i++)
+	if (encoding == native_converters[i].name)
+	    return native_converters[i].create();
 
     return NULL;
 }
 
 Converter *ConverterFactory::get_converter_from(const char *encoding)
 {
+    Converter *native = get_native_converter(encoding);
+    if (native)
+	return native;
 #ifdef USE_ICONV
     IconvConverter *iconv = new IconvConverter();
     if (!iconv->set_source_encoding(encoding)) {
@@ -274,12 +703,15 @@ Converter *ConverterFactory::get_converter_from(const char *encoding)
 	return iconv;
     }
 #else
-    return ConverterFactory::get_internal_converter(encoding);
+    return NULL;
 #endif
 }
 
 Converter *ConverterFactory::get_converter_to(const char *encoding)
 {
+    Converter *native = get_native_converter(encoding);
+    if (native)
+	return native;
 #ifdef USE_ICONV
     IconvConverter *iconv = new IconvConverter();
     if (!iconv->set_target_encoding(encoding)) {
@@ -289,7 +721,7 @@ Converter *ConverterFactory::get_converter_to(const char *encoding)
 	return iconv;
     }
 #else
-    return ConverterFactory::get_internal_converter(encoding);
+    return NULL;
 #endif
 }
 
@@ -36,9 +36,13 @@
 //  |
 //  +-- IconvConverter	    (used when the system has ICONV)
 //  |
-//  +-- ISO88598Converter   (used when no ICONV presents)
-//  +-- Latin1Converter	    ditto
-//  +-- UTF8Converter	    ditto
+//  +-- SingleByteConverter (ISO-8859-8, CP1255, Latin-1, ASCII)
+//  +-- UTF8Converter
+//  +-- UTF16Converter
+//  +-- UTF32Converter
+//
+// ConverterFactory prefers our own converters; iconv is used only for
+// the encodings they don't handle.
 
 const char *guess_encoding(const char *buf, int len);
 
@@ -73,26 +77,65 @@ public:
 };
 #endif
 
-class ISO88598Converter : public Converter {
+// SingleByteConverter converts an 8-bit encoding whose lower half is
+// ASCII. The upper half is given as a 128-entry table (0 marks a byte that
+// isn't mapped); a NULL table means Latin-1. "decompositions" optionally
+// lists characters that are saved as a sequence of characters, each row
+// being { character, component, component, 0-or-component }.
+
+class SingleByteConverter : public Converter {
+    unichar to_unicode[256];
+    unsigned char *from_unicode[256];	// pages of the BMP; 0 is unmapped.
+    const unichar (*decompositions)[4];
+
+    int to_byte(unichar ch) const {
+	return (ch < 0x10000 && from_unicode[ch >> 8])
+		    ? from_unicode[ch >> 8][ch & 0xFF] : 0;
+    }
+    bool decompose(char *&dest, unichar ch) const;
+
+    SingleByteConverter(const SingleByteConverter &);
+    SingleByteConverter &operator=(const SingleByteConverter &);
 public:
+    SingleByteConverter(const unichar *upper_half,
+			const unichar (*decompositions)[4] = NULL);
+    virtual ~SingleByteConverter();
     virtual int convert(unichar **dest, char **src, int len);
     virtual int convert(char **dest, unichar **src, int len);
 };
 
-class Latin1Converter : public Converter {
+class UTF8Converter : public Converter {
 public:
     virtual int convert(unichar **dest, char **src, int len);
     virtual int convert(char **dest, unichar **src, int len);
 };
 
-class UTF8Converter : public Converter {
+// UTF16Converter and UTF32Converter: when the encoding name doesn't
+// specify the byte order ("UTF-16", "UTF-32"), the text starts with a BOM.
+// Like glibc, we assume the machine's byte order when there's no BOM.
+
+class UTF16Converter : public Converter {
+    bool big_endian;
+    bool has_bom;
+    bool bom_done;
+public:
+    UTF16Converter(bool big_endian, bool has_bom = false);
+    virtual int convert(unichar **dest, char **src, int len);
+    virtual int convert(char **dest, unichar **src, int len);
+};
+
+class UTF32Converter : public Converter {
+    bool big_endian;
+    bool has_bom;
+    bool bom_done;
 public:
+    UTF32Converter(bool big_endian, bool has_bom = false);
     virtual int convert(unichar **dest, char **src, int len);
     virtual int convert(char **dest, unichar **src, int len);
 };
 
 class ConverterFactory {
-    static Converter *get_internal_converter(const char *encoding);
+    static Converter *get_native_converter(const char *encoding);
 public:
     static Converter *get_converter_from(const char *encoding);
     static Converter *get_converter_to(const char *encoding);
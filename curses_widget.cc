@@ -0,0 +1,172 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include "curses_widget.h"
+#include "themes.h"
+#include "mk_wcwidth.h"
+#include "bidi.h"
+#include "shaping.h"
+
+// CursesCanvas {{{
+
+// create() - the canvas factory (see Widget::canvas_factory).
+
+Canvas *CursesCanvas::create(int lines, int cols)
+{
+    WINDOW *wnd = newwin(lines, cols, 0, 0);
+    if (!wnd)
+	return NULL;
+    keypad(wnd, TRUE);
+    return new CursesCanvas(wnd);
+}
+
+CursesCanvas::~CursesCanvas()
+{
+    delwin(wnd);
+}
+
+int CursesCanvas::width() const
+{
+    int x, y;
+    getmaxyx(wnd, y, x);
+    return x;
+}
+
+int CursesCanvas::height() const
+{
+    int x, y;
+    getmaxyx(wnd, y, x);
+    return y;
+}
+
+void CursesCanvas::resize(int lines, int columns, int y, int x)
+{
+    wresize(wnd, lines, columns);
+    mvwin(wnd, y, x);
+}
+
+attribute_t CursesCanvas::get_attr(int ident)
+{
+    return ::get_attr(ident);
+}
+
+void CursesCanvas::blank(attribute_t attr)
+{
+    wbkgd(wnd, attr);
+    werase(wnd);
+}
+
+void CursesCanvas::move_to(int line, int col)
+{
+    wmove(wnd, line, col);
+}
+
+void CursesCanvas::set_attr(attribute_t attr)
+{
+    wattrset(wnd, attr);
+}
+
+void CursesCanvas::put_char(unichar ch)
+{
+#ifdef HAVE_WIDE_CURSES
+    waddnwstr(wnd, (wchar_t*)&ch, 1);
+#else
+    waddch(wnd, (unsigned char)ch);
+#endif
+}
+
+void CursesCanvas::clear_to_eol()
+{
+    wclrtoeol(wnd);
+}
+
+// scroll_lines() - we let curses scroll the terminal, using its
+// insert/delete-line capabilities, instead of retransmitting the lines.
+
+void CursesCanvas::scroll_lines(int count)
+{
+    idlok(wnd, TRUE);
+    scrollok(wnd, TRUE);
+    wscrl(wnd, count);
+    scrollok(wnd, FALSE);
+}
+
+void CursesCanvas::flush()
+{
+    wnoutrefresh(wnd);
+}
+
+// }}}
+
+// CursesWidget {{{
+
+// draw_string() - draws a UTF-8 string. This is a very simple routine and
+// it's used by the most simple widgets only (like Label).
+
+void CursesWidget::draw_string(const char *u8, bool align_right)
+{
+    unistring text, vis_text;
+    text.init_from_utf8(u8);
+
+    // trim string to fit window width
+    int wnd_x, dummy;
+    getyx(wnd, dummy, wnd_x);
+    int swidth = wnd_x;
+    unichar *trim_pos = text.begin();
+    while (trim_pos < text.end()) {
+	int char_width = mk_wcwidth(*trim_pos);
+	if (swidth + char_width > window_width())
+	    break;
+	swidth += char_width;
+	trim_pos++;
+    }
+    text.erase(trim_pos, text.end());
+
+    // convert to visual
+    direction_t dir = BiDi::determine_base_dir(text.begin(), text.size(),
+					       algoUnicode);
+    BiDi::simple_log2vis(text, dir, vis_text);
+
+    if (terminal::do_arabic_shaping) {
+	int new_len = shape(vis_text.begin(), vis_text.len());
+	swidth -= vis_text.len() - new_len;
+	vis_text.resize(new_len);
+    }
+
+    // draw the string
+    if (align_right && dir == dirRTL)
+	wmove(wnd, 0, window_width() - swidth);
+    for (int i = 0; i < vis_text.len(); i++) {
+	put_unichar(vis_text[i], '?');
+    }
+
+    // reposition the cursor
+    if (align_right && dir == dirRTL)
+	wmove(wnd, 0, window_width() - swidth - 1);
+}
+
+void CursesWidget::signal_error()
+{
+    // I don't like those awful beeps,
+    // but people may not be familiar with flashes.
+
+    //flash();
+    beep();
+}
+
+// }}}
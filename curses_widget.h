@@ -0,0 +1,93 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_CURSES_WIDGET_H
+#define BDE_CURSES_WIDGET_H
+
+#include "widget.h"
+
+// CursesCanvas is the Canvas of the frontend: a curses window.
+
+class CursesCanvas : public Canvas {
+public:
+
+    WINDOW *wnd;
+
+    CursesCanvas(WINDOW *aWnd) { wnd = aWnd; }
+    virtual ~CursesCanvas();
+
+    static Canvas *create(int lines, int cols);
+
+    virtual int width() const;
+    virtual int height() const;
+    virtual void resize(int lines, int columns, int y, int x);
+    virtual attribute_t get_attr(int ident);
+    virtual void blank(attribute_t attr);
+    virtual void move_to(int line, int col);
+    virtual void set_attr(attribute_t attr);
+    virtual void put_char(unichar ch);
+    virtual void clear_to_eol();
+    virtual void scroll_lines(int count);
+    virtual void flush();
+};
+
+// curses_window() - the window a widget draws on, or NULL.
+
+inline WINDOW *curses_window(const Widget *widget)
+{
+    return widget->canvas ? ((CursesCanvas *)widget->canvas)->wnd : NULL;
+}
+
+// CursesWidget is the base of the widgets that draw with curses directly
+// (the menus, the status line, etc). "wnd" is the window of their canvas.
+
+class CursesWidget : public Widget {
+
+public:
+
+    WINDOW *wnd; // public
+
+    CursesWidget() { wnd = NULL; }
+
+    bool create_window(int lines = 1, int cols = 5) {
+	Widget::create_window(lines, cols);
+	wnd = curses_window(this);
+	return wnd != NULL;
+    }
+
+    void destroy_window() {
+	Widget::destroy_window();
+	wnd = NULL;
+    }
+
+    int window_begx() const {
+	int x, y;
+	getbegyx(wnd, y, x);
+	return x;
+    }
+
+    int window_begy() const {
+	int x, y;
+	getbegyx(wnd, y, x);
+	return y;
+    }
+
+    void draw_string(const char *u8, bool align_right = false);
+
+    static void signal_error();
+};
+
+#endif
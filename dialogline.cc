@@ -98,7 +98,7 @@ void DialogLine::modalize(Widget *wgt)
 	Event evt;
 	wgt->update();
 	doupdate();
-	get_next_event(evt, wgt->wnd);
+	get_next_event(evt, curses_window(wgt));
 	if (!handle_event(evt))
 	    wgt->handle_event(evt);
     }
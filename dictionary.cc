@@ -0,0 +1,285 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
+#include <algorithm>
+
+#include "dictionary.h"
+#include "converters.h"
+#include "geresh_io.h" // set_last_error
+#include "dbg.h"
+
+// In a dictionary of more words than this, get_alphabet() looks at this
+// many of them only.
+#define DICT_ALPHABET_SAMPLE	8192
+
+// compare_keys() - compares two words bytewise, like memcmp() but for
+// strings of different lengths.
+
+static int compare_keys(const char *a, size_t alen, const char *b, size_t blen)
+{
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    if (c != 0)
+	return c;
+    return (alen < blen) ? -1 : (alen > blen) ? 1 : 0;
+}
+
+// key_len() - returns the length of the word on the line starting at
+// "offset".
+
+static size_t key_len(const char *data, size_t size, size_t offset)
+{
+    const char *p = data + offset, *end = data + size;
+    const char *q = p;
+    while (q < end && *q != '\n' && *q != '\r' && *q != '/')
+	q++;
+    return q - p;
+}
+
+// next_line() - returns the offset of the line following the one starting
+// at "offset".
+
+static size_t next_line(const char *data, size_t size, size_t offset)
+{
+    const char *eol = (const char *)memchr(data + offset, '\n', size - offset);
+    return eol ? eol - data + 1 : size;
+}
+
+// A function object to sort the index by the words the lines hold.
+
+struct cmp_lines {
+    const char *data;
+    size_t size;
+    cmp_lines(const char *d, size_t sz) : data(d), size(sz) {}
+    bool operator() (size_t a, size_t b) const {
+	return compare_keys(data + a, key_len(data, size, a),
+			    data + b, key_len(data, size, b)) < 0;
+    }
+};
+
+Dictionary::Dictionary()
+{
+    data = NULL;
+    size = 0;
+    mapped = false;
+    count = 0;
+}
+
+Dictionary::~Dictionary()
+{
+    unload();
+}
+
+// load() - maps the word list into memory. Returns false on error; the
+// error message can be retrieved with get_last_error().
+
+bool Dictionary::load(const char *filename)
+{
+    unload();
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+	set_last_error(errno);
+	return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+	set_last_error(errno);
+	close(fd);
+	return false;
+    }
+    size = st.st_size;
+
+#ifdef HAVE_MMAP
+    if (size > 0) {
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED) {
+	    data = (const char *)map;
+	    mapped = true;
+	}
+    }
+#endif
+    if (!data) {
+	char *buf = (char *)malloc(size + 1);
+	size_t nread = 0;
+	while (buf && nread < size) {
+	    ssize_t n = read(fd, buf + nread, size - nread);
+	    if (n <= 0) {
+		if (n < 0 && errno == EINTR)
+		    continue;
+		set_last_error(n < 0 ? errno : EIO);
+		free(buf);
+		close(fd);
+		size = 0;
+		return false;
+	    }
+	    nread += n;
+	}
+	if (!buf) {
+	    set_last_error(ENOMEM);
+	    close(fd);
+	    size = 0;
+	    return false;
+	}
+	data = buf;
+    }
+    close(fd);
+
+    // Count the words, and find out whether they're sorted. If they
+    // aren't, sort the index.
+    bool sorted = true;
+    size_t prev = 0, prev_len = 0;
+    bool has_prev = false;
+    for (size_t offset = 0; offset < size; ) {
+	size_t len = key_len(data, size, offset);
+	if (len > 0) {
+	    count++;
+	    if (has_prev && sorted
+		    && compare_keys(data + prev, prev_len, data + offset, len) > 0)
+		sorted = false;
+	    prev = offset;
+	    prev_len = len;
+	    has_prev = true;
+	}
+	offset = next_line(data, size, offset);
+    }
+    if (!sorted) {
+	index.reserve(count);
+	for (size_t offset = 0; offset < size; ) {
+	    if (key_len(data, size, offset) > 0)
+		index.push_back(offset);
+	    offset = next_line(data, size, offset);
+	}
+	std::sort(index.begin(), index.end(), cmp_lines(data, size));
+    }
+    DBG(1, ("dictionary %s: %lu words, %s\n", filename, count,
+	    sorted ? "sorted" : "indexed"));
+    return true;
+}
+
+void Dictionary::unload()
+{
+    if (data) {
+#ifdef HAVE_MMAP
+	if (mapped)
+	    munmap((void *)data, size);
+	else
+#endif
+	    free((void *)data);
+    }
+    data = NULL;
+    size = 0;
+    mapped = false;
+    index.clear();
+    count = 0;
+    added.clear();
+    alphabet.clear();
+}
+
+// search_sorted() - binary-searches the (sorted) lines themselves, like
+// look(1) does.
+
+bool Dictionary::search_sorted(const char *word, size_t len) const
+{
+    size_t lo = 0, hi = size; // both are at the start of a line.
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	while (mid > lo && data[mid - 1] != '\n')
+	    mid--;
+	size_t klen = key_len(data, size, mid);
+	int c = compare_keys(data + mid, klen, word, len);
+	if (c == 0 && klen > 0)
+	    return true;
+	if (c < 0)
+	    lo = next_line(data, size, mid);
+	else
+	    hi = mid;
+    }
+    return false;
+}
+
+// search_index() - binary-searches the sorted index.
+
+bool Dictionary::search_index(const char *word, size_t len) const
+{
+    size_t lo = 0, hi = index.size();
+    while (lo < hi) {
+	size_t mid = lo + (hi - lo) / 2;
+	int c = compare_keys(data + index[mid],
+			     key_len(data, size, index[mid]), word, len);
+	if (c == 0)
+	    return true;
+	if (c < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return false;
+}
+
+// contains() - is "word", in the speller encoding, a correct word?
+
+bool Dictionary::contains(const char *word, size_t len) const
+{
+    if (len == 0)
+	return false;
+    if (index.empty() ? search_sorted(word, len) : search_index(word, len))
+	return true;
+    return !added.empty() && added.find(cstring(word, len)) != added.end();
+}
+
+// get_alphabet() - returns the characters the words are made of. The
+// speller builds its suggestions from them. It's figured out the first
+// time it's needed, so that loading stays quick, and, in a big dictionary,
+// from DICT_ALPHABET_SAMPLE lines spread over the file, so that it's quick
+// too. A letter that none of them has is very rare anyway.
+
+const std::vector<unichar> &Dictionary::get_alphabet(Converter *conv)
+{
+    if (!alphabet.empty() || !data)
+	return alphabet;
+
+    std::set<unichar> chars;
+    unistring ustr;
+    bool sample = (count > DICT_ALPHABET_SAMPLE);
+    size_t step = size / DICT_ALPHABET_SAMPLE;
+    for (size_t offset = 0; offset < size; ) {
+	size_t len = key_len(data, size, offset);
+	if (len > 0) {
+	    ustr.resize(len);
+	    unichar *us_p = ustr.begin();
+	    char *cs_p = (char *)data + offset;
+	    conv->convert(&us_p, &cs_p, len);
+	    chars.insert(ustr.begin(), us_p);
+	}
+	if (sample && offset + step < size)
+	    offset += step; // then to the start of the next line.
+	offset = next_line(data, size, offset);
+    }
+    alphabet.assign(chars.begin(), chars.end());
+    return alphabet;
+}
@@ -0,0 +1,66 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_DICTIONARY_H
+#define BDE_DICTIONARY_H
+
+#include <vector>
+#include <set>
+
+#include "types.h"
+
+class Converter;
+
+// A Dictionary is the list of correct words the built-in speller (see
+// Speller) looks words up in. It's loaded from a plain word list, one word
+// per line, in the speller encoding. Anything following a '/' on a line is
+// ignored, so ispell/hunspell-style ".dic" files, with their affix flags,
+// can be used too (but their affixes aren't expanded: expand them
+// beforehand, e.g. with "aspell dump master | aspell expand").
+//
+// The file is mapped into memory and searched in place. If the words are
+// sorted bytewise (as "LC_ALL=C sort -u" does), loading it costs one pass
+// to verify that. Otherwise we sort an index of the lines' offsets.
+
+class Dictionary {
+
+    const char *data;
+    size_t size;
+    bool mapped;		    // is "data" mmap()ed or malloc()ed?
+    std::vector<size_t> index;	    // lines' offsets, if not sorted
+    unsigned long count;
+    std::set<cstring> added;	    // words accepted in this session
+    std::vector<unichar> alphabet;
+
+    bool search_sorted(const char *word, size_t len) const;
+    bool search_index(const char *word, size_t len) const;
+
+public:
+
+    Dictionary();
+    ~Dictionary();
+
+    bool load(const char *filename);
+    void unload();
+
+    unsigned long words_count() const { return count; }
+    bool contains(const char *word, size_t len) const;
+    void add(const cstring &word) { added.insert(word); }
+    const std::vector<unichar> &get_alphabet(Converter *conv);
+};
+
+#endif
+
@@ -65,7 +65,7 @@ public:
     void push_back(const T& x) { vec.push_back(x); }
     void pop_back() { vec.pop_back(); }
 
-    void swap(DirectVector& other_vec) { vec.swap(other_vec); }
+    void swap(DirectVector& other_vec) { vec.swap(other_vec.vec); }
     void clear() { vec.clear(); }
    
     // Note the "&*expression" syntax. "*" dereferences the iterator
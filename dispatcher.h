@@ -19,6 +19,8 @@
 
 #include "event.h"
 #include <cstring>
+#include <map>
+#include <string>
 
 // class Dispatcher represents a class that receives GUI events.
 
@@ -29,34 +31,123 @@ struct binding_entry {
     const char *action;
 };
 
+struct cstr_less {
+    bool operator() (const char *a, const char *b) const {
+	return strcmp(a, b) < 0;
+    }
+};
+
+// BindingsIndex maps events to actions, and actions back to events. Each
+// class with a bindings map has one, which includes the bindings it
+// inherits, so resolving a key takes a single lookup however deep the
+// class is. The index is rebuilt when some class is rebound (see
+// HAS_BINDINGS_MAP's rebind()).
+
+struct BindingsIndex {
+    typedef std::map<Event, const char *> actions_map;
+    typedef std::map<const char *, Event, cstr_less> events_map;
+    
+    actions_map actions;
+    events_map events;
+    int generation;
+
+    BindingsIndex() { generation = -1; }
+
+    void clear() {
+	actions.clear();
+	events.clear();
+    }
+
+    // bind() - a NULL action unbinds the event, hiding any binding
+    // inherited from the parent class.
+    void bind(const Event &evt, const char *action) {
+	actions_map::iterator old = actions.find(evt);
+	if (old != actions.end() && old->second) {
+	    events_map::iterator rev = events.find(old->second);
+	    if (rev != events.end() && rev->second == evt)
+		events.erase(rev);
+	}
+	actions[evt] = action;
+	if (action)
+	    events[action] = evt;
+    }
+
+    // add_table() - the table overrides the inherited bindings. Within the
+    // table, the first entry for an event, or for an action, wins.
+    void add_table(const binding_entry *table) {
+	actions_map own_actions;
+	events_map own_events;
+	for (; table->action; table++) {
+	    own_actions.insert(std::make_pair(table->evt, table->action));
+	    own_events.insert(std::make_pair(table->action, table->evt));
+	}
+	for (actions_map::iterator it = own_actions.begin();
+		it != own_actions.end(); ++it)
+	    actions[it->first] = it->second;
+	for (events_map::iterator it = own_events.begin();
+		it != own_events.end(); ++it)
+	    events[it->first] = it->second;
+    }
+
+    void add_user_bindings(const std::map<Event, std::string> &user) {
+	for (std::map<Event, std::string>::const_iterator it = user.begin();
+		it != user.end(); ++it)
+	    bind(it->first, it->second.empty() ? NULL : it->second.c_str());
+    }
+
+    const char *find_action(const Event &evt) const {
+	actions_map::const_iterator it = actions.find(evt);
+	return (it == actions.end()) ? NULL : it->second;
+    }
+
+    bool find_event(const char *action, Event &evt) const {
+	events_map::const_iterator it = events.find(action);
+	if (it == events.end())
+	    return false;
+	evt = it->second;
+	return true;
+    }
+};
+
 class Dispatcher {
     
 public:
 
     Dispatcher() { }
 
-    virtual bool do_action(const char *action) {
+    virtual bool do_action(const char *) {
 	return false;
     }
 
-    virtual const char *get_event_action(const Event &evt) {
+    virtual const char *get_event_action(const Event &) {
 	return NULL;
     }
     
-    virtual bool get_action_event(const char *action, Event &evt) {
+    virtual bool get_action_event(const char *, Event &) {
 	return false;
     }
     
-    virtual const char *get_action_description(const char *action) {
+    virtual const char *get_action_description(const char *) {
 	return NULL;
     }
 
     virtual bool handle_event(const Event &evt) {
 	return do_action(get_event_action(evt));
     }
+
+    // the root of collect_bindings() (see HAS_BINDINGS_MAP).
+    static void collect_bindings(BindingsIndex &) { }
+
+    // bumped whenever some class is rebound, to tell the BindingsIndex
+    // objects they're stale.
+    static int &bindings_generation() {
+	static int generation = 0;
+	return generation;
+    }
 };
 
-// :TODO: I should use STL's map instead of a simple linear search.
+// The action names of a class are looked up in a std::map built on first
+// use; the parent classes are searched only when the name isn't found.
 
 #define HAS_ACTIONS_MAP(CLASS, PARENT_CLASS)    \
     typedef void (CLASS::*method_ptr)();    \
@@ -66,27 +157,34 @@ public:
 	const char *short_description;	    \
     };					    \
     static action_entry actions_table[];    \
+    typedef std::map<const char *, const action_entry *, \
+		     cstr_less> actions_index_t;    \
+    static const action_entry *find_action_entry(   \
+	    const char *action) {		    \
+	static actions_index_t index;		    \
+	if (index.empty())			    \
+	    for (action_entry *entry = actions_table;	\
+		    entry->action; entry++)	    \
+		index.insert(std::make_pair(entry->action, \
+					    entry));	\
+	actions_index_t::const_iterator it = index.find(action); \
+	return (it == index.end()) ? NULL : it->second;	\
+    }						    \
     virtual bool do_action(const char *action) {    \
 	if (!action) return false;		    \
-	action_entry *entry = actions_table;	    \
-	while (entry->action) {			    \
-	    if (!strcmp(entry->action, action)) {   \
-		(this->*(entry->method))();	    \
-		return true;			    \
-	    }					    \
-	    entry++;				    \
+	const action_entry *entry = find_action_entry(action); \
+	if (entry) {				    \
+	    (this->*(entry->method))();		    \
+	    return true;			    \
 	}					    \
 	return PARENT_CLASS::do_action(action);	    \
     }						    \
     virtual const char *get_action_description	    \
     (const char *action) {			    \
 	if (!action) return NULL;		    \
-	action_entry *entry = actions_table;	    \
-	while (entry->action) {			    \
-	    if (!strcmp(entry->action, action))	    \
-		return entry->short_description;    \
-	    entry++;				    \
-	}					    \
+	const action_entry *entry = find_action_entry(action); \
+	if (entry)				    \
+	    return entry->short_description;	    \
 	return PARENT_CLASS::			    \
 	    get_action_description(action);	    \
     }
@@ -97,31 +195,42 @@ public:
 #define END_ACTIONS \
  { 0, 0 }
 
+// rebind() binds an event to an action (or unbinds it, when the action is
+// NULL) in this class and in the classes derived from it, overriding the
+// bindings table.
+
 #define HAS_BINDINGS_MAP(CLASS, PARENT_CLASS)		    	\
     static binding_entry bindings_table[];		    	\
-    virtual const char *get_event_action(const Event &evt) {	\
-	binding_entry *entry = bindings_table;			\
-	while (entry->action) {					\
-	    if (entry->evt == evt)				\
-		return entry->action;				\
-	    entry++;						\
+    static std::map<Event, std::string> &user_bindings() {	\
+	static std::map<Event, std::string> bindings;		\
+	return bindings;					\
+    }								\
+    static void collect_bindings(BindingsIndex &index) {	\
+	PARENT_CLASS::collect_bindings(index);			\
+	index.add_table(bindings_table);			\
+	index.add_user_bindings(user_bindings());		\
+    }								\
+    static const BindingsIndex &get_bindings_index() {		\
+	static BindingsIndex index;				\
+	if (index.generation != bindings_generation()) {	\
+	    index.clear();					\
+	    collect_bindings(index);				\
+	    index.generation = bindings_generation();		\
 	}							\
-	return PARENT_CLASS::get_event_action(evt);		\
+	return index;						\
+    }								\
+    static void rebind(const Event &evt, const char *action) {	\
+	user_bindings()[evt] = action ? action : "";		\
+	bindings_generation()++;				\
+    }								\
+    virtual const char *get_event_action(const Event &evt) {	\
+	return get_bindings_index().find_action(evt);		\
     } \
     virtual bool get_action_event(const char *action, Event &evt) { \
-	binding_entry *entry = bindings_table;			\
-	while (entry->action) {					\
-	    if (!strcmp(entry->action, action))	{		\
-		evt = entry->evt;				\
-		return true;					\
-	    }							\
-	    entry++;						\
-	}							\
-	return PARENT_CLASS::get_action_event(action, evt);	\
+	return get_bindings_index().find_event(action, evt);	\
     }
 
 #define END_BINDINGS \
  { Event(), 0 }
 
 #endif
-
@@ -17,6 +17,7 @@
 #include <config.h>
 
 #include <algorithm>
+#include <string.h> // memcpy
 
 #include "editbox.h"
 #include "scrollbar.h"
@@ -25,6 +26,8 @@
 #include "themes.h"
 #include "dbg.h"
 
+unsigned long Paragraph::last_stamp = 0;
+
 TranslationTable EditBox::transtbl;
 TranslationTable EditBox::reprtbl;
 TranslationTable EditBox::altkbdtbl;
@@ -74,18 +77,24 @@ EditBox::EditBox()
     rfc2646_trailing_space = true;
     data_transfer.in_transfer = false;
     old_width		= -1;
+    layout_stamp	= 0;
+    snapshot		= NULL;
+    snapshot_gen	= 0;
+    modification_count	= 0;
     prev_command_type = current_command_type = cmdtpUnknown;
     paragraphs.push_back(new Paragraph());
 }
 
 EditBox::~EditBox()
 {
+    preserve_all_parags();
     for (int i = 0; i < parags_count(); i++)
 	delete paragraphs[i];
 }
   
 void EditBox::new_document()
 {
+    preserve_all_parags();
     for (int i = 0; i < parags_count(); i++)
 	delete paragraphs[i];
     paragraphs.clear();
@@ -99,13 +108,6 @@ void EditBox::new_document()
     request_update(rgnAll);
 }
 
-void EditBox::sync_scrollbar(Scrollbar *scrollbar)
-{
-    scrollbar->set_total_size(parags_count());
-    scrollbar->set_page_size(window_height());
-    scrollbar->set_page_pos(top_line.para);
-}
-
 // }}}
 
 // Utility methods dealing with End-Of-Paragraphs {{{
@@ -172,8 +174,11 @@ void EditBox::set_eops(eop_t new_eop)
 	return;
     }
     
-    for (int i = 0; i < parags_count() - 1; i++)
+    for (int i = 0; i < parags_count() - 1; i++) {
+	preserve_para(*paragraphs[i]);
 	paragraphs[i]->eop = new_eop;
+    }
+    modification_count++;
     set_modified(true);
     
     request_update(rgnAll);
@@ -503,33 +508,28 @@ int EditBox::transfer_data(unichar *buf, int len)
 	return transfer_data_out(buf, len);
 }
 
-// transfer_data_out() - transfers data out of EditBox. returns the number of
-// characters placed in "buf". when it returns 0, we know we've reached end
-// of buffer.
+// transfer_data_out_ref() - the zero-copy variant of transfer_data_out():
+// instead of copying characters into a buffer, it makes *buf point at the
+// next segment of text -- up to "len" characters of the current paragraph,
+// or its EOP -- and returns the segment's length. The pointer is valid
+// until the next call. When it returns 0, we know we've reached end of
+// buffer.
 
-int EditBox::transfer_data_out(unichar *buf, int len)
+int EditBox::transfer_data_out_ref(const unichar **buf, int len)
 {
-    if (data_transfer.at_eof)
-	return 0;	// end-of-buffer: no more chars to write
-
-    int nwritten = 0;	// number of chars we've written to buf
-    while (nwritten < len && !data_transfer.at_eof) {
+    while (!data_transfer.at_eof) {
 	if (cursor.pos == curr_para()->str.len()) {
+	    int neop = 0;
 
 	    // write EOP
 	    if (curr_para()->eop != eopNone) {
 		if (curr_para()->eop == eopDOS) {
-		    // DOS's EOP is two characters. If there's not
-		    // enough space in buf, we exit and do it in the
-		    // next call.
-		    if (len - nwritten < 2)
-			break;
-		    *buf++ = '\r';
-		    *buf++ = '\n';
-		    nwritten += 2;
+		    data_transfer.eop_buf[0] = '\r';
+		    data_transfer.eop_buf[1] = '\n';
+		    neop = 2;
 		} else {
-		    *buf++ = get_curr_eop_char();
-		    nwritten++;
+		    data_transfer.eop_buf[0] = get_curr_eop_char();
+		    neop = 1;
 		}
 		data_transfer.ntransferred_out++;
 		if (data_transfer.ntransferred_out_max != -1
@@ -546,27 +546,56 @@ int EditBox::transfer_data_out(unichar *buf, int len)
 		// we've reached end of buffer
 		data_transfer.at_eof = true;
 	    }
+
+	    if (neop) {
+		*buf = data_transfer.eop_buf;
+		return neop;
+	    }
 	} else {
-	    // write the [cursor, end-of-paragraph) segment into buf.
-	    int to_copy = MIN(curr_para()->str.len() - cursor.pos, (len - nwritten));
+	    // point at the [cursor, end-of-paragraph) segment.
+	    int to_copy = MIN(curr_para()->str.len() - cursor.pos, len);
 	    if (data_transfer.ntransferred_out_max != -1
 		    && data_transfer.ntransferred_out + to_copy
 			    > data_transfer.ntransferred_out_max) {
 		to_copy = MAX(data_transfer.ntransferred_out_max
 				- data_transfer.ntransferred_out, 0);
 	    }
-	    unichar *src = curr_para()->str.begin() + cursor.pos;
+	    *buf = curr_para()->str.begin() + cursor.pos;
 	    cursor.pos += to_copy;
-	    nwritten += to_copy;
 	    data_transfer.ntransferred_out += to_copy;
-	    while (to_copy--)
-		*buf++ = *src++;
 	    if (data_transfer.ntransferred_out_max != -1
 		    && data_transfer.ntransferred_out
 			    >= data_transfer.ntransferred_out_max)
 		data_transfer.at_eof = true;
+	    if (to_copy)
+		return to_copy;
 	}
     }
+    return 0;	// end-of-buffer: no more chars to write
+}
+
+// transfer_data_out() - transfers data out of EditBox. returns the number of
+// characters placed in "buf". when it returns 0, we know we've reached end
+// of buffer.
+
+int EditBox::transfer_data_out(unichar *buf, int len)
+{
+    int nwritten = 0;	// number of chars we've written to buf
+    while (nwritten < len) {
+	// DOS's EOP is two characters. If there's not enough space in
+	// buf, we exit and do it in the next call.
+	if (!data_transfer.at_eof
+		&& cursor.pos == curr_para()->str.len()
+		&& curr_para()->eop == eopDOS
+		&& len - nwritten < 2)
+	    break;
+	const unichar *segment;
+	int n = transfer_data_out_ref(&segment, len - nwritten);
+	if (n == 0)
+	    break;
+	memcpy(buf + nwritten, segment, n * sizeof(unichar));
+	nwritten += n;
+    }
     return nwritten;
 }
 
@@ -642,6 +671,170 @@ void EditBox::end_data_transfer()
 #undef INSERT_DOS_PS
 #undef INSERT_CR
 
+// build_paragraphs() - the building block of the parallel loader (see
+// io.cc). It does what transfer_data_in() does, but instead of inserting
+// the text into the buffer it appends it to "parags", a private list of
+// paragraphs, so it may run on several threads at once (it only reads
+// EditBox's settings). The last element of "parags" is the "open"
+// paragraph, the one whose EOP we haven't seen yet; "prev_is_cr" plays the
+// same role it plays in transfer_data_in().
+//
+// Every paragraph that gets closed is wrapped and has its base direction
+// determined; transfer_paragraphs_in() takes care of the open one, and
+// stamps them all (stamps can't be taken on several threads at once).
+
+void EditBox::build_paragraphs(std::vector<Paragraph *> &parags,
+			       const unichar *data, int len, bool &prev_is_cr)
+{
+    if (parags.empty())
+	parags.push_back(new Paragraph());
+
+    int start = 0;
+    if (prev_is_cr && len) {
+	close_paragraph(parags, data[0] == '\n' ? eopDOS : eopMac);
+	if (data[0] == '\n')
+	    start = 1;
+	prev_is_cr = false;
+    }
+    for (int i = start; i < len; i++) {
+	if (!is_eop(data[i]))
+	    continue;
+	parags.back()->str.append(data + start, i - start);
+	if (data[i] == '\r') {
+	    if (i + 1 == len) {
+		prev_is_cr = true;
+		return;
+	    }
+	    if (data[i + 1] == '\n') {
+		close_paragraph(parags, eopDOS);
+		i++;
+	    } else {
+		close_paragraph(parags, eopMac);
+	    }
+	} else {
+	    close_paragraph(parags, get_eop_type(data[i]));
+	}
+	start = i + 1;
+    }
+    parags.back()->str.append(data + start, len - start);
+}
+
+void EditBox::close_paragraph(std::vector<Paragraph *> &parags, eop_t eop)
+{
+    Paragraph *p = parags.back();
+    p->eop = eop;
+    p->determine_base_dir(dir_algo);
+    wrap_para(*p);
+    parags.push_back(new Paragraph());
+}
+
+// finish_paragraphs() - called when there's no more data for "parags".
+// The last paragraph is left open, but, like the others, it's wrapped and
+// its direction is determined.
+
+void EditBox::finish_paragraphs(std::vector<Paragraph *> &parags,
+				bool prev_is_cr)
+{
+    if (parags.empty())
+	parags.push_back(new Paragraph());
+    if (prev_is_cr)
+	close_paragraph(parags, eopMac);
+    parags.back()->determine_base_dir(dir_algo);
+    wrap_para(*parags.back());
+}
+
+// transfer_paragraphs_in() - appends paragraphs built by
+// build_paragraphs() to the end of the buffer. EditBox takes ownership of
+// the paragraphs. It's used while loading a new document, so it doesn't
+// record undo information and it doesn't move the cursor: the progressive
+// loader (see io.cc) lets the user look around while the rest of the file
+// is being appended.
+//
+// Like the text passed to insert_text(), the first paragraph continues the
+// last paragraph of the buffer, which is still "open".
+
+void EditBox::transfer_paragraphs_in(std::vector<Paragraph *> &parags)
+{
+    if (parags.empty())
+	return;
+
+    int orig_last_para = parags_count() - 1;
+    Paragraph *last = paragraphs.back();
+    Paragraph *first = parags[0];
+    preserve_para(*last);
+    if (last->str.empty()) {
+	paragraphs.back() = first;
+	delete last;
+    } else {
+	last->str.append(first->str.begin(), first->str.len());
+	last->eop = first->eop;
+	delete first;
+    }
+    paragraphs.insert(paragraphs.end(), parags.begin() + 1, parags.end());
+    parags.clear();
+
+    for (int i = orig_last_para; i < parags_count(); i++)
+	paragraphs[i]->stamp = ++Paragraph::last_stamp;
+    // the paragraphs at both ends haven't been wrapped yet.
+    post_para_modification(*paragraphs[orig_last_para]);
+    if (orig_last_para != parags_count() - 1)
+	post_para_modification(*paragraphs.back());
+
+    // the neutral paragraphs at the end of the buffer may get their
+    // direction from the new ones; calc_contextual_dirs() looks back for
+    // them.
+    calc_contextual_dirs(orig_last_para, parags_count() - 1, false);
+
+    cache.invalidate();
+    request_update(rgnAll);
+}
+
+// take_snapshot() - makes "snapshot" refer to the paragraphs of the
+// buffer, which are placed in "parags", till release_snapshot() is
+// called. From now on, a paragraph is handed to snapshot->preserve()
+// before it's modified or deleted for the first time.
+
+void EditBox::take_snapshot(TextSnapshot *snapshot,
+			    std::vector<const Paragraph *> &parags)
+{
+    release_snapshot();
+    this->snapshot = snapshot;
+    snapshot_gen++;
+    parags.reserve(parags_count());
+    for (int i = 0; i < parags_count(); i++) {
+	paragraphs[i]->snapshot_gen = snapshot_gen;
+	paragraphs[i]->snapshot_idx = i;
+	parags.push_back(paragraphs[i]);
+    }
+}
+
+void EditBox::release_snapshot()
+{
+    snapshot = NULL;
+}
+
+// preserve_all_parags() - called before all the paragraphs are deleted.
+
+void EditBox::preserve_all_parags()
+{
+    if (snapshot) {
+	for (int i = 0; i < parags_count(); i++)
+	    preserve_para(*paragraphs[i]);
+    }
+}
+
+// rewrap_paragraphs() - wraps paragraphs built by build_paragraphs() anew,
+// and determines their direction anew, after the settings they were built
+// with have changed (see get_layout_stamp()).
+
+void EditBox::rewrap_paragraphs(std::vector<Paragraph *> &parags)
+{
+    for (size_t i = 0; i < parags.size(); i++) {
+	parags[i]->determine_base_dir(dir_algo);
+	wrap_para(*parags[i]);
+    }
+}
+
 // }}}
 
 // Scrolling {{{
@@ -743,23 +936,12 @@ void EditBox::scroll_to_cursor_line()
 	// the window view and we have to scroll up to make it visible.
 
 	// calculate the new top line
-	CombinedLine old_top_line = top_line;
 	top_line = curr;
 	add_rows_to_line(top_line, -(get_effective_scroll_step() - 1));
 
-	// Performance: we can either repaint all the window (rgnAll),
-	// or use curses' wscrl() and paint only the lines that aren't already
-	// on screen.
-	if (top_line.is_near(old_top_line)) {
-	    int diff = lines_diff(top_line, old_top_line);
-	    scrollok(wnd, TRUE);
-	    wscrl(wnd, -diff);
-	    scrollok(wnd, FALSE);
-	    request_update(top_line.para, old_top_line.para - 1);
-	} else {
-	    request_update(rgnAll);
-	}
-	
+	// update() scrolls the window contents and paints only the lines
+	// that aren't already on screen.
+	request_update(rgnAll);
 	return;
     }
 
@@ -778,23 +960,10 @@ void EditBox::scroll_to_cursor_line()
 	add_rows_to_line(bottom_line, get_effective_scroll_step() - 1);
 	
 	// and the new top line
-	CombinedLine old_top_line = top_line;
 	top_line = bottom_line;
 	add_rows_to_line(top_line, -(window_height() - 1));
 
-	// Performance: either repaint everything or just the lines that
-	// aren't already on screen.
-	if (top_line.is_near(old_top_line)) {
-	    int diff = lines_diff(top_line, old_top_line);
-	    CombinedLine from = bottom_line;
-	    add_rows_to_line(from, -(diff - 1));
-	    scrollok(wnd, TRUE);
-	    wscrl(wnd, diff);
-	    scrollok(wnd, FALSE);
-	    request_update(from.para, bottom_line.para);
-	} else {
-	    request_update(rgnAll);
-	}
+	request_update(rgnAll);
     }
 }
 
@@ -1357,6 +1526,30 @@ void EditBox::key_dash()
 	insert_char('-');
 }
 
+// insert_pasted_text() - inserts text the user pasted into the terminal
+// (see event.cc). Unlike typed text, it isn't indented or justified, and
+// it's inserted with a single insert_text(), so it's one undo operation.
+// The terminal sends line ends as CR (or as LF, or CR+LF); we convert them
+// to the current paragraph's EOP, as key_enter() would.
+
+void EditBox::insert_pasted_text(const unistring &text)
+{
+    unichar eop = get_curr_eop_char();
+    unistring str;
+    str.reserve(text.len());
+    for (idx_t i = 0; i < text.len(); i++) {
+	if (text[i] == '\r' || text[i] == '\n') {
+	    if (text[i] == '\r' && i + 1 < text.len() && text[i + 1] == '\n')
+		i++;
+	    str.push_back(eop);
+	} else {
+	    str.push_back(text[i]);
+	}
+    }
+    insert_text(str);
+    last_modification = cursor;
+}
+
 void EditBox::set_translation_mode(bool value)
 {
     if (!transtbl.empty()) {
@@ -1384,6 +1577,42 @@ INTERACTIVE void EditBox::toggle_alt_kbd()
     }
 }
 
+// retype_selection_alt_kbd() - translates the selected text according to
+// the "altkbdtbl" table, as if it were typed with the alternative keyboard
+// active. For when one forgets to switch keyboards.
+
+INTERACTIVE void EditBox::retype_selection_alt_kbd()
+{
+    if (altkbdtbl.empty()) {
+	NOTIFY_ERROR(no_alt_kbd);
+	return;
+    }
+    if (!is_primary_mark_set()) {
+	NOTIFY_ERROR(no_selection);
+	return;
+    }
+    if (read_only) {
+	NOTIFY_ERROR(read_only);
+	return;
+    }
+
+    int len = calc_distance(cursor, primary_mark);
+    if (cursor > primary_mark)
+	cursor = primary_mark;
+    Point start = cursor;
+
+    // copy_text() works through the clipboard; keep the user's.
+    unistring saved_clipboard = clipboard;
+    copy_text(len);
+    unistring text = clipboard;
+    clipboard = saved_clipboard;
+    cursor = start;
+
+    if (altkbdtbl.translate(text.begin(), text.len()))
+	replace_text(text, len);
+    unset_primary_mark();
+}
+
 // handle_event() - deals with literal keys. Special keys (control & alt
 // combinations, function keys, arrows, etc) are dealt by the base class,
 // Dispatcher. 
@@ -1395,7 +1624,11 @@ INTERACTIVE void EditBox::toggle_alt_kbd()
 bool EditBox::handle_event(const Event &evt)
 {
     current_command_type = cmdtpUnknown;
-    if (evt.is_literal()) {
+    if (evt.type == evtPaste) {
+	insert_pasted_text(*evt.text);
+	prev_command_type = current_command_type;
+	return true;
+    } else if (evt.is_literal()) {
 	unichar ch = evt.ch;
 	if (in_translation_mode()) {
 	    transtbl.translate_char(ch);
@@ -1520,6 +1753,7 @@ INTERACTIVE void EditBox::justify()
 void EditBox::set_dir_algo(diralgo_t value)
 {
     dir_algo = value;
+    layout_stamp++;
     for (int i = 0; i < parags_count(); i++)
 	paragraphs[i]->determine_base_dir(dir_algo);
     if (dir_algo == algoContextStrong || dir_algo == algoContextRTL)
@@ -1644,16 +1878,19 @@ void EditBox::post_modification()
     cache.invalidate();
     if (is_primary_mark_set())
 	unset_primary_mark();
+    modification_count++;
     if (!is_modified())
 	set_modified(true);
     NOTIFY_CHANGE(position);
 }
 
 // post_para_modification() - should be called for every paragraph that has
-// been modified. It recalculates its base direcion and rewraps it.
+// been modified. It advances its stamp, recalculates its base direcion and
+// rewraps it.
 
 void EditBox::post_para_modification(Paragraph &p)
 {
+    p.stamp = ++Paragraph::last_stamp;
     p.determine_base_dir(dir_algo);
     wrap_para(p);
 }
@@ -1775,6 +2012,8 @@ void EditBox::delete_text(int len, bool skip_undo, unistring *alt_deleted)
 		// paragraph to the current paragraph.
 		deleted->push_back(get_curr_eop_char());
 		Paragraph *next_para = paragraphs[cursor.para + 1];
+		preserve_para(*curr_para());
+		preserve_para(*next_para);
 		curr_para()->str.append(next_para->str);
 		curr_para()->eop = next_para->eop;
 		delete next_para;
@@ -1785,6 +2024,7 @@ void EditBox::delete_text(int len, bool skip_undo, unistring *alt_deleted)
 	} else {
 	    // delete the [cursor, end-of-paragraph) segment
 	    int to_delete = MIN(curr_para()->str.len() - cursor.pos, len);
+	    preserve_para(*curr_para());
 	    unichar *cursor_ptr = curr_para()->str.begin() + cursor.pos;
 	    deleted->append(cursor_ptr, to_delete);
 	    curr_para()->str.erase(cursor_ptr, cursor_ptr + to_delete);
@@ -1849,6 +2089,7 @@ void EditBox::insert_text(const unichar *str, int len, bool skip_undo)
     min_changed_para = cursor.para;
 
     while (len > 0) {
+	preserve_para(*curr_para());
 	if (is_eop(str[0])) {
 	    // inserting EOP is like pressing Enter: split the current
 	    // paragraph into two.
@@ -68,6 +68,28 @@ public:
 
     direction_t contextual_base_dir;
 
+    // "stamp" is advanced whenever the text is modified (see
+    // post_para_modification()). Stamps are taken from "last_stamp", so
+    // no two paragraphs, and no two versions of a paragraph, share one.
+    // The background spell checker records in
+    // "spell_stamp" the stamp of the text it has checked, so it knows to
+    // re-check only the paragraphs whose stamp moved on.
+    // "misspellings" holds the misspelled words it found, as pairs of
+    // offset and length.
+
+    unsigned long stamp;
+    unsigned long spell_stamp;
+    IdxArray misspellings;
+
+    static unsigned long last_stamp;
+
+    // When a TextSnapshot refers to the paragraph, "snapshot_gen" holds
+    // the generation of that snapshot and "snapshot_idx" the paragraph's
+    // index in it (see EditBox::take_snapshot()).
+
+    unsigned long snapshot_gen;
+    int snapshot_idx;
+
 public:
 
     int breaks_count() const { return line_breaks.size(); }
@@ -78,6 +100,10 @@ public:
 	line_breaks.push_back(0);
 	individual_base_dir = contextual_base_dir = dirN;
 	eop = eopNone;
+	stamp = 0;	// not stamped yet; see post_para_modification()
+	spell_stamp = 0;
+	snapshot_gen = 0;
+	snapshot_idx = 0;
     }
 
     void determine_base_dir(diralgo_t dir_algo)
@@ -92,6 +118,18 @@ public:
     }
 };
 
+// TextSnapshot is a copy-on-write snapshot of the text, taken with
+// EditBox::take_snapshot() (AsyncSaver saves one on another thread). It
+// refers to the paragraphs themselves instead of copying them. Before
+// EditBox modifies or deletes a paragraph the snapshot refers to, it calls
+// preserve(), which copies the text of the paragraph if it's still needed.
+
+class TextSnapshot {
+public:
+    virtual ~TextSnapshot() {}
+    virtual void preserve(int idx, const Paragraph &p) = 0;
+};
+
 #define MIN(x,y) ((x)<(y)?(x):(y))
 #define MAX(x,y) ((x)>(y)?(x):(y))
 
@@ -205,8 +243,11 @@ public:
 // start_data_transfer(direction);
 // transfer_data(buffer);
 // end_data_transfer(); 
-
-class Scrollbar;
+//
+// When saving, transfer_data_out_ref() may be used instead of
+// transfer_data() to read the text in place, without copying it. When
+// loading, the text may be split into paragraphs on other threads, with
+// build_paragraphs(), and then handed over with transfer_paragraphs_in().
 
 class EditBox : public Widget {
 
@@ -333,6 +374,10 @@ protected:
     // Has the buffer been modified?
     bool modified;
 
+    // Incremented on every modification. The background saver uses it to
+    // tell whether the buffer was modified while it was saving.
+    unsigned long modification_count;
+
     // justification_column holds the maximum line length to use when
     // justifying paragraphs.
     idx_t justification_column;
@@ -379,6 +424,14 @@ protected:
     // and wrap lines only if they're different.
     int old_width;
 
+    // incremented whenever all the paragraphs are wrapped anew or have
+    // their direction determined anew.
+    unsigned long layout_stamp;
+
+    // the snapshot the paragraphs may belong to, and its generation.
+    TextSnapshot *snapshot;
+    unsigned long snapshot_gen;
+
     bool bidi_enabled;
 
     bool visual_cursor_movement;
@@ -404,6 +457,7 @@ private:
 	bool prev_is_cr;
 	int ntransferred_out;
 	int ntransferred_out_max;
+	unichar eop_buf[2];
     } data_transfer;
 
 public:
@@ -456,6 +510,8 @@ public:
 
     void set_modified(bool value);
     bool is_modified() const { return modified; }
+    unsigned long get_modification_count() const
+	{ return modification_count; }
 
     void set_auto_indent(bool value);
     bool is_auto_indent() const { return auto_indent; }
@@ -507,6 +563,7 @@ public:
     void set_alt_kbd(bool val);
     bool get_alt_kbd() const { return alt_kbd; }
     INTERACTIVE void toggle_alt_kbd();
+    INTERACTIVE void retype_selection_alt_kbd();
 
     void set_primary_mark(const Point &point);
     void set_primary_mark() { set_primary_mark(cursor); }
@@ -528,7 +585,6 @@ public:
     bool is_key_for_key_undo() const
 	{ return !undo_stack.is_merge(); }
     INTERACTIVE void toggle_key_for_key_undo();
-    void sync_scrollbar(Scrollbar *scrollbar);
 
     void enable_bidi(bool value);
     bool is_bidi_enabled() const { return bidi_enabled; }
@@ -581,10 +637,22 @@ public:
 			     bool new_document = false,
 			     bool selection_only = false);
     int transfer_data(unichar *buf, int len);
+    int transfer_data_out_ref(const unichar **buf, int len);
     void end_data_transfer(); 
 
+    void build_paragraphs(std::vector<Paragraph *> &parags,
+			  const unichar *data, int len, bool &prev_is_cr);
+    void finish_paragraphs(std::vector<Paragraph *> &parags, bool prev_is_cr);
+    void transfer_paragraphs_in(std::vector<Paragraph *> &parags);
+    void rewrap_paragraphs(std::vector<Paragraph *> &parags);
+    unsigned long get_layout_stamp() const { return layout_stamp; }
+    void take_snapshot(TextSnapshot *snapshot,
+		       std::vector<const Paragraph *> &parags);
+    void release_snapshot();
+
 protected:
 
+    void close_paragraph(std::vector<Paragraph *> &parags, eop_t eop);
     int transfer_data_in(unichar *data, int len);
     int transfer_data_out(unichar *buf, int len);
     bool is_in_data_transfer() const;
@@ -685,14 +753,43 @@ public:
     INTERACTIVE void set_eops_dos() { set_eops(eopDOS); }
     INTERACTIVE void set_eops_mac() { set_eops(eopMac); }
     INTERACTIVE void set_eops_unicode() { set_eops(eopUnicode); }
+
+    // log2vis() options; see parse_log2vis_options().
+    struct Log2VisOptions {
+	bool bdo;
+	bool nopad;
+	bool engpad;
+	bool emph;
+	unichar emph_marker;
+	unichar emph_ch;
+    };
+    // the arrays log2vis_para() works in. Each thread converting
+    // paragraphs needs its own.
+    struct Log2VisBuffers {
+	LevelsArray levels;
+	IdxArray position_L_to_V;
+	IdxArray position_V_to_L;
+    };
+    static void parse_log2vis_options(const char *options,
+				      Log2VisOptions &opt);
+    void log2vis_para(Paragraph &p, const Log2VisOptions &opt,
+		      Log2VisBuffers &bufs, std::vector<unistring> &visuals);
     void log2vis(const char *options);
     void key_enter();
     void key_dash();
+    virtual void insert_pasted_text(const unistring &text);
 
 protected:
 
     void post_modification();
     void post_para_modification(Paragraph &p);
+    void preserve_para(Paragraph &p) {
+	if (snapshot && p.snapshot_gen == snapshot_gen) {
+	    snapshot->preserve(p.snapshot_idx, p);
+	    p.snapshot_gen = 0;
+	}
+    }
+    void preserve_all_parags();
     void undo_op(UndoOp *opp);
     void redo_op(UndoOp *opp);
     void calc_contextual_dirs(int min_para, int max_para, bool update_display);
@@ -712,7 +809,7 @@ public:
     virtual void update();
     virtual void update_cursor() { request_update(rgnCursor); update(); }
     virtual bool is_dirty() const { return update_region != rgnNone; }
-    virtual void invalidate_view() { request_update(rgnAll); }
+    virtual void invalidate_view() { invalidate_frame(); }
     void reformat();
 
 protected:
@@ -761,6 +858,63 @@ protected:
 	}
     } cache;
 
+    // The frame records what each window line shows, so that update() can
+    // tell which visible paragraphs are already painted the way they
+    // should be, and skip them even when asked to paint the whole window.
+    // A paragraph looks the same as long as its text (see "stamp"), its
+    // direction, its EOP, its selected part and its place in the window
+    // are the same. The current paragraph is always repainted, and in
+    // no-wrap mode it's also repainted once the cursor leaves it, as it
+    // may have been scrolled sideways. Changes that affect every
+    // paragraph, like the display options, call invalidate_frame().
+
+    struct FrameLine {
+	const Paragraph *para;	// NULL: a blank line
+	unsigned long stamp;
+	int inner_line;		// which of the paragraph's lines is shown
+	direction_t dir;
+	eop_t eop;
+	idx_t sel_start;	// the selected part, [sel_start, sel_end);
+	idx_t sel_end;		// sel_end is past the text if the EOP is too.
+	bool current;
+
+	FrameLine() {
+	    clear();
+	}
+	void clear() {
+	    para = NULL;
+	    stamp = 0;
+	    inner_line = 0;
+	    dir = dirN;
+	    eop = eopNone;
+	    sel_start = sel_end = -1;
+	    current = false;
+	}
+	bool operator==(const FrameLine &other) const {
+	    return para == other.para && stamp == other.stamp
+		&& inner_line == other.inner_line && dir == other.dir
+		&& eop == other.eop && sel_start == other.sel_start
+		&& sel_end == other.sel_end && current == other.current;
+	}
+    };
+
+    std::vector<FrameLine> frame;
+
+    void invalidate_frame();
+    void invalidate_frame(int para);
+    // the top line the frame was painted from.
+    CombinedLine frame_top_line;
+
+    void scroll_frame(int diff);
+    void scroll_to_top_line();
+    bool has_frame() const { return (int)frame.size() == window_height(); }
+    FrameLine get_frame_line(const Paragraph &p, int para_num,
+			     int inner_line, bool current);
+    bool is_painted(const Paragraph &p, int para_num, int window_start_line);
+    void record_painted(const Paragraph &p, int para_num,
+			int window_start_line, bool current);
+    void clear_lines(int window_start_line, int count);
+
     virtual void redraw_paragraph(
 			    Paragraph &p,
 			    int window_start_line,
@@ -817,9 +971,24 @@ public:
 
     int get_number_of_paragraphs() const
 	{ return parags_count(); }
+    int get_top_paragraph() const
+	{ return top_line.para; }
     const unistring &get_paragraph_text(int i) {
 	return paragraphs[i]->str;
     }
+
+    // The background spell checker (see Speller) uses these to find the
+    // paragraphs that have changed since it last checked them, and to
+    // hand us its results.
+    bool needs_spell_check(int i) const {
+	return paragraphs[i]->spell_stamp != paragraphs[i]->stamp;
+    }
+    unsigned long get_paragraph_stamp(int i) const {
+	return paragraphs[i]->stamp;
+    }
+    void set_misspellings(int i, const IdxArray &misspellings);
+    void invalidate_misspellings();
+    void get_visible_paragraphs(int &first, int &last);
 };
 
 #endif
@@ -24,6 +24,8 @@
 #include "shaping.h"
 #include "themes.h"
 #include "dbg.h"
+#include "stats.h"
+#include "trace.h"
 
 // Default representations for some characters and concepts.
 // If you want to change these, don't edit this file; edit "reprtab" instead.
@@ -67,7 +69,7 @@ INTERACTIVE void EditBox::toggle_formatting_marks()
 void EditBox::set_maqaf_display(maqaf_display_t disp)
 {
     maqaf_display = disp;
-    request_update(rgnAll);
+    invalidate_frame();
     NOTIFY_CHANGE(maqaf);
 }
 
@@ -118,7 +120,7 @@ void EditBox::enable_bidi(bool value)
     bidi_enabled = value;
     cache.invalidate();
     invalidate_optimal_vis_column();
-    request_update(rgnAll);
+    invalidate_frame();
 }
 
 INTERACTIVE void EditBox::toggle_bidi()
@@ -156,9 +158,12 @@ void EditBox::request_update(int from, int to)
 
 void EditBox::update()
 {
-    if (update_region == rgnNone)
+    if (update_region == rgnNone || !canvas)
 	return;
 
+    TRACE_SCOPE("EditBox::update");
+    double start_time = perf_now_msecs();
+
     static int last_cursor_para = -1;
     if (is_primary_mark_set()) {
 	// Determining which paragraphs to repaint when a selection is active
@@ -186,8 +191,14 @@ void EditBox::update()
     }
 	
     if (update_region & rgnAll) {
-	wbkgd(wnd, get_attr(EDIT_ATTR));
-	werase(wnd);
+	if (!has_frame()) {
+	    // we don't know what the window shows; start with a blank one.
+	    canvas->blank(get_attr(EDIT_ATTR));
+	    frame.clear();
+	    frame.resize(window_height());
+	} else {
+	    scroll_to_top_line();
+	}
 	// we invalidate the cache here instead of doing it after every change
 	// that affects the display.
 	cache.invalidate();
@@ -209,31 +220,196 @@ void EditBox::update()
 	    curr_para_line = window_line;
 	    if (update_region != rgnCursor) {
 		// we don't paint it yet, but we erase its background
-		for (int k = window_line;
-			 k < window_line + para->breaks_count()
-			    && k < window_height();
-			 k++) {
-		    wmove(wnd, k, 0);
-		    wclrtoeol(wnd);
-		}
+		clear_lines(window_line, para->breaks_count());
 	    }
 	}
-	else if ((update_region & rgnAll)
+	else if (((update_region & rgnAll) && !is_painted(*para, i, window_line))
 		 || ((update_region & rgnRange)
 		      && i >= update_from && i <= update_to)) {
+	    clear_lines(window_line, para->breaks_count());
 	    redraw_paragraph(*para, window_line, false, i);
+	    record_painted(*para, i, window_line, false);
+	} else if (update_region & rgnAll) {
+	    PERF_COUNT(kept_paragraphs, 1);
 	}
 	window_line += para->breaks_count();
     }
 
+    if ((update_region & rgnAll) && window_line < window_height()) {
+	// blank the lines past the end of the buffer.
+	for (int k = window_line < 0 ? 0 : window_line;
+		k < window_height(); k++) {
+	    if (frame[k].para)
+		clear_lines(k, 1);
+	}
+    }
+
     // paint the current paragraph
     bool only_cursor = (update_region == rgnCursor);
     redraw_paragraph(*curr_para(), curr_para_line, only_cursor, cursor.para);
+    if (!only_cursor) {
+	// in no-wrap mode the current paragraph may be scrolled sideways, so
+	// it must be repainted once the cursor leaves it.
+	record_painted(*curr_para(), cursor.para, curr_para_line,
+		       wrap_type == wrpOff);
+    }
 
-    wnoutrefresh(wnd);
+    frame_top_line = top_line;
+    canvas->flush();
+    record_update_time(update_region, perf_now_msecs() - start_time);
     update_region = rgnNone;
 }
 
+// invalidate_frame() - forgets what the window shows, so that the next
+// update() paints all of it. It's called when something that affects
+// every paragraph, like a display option, changes.
+
+void EditBox::invalidate_frame()
+{
+    frame.clear();
+    request_update(rgnAll);
+}
+
+// invalidate_frame(para) - forgets the lines showing paragraph "para",
+// e.g. when its highlighting changes.
+
+void EditBox::invalidate_frame(int para)
+{
+    for (int k = 0; k < (int)frame.size(); k++)
+	if (frame[k].para == paragraphs[para])
+	    frame[k].inner_line = -1; // the next update() won't match it.
+    request_update(rgnAll);
+}
+
+// scroll_frame() - follows a Canvas::scroll_lines() of "diff" lines (up, if positive).
+
+void EditBox::scroll_frame(int diff)
+{
+    if (!has_frame())
+	return;
+    int height = window_height();
+    if (diff >= height || -diff >= height) {
+	frame.assign(height, FrameLine());
+    } else if (diff > 0) {
+	frame.erase(frame.begin(), frame.begin() + diff);
+	frame.resize(height);
+    } else if (diff < 0) {
+	frame.insert(frame.begin(), -diff, FrameLine());
+	frame.resize(height);
+    }
+}
+
+// scroll_to_top_line() - if the window was scrolled since the frame was
+// painted, and some of what it showed is still to be shown, scrolls the
+// canvas contents instead of having them repainted (and the curses canvas,
+// in turn, scrolls the terminal instead of retransmitting them).
+//
+// If paragraphs were inserted or deleted meanwhile, the frame_top_line
+// may not be the line it was, but then the frame doesn't match either
+// and update() repaints the difference.
+
+void EditBox::scroll_to_top_line()
+{
+    if (frame_top_line == top_line || frame_top_line.para >= parags_count())
+	return;
+    int para_diff = top_line.para - frame_top_line.para;
+    // each paragraph is at least one line, so don't bother counting.
+    if (para_diff >= window_height() || -para_diff >= window_height())
+	return;
+    int diff = lines_diff(frame_top_line, top_line);
+    if (top_line < frame_top_line)
+	diff = -diff;
+    if (diff >= window_height() || -diff >= window_height())
+	return;
+    canvas->scroll_lines(diff);
+    scroll_frame(diff);
+    PERF_COUNT(scrolled_lines, diff > 0 ? diff : -diff);
+}
+
+// get_frame_line() - describes line "inner_line" of paragraph "p" as
+// we'd paint it now.
+
+EditBox::FrameLine EditBox::get_frame_line(const Paragraph &p, int para_num,
+					   int inner_line, bool current)
+{
+    FrameLine fl;
+    fl.para = &p;
+    fl.stamp = p.stamp;
+    fl.inner_line = inner_line;
+    fl.dir = p.base_dir();
+    fl.eop = p.eop;
+    fl.current = current;
+    if (is_primary_mark_set()) {
+	Point lo = primary_mark, hi = cursor;
+	if (hi < lo)
+	    hi.swap(lo);
+	if (lo.para <= para_num && hi.para >= para_num) {
+	    fl.sel_start = (lo.para == para_num) ? lo.pos : 0;
+	    fl.sel_end = (hi.para == para_num) ? hi.pos : p.str.len() + 1;
+	}
+    }
+    return fl;
+}
+
+// is_painted() - does the window already show paragraph "p", starting at
+// "window_start_line", the way we'd paint it now?
+
+bool EditBox::is_painted(const Paragraph &p, int para_num,
+			 int window_start_line)
+{
+    if (!has_frame())
+	return false;
+    FrameLine fl = get_frame_line(p, para_num, 0, false);
+    for (int k = 0; k < p.breaks_count(); k++) {
+	int line = window_start_line + k;
+	if (line < 0)
+	    continue;
+	if (line >= window_height())
+	    break;
+	fl.inner_line = k;
+	if (!(frame[line] == fl))
+	    return false;
+    }
+    return true;
+}
+
+// record_painted() - records in the frame that paragraph "p" was painted
+// starting at "window_start_line".
+
+void EditBox::record_painted(const Paragraph &p, int para_num,
+			     int window_start_line, bool current)
+{
+    if (!has_frame())
+	return;
+    FrameLine fl = get_frame_line(p, para_num, 0, current);
+    for (int k = 0; k < p.breaks_count(); k++) {
+	int line = window_start_line + k;
+	if (line < 0)
+	    continue;
+	if (line >= window_height())
+	    break;
+	fl.inner_line = k;
+	frame[line] = fl;
+    }
+}
+
+// clear_lines() - erases "count" window lines, starting at
+// "window_start_line", and records them as blank.
+
+void EditBox::clear_lines(int window_start_line, int count)
+{
+    for (int k = window_start_line;
+	     k < window_start_line + count && k < window_height();
+	     k++) {
+	if (k < 0)
+	    continue;
+	canvas->move_to(k, 0);
+	canvas->clear_to_eol();
+	if (has_frame())
+	    frame[k].clear();
+    }
+}
+
 // }}}
 
 // BiDi Reordering {{{
@@ -474,7 +650,10 @@ int EditBox::calc_vis_column()
     unistring &vis = cache.vis;
     // We apply the BiDi algorithm if the
     // results are not already cached.
-    if (!cache.owned_by(cursor.para)) {
+    if (cache.owned_by(cursor.para)) {
+	PERF_COUNT(cache_hits, 1);
+    } else {
+	PERF_COUNT(cache_misses, 1);
 	cache.invalidate(); // it's owned by someone else
 	levels.resize(p.str.len());
 	DBG(100, ("get_embedding_levels() - by calc_vis_column()\n"));
@@ -544,7 +723,10 @@ void EditBox::move_to_vis_column(int column)
     unistring &vis = cache.vis;
     // We apply the BiDi algorithm if the
     // results are not already cached.
-    if (!cache.owned_by(cursor.para)) {
+    if (cache.owned_by(cursor.para)) {
+	PERF_COUNT(cache_hits, 1);
+    } else {
+	PERF_COUNT(cache_misses, 1);
 	cache.invalidate(); // it's owned by someone else
 	levels.resize(p.str.len());
 	DBG(100, ("get_embedding_levels() - by move_to_vis_column()\n"));
@@ -608,12 +790,17 @@ void EditBox::move_to_vis_column(int column)
     cursor.pos = start + cursor_log_line_pos;
 }
 
+// get_text_width() - we use the width given to resize() rather than ask
+// curses, because the progressive loader wraps paragraphs on other threads
+// (and curses may change the window size when the terminal is resized).
+
 int EditBox::get_text_width() const
 {
     if (!terminal::is_interactive())
 	return non_interactive_text_width;
     else
-	return window_width() - margin_before - margin_after;
+	return (old_width != -1 ? old_width : window_width())
+		- margin_before - margin_after;
 }
 
 // wrap_para() - wraps a paragraph. that means to populate the line_breaks
@@ -622,6 +809,8 @@ int EditBox::get_text_width() const
 
 void EditBox::wrap_para(Paragraph &para)
 {
+    PERF_COUNT(wrapped_paragraphs, 1);
+    PERF_COUNT(wrapped_chars, para.str.len());
     para.line_breaks.clear();
   
     if (wrap_type == wrpOff) {
@@ -676,6 +865,7 @@ void EditBox::wrap_para(Paragraph &para)
 
 void EditBox::rewrap_all()
 {
+    layout_stamp++;
     for (int i = 0; i < parags_count(); i++)
 	wrap_para(*paragraphs[i]);
     if (wrap_type == wrpOff) {
@@ -683,7 +873,7 @@ void EditBox::rewrap_all()
 	top_line.inner_line = 0;
     }
     scroll_to_cursor_line();
-    request_update(rgnAll);
+    invalidate_frame();
 }
 
 void EditBox::reformat()
@@ -718,14 +908,15 @@ void EditBox::set_tab_width(int value)
 void EditBox::resize(int lines, int columns, int y, int x)
 {
     Widget::resize(lines, columns, y, x);
-    if (old_width != columns) { // has the width changed?
+    bool width_changed = (old_width != columns);
+    old_width = columns; // get_text_width() uses it
+    if (width_changed) {
 	rewrap_all();
     } else {
 	// No, no need to rewrap
 	scroll_to_cursor_line();
-	request_update(rgnAll);
+	invalidate_frame();
     }
-    old_width = columns;
 }
 
 // }}}
@@ -735,7 +926,7 @@ void EditBox::resize(int lines, int columns, int y, int x)
 void EditBox::set_syn_hlt(syn_hlt_t syn)
 {
     syn_hlt = syn;
-    request_update(rgnAll);
+    invalidate_frame();
 }
 
 INTERACTIVE void EditBox::menu_set_syn_hlt_none()
@@ -756,7 +947,7 @@ INTERACTIVE void EditBox::menu_set_syn_hlt_email()
 void EditBox::set_underline(bool v)
 {
     underline_hlt = v;
-    request_update(rgnAll);
+    invalidate_frame();
 }
 
 INTERACTIVE void EditBox::toggle_underline()
@@ -803,10 +994,11 @@ void EditBox::detect_syntax()
 
 // Highlight HTML
 
-static void highlight_html(const unistring &str, EditBox::AttributeArray& attributes)
+static void highlight_html(Canvas &canvas, const unistring &str,
+			   EditBox::AttributeArray& attributes)
 {
     idx_t len = str.len();
-    attribute_t html_attr = get_attr(EDIT_HTML_TAG_ATTR);
+    attribute_t html_attr = canvas.get_attr(EDIT_HTML_TAG_ATTR);
     bool is_color = contains_color(html_attr);
     bool in_tag = false;
 
@@ -827,7 +1019,8 @@ static void highlight_html(const unistring &str, EditBox::AttributeArray& attrib
 // Highlight Email
 
 #define MAX_QUOTE_LEVEL 9
-static void highlight_email(const unistring &str, EditBox::AttributeArray& attributes)
+static void highlight_email(Canvas &canvas, const unistring &str,
+			    EditBox::AttributeArray& attributes)
 {
     idx_t len = str.len();
     attribute_t quote_attr = A_NORMAL; // silence the compiler.
@@ -841,7 +1034,7 @@ static void highlight_email(const unistring &str, EditBox::AttributeArray& attri
 	while (pos < len) {
 	    if (str[pos] == '>' && level < MAX_QUOTE_LEVEL) {
 		level++;
-		quote_attr = get_attr(EDIT_EMAIL_QUOTE1_ATTR + level - 1);
+		quote_attr = canvas.get_attr(EDIT_EMAIL_QUOTE1_ATTR + level - 1);
 		is_color   = contains_color(quote_attr);
 	    }
 	    if (is_color)
@@ -859,10 +1052,11 @@ inline bool is_ltr_alpha(unichar ch)
 
 // Highlight underline (*text* and _text_)
 
-static void highlight_underline(const unistring &str, EditBox::AttributeArray& attributes)
+static void highlight_underline(Canvas &canvas, const unistring &str,
+				EditBox::AttributeArray& attributes)
 {
     idx_t len = str.len();
-    attribute_t underline_attr = get_attr(EDIT_EMPHASIZED_ATTR);
+    attribute_t underline_attr = canvas.get_attr(EDIT_EMPHASIZED_ATTR);
     bool is_color = contains_color(underline_attr);
     bool in_emph = false;
 
@@ -886,6 +1080,64 @@ static void highlight_underline(const unistring &str, EditBox::AttributeArray& a
     }
 }
 
+// Highlight the misspelled words the background spell checker found.
+
+static void highlight_misspellings(Canvas &canvas, const Paragraph &p,
+				   EditBox::AttributeArray& attributes)
+{
+    if (p.spell_stamp != p.stamp) // they're of some older text.
+	return;
+    attribute_t misspelled_attr = canvas.get_attr(EDIT_MISSPELLED_ATTR);
+    bool is_color = contains_color(misspelled_attr);
+    for (int i = 0; i + 1 < (int)p.misspellings.size(); i += 2) {
+	idx_t end = MIN(p.misspellings[i] + p.misspellings[i+1], p.str.len());
+	for (idx_t pos = p.misspellings[i]; pos < end; pos++) {
+	    if (is_color)
+		attributes[pos] = misspelled_attr;
+	    else
+		attributes[pos] |= misspelled_attr;
+	}
+    }
+}
+
+// set_misspellings() - the background spell checker calls this with the
+// results for paragraph "i". It has made sure the results are of the
+// current text.
+
+void EditBox::set_misspellings(int i, const IdxArray &misspellings)
+{
+    Paragraph &p = *paragraphs[i];
+    p.spell_stamp = p.stamp;
+    if (p.misspellings.empty() && misspellings.empty())
+	return;
+    p.misspellings = misspellings;
+    if (cache.owned_by(i))
+	cache.invalidate();
+    invalidate_frame(i);
+}
+
+// invalidate_misspellings() - forgets the results of the background spell
+// checker, e.g. when it's turned off or the dictionary has changed.
+
+void EditBox::invalidate_misspellings()
+{
+    for (int i = 0; i < parags_count(); i++) {
+	paragraphs[i]->spell_stamp = 0;
+	paragraphs[i]->misspellings.clear();
+    }
+    cache.invalidate();
+    invalidate_frame();
+}
+
+// get_visible_paragraphs() - returns the range of paragraphs that may be
+// visible in the window. The background spell checker checks them first.
+
+void EditBox::get_visible_paragraphs(int &first, int &last)
+{
+    first = top_line.para;
+    last  = MIN(top_line.para + window_height(), parags_count() - 1);
+}
+
 // }}}
 
 // low-level drawing {{{
@@ -972,7 +1224,7 @@ void EditBox::draw_unistr(const unichar *str, idx_t len,
     
 #define SETWATTR(_attr) \
 	  if (current_attr != int(_attr)) { \
-		wattrset(wnd, _attr); \
+		canvas->set_attr(_attr); \
 		current_attr = _attr; \
 	  }
 
@@ -993,7 +1245,7 @@ void EditBox::draw_unistr(const unichar *str, idx_t len,
 	    } \
 	    /*SETWATTR(_attr | def_attr);*/ \
 	    SETWATTR(contains_color(def_attr) ? def_attr : (_attr | def_attr)); \
-	    waddnwstr(wnd, (wchar_t*)&wch, 1); \
+	    canvas->put_char(wch); \
 	} while (0)
 #else
 #define put_unichar_attr(_wch, _attr) \
@@ -1010,7 +1262,7 @@ void EditBox::draw_unistr(const unichar *str, idx_t len,
 	    } \
 	    /*SETWATTR(_attr | def_attr);*/ \
 	    SETWATTR(contains_color(def_attr) ? def_attr : (_attr | def_attr)); \
-	    waddch(wnd, (unsigned char)ich); \
+	    canvas->put_char((unsigned char)ich); \
 	} while (0)
 #endif
 
@@ -1139,8 +1391,8 @@ void EditBox::draw_rev_unistr(const unichar *str, idx_t len,
 
 void EditBox::put_unichar_attr_at(int line, int col, unichar ch, int attr)
 {
-    wattrset(wnd, attr);
-    wmove(wnd, line, col);
+    canvas->set_attr(attr);
+    canvas->move_to(line, col);
     put_unichar(ch, get_char_repr(FAILED_CONV_REPR));
 }
 
@@ -1263,12 +1515,12 @@ void EditBox::redraw_unwrapped_paragraph(
     // Step 2. draw the segment [start_col .. end_col)
 
     if (p.is_rtl()) {
-	wmove(wnd, window_start_line,
+	canvas->move_to(window_start_line,
 	      margin_after + visible_text_width - segment_width);
 	draw_rev_unistr(vis.begin() + start_col, end_col - start_col,
 			attributes.begin() + start_col);
     } else {
-	wmove(wnd, window_start_line, margin_before);
+	canvas->move_to(window_start_line, margin_before);
 	draw_unistr(vis.begin() + start_col, end_col - start_col,
 		    attributes.begin() + start_col);
     }
@@ -1311,9 +1563,9 @@ void EditBox::redraw_unwrapped_paragraph(
 
     if (p.is_rtl()) {
 	cursor_vis_width = visible_text_width - cursor_vis_width - 1;
-	wmove(wnd, window_start_line, margin_after + cursor_vis_width);
+	canvas->move_to(window_start_line, margin_after + cursor_vis_width);
     } else {	
-	wmove(wnd, window_start_line, margin_before + cursor_vis_width);
+	canvas->move_to(window_start_line, margin_before + cursor_vis_width);
     }
 }
 
@@ -1371,7 +1623,7 @@ void EditBox::redraw_wrapped_paragraph(
 		    window_x--;
 		else
 		    window_x += visible_text_width - line_width;
-		wmove(wnd, window_start_line + line_num, window_x);
+		canvas->move_to(window_start_line + line_num, window_x);
 		draw_rev_unistr(vis.begin() + prev_line_break, line_len,
 				attributes.begin() + prev_line_break);
 		if (is_last_line) {
@@ -1384,7 +1636,7 @@ void EditBox::redraw_wrapped_paragraph(
 			     get_char_repr(WRAP_RTL_REPR), get_attr(EDIT_WRAP_ATTR));
 		}
 	    } else {
-		wmove(wnd, window_start_line + line_num, margin_before);
+		canvas->move_to(window_start_line + line_num, margin_before);
 		draw_unistr(vis.begin() + prev_line_break, line_len,
 			    attributes.begin() + prev_line_break);
 		if (is_last_line) {
@@ -1440,12 +1692,10 @@ void EditBox::redraw_wrapped_paragraph(
     if (cursor_line != -1) {
         if (p.is_rtl()) {
 	    cursor_vis_width = visible_text_width - cursor_vis_width - 1;
-	    wmove(wnd,
-		  window_start_line + cursor_line,
+	    canvas->move_to(window_start_line + cursor_line,
 		  margin_after + cursor_vis_width);
 	} else {
-	    wmove(wnd,
-		  window_start_line + cursor_line,
+	    canvas->move_to(window_start_line + cursor_line,
 		  margin_before + cursor_vis_width);
 	}
     }
@@ -1456,16 +1706,18 @@ void EditBox::do_syntax_highlight(const unistring &str,
 {
     switch (syn_hlt) {
     case synhltHTML:
-	highlight_html(str, attributes);
+	highlight_html(*canvas, str, attributes);
 	break;
     case synhltEmail:
-	highlight_email(str, attributes);
+	highlight_email(*canvas, str, attributes);
 	break;
     default:
 	break;
     }
     if (underline_hlt)
-	highlight_underline(str, attributes);
+	highlight_underline(*canvas, str, attributes);
+    if (para_num >= 0 && para_num < parags_count())
+	highlight_misspellings(*canvas, *paragraphs[para_num], attributes);
 }
 	
 void EditBox::redraw_paragraph(Paragraph &p, int window_start_line,
@@ -1484,7 +1736,11 @@ void EditBox::redraw_paragraph(Paragraph &p, int window_start_line,
     IdxArray &position_V_to_L = cache.position_V_to_L;
     AttributeArray &attributes = cache.attributes; 
 
-    if (!cache.owned_by(para_num)) {
+    PERF_COUNT(redrawn_paragraphs, 1);
+    if (cache.owned_by(para_num)) {
+	PERF_COUNT(cache_hits, 1);
+    } else {
+	PERF_COUNT(cache_misses, 1);
 	position_L_to_V.resize(p.str.len());
 	position_V_to_L.resize(p.str.len());
 	levels.resize(p.str.len());
@@ -1596,149 +1852,171 @@ static void emph_string(unistring &str,
     }
 }
 
-// log2vis() - convert the [logical] document into visual.
+// parse_log2vis_options() - parses the options string of log2vis().
 
-void EditBox::log2vis(const char *options)
+void EditBox::parse_log2vis_options(const char *options, Log2VisOptions &opt)
 {
-    bool    opt_bdo	    = false;
-    bool    opt_nopad       = false;
-    bool    opt_engpad	    = false;
+    opt.bdo	    = false;
+    opt.nopad	    = false;
+    opt.engpad	    = false;
+    opt.emph	    = false;
+    opt.emph_marker = 0;
+    opt.emph_ch	    = UNI_NS_UNDERSCORE;
 
-    unichar opt_emph	    = false;
-    unichar opt_emph_marker = 0;
-    unichar opt_emph_ch     = UNI_NS_UNDERSCORE;
-
-    // parse the 'options' string.
     if (options) {
 	if (strstr(options, "bdo"))
-	    opt_bdo = true;
+	    opt.bdo = true;
 	if (strstr(options, "nopad"))
-	    opt_nopad = true;
+	    opt.nopad = true;
 	if (strstr(options, "engpad"))
-	    opt_engpad = true;
+	    opt.engpad = true;
 	const char *s;
 	if ((s = strstr(options, "emph"))) {
-	    opt_emph = true;
+	    opt.emph = true;
 	    if (s[4] == ':') {
 		char *endptr;
-		opt_emph_ch = strtol(s + 5, &endptr, 0);
+		opt.emph_ch = strtol(s + 5, &endptr, 0);
 		s = endptr;
 		if (s && (*s == ':' || *s == ','))
-		    opt_emph_marker = strtol(s + 1, NULL, 0);
+		    opt.emph_marker = strtol(s + 1, NULL, 0);
 	    }
 	    DBG(1, ("--EMPH-- glyph: U+%04lX, marker: U+%04lX\n",
-				    (unsigned long)opt_emph_ch,
-				    (unsigned long)opt_emph_marker));
+				    (unsigned long)opt.emph_ch,
+				    (unsigned long)opt.emph_marker));
 	}
     }
-   
-    std::vector<unistring> visuals;
-    
-    for (int i = 0; i < parags_count(); i++)
-    {
-	Paragraph &p = *paragraphs[i];
-
-	unistring &visp = p.str;
-	if (opt_emph) {
-	    emph_string(visp, opt_emph_marker, opt_emph_ch);
-	    post_para_modification(p);
-	}
-	
-	cache.invalidate();
-	LevelsArray &levels = cache.levels;
-	IdxArray &position_L_to_V = cache.position_L_to_V;
-	IdxArray &position_V_to_L = cache.position_V_to_L;
-
-	position_L_to_V.resize(p.str.len());
-	position_V_to_L.resize(p.str.len());
-	levels.resize(p.str.len());
-	DBG(100, ("get_embedding_levels() - by log2vis()\n"));
-	BiDi::get_embedding_levels(p.str.begin(), p.str.len(),
-				   p.base_dir(), levels.begin(),
-				   p.breaks_count(), p.line_breaks.begin());
-
-	int visible_text_width = get_text_width();
-	idx_t prev_line_break = 0;
+}
 
-	for (int line_num = 0;
-		 line_num < p.breaks_count();
-		 line_num++)
-	{
-	    idx_t line_break = p.line_breaks[line_num];
-	    idx_t line_len = line_break - prev_line_break;
-	   
-	    // trim
-	    while (line_len
-		    && BiDi::is_space(p.str[prev_line_break + line_len - 1]))
-	      line_len--;
-
-	    // convert to visual
-	    reorder(levels.begin() + prev_line_break, line_len,
-		    position_V_to_L.begin() + prev_line_break,
-		    position_L_to_V.begin() + prev_line_break,
-		    visp.begin() + prev_line_break,
-		    NULL, true,
-		    rtl_nsm_display == rtlnsmAsis);
+// log2vis_para() - converts a paragraph into visual lines, which are
+// appended to "visuals". The paragraph needn't be in the buffer, but its
+// base direction should have been determined (see
+// calc_contextual_dirs()). The paragraph's text is left reordered.
+//
+// It changes nothing but "p" and "bufs", so several threads may convert
+// paragraphs at once, each with its own "bufs".
 
-	    if (terminal::do_arabic_shaping)
-		line_len = shape(p.str.begin() + prev_line_break,
-				 line_len, NULL);
+void EditBox::log2vis_para(Paragraph &p, const Log2VisOptions &opt,
+			   Log2VisBuffers &bufs,
+			   std::vector<unistring> &visuals)
+{
+    unistring &visp = p.str;
+    if (opt.emph) {
+	emph_string(visp, opt.emph_marker, opt.emph_ch);
+	// like post_para_modification(), but without stamping the
+	// paragraph: stamps can't be taken on several threads at once.
+	p.determine_base_dir(dir_algo);
+	wrap_para(p);
+    }
+    
+    LevelsArray &levels = bufs.levels;
+    IdxArray &position_L_to_V = bufs.position_L_to_V;
+    IdxArray &position_V_to_L = bufs.position_V_to_L;
+
+    position_L_to_V.resize(p.str.len());
+    position_V_to_L.resize(p.str.len());
+    levels.resize(p.str.len());
+    DBG(100, ("get_embedding_levels() - by log2vis()\n"));
+    BiDi::get_embedding_levels(p.str.begin(), p.str.len(),
+			       p.base_dir(), levels.begin(),
+			       p.breaks_count(), p.line_breaks.begin());
 
-	    unistring visline;
-	    // pad RTL lines
-	    if (p.is_rtl() && !opt_nopad) {
-		int line_width = get_rev_str_width(
-				    visp.begin() + prev_line_break, line_len);
-		while (line_width < visible_text_width) {
-		    visline.push_back(' ');
-		    line_width++;
-		}
-	    }
+    int visible_text_width = get_text_width();
+    idx_t prev_line_break = 0;
 
-	    // convert TABs to spaces, and convert/erase some
-	    // special chars.
-	    IntArray tab_widths;
-	    int tab_counter = 0;
-	    calc_tab_widths(visp.begin() + prev_line_break, line_len,
-			    p.is_rtl(), tab_widths);
-	    for (int i = prev_line_break; i < prev_line_break + line_len; i++) {
-		if (visp[i] == '\t') {
-		    int j = tab_widths[tab_counter++];
-		    while (j--)
-			visline.push_back(' ');
-		} else if (visp[i] == UNI_HEB_MAQAF
-			    && maqaf_display != mqfAsis) {
-		    visline.push_back('-');
-		} else {
-		    if (!BiDi::is_transparent_formatting_code(visp[i]))
-			visline.push_back(visp[i]);
-		}
+    for (int line_num = 0;
+	     line_num < p.breaks_count();
+	     line_num++)
+    {
+	idx_t line_break = p.line_breaks[line_num];
+	idx_t line_len = line_break - prev_line_break;
+       
+	// trim
+	while (line_len
+		&& BiDi::is_space(p.str[prev_line_break + line_len - 1]))
+	  line_len--;
+
+	// convert to visual
+	reorder(levels.begin() + prev_line_break, line_len,
+		position_V_to_L.begin() + prev_line_break,
+		position_L_to_V.begin() + prev_line_break,
+		visp.begin() + prev_line_break,
+		NULL, true,
+		rtl_nsm_display == rtlnsmAsis);
+
+	if (terminal::do_arabic_shaping)
+	    line_len = shape(p.str.begin() + prev_line_break,
+			     line_len, NULL);
+
+	unistring visline;
+	// pad RTL lines
+	if (p.is_rtl() && !opt.nopad) {
+	    int line_width = get_rev_str_width(
+				visp.begin() + prev_line_break, line_len);
+	    while (line_width < visible_text_width) {
+		visline.push_back(' ');
+		line_width++;
 	    }
+	}
 
-	    // pad LTR lines
-	    if (!p.is_rtl() && opt_engpad) {
-		int line_width = get_str_width(
-				    visp.begin() + prev_line_break, line_len);
-		while (line_width < visible_text_width) {
+	// convert TABs to spaces, and convert/erase some
+	// special chars.
+	IntArray tab_widths;
+	int tab_counter = 0;
+	calc_tab_widths(visp.begin() + prev_line_break, line_len,
+			p.is_rtl(), tab_widths);
+	for (int i = prev_line_break; i < prev_line_break + line_len; i++) {
+	    if (visp[i] == '\t') {
+		int j = tab_widths[tab_counter++];
+		while (j--)
 		    visline.push_back(' ');
-		    line_width++;
-		}
+	    } else if (visp[i] == UNI_HEB_MAQAF
+			&& maqaf_display != mqfAsis) {
+		visline.push_back('-');
+	    } else {
+		if (!BiDi::is_transparent_formatting_code(visp[i]))
+		    visline.push_back(visp[i]);
 	    }
-	    
-	    if (opt_bdo) {
-		visline.insert(visline.begin(), UNI_LRO);
-		visline.push_back(UNI_PDF);
+	}
+
+	// pad LTR lines
+	if (!p.is_rtl() && opt.engpad) {
+	    int line_width = get_str_width(
+				visp.begin() + prev_line_break, line_len);
+	    while (line_width < visible_text_width) {
+		visline.push_back(' ');
+		line_width++;
 	    }
-	    visuals.push_back(visline);
-	    
-	    prev_line_break = line_break;
 	}
+	
+	if (opt.bdo) {
+	    visline.insert(visline.begin(), UNI_LRO);
+	    visline.push_back(UNI_PDF);
+	}
+	visuals.push_back(visline);
+	
+	prev_line_break = line_break;
+    }
+}
+
+// log2vis() - convert the [logical] document into visual.
 
+void EditBox::log2vis(const char *options)
+{
+    Log2VisOptions opt;
+    parse_log2vis_options(options, opt);
+   
+    Log2VisBuffers bufs;
+    std::vector<unistring> visuals;
+    
+    preserve_all_parags();
+    for (int i = 0; i < parags_count(); i++) {
+	log2vis_para(*paragraphs[i], opt, bufs, visuals);
 	delete paragraphs[i];
     }
 
     // replace the logical document with the visual version.
     paragraphs.clear();
+    cache.invalidate();
     for (int i = 0; i < (int)visuals.size(); i++) {
 	Paragraph *p = new Paragraph();
 	p->str = visuals[i];
@@ -1751,6 +2029,7 @@ void EditBox::log2vis(const char *options)
 
     undo_stack.clear();
     unset_primary_mark();
+    modification_count++;
     set_modified(true);
     cursor.zero();
     scroll_to_cursor_line();
@@ -0,0 +1,241 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include "editbox.h"
+
+// EditBox's tables live apart from the other widgets' tables (see
+// bindings.cc) because EditBox is part of libgeresh-core, which doesn't
+// know about the editor and its dialogs.
+
+EditBox::action_entry EditBox::actions_table[] = {
+    ADD_ACTION(EditBox, key_left,
+	    N_("Move a character left")),
+    ADD_ACTION(EditBox, key_right,
+	    N_("Move a character right")),
+    ADD_ACTION(EditBox, move_previous_line,
+	    N_("Move to the previous line")),
+    ADD_ACTION(EditBox, move_next_line,
+	    N_("Move to the next line")),
+    ADD_ACTION(EditBox, move_forward_page,
+	    N_("Move to the next page")),
+    ADD_ACTION(EditBox, move_backward_page,
+	    N_("Move to the previous page")),
+    ADD_ACTION(EditBox, move_forward_char,
+	    N_("Move forward a character")),
+    ADD_ACTION(EditBox, move_backward_char,
+	    N_("Move back a character")),
+    ADD_ACTION(EditBox, move_beginning_of_line,
+	    N_("Move to the beginning of the current line, logical")),
+    ADD_ACTION(EditBox, move_beginning_of_visual_line,
+	    N_("Move to the beginning of the current line, visual")),
+    ADD_ACTION(EditBox, key_home,
+	    N_("Move to the beginning of the current line")),
+    ADD_ACTION(EditBox, move_end_of_line,
+	    N_("Move to the end of the current line")),
+    ADD_ACTION(EditBox, move_last_modification,
+	    N_("Jump to the place of the last editing operation")),
+    ADD_ACTION(EditBox, delete_backward_char,
+	    N_("Delete the previous character")),
+    ADD_ACTION(EditBox, delete_forward_char,
+	    N_("Delete the character the cursor is on")),
+    ADD_ACTION(EditBox, copy,
+	    N_("Copy the selected text to clipboard")),
+    ADD_ACTION(EditBox, cut,
+	    N_("Copy the selected text to clipboard and delete it from the buffer")),
+    ADD_ACTION(EditBox, paste,
+	    N_("Paste the text in the clipboard into the buffer")),
+    ADD_ACTION(EditBox, move_end_of_buffer,
+	    N_("Move to the end of the buffer")),
+    ADD_ACTION(EditBox, move_beginning_of_buffer,
+	    N_("Move to the beginning of the buffer")),
+    ADD_ACTION(EditBox, move_backward_word,
+	    N_("Move to the beginning of the current or previous word")),
+    ADD_ACTION(EditBox, move_forward_word,
+	    N_("Move to the end of the current or next word")),
+    ADD_ACTION(EditBox, delete_backward_word,
+	    N_("Delete to the beginning of the current or previous word")),
+    ADD_ACTION(EditBox, delete_forward_word,
+	    N_("Delete to the end of the current or next word")),
+    ADD_ACTION(EditBox, toggle_dir_algo,
+	    N_("Change the algorithm used to determine the base direction of paragraphs")),
+    ADD_ACTION(EditBox, set_dir_algo_unicode,
+	    N_("Unicode's TR #9: First strong character determines base dir. Neutral gets LTR.")),
+    ADD_ACTION(EditBox, set_dir_algo_context_strong,
+	    N_("Contextual-strong: Unicode's TR #9 + neutral paras now inherit surroundings")),
+    ADD_ACTION(EditBox, set_dir_algo_context_rtl,
+	    N_("Contextual-rtl: like Contextual-strong, but if there's any RTL char, para is RTL")),
+    ADD_ACTION(EditBox, set_dir_algo_force_ltr,
+	    N_("Force LTR")),
+    ADD_ACTION(EditBox, set_dir_algo_force_rtl,
+	    N_("Force RTL")),
+    ADD_ACTION(EditBox, toggle_wrap,
+	    N_("Change the way long lines are displayed (whether to wrap or not, and how)")),
+    ADD_ACTION(EditBox, set_wrap_type_at_white_space,
+	    N_("Wrap lines, do not break words (just like a word processor)")),
+    ADD_ACTION(EditBox, set_wrap_type_anywhere,
+	    N_("Wrap lines, break words")),
+    ADD_ACTION(EditBox, set_wrap_type_off,
+	    N_("Don't wrap lines;you'll have to scroll horizontally to view the rest of the line")),
+    ADD_ACTION(EditBox, toggle_alt_kbd,
+	    N_("Toogle Hebrew keyboard emulation")),
+    ADD_ACTION(EditBox, retype_selection_alt_kbd,
+	    N_("Convert the selected text as if it were typed with the Hebrew keyboard emulation")),
+    ADD_ACTION(EditBox, set_translate_next_char,
+	    N_("Translate next character")),
+    ADD_ACTION(EditBox, justify,
+	    N_("Justify the current or next paragraph")),
+    ADD_ACTION(EditBox, cut_end_of_paragraph,
+	    N_("Cut [to] end of paragraph")),
+    ADD_ACTION(EditBox, undo,
+	    N_("Undo the last change")),
+    ADD_ACTION(EditBox, redo,
+	    N_("Redo the last change you canceled")),
+    ADD_ACTION(EditBox, delete_paragraph,
+	    N_("Delete the current paragraph")),
+    ADD_ACTION(EditBox, toggle_primary_mark,
+	    N_("Start/cancel selection")),
+    ADD_ACTION(EditBox, toggle_auto_justify,
+	    N_("Toggle auto-justify")),
+    ADD_ACTION(EditBox, toggle_auto_indent,
+	    N_("Toggle auto-indent")),
+    ADD_ACTION(EditBox, toggle_formatting_marks,
+	    N_("Toggle display of formatting marks (paragraph ends, explicit BiDi marks, tabs)")),
+    ADD_ACTION(EditBox, toggle_rtl_nsm,
+	    N_("Toggle display of Hebrew/Arabic points (off/transliterated/as-is)")),
+    ADD_ACTION(EditBox, set_rtl_nsm_asis,
+	    N_("Display Hebrew/Arabic points as-is (for capable terminals only)")),
+    ADD_ACTION(EditBox, set_rtl_nsm_transliterated,
+	    N_("Display Hebrew/Arabic points as highlighted ASCII characters")),
+    ADD_ACTION(EditBox, set_rtl_nsm_off,
+	    N_("Hide Hebrew/Arabic points")),
+    ADD_ACTION(EditBox, toggle_maqaf,
+	    N_("Toggle Hebrew maqaf highlighting and/or enable its ASCII transliteration")),
+    ADD_ACTION(EditBox, set_maqaf_display_transliterated,
+	    N_("Display the maqaf as ASCII dash")),
+    ADD_ACTION(EditBox, set_maqaf_display_highlighted,
+	    N_("Highlight the maqaf")),
+    ADD_ACTION(EditBox, set_maqaf_display_asis,
+	    N_("Display the maqaf as-is (for capable terminals)")),
+    ADD_ACTION(EditBox, toggle_smart_typing,
+	    N_("Toggle smart-typing mode: auto replace some plain characters with typographical ones")),
+    ADD_ACTION(EditBox, insert_maqaf,
+	    N_("Insert Hebrew maqaf")),
+    ADD_ACTION(EditBox, toggle_read_only,
+	    N_("Toggle read-only status of buffer")),
+    ADD_ACTION(EditBox, toggle_eops,
+	    N_("Change end-of-paragraphs type")),
+    ADD_ACTION(EditBox, set_eops_unix,
+	    N_("Set end-of-paragraphs type to Unix")),
+    ADD_ACTION(EditBox, set_eops_dos,
+	    N_("Set end-of-paragraphs type to DOS/Windows")),
+    ADD_ACTION(EditBox, set_eops_mac,
+	    N_("Set end-of-paragraphs type to Macintosh")),
+    ADD_ACTION(EditBox, set_eops_unicode,
+	    N_("Set end-of-paragraphs type to Unicode PS")),
+    ADD_ACTION(EditBox, toggle_key_for_key_undo,
+	    N_("Toggle key-for-key undo (whether to group small editing operations)")),
+    ADD_ACTION(EditBox, toggle_bidi,
+	    N_("Turn off/on the BiDi algorithm (useful when editing complicated bi-di texts)")),
+    ADD_ACTION(EditBox, toggle_visual_cursor_movement,
+	    N_("Toggle between logical and visual cursor movement")),
+    ADD_ACTION(EditBox, menu_set_syn_hlt_none,  N_("Don't do syntax-highlighting")),
+    ADD_ACTION(EditBox, menu_set_syn_hlt_html,  N_("Highlight HTML tags")),
+    ADD_ACTION(EditBox, menu_set_syn_hlt_email, N_("Highlight lines starting with '>'")),
+    ADD_ACTION(EditBox, toggle_underline,       N_("Whether to highlight *text* and _text_ on your terminal")),
+    END_ACTIONS
+};
+
+binding_entry EditBox::bindings_table[] = {
+    { Event(KEY_LEFT), "key_left" },
+    { Event(KEY_RIGHT), "key_right" },
+    { Event(KEY_UP), "move_previous_line" },
+    { Event(KEY_DOWN), "move_next_line" },
+    { Event(KEY_NPAGE), "move_forward_page" },
+    { Event(KEY_PPAGE), "move_backward_page" },
+    { Event(KEY_HOME), "key_home" },
+    { Event(KEY_END), "move_end_of_line" },
+    { Event(CTRL, 'b'), "move_backward_char" },
+    { Event(CTRL, 'f'), "move_forward_char" },
+    { Event(CTRL, 'p'), "move_previous_line" },
+    { Event(CTRL, 'n'), "move_next_line" },
+    { Event(CTRL, 'a'), "move_beginning_of_line" },
+    { Event(CTRL, 'e'), "move_end_of_line" },
+    { Event(CTRL, 'o'), "move_last_modification" },
+    { Event(ALT, 'o'), "move_last_modification" },
+    { Event(KEY_BACKSPACE), "delete_backward_char" },
+    { Event(KEY_DC), "delete_forward_char" },
+    { Event(CTRL, 'd'), "delete_forward_char" },
+    { Event(ALT, 'h'), "toggle_alt_kbd" },
+    { Event(KEY_F(12)), "toggle_alt_kbd" },
+    { Event(CTRL | ALT, 'k'), "retype_selection_alt_kbd" },
+    { Event(ALT, '>'), "move_end_of_buffer" },
+    { Event(ALT, '<'), "move_beginning_of_buffer" },
+    { Event(ALT, 'b'), "move_backward_word" },
+    { Event(ALT, 'f'), "move_forward_word" },
+    { Event(ALT, 'F'), "toggle_formatting_marks" },
+    { Event(ALT, 'n'), "toggle_rtl_nsm" },
+    { Event(ALT, 'd'), "delete_forward_word" },
+    { Event(ALT, 0, KEY_BACKSPACE), "delete_backward_word" },
+    { Event(ALT, 't'), "toggle_dir_algo" },
+    { Event(ALT, 'w'), "toggle_wrap" },
+    { Event(CTRL, 'q'), "set_translate_next_char" },
+    { Event(CTRL, 'j'), "justify" },
+    { Event(CTRL, 'k'), "cut_end_of_paragraph" },
+    { Event(CTRL, 'r'), "redo" },
+    { Event(CTRL, 'u'), "undo" },
+    { Event(CTRL, 'c'), "copy" },
+    { Event(CTRL, 'x'), "cut" },
+    { Event(CTRL, 'v'), "paste" },
+    { Event(CTRL, 'y'), "delete_paragraph" },
+    { Event(CTRL, '^'), "toggle_primary_mark" },
+    { Event(CTRL, '@'), "toggle_primary_mark" },
+    { Event(KEY_F(11)), "toggle_primary_mark" }, // cygwin
+    { Event(ALT, 'J'), "toggle_auto_justify" },
+    { Event(ALT, 'i'), "toggle_auto_indent" },
+    { Event(ALT, 'k'), "toggle_maqaf" },
+    { Event(ALT, 'q'), "toggle_smart_typing" },
+    { Event(ALT, '-'), "insert_maqaf" },
+    { Event(ALT, 'R'), "toggle_read_only" },
+    { Event(CTRL | ALT, 'e'), "toggle_eops" },
+    { Event(VIRTUAL, 2001), "set_eops_unix" },
+    { Event(VIRTUAL, 2002), "set_eops_dos" },
+    { Event(VIRTUAL, 2003), "set_eops_mac" },
+    { Event(VIRTUAL, 2004), "set_eops_unicode" },
+    { Event(VIRTUAL, 2005), "set_rtl_nsm_off" },
+    { Event(VIRTUAL, 2006), "set_rtl_nsm_asis" },
+    { Event(VIRTUAL, 2007), "set_rtl_nsm_transliterated" },
+    { Event(VIRTUAL, 2008), "set_maqaf_display_transliterated" },
+    { Event(VIRTUAL, 2009), "set_maqaf_display_highlighted" },
+    { Event(VIRTUAL, 2010), "set_maqaf_display_asis" },
+    { Event(VIRTUAL, 2011), "set_wrap_type_at_white_space" },
+    { Event(VIRTUAL, 2012), "set_wrap_type_anywhere" },
+    { Event(VIRTUAL, 2013), "set_wrap_type_off" },
+    { Event(ALT, '1'), "set_dir_algo_unicode" },
+    { Event(ALT, '2'), "set_dir_algo_context_strong" },
+    { Event(ALT, '3'), "set_dir_algo_context_rtl" },
+    { Event(ALT, '4'), "set_dir_algo_force_ltr" },
+    { Event(ALT, '5'), "set_dir_algo_force_rtl" },
+    { Event(VIRTUAL, 2300), "toggle_key_for_key_undo" },
+    { Event(CTRL | ALT, 'b'), "toggle_bidi" },
+    { Event(VIRTUAL, 4000), "menu_set_syn_hlt_none" },
+    { Event(VIRTUAL, 4001), "menu_set_syn_hlt_html" },
+    { Event(VIRTUAL, 4002), "menu_set_syn_hlt_email" },
+    { Event(VIRTUAL, 4010), "toggle_underline" },
+    { Event(ALT, 'v'), "toggle_visual_cursor_movement" },
+    END_BINDINGS
+};
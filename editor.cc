@@ -32,9 +32,29 @@
 #include "dbg.h"
 #include "transtbl.h"
 #include "helpbox.h"
+#include "trace.h"
+#include "stats.h"
+#include "mainloop.h"
+
+// While a file loads progressively, load_file() waits at most
+// FIRST_SCREEN_WAITS periods of LOAD_WAIT_MSECS milliseconds for the first
+// screenful. The loading and saving tasks of the main loop are woken by
+// the reader and writer threads, but they also check every such period.
+#define LOAD_WAIT_MSECS	    100
+#define FIRST_SCREEN_WAITS  5
+
+// While keys arrive faster than we can paint (a paste, a repeating key),
+// exec() handles them all before it updates the screen, but it doesn't
+// leave the screen stale for longer than TYPEAHEAD_MAX_MSECS milliseconds.
+#define TYPEAHEAD_MAX_MSECS 100
 
 Editor *Editor::global_instance; // for SIGHUP
 
+static void sighup_handler()
+{
+    Editor::get_global_instance()->emergency_save();
+}
+
 #define LOAD_HISTORY		1
 #define SAVEAS_HISTORY		0
 #define SEARCH_HISTORY		2
@@ -144,8 +164,11 @@ Editor::Editor()
       speller(*this, dialog)
 {
     spellerwnd = NULL;
+    loader = NULL;
+    saver = NULL;
     wedit.set_error_listener(this);
     global_instance = this;
+    terminal::hangup_handler = sighup_handler;
     set_default_encoding(DEFAULT_FILE_ENCODING);
     set_encoding(get_default_encoding());
     set_filename("");
@@ -215,6 +238,16 @@ bool Editor::is_cursor_position_report() const
     return status.is_cursor_position_report();
 }
 
+INTERACTIVE void Editor::toggle_stats_report()
+{
+    status.toggle_stats_report();
+}
+
+bool Editor::is_stats_report() const
+{
+    return status.is_stats_report();
+}
+
 // quit() - interactive command to quit the editor. it first makes sure the
 // user don't want to save the changes.
 
@@ -227,11 +260,15 @@ INTERACTIVE void Editor::quit()
 	if (canceled)
 	    return;
 	if (save) {
-	    save_file();
+	    save_buffer(false);
 	    if (wedit.is_modified())
 		return;
 	}
     }
+    if (is_saving())
+	finish_saving();
+    if (is_loading())
+	cancel_loading();
     finished = true; // signal exec()
 }
 
@@ -263,7 +300,7 @@ void Editor::set_scrollbar_pos(scrollbar_pos_t pos)
 	} else {
 	    if (!scrollbar)
 		scrollbar = new Scrollbar();
-	    wedit.sync_scrollbar(scrollbar);
+	    scrollbar->sync_to(wedit);
 	}
 	scrollbar_pos = pos;
 	layout_windows();
@@ -291,9 +328,30 @@ INTERACTIVE void Editor::menu()
 	menubar->exec();
 }
 
-bool Editor::save_file(const char *filename, const char *specified_encoding)
+// save_file() - saves the buffer. When "in_background" is true, and the
+// file isn't a pipe, the buffer is saved by an AsyncSaver and the result
+// is reported by finish_saving(); the return value then only tells
+// whether saving has started.
+
+bool Editor::save_file(const char *filename, const char *specified_encoding,
+		       bool in_background)
 {
+    if (is_loading()) {
+	// we'd save only part of the file.
+	dialog.show_message(_("The file is still loading"));
+	return false;
+    }
+    if (is_saving())
+	finish_saving();
     status.invalidate_view(); // encoding may change, so update the statusline
+    if (in_background && terminal::is_interactive()
+	    && (saver = AsyncSaver::start(&wedit, filename, specified_encoding,
+					  get_backup_suffix()))) {
+	modification_count_at_save = wedit.get_modification_count();
+	dialog.show_message(_("Saving..."));
+	MainLoop::add_task(saving_task, this, LOAD_WAIT_MSECS);
+	return true;
+    }
     unichar offending_char;
     if (!xsave_file(&wedit, filename, specified_encoding,
 		get_backup_suffix(), offending_char)) {
@@ -311,6 +369,48 @@ bool Editor::save_file(const char *filename, const char *specified_encoding)
     }
 }
 
+// finish_saving() - waits for the background saver, if it hasn't finished
+// yet, and reports the result. The buffer is marked as unmodified only if
+// it wasn't modified since the snapshot was taken.
+
+void Editor::finish_saving()
+{
+    unichar offending_char;
+    bool result = saver->finish(offending_char);
+    u8string filename = saver->get_filename();
+    u8string encoding = saver->get_encoding();
+    delete saver;
+    saver = NULL;
+
+    status.invalidate_view();
+    if (!result) {
+	show_file_io_error(_("Saving %s failed: %s"), filename.c_str());
+	if (offending_char)
+	    wedit.move_first_char(offending_char);
+    } else {
+	set_filename(filename.c_str());
+	set_encoding(encoding.c_str());
+	set_new(false);
+	if (wedit.get_modification_count() == modification_count_at_save)
+	    wedit.set_modified(false);
+	dialog.show_message(_("Saved OK"));
+    }
+}
+
+// saving_task() - the main loop's task while saving in the background. The
+// writer thread wakes it up when it's done.
+
+int Editor::saving_task(void *data)
+{
+    Editor *editor = (Editor *)data;
+    if (!editor->is_saving())
+	return TASK_DONE; // somebody has waited for it already.
+    if (!editor->saver->is_done())
+	return LOAD_WAIT_MSECS;
+    editor->finish_saving();
+    return TASK_DONE;
+}
+
 bool Editor::write_selection_to_file(const char *filename,
 				     const char *specified_encoding)
 {
@@ -347,15 +447,53 @@ void Editor::set_encoding(const char *s)
 bool Editor::load_file(const char *filename, const char *specified_encoding)
 {
     bool is_new;
+    bool looks_visual;
     u8string effective_encoding;
 
+    if (is_loading())
+	cancel_loading();
+    if (is_saving())
+	finish_saving();
+
     status.invalidate_view();
     set_filename("");
 
     dialog.show_message(_("Loading..."));
     dialog.immediate_update();
+
+    if (terminal::is_interactive()
+	    && (loader = ProgressiveLoader::start(&wedit, filename,
+				specified_encoding, get_default_encoding(),
+				is_new))) {
+	// Show the first screenful of text (or whatever arrives within
+	// a short while), and let exec() load the rest between keystrokes.
+	// The buffer is read-only till then.
+	for (int i = 0; i < FIRST_SCREEN_WAITS
+		&& wedit.get_number_of_paragraphs() <= wedit.window_height(); i++)
+	    if (!loader->transfer(LOAD_WAIT_MSECS))
+		break;
+	loading_filename = filename;
+	set_filename(filename);
+	if (!is_new)
+	    set_encoding(loader->get_encoding().c_str());
+	else
+	    set_encoding(specified_encoding ? specified_encoding
+					    : get_default_encoding());
+	set_new(is_new);
+	read_only_after_load = wedit.is_read_only();
+	wedit.set_read_only(true);
+	if (scrollbar)
+	    scrollbar->sync_to(wedit);
+	dialog.show_message(_("Loading... (press C-c to cancel)"));
+	continue_loading();
+	if (is_loading())
+	    MainLoop::add_task(loading_task, this);
+	return true;
+    }
+
     if (!xload_file(&wedit, filename, specified_encoding,
-		    get_default_encoding(), effective_encoding, is_new, true)) {
+		    get_default_encoding(), effective_encoding, is_new, true,
+		    &looks_visual)) {
 	if (!effective_encoding.empty())
 	    set_encoding(effective_encoding.c_str());
 	set_new(false);
@@ -363,7 +501,7 @@ bool Editor::load_file(const char *filename, const char *specified_encoding)
 	return false;
     } else {
 	if (scrollbar)
-	    wedit.sync_scrollbar(scrollbar);
+	    scrollbar->sync_to(wedit);
 	set_filename(filename);
 	if (!is_new)
 	    set_encoding(effective_encoding.c_str());
@@ -371,7 +509,7 @@ bool Editor::load_file(const char *filename, const char *specified_encoding)
 	    set_encoding(specified_encoding ? specified_encoding
 					    : get_default_encoding());
 	set_new(is_new);
-	dialog.show_message(_("Loaded OK"));
+	show_loaded_message(looks_visual);
 	if (get_syntax_auto_detection())
 	    detect_syntax();
 	else
@@ -380,10 +518,107 @@ bool Editor::load_file(const char *filename, const char *specified_encoding)
     }
 }
 
+// show_loaded_message() - reports a successful loading. We can't display
+// Hebrew in visual order properly, so we warn when the text seems to be in
+// visual order.
+
+void Editor::show_loaded_message(bool looks_visual)
+{
+    if (looks_visual)
+	dialog.show_message(_("Loaded OK (the text seems to be in visual order)"));
+    else
+	dialog.show_message(_("Loaded OK"));
+}
+
+// continue_loading() - transfers to the buffer the text that the
+// progressive loader has read since the last call. Called by the loading
+// task whenever the user isn't typing.
+
+void Editor::continue_loading()
+{
+    TRACE_SCOPE("continue_loading");
+    if (loader->transfer(0)) {
+	status.invalidate_view(); // the progress indicator
+	if (scrollbar)
+	    scrollbar->sync_to(wedit);
+    } else {
+	finish_loading();
+    }
+}
+
+// loading_task() - the main loop's task while a file loads progressively
+// (see mainloop.h). The reader thread wakes it up when there's new text.
+
+int Editor::loading_task(void *data)
+{
+    Editor *editor = (Editor *)data;
+    if (!editor->is_loading())
+	return TASK_DONE; // cancelled
+    if (!editor->loader->has_pending_data())
+	return LOAD_WAIT_MSECS;
+    editor->continue_loading();
+    editor->speller.wake_background(); // there's new text.
+    return editor->is_loading() ? 0 : TASK_DONE;
+}
+
+// finish_loading() - ends a progressive loading, successful or not. As
+// with load_file(), a failed loading leaves the buffer untitled, so that
+// the partial text isn't saved over the file by mistake.
+
+void Editor::finish_loading()
+{
+    u8string effective_encoding;
+    bool result = loader->finish(effective_encoding);
+    bool looks_visual = loader->looks_visual();
+    delete loader;
+    loader = NULL;
+
+    wedit.set_read_only(read_only_after_load);
+    if (!is_new())
+	set_encoding(effective_encoding.c_str());
+    status.invalidate_view();
+    if (scrollbar)
+	scrollbar->sync_to(wedit);
+
+    if (!result) {
+	set_filename("");
+	set_new(false);
+	show_file_io_error(_("Loading %s failed: %s"),
+			   loading_filename.c_str());
+    } else {
+	show_loaded_message(looks_visual);
+	if (get_syntax_auto_detection())
+	    detect_syntax();
+	else
+	    wedit.set_syn_hlt(EditBox::synhltOff);
+    }
+}
+
+// cancel_loading() - stops a progressive loading. The part of the file
+// that was already loaded stays in the buffer.
+
+void Editor::cancel_loading()
+{
+    loader->cancel();
+    finish_loading();
+}
+
+void Editor::get_load_progress(size_t &bytes_read, size_t &bytes_total) const
+{
+    if (loader)
+	loader->get_progress(bytes_read, bytes_total);
+    else
+	bytes_read = bytes_total = 0;
+}
+
 // insert_file() - insert file at the cursor location.
 
 bool Editor::insert_file(const char *filename, const char *specified_encoding)
 {
+    if (is_loading()) {
+	dialog.show_message(_("The file is still loading"));
+	return false;
+    }
     bool dummy_is_new;
     u8string dummy_effective_encoding;
     status.invalidate_view();
@@ -400,19 +635,34 @@ bool Editor::insert_file(const char *filename, const char *specified_encoding)
 }
 
 INTERACTIVE void Editor::save_file_as()
+{
+    save_buffer_as(true);
+}
+
+INTERACTIVE void Editor::save_file()
+{
+    save_buffer(true);
+}
+
+// save_buffer_as() and save_buffer() implement the commands above.
+// Commands that need the file on the disk right away (quitting, external
+// editing) pass false for "in_background".
+
+void Editor::save_buffer_as(bool in_background)
 {
     u8string qry_filename = get_filename(), qry_encoding;
     if (query_filename(_("Save file as:"), qry_filename, qry_encoding, SAVEAS_HISTORY))
 	save_file(qry_filename.c_str(),
-		    qry_encoding.empty() ? get_encoding() : qry_encoding.c_str());
+		    qry_encoding.empty() ? get_encoding() : qry_encoding.c_str(),
+		    in_background);
 }
 
-INTERACTIVE void Editor::save_file()
+void Editor::save_buffer(bool in_background)
 {
     if (is_untitled())
-	save_file_as();
+	save_buffer_as(in_background);
     else
-	save_file(get_filename(), get_encoding());
+	save_file(get_filename(), get_encoding(), in_background);
 }
 
 // emergency_save() - called by the SIGHUP handler to save the buffer.
@@ -571,9 +821,23 @@ INTERACTIVE void Editor::insert_unicode_char()
 	wedit.insert_char(ch);
 }
 
-void Editor::log2vis(const char *options)
+// log2vis() - converts a file to visual order and writes it to the
+// standard output, a paragraph at a time (see xlog2vis_file()).
+
+bool Editor::log2vis(const char *filename, const char *specified_encoding,
+		     const char *output_encoding, const char *options)
 {
-    wedit.log2vis(options);
+    bool output_failed;
+    if (!xlog2vis_file(&wedit, filename, specified_encoding,
+		       get_default_encoding(), output_encoding, options,
+		       output_failed)) {
+	if (output_failed)
+	    show_file_io_error(_("Saving %s failed: %s"), "-");
+	else
+	    show_file_io_error(_("Loading %s failed: %s"), filename);
+	return false;
+    }
+    return true;
 }
 
 INTERACTIVE void Editor::toggle_arabic_shaping()
@@ -693,12 +957,14 @@ void Editor::external_edit(bool prompt)
 {
     // Step 1: we may first need to save the file.
 
+    if (is_saving())
+	finish_saving();
     if (is_untitled()) {
 	if (dialog.ask_yes_or_no(_("First I must save this buffer as a file; is it OK with you?")))
-	    save_file();
+	    save_buffer(false);
     } else if (wedit.is_modified()) {
 	if (dialog.ask_yes_or_no(_("Buffer was modified and I must save it first; is it OK with you?")))
-	    save_file();
+	    save_buffer(false);
     }
     if (is_untitled() || wedit.is_modified())
 	return;
@@ -782,8 +1048,12 @@ void Editor::external_edit(bool prompt)
     dialog.show_message(msg.c_str());
     update_terminal();
     
+    terminal::set_bracketed_paste(false);
     endwin();
+    TRACE_BEGIN("external_editor");
     int status = system(command.c_str());
+    TRACE_END("external_editor");
+    terminal::set_bracketed_paste(true);
     doupdate();
    
     // Step 6: reload the file.
@@ -867,6 +1137,7 @@ INTERACTIVE void Editor::layout_windows()
 
 void Editor::update_terminal(bool soft)
 {
+    TRACE_SCOPE("update_terminal");
     // for every widget that's dirty, call its update() method to update
     // stdscr. If any was dirty, call doupdate() to update the physical
     // screen.
@@ -883,6 +1154,11 @@ void Editor::update_terminal(bool soft)
 	need_dorefresh = true;
     }
     
+    // the statistics are of the previous update of wedit; we can't
+    // draw the status line after wedit because wedit has the cursor.
+    if (status.is_stats_report() && wedit.is_dirty())
+	status.invalidate_view();
+
     if (status.is_dirty()) {
     	status.update();
 	need_dorefresh = true;
@@ -922,20 +1198,65 @@ void Editor::update_terminal(bool soft)
 void Editor::exec()
 {
     finished = false;
+    double last_update_time = 0;
     while (!finished) {
 	Event evt;
-	update_terminal();
-	get_next_event(evt, wedit.wnd);
+	if (!is_event_ready(curses_window(&wedit))
+		|| perf_now_msecs() - last_update_time >= TYPEAHEAD_MAX_MSECS) {
+	    // when replaying events, we measure the handling of the last
+	    // event and the screen update (see event.cc).
+	    replay_mark_handled();
+	    update_terminal();
+	    replay_mark_updated();
+	    last_update_time = perf_now_msecs();
+	} else {
+	    PERF_COUNT(skipped_updates, 1);
+	}
+	// the background work (loading, saving, spell checking) is done by
+	// the main loop's tasks while the user isn't typing.
+	if (!wait_for_event(evt, curses_window(&wedit)))
+	    continue; // show its progress
+	if (is_loading() && evt == Event(CTRL, 'c')) {
+	    cancel_loading();
+	    continue;
+	}
+	TRACE_SCOPE("handle_event");
+	if (speller.is_background())
+	    speller.wake_background();
 	dialog.clear_transient_message();
-	if (!evt.is_literal())
-	    if (handle_event(evt))
-		continue;
-	wedit.handle_event(evt);
-	if (scrollbar)
-	    wedit.sync_scrollbar(scrollbar);
+	// the loader's threads wrap paragraphs according to the settings
+	// of the EditBox, which the event may change.
+	if (is_loading())
+	    loader->suspend();
+	if (evt.is_literal() || !handle_event(evt)) {
+	    wedit.handle_event(evt);
+	    if (scrollbar)
+		scrollbar->sync_to(wedit);
+	}
+	if (is_loading()) {
+	    loader->resume();
+	    keep_read_only_while_loading();
+	}
     }
 }
 
+// keep_read_only_while_loading() - the buffer is read-only while a file
+// loads progressively. If the user toggles the read-only status meanwhile,
+// the buffer stays read-only, and the user's choice takes effect when the
+// loading ends.
+
+void Editor::keep_read_only_while_loading()
+{
+    if (wedit.is_read_only())
+	return;
+    read_only_after_load = !read_only_after_load;
+    wedit.set_read_only(true);
+    if (read_only_after_load)
+	dialog.show_message(_("The buffer will stay read-only after loading"));
+    else
+	dialog.show_message(_("The buffer will be writable after loading"));
+}
+
 // load_unload_speller() - interactively loads and unloads a speller
 // process. When the user interactively loads a speller, he is asked to
 // specify the speller-command and the speller-encoding.
@@ -1048,6 +1369,20 @@ void Editor::spell_check(Speller::splRng range)
     layout_windows();
 }
 
+// toggle_background_spelling() - interactive command to turn the background
+// spell checker on or off. It loads the speller if it isn't loaded yet.
+
+INTERACTIVE void Editor::toggle_background_spelling()
+{
+    if (!speller.is_background() && !speller.is_loaded()) {
+	speller.load(get_speller_cmd(), get_speller_encoding());
+	status.invalidate_view();
+	if (!speller.is_loaded())
+	    return;
+    }
+    speller.set_background(!speller.is_background(), wedit);
+}
+
 // show_hint() is used to print the popdown menu hints. Screen is updated
 // only after doupdate()
 
@@ -1066,7 +1401,7 @@ void Editor::show_kbd_error(const char *msg)
     // we don't use show_error_message() because we want the
     // message to disappear at the next event.
     dialog.show_message(msg);
-    Widget::signal_error();
+    CursesWidget::signal_error();
 }
 
 void Editor::on_read_only_error(unichar ch)
@@ -25,6 +25,8 @@
 
 class Menubar;
 class Scrollbar;
+class ProgressiveLoader;
+class AsyncSaver;
 
 class Editor : public Dispatcher, public EditBoxErrorListener {
 public:
@@ -54,6 +56,13 @@ protected:
 
     bool      finished;		     // exec() quits when this flag is set.
 
+    ProgressiveLoader *loader;	     // not NULL while a file loads.
+    u8string  loading_filename;
+    bool      read_only_after_load;  // the buffer is read-only meanwhile.
+
+    AsyncSaver *saver;		     // not NULL while saving in the background.
+    unsigned long modification_count_at_save;
+
     static Editor *global_instance;  // for use by the SIGHUP handler.
 
 #ifdef HAVE_CURS_SET
@@ -69,6 +78,14 @@ protected:
 			u8string &qry_encoding, int history_set = 0,
 			InputLine::CompleteType complete = InputLine::cmpltAll);
     void show_kbd_error(const char *msg);
+    void continue_loading();
+    static int loading_task(void *editor);
+    static int saving_task(void *editor);
+    void finish_loading();
+    void keep_read_only_while_loading();
+    void show_loaded_message(bool looks_visual);
+    void save_buffer(bool in_background);
+    void save_buffer_as(bool in_background);
 
 public:
 
@@ -97,6 +114,8 @@ public:
     void set_backup_suffix(const char *s) { backup_suffix = u8string(s); }
     void set_speller_encoding(const char *s) { speller_encoding = u8string(s); }
     void set_speller_cmd(const char *s) { speller_cmd = u8string(s); }
+    void set_speller_broker(int idle_minutes)
+	    { speller.set_broker_idle_minutes(idle_minutes); }
     u8string get_external_editor();
     void set_external_editor(const char *cmd);
     bool is_new() const { return new_flag; }
@@ -104,6 +123,9 @@ public:
     void set_new(bool value) { new_flag = value; }
     bool is_speller_loaded() const { return speller.is_loaded(); }
     bool in_spelling() const { return spellerwnd != NULL; }
+    bool is_loading() const { return loader != NULL; }
+    bool is_saving() const { return saver != NULL; }
+    void get_load_progress(size_t &bytes_read, size_t &bytes_total) const;
     void set_scrollbar_pos(scrollbar_pos_t);
     scrollbar_pos_t get_scrollbar_pos() const { return scrollbar_pos; }
     void adjust_speller_cmd();
@@ -141,7 +163,8 @@ public:
     void set_non_interactive_text_width(int cols)
 	{ wedit.set_non_interactive_text_width(cols); }
     void enable_bidi(bool value) { wedit.enable_bidi(value); }
-    void log2vis(const char *options);
+    bool log2vis(const char *filename, const char *specified_encoding,
+		 const char *output_encoding, const char *options);
     bool get_syntax_auto_detection()
 	{ return syntax_auto_detection; }
     void set_syntax_auto_detection(bool value);
@@ -158,6 +181,8 @@ public:
     INTERACTIVE void describe_key();
     INTERACTIVE void toggle_cursor_position_report();
     bool is_cursor_position_report() const;
+    INTERACTIVE void toggle_stats_report();
+    bool is_stats_report() const;
     INTERACTIVE void quit();
     INTERACTIVE void layout_windows();
     INTERACTIVE void menu();
@@ -187,6 +212,8 @@ public:
     INTERACTIVE void spell_check_forward();
     INTERACTIVE void spell_check_word();
     void spell_check(Speller::splRng range);
+    INTERACTIVE void toggle_background_spelling();
+    bool is_background_spelling() const { return speller.is_background(); }
 #ifdef HAVE_CURS_SET
     INTERACTIVE void toggle_big_cursor();
 #endif
@@ -202,10 +229,13 @@ public:
     void emergency_save();
     void show_file_io_error(const char *msg, const char *filename);
     bool load_file(const char *filename, const char *specified_encoding);
-    bool save_file(const char *filename, const char *specified_encoding);
+    bool save_file(const char *filename, const char *specified_encoding,
+		   bool in_background = false);
+    void finish_saving();
     bool write_selection_to_file(const char *filename,
 				 const char *specified_encoding);
     bool insert_file(const char *raw_filename, const char *encoding);
+    void cancel_loading();
     void search_forward(const unistring &search);
     void refresh(bool soft = false);
     void update_terminal(bool soft = false);
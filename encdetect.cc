@@ -0,0 +1,385 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include <string.h> // strcmp
+
+#include "encdetect.h"
+#include "converters.h"
+#include "univalues.h"
+#include "utf8.h"
+#include "dbg.h"
+
+// Encoding detection
+//
+// guess_encoding() only tells BOMs and UTF-8 apart. When it can't tell,
+// detect_encoding() scores a sample of the file:
+//
+// 1. UTF-16 and UTF-32 without a BOM: the text is mostly ASCII or Hebrew,
+//    so one byte of each UTF-16 unit (and two of each UTF-32 unit) is
+//    almost always 0x00 or 0x05.
+//
+// 2. UTF-8: all the pieces should be valid.
+//
+// 3. 8-bit Hebrew: the bigrams of byte classes tell Hebrew words apart
+//    from accented Latin letters inside ASCII words, and the frequencies
+//    of the letters should look like Hebrew. CP1255 and ISO-8859-8 are
+//    then told apart by the bytes each of them doesn't map, and by the
+//    niqqud and punctuation only CP1255 has. When the two agree on the
+//    text, the user's default encoding wins, if it's one of them.
+//
+// Once we know the encoding, we decode the sample and look at where the
+// final letters are: at the beginning of words, the text is in visual
+// order.
+
+void EncodingSample::add(const char *data, int len)
+{
+    if (nparts < 3 && len > 0) {
+	parts[nparts] = data;
+	lens[nparts] = (len < ENCODING_SAMPLE_PART) ? len : ENCODING_SAMPLE_PART;
+	nparts++;
+    }
+}
+
+// {{{ UTF-16 and UTF-32
+
+// wide_unit_order() - checks whether the sample looks like UTF-16 or UTF-32
+// ("unit" is 2 or 4). Returns 1 for little-endian, -1 for big-endian, and
+// 0 if it doesn't look like it.
+
+static int wide_unit_order(const EncodingSample &sample, int unit)
+{
+    int zeros[4] = { 0, 0, 0, 0 };	// 0x00 or 0x05, by position in unit
+    int total = 0;
+    for (int p = 0; p < sample.nparts; p++) {
+	const unsigned char *s = (const unsigned char *)sample.parts[p];
+	int len = sample.lens[p] & ~3;
+	for (int i = 0; i < len; i++)
+	    if (s[i] == 0x00 || s[i] == 0x05)
+		zeros[i % unit]++;
+	total += len / unit;
+    }
+    if (total < 8)
+	return 0;
+
+    // the high bytes are nearly always 0x00/0x05; the low bytes hardly
+    // ever are.
+#define MOSTLY(n) ((n) * 10 >= total * 9)
+#define RARELY(n) ((n) * 10 <= total)
+    if (unit == 2) {
+	if (MOSTLY(zeros[1]) && RARELY(zeros[0]))
+	    return 1;
+	if (MOSTLY(zeros[0]) && RARELY(zeros[1]))
+	    return -1;
+    } else {
+	if (MOSTLY(zeros[1]) && MOSTLY(zeros[2]) && MOSTLY(zeros[3])
+		&& RARELY(zeros[0]))
+	    return 1;
+	if (MOSTLY(zeros[0]) && MOSTLY(zeros[1]) && MOSTLY(zeros[2])
+		&& RARELY(zeros[3]))
+	    return -1;
+    }
+#undef MOSTLY
+#undef RARELY
+    return 0;
+}
+
+// }}}
+
+// {{{ UTF-8
+
+// skip_continuation() - the pieces following the head may start in the
+// middle of a UTF-8 sequence.
+
+static int skip_continuation(const EncodingSample &sample, int p)
+{
+    int i = 0;
+    if (p > 0)
+	while (i < 3 && i < sample.lens[p]
+		&& (sample.parts[p][i] & 0xC0) == 0x80)
+	    i++;
+    return i;
+}
+
+// sample_is_utf8() - returns true if all the pieces are valid UTF-8 and
+// at least one of them has a multi-byte sequence.
+
+static bool sample_is_utf8(const EncodingSample &sample)
+{
+    bool multibyte = false;
+    for (int p = 0; p < sample.nparts; p++) {
+	int skip = skip_continuation(sample, p);
+	const char *buf = sample.parts[p] + skip;
+	int len = sample.lens[p] - skip;
+	const char *problem;
+	bool illegal;
+	int nchars = utf8_to_unicode_strict(NULL, buf, len, &problem, illegal);
+	if (illegal)
+	    return false;
+	if (nchars < (problem ? problem - buf : len))
+	    multibyte = true;
+    }
+    return multibyte;
+}
+
+// }}}
+
+// {{{ 8-bit Hebrew
+
+// The classes of bytes, for the bigram table.
+
+enum {
+    bcOther,	// ASCII punctuation, digits, whitespace
+    bcLatin,	// ASCII letters
+    bcHebrew,	// 0xE0..0xFA, the Hebrew letters
+    bcPoint,	// 0xC0..0xD2, the niqqud in CP1255
+    bcHigh,	// any other byte with the high bit set
+    bcCount
+};
+
+// How much a pair of adjacent byte classes tells for Hebrew (positive)
+// or against it (negative). Hebrew letters make words of their own;
+// accented Latin letters sit among ASCII letters.
+
+static const int hebrew_bigram_weights[bcCount][bcCount] = {
+    //            Other  Latin  Hebrew Point  High
+    /* Other  */ {  0,     0,     1,     0,     0 },
+    /* Latin  */ {  0,     0,    -3,    -1,    -2 },
+    /* Hebrew */ {  1,    -3,     2,     2,     0 },
+    /* Point  */ {  0,    -1,     2,     1,     0 },
+    /* High   */ {  0,    -2,     0,     0,     0 },
+};
+
+// The frequencies of the Hebrew letters in running text, per mille of
+// the letters, alef to tav (final forms in their Unicode positions).
+
+static const int hebrew_letter_freqs[27] = {
+    63, 47, 13, 26, 87, 105, 9, 23, 12, 110,	// alef .. yod
+    5, 28, 73, 29, 58, 11, 31, 10, 30,		// final kaf .. ayin
+    2, 17, 2, 12, 18, 56, 42, 55,		// final pe .. tav
+};
+
+static inline int byte_class(unsigned char c)
+{
+    if (c < 0x80)
+	return ((c | 0x20) >= 'a' && (c | 0x20) <= 'z') ? bcLatin : bcOther;
+    if (c >= 0xE0 && c <= 0xFA)
+	return bcHebrew;
+    if (c >= 0xC0 && c <= 0xD2 && c != 0xCA)
+	return bcPoint;
+    return bcHigh;
+}
+
+// Bytes that CP1255, and ISO-8859-8, don't map (see converters.cc).
+
+static inline bool unmapped_in_cp1255(unsigned char c)
+{
+    return c == 0x81 || c == 0x8A || (c >= 0x8C && c <= 0x90)
+	    || c == 0x9A || (c >= 0x9C && c <= 0x9F) || c == 0xCA
+	    || (c >= 0xD9 && c <= 0xDF) || c == 0xFB || c == 0xFC
+	    || c == 0xFF;
+}
+
+static inline bool unmapped_in_iso88598(unsigned char c)
+{
+    return c == 0xA1 || (c >= 0xBF && c <= 0xDA) || c == 0xDE || c == 0xFF;
+}
+
+// is_cp1255() - is "encoding" a name of CP1255?
+
+static bool is_cp1255(const char *encoding)
+{
+    u8string name = u8string(encoding).erase_char('-').toupper_ascii();
+    return name == "CP1255" || name == "WINDOWS1255";
+}
+
+// detect_hebrew_8bit() - returns "CP1255" or "ISO-8859-8" if the sample
+// looks like 8-bit Hebrew, or NULL.
+
+static const char *detect_hebrew_8bit(const EncodingSample &sample,
+				      const char *default_encoding)
+{
+    int score = 0;
+    int letters[27] = { 0 };
+    int nletters = 0, nhigh = 0;
+    int cp1255_only = 0;	// niqqud, and punctuation in 0x80..0x9F
+    int bad_cp1255 = 0, bad_iso88598 = 0;
+
+    for (int p = 0; p < sample.nparts; p++) {
+	const unsigned char *s = (const unsigned char *)sample.parts[p];
+	int len = sample.lens[p];
+	int prev = bcOther;
+	for (int i = 0; i < len; i++) {
+	    unsigned char c = s[i];
+	    int cls = byte_class(c);
+	    score += hebrew_bigram_weights[prev][cls];
+	    prev = cls;
+	    if (c < 0x80)
+		continue;
+	    nhigh++;
+	    if (cls == bcHebrew) {
+		letters[c - 0xE0]++;
+		nletters++;
+	    }
+	    if (unmapped_in_cp1255(c))
+		bad_cp1255++;
+	    else if (c < 0xA0 || cls == bcPoint)
+		cp1255_only++;
+	    if (unmapped_in_iso88598(c))
+		bad_iso88598++;
+	}
+    }
+
+    if (nhigh == 0 || score <= 0 || nletters * 2 < nhigh)
+	return NULL;
+
+    // how much of the letter distribution overlaps Hebrew's.
+    int overlap = 0;
+    for (int i = 0; i < 27; i++) {
+	int freq = letters[i] * 974 / nletters;
+	overlap += (freq < hebrew_letter_freqs[i]) ? freq
+						   : hebrew_letter_freqs[i];
+    }
+    DBG(1, ("8-bit Hebrew: bigram score %d, letter overlap %d/974\n",
+	    score, overlap));
+    if (overlap * 2 < 974)
+	return NULL;
+
+    if (bad_cp1255 == 0 && (cp1255_only > 0 || bad_iso88598 > 0))
+	return "CP1255";
+    if (bad_cp1255 == 0 && default_encoding && is_cp1255(default_encoding))
+	return "CP1255"; // the two agree on the text; the user prefers it.
+    if (bad_iso88598 == 0)
+	return "ISO-8859-8"; // when the two agree on the text, too: it
+			     // has the bidi codes (e.g. for log2vis' "bdo").
+    return NULL;
+}
+
+// }}}
+
+// {{{ Visual order
+
+#define IS_HEB_LETTER(ch)  ((ch) >= UNI_HEB_ALEF && (ch) <= UNI_HEB_TAV)
+#define IS_HEB_POINT(ch)   ((ch) >= UNI_HEB_ETNAHTA && (ch) <= UNI_HEB_UPPER_DOT \
+			    && (ch) != UNI_HEB_MAQAF && (ch) != UNI_HEB_PASEQ \
+			    && (ch) != UNI_HEB_SOF_PASUQ)
+
+// is_final_form() returns 1 for final letters, -1 for the letters that
+// have a final form, and 0 for the rest.
+
+static inline int is_final_form(unichar ch)
+{
+    switch (ch) {
+    case 0x05DA: case 0x05DD: case 0x05DF: case 0x05E3: case 0x05E5:
+	return 1;
+    case 0x05DB: case 0x05DE: case 0x05E0: case 0x05E4: case 0x05E6:
+	return -1;
+    }
+    return 0;
+}
+
+// score_word_ends() - adds up the evidence for logical and visual order
+// in the Hebrew words of the text. A final letter at the end of a word,
+// or a non-final one at its beginning, is what logical order looks like;
+// the reverse is what visual order looks like.
+
+static void score_word_ends(const unichar *text, int len,
+			    int &logical, int &visual)
+{
+    int i = 0;
+    while (i < len) {
+	if (!IS_HEB_LETTER(text[i])) {
+	    i++;
+	    continue;
+	}
+	unichar first = text[i], last = first;
+	int nletters = 0;
+	while (i < len && (IS_HEB_LETTER(text[i]) || IS_HEB_POINT(text[i]))) {
+	    if (IS_HEB_LETTER(text[i])) {
+		last = text[i];
+		nletters++;
+	    }
+	    i++;
+	}
+	if (nletters < 2)
+	    continue;
+	switch (is_final_form(first)) {
+	case 1:  visual++;  break;
+	case -1: logical++; break;
+	}
+	switch (is_final_form(last)) {
+	case 1:  logical++; break;
+	case -1: visual++;  break;
+	}
+    }
+}
+
+static bool sample_looks_visual(const EncodingSample &sample,
+				const char *encoding)
+{
+    unichar buf[ENCODING_SAMPLE_PART];
+    int logical = 0, visual = 0;
+    for (int p = 0; p < sample.nparts; p++) {
+	Converter *conv = ConverterFactory::get_converter_from(encoding);
+	if (!conv)
+	    return false;
+	int skip = skip_continuation(sample, p);
+	char *src = const_cast<char *>(sample.parts[p]) + skip;
+	unichar *dest = buf;
+	// an error only stops the decoding; we score what we've got.
+	conv->convert(&dest, &src, sample.lens[p] - skip);
+	delete conv;
+	score_word_ends(buf, dest - buf, logical, visual);
+    }
+    DBG(1, ("word ends: %d logical, %d visual\n", logical, visual));
+    return visual >= 8 && visual > logical * 3;
+}
+
+// }}}
+
+// detect_encoding() - guesses the encoding of a sample of a file. Returns
+// NULL when there's no telling. "default_encoding" (may be NULL) is the
+// user's choice, which wins a tie. "looks_visual" tells whether the text
+// seems to be Hebrew in visual order.
+
+const char *detect_encoding(const EncodingSample &sample,
+			    const char *default_encoding, bool &looks_visual)
+{
+    looks_visual = false;
+    if (sample.nparts == 0)
+	return NULL;
+
+    const char *encoding = guess_encoding(sample.parts[0], sample.lens[0]);
+    if (encoding && strcmp(encoding, "UTF-8") != 0)
+	return encoding; // UTF-16 or UTF-32, with a BOM.
+
+    int order;
+    if ((order = wide_unit_order(sample, 4)) != 0)
+	encoding = (order > 0) ? "UTF-32LE" : "UTF-32BE";
+    else if ((order = wide_unit_order(sample, 2)) != 0)
+	encoding = (order > 0) ? "UTF-16LE" : "UTF-16BE";
+    else if (sample_is_utf8(sample))
+	encoding = "UTF-8";
+    else
+	encoding = detect_hebrew_8bit(sample, default_encoding);
+
+    DBG(1, ("detected encoding: %s\n", encoding ? encoding : "(none)"));
+    if (encoding)
+	looks_visual = sample_looks_visual(sample, encoding);
+    return encoding;
+}
+
@@ -0,0 +1,42 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_ENCDETECT_H
+#define BDE_ENCDETECT_H
+
+// The size of each of the pieces of a file that detect_encoding() looks
+// at. However big the file is, we look at no more than three pieces.
+
+#define ENCODING_SAMPLE_PART 8192
+
+// EncodingSample points at pieces of a file: its head, and, for big
+// files, pieces of its middle and its tail. The pieces following the
+// head start at a multiple of 4 bytes.
+
+struct EncodingSample {
+    const char *parts[3];
+    int lens[3];
+    int nparts;
+
+    EncodingSample() { nparts = 0; }
+    void add(const char *data, int len);
+};
+
+const char *detect_encoding(const EncodingSample &sample,
+			    const char *default_encoding, bool &looks_visual);
+
+#endif
+
@@ -16,7 +16,16 @@
 
 #include <config.h>
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h> // STDIN_FILENO
+
+#include <vector>
+#include <algorithm>
+
 #include "event.h"
+#include "mainloop.h"
 #include "my_wctob.h"
 #include "dbg.h"
 
@@ -101,8 +110,11 @@ void Event::print()
     }
 }
 
+// low_level_get_wch() - reads a key. When "retry" is false and the window
+// is in no-delay mode (see wtimeout()), it may give up and return false.
+
 #ifdef HAVE_WIDE_CURSES
-static void low_level_get_wch(Event &evt, WINDOW *wnd)
+static bool low_level_get_wch(Event &evt, WINDOW *wnd, bool retry = true)
 {
     wint_t c;
     int ret;
@@ -115,14 +127,17 @@ static void low_level_get_wch(Event &evt, WINDOW *wnd)
 	    evt.keycode = 0;
 	    evt.ch = (unichar)c;
 	}
-    } while (ret == ERR);
+    } while (ret == ERR && retry);
+    return ret != ERR;
 }
 #else
-static void low_level_get_wch(Event &evt, WINDOW *wnd)
+static bool low_level_get_wch(Event &evt, WINDOW *wnd, bool retry = true)
 {
     int ret;
     do {
 	ret = wgetch(wnd);
+	if (ret == ERR)
+	    continue;
 	if (ret >= 256) {
 	    evt.ch = 0;
 	    evt.keycode = ret;
@@ -130,15 +145,17 @@ static void low_level_get_wch(Event &evt, WINDOW *wnd)
 	    evt.keycode = 0;
 	    evt.ch = terminal::force_iso88598 ? iso88598_to_unicode(ret) : BTOWC(ret);
 	}
-    } while (ret == ERR);
+    } while (ret == ERR && retry);
+    return ret != ERR;
 }
 #endif
 
-static void get_base_event(Event &evt, WINDOW *wnd)
+static bool get_base_event(Event &evt, WINDOW *wnd, bool retry = true)
 {
     evt.type = evtKbd;
     evt.modifiers = 0;
-    low_level_get_wch(evt, wnd);
+    if (!low_level_get_wch(evt, wnd, retry))
+	return false;
     if (evt.keycode == 0 && evt.ch < 32) {
 	switch (evt.ch) {
 	case 9:
@@ -159,8 +176,238 @@ static void get_base_event(Event &evt, WINDOW *wnd)
 	    evt.modifiers = CTRL;
 	}
     }
+    return true;
+}
+
+// Recording and replaying {{{
+//
+// With --record-events every event read from the terminal is logged to a
+// file, one per line:
+//
+//   <msecs> k <type> <modifiers> <ch> <keycode>
+//
+// <msecs> is the time since the recording started. When the main loop
+// does some background work (e.g. loading) instead of returning a key (see
+// wait_for_event()), we log an idle line, "<msecs> i", and the replay does
+// a round of that work there. Lines starting with '#' are
+// comments.
+//
+// With --replay-events the events are read from such a log instead of the
+// terminal, as fast as the editor takes them (so the timestamps are only
+// for reference). We measure how long each event takes to handle, and then
+// to update the screen; when the log runs out we print the p50, p99 and max
+// of both and exit.
+
+static FILE *record_file = NULL;
+static FILE *replay_file = NULL;
+static double log_start_time;
+
+static bool reading_paste = false; // see read_paste()
+static bool log_ended = false;
+
+static double event_time;	// when the event being handled was read
+static double handled_time;	// when it was handled
+static bool in_event = false;
+static bool in_update = false;
+static std::vector<double> handle_latencies; // msecs
+static std::vector<double> update_latencies;
+static int replayed_count = 0;
+
+static double now_msecs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+bool record_events(const char *filename)
+{
+    if (!(record_file = fopen(filename, "w")))
+	return false;
+    log_start_time = now_msecs();
+    fprintf(record_file, "# geresh event log: "
+			 "msecs k type modifiers ch keycode | msecs i\n");
+    fflush(record_file);
+    return true;
+}
+
+static void log_event(const Event *evt)
+{
+    if (!record_file)
+	return;
+    double msecs = now_msecs() - log_start_time;
+    if (evt)
+	fprintf(record_file, "%.3f k %d %d %lu %d\n", msecs, (int)evt->type,
+		evt->modifiers, (unsigned long)evt->ch, evt->keycode);
+    else
+	fprintf(record_file, "%.3f i\n", msecs);
+    // the log should survive a crash; that's when it's most useful.
+    fflush(record_file);
+}
+
+bool replay_events(const char *filename)
+{
+    if (!(replay_file = fopen(filename, "r")))
+	return false;
+    return true;
+}
+
+bool is_replaying_events()
+{
+    return replay_file != NULL;
+}
+
+static void print_latencies(const char *name, std::vector<double> &latencies)
+{
+    double p50 = 0, p99 = 0, max = 0;
+    if (!latencies.empty()) {
+	std::sort(latencies.begin(), latencies.end());
+	size_t n = latencies.size();
+	p50 = latencies[n / 2];
+	p99 = latencies[std::min(n - 1, n * 99 / 100)];
+	max = latencies[n - 1];
+    }
+    printf("{\"name\": \"%s\", \"events\": %d, \"p50_ms\": %.3f, "
+	   "\"p99_ms\": %.3f, \"max_ms\": %.3f}\n", name,
+	   (int)latencies.size(), p50, p99, max);
+}
+
+// end_event_replay() - prints the latencies and exits. It's called when
+// the log runs out, or when the editor quits before that.
+
+void end_event_replay()
+{
+    terminal::finish();
+    printf("{\"name\": \"replay\", \"events\": %d}\n", replayed_count);
+    print_latencies("replay/handle", handle_latencies);
+    print_latencies("replay/update", update_latencies);
+    exit(0);
+}
+
+// read_logged_event() - reads the next line of the log. Returns false if
+// it's an idle line. When the log runs out, the replay ends; but in the
+// middle of a paste (a truncated log) we only set "log_ended" and return
+// false, so that the paste is handled, and measured, first. The replay
+// then ends at the next read.
+
+static bool read_logged_event(Event &evt)
+{
+    char line[256];
+    while (fgets(line, sizeof(line), replay_file)) {
+	double msecs;
+	char kind;
+	int type, modifiers, keycode;
+	unsigned long ch;
+	if (line[0] == '#' || sscanf(line, "%lf %c", &msecs, &kind) != 2)
+	    continue;
+	if (kind == 'i')
+	    return false;
+	if (sscanf(line, "%lf k %d %d %lu %d", &msecs, &type, &modifiers,
+		   &ch, &keycode) != 5)
+	    continue;
+	evt.type = (EventType)type;
+	evt.modifiers = modifiers;
+	evt.ch = (unichar)ch;
+	evt.keycode = keycode;
+	replayed_count++;
+	// an event read while handling another one (e.g. an answer to a
+	// dialog) is counted as part of that one.
+	if (!in_event) {
+	    event_time = now_msecs();
+	    in_event = true;
+	}
+	return true;
+    }
+    if (reading_paste) {
+	log_ended = true;
+	return false;
+    }
+    end_event_replay();
+    return false;
+}
+
+// replay_mark_handled() - Editor::exec() calls this when it has handled an
+// event, before it updates the screen, and replay_mark_updated() after.
+
+void replay_mark_handled()
+{
+    if (!replay_file || !in_event)
+	return;
+    handled_time = now_msecs();
+    handle_latencies.push_back(handled_time - event_time);
+    in_event = false;
+    in_update = true;
+}
+
+void replay_mark_updated()
+{
+    if (!replay_file || !in_update)
+	return;
+    update_latencies.push_back(now_msecs() - handled_time);
+    in_update = false;
+}
+
+// }}}
+
+// Bracketed paste {{{
+//
+// A terminal in "bracketed paste" mode (see terminal::init()) puts pasted
+// text between two sequences, which curses returns as KEY_PASTE_BEGIN and
+// KEY_PASTE_END. read_paste() collects what's between them into a single
+// evtPaste event, and EditBox inserts the text at one go, instead of having
+// each character "typed", with its auto-indentation, justification, undo
+// record and screen update.
+//
+// The pasted characters are recorded as ordinary keys, so a replayed paste
+// is collected here too.
+//
+// A terminal may drop the end sequence. So as not to wait for it forever,
+// we end the paste when no key comes for PASTE_TIMEOUT_MSECS, and record
+// a KEY_PASTE_END there, so that the replay ends it at the same place.
+
+#define PASTE_TIMEOUT_MSECS 1000
+
+static unistring pasted_text;
+
+static void read_paste(Event &evt, WINDOW *wnd)
+{
+    pasted_text.clear();
+    if (!replay_file)
+	wtimeout(wnd, PASTE_TIMEOUT_MSECS);
+    reading_paste = true;
+    while (1) {
+	if (replay_file) {
+	    if (!read_logged_event(evt)) {
+		if (log_ended)
+		    break;
+		continue;
+	    }
+	} else {
+	    evt.type = evtKbd;
+	    evt.modifiers = 0;
+	    if (!low_level_get_wch(evt, wnd, false)) {
+		evt.ch = 0;
+		evt.keycode = KEY_PASTE_END;
+	    }
+	    log_event(&evt);
+	}
+	if (evt.keycode == KEY_PASTE_END)
+	    break;
+	if (evt.ch)
+	    pasted_text.push_back(evt.ch);
+    }
+    reading_paste = false;
+    if (!replay_file)
+	wtimeout(wnd, -1);
+    evt.type = evtPaste;
+    evt.modifiers = 0;
+    evt.ch = 0;
+    evt.keycode = 0;
+    evt.text = &pasted_text;
 }
 
+// }}}
+
 bool is_event_pending = false;
 Event pending_event;
 
@@ -172,6 +419,14 @@ void get_next_event(Event &evt, WINDOW *wnd)
 	return;
     }
 
+    if (replay_file) {
+	while (!read_logged_event(evt))
+	    ; // nothing to do while idle
+	if (evt.keycode == KEY_PASTE_BEGIN)
+	    read_paste(evt, wnd);
+	return;
+    }
+
     get_base_event(evt, wnd);
     if (evt.ch == 27) {
 	// emulate ALT
@@ -179,6 +434,41 @@ void get_next_event(Event &evt, WINDOW *wnd)
 	if (evt.ch != 27) // ...but make sure we can still generate ESCape
 	    evt.modifiers |= ALT;
     }
+    log_event(&evt);
+    if (evt.keycode == KEY_PASTE_BEGIN)
+	read_paste(evt, wnd);
+}
+
+// wait_for_event() - reads an event, and meanwhile runs the background
+// work of the main loop (see mainloop.h). It returns false, without an
+// event, whenever it has done some of that work, so that the caller can
+// update the screen.
+
+bool wait_for_event(Event &evt, WINDOW *wnd)
+{
+    if (is_event_pending) {
+	evt = pending_event;
+	is_event_pending = false;
+	return true;
+    }
+
+    if (replay_file) {
+	if (read_logged_event(evt)) {
+	    if (evt.keycode == KEY_PASTE_BEGIN)
+		read_paste(evt, wnd);
+	    return true;
+	}
+	MainLoop::iterate(-1); // an idle line: the work was done here.
+	return false;
+    }
+
+    // curses may already hold keys it has read, which poll() won't see.
+    if (is_event_ready(wnd) || MainLoop::iterate(STDIN_FILENO)) {
+	get_next_event(evt, wnd);
+	return true;
+    }
+    log_event(NULL);
+    return false;
 }
 
 void set_next_event(const Event &evt)
@@ -187,3 +477,37 @@ void set_next_event(const Event &evt)
     pending_event = evt;
 }
 
+// is_event_ready() - is there an event that get_next_event() would return
+// without waiting? (E.g. the rest of a paste, or a repeating key.) We read
+// it ahead, as curses may already hold it in its own buffer, and keep it
+// for get_next_event().
+//
+// When replaying events, every event is ready, but we say none is so that
+// each is measured with its screen update.
+
+bool is_event_ready(WINDOW *wnd)
+{
+    if (is_event_pending)
+	return true;
+    if (replay_file)
+	return false;
+
+    Event evt;
+    wtimeout(wnd, 0);
+    bool got_key = get_base_event(evt, wnd, false);
+    wtimeout(wnd, -1);
+    if (!got_key)
+	return false;
+    if (evt.ch == 27) {
+	// emulate ALT
+	get_base_event(evt, wnd);
+	if (evt.ch != 27)
+	    evt.modifiers |= ALT;
+    }
+    log_event(&evt);
+    if (evt.keycode == KEY_PASTE_BEGIN)
+	read_paste(evt, wnd);
+    set_next_event(evt);
+    return true;
+}
+
@@ -29,7 +29,7 @@
 #define ALT	4
 #define VIRTUAL 8
 
-enum EventType { evtKbd, evtMouse };
+enum EventType { evtKbd, evtMouse, evtPaste };
 
 class Event {
 public:
@@ -39,6 +39,7 @@ public:
     int modifiers;
     unichar ch; 
     int keycode;
+    const unistring *text; // the pasted text, of an evtPaste.
 
     bool operator== (const Event &other) const
     {
@@ -48,6 +49,18 @@ public:
 		keycode == other.keycode;
     }
 
+    // for using events as std::map keys.
+    bool operator< (const Event &other) const
+    {
+	if (type != other.type)
+	    return type < other.type;
+	if (modifiers != other.modifiers)
+	    return modifiers < other.modifiers;
+	if (ch != other.ch)
+	    return ch < other.ch;
+	return keycode < other.keycode;
+    }
+
     Event() { }
 
     Event(int modifiers, unichar ch, int keycode = 0)
@@ -82,7 +95,17 @@ public:
 };
 
 void get_next_event(Event &evt, WINDOW *wnd);
+bool wait_for_event(Event &evt, WINDOW *wnd);
 void set_next_event(const Event &evt);
+bool is_event_ready(WINDOW *wnd);
+
+// Recording and replaying events, see event.cc.
+bool record_events(const char *filename);
+bool replay_events(const char *filename);
+bool is_replaying_events();
+void end_event_replay();
+void replay_mark_handled();
+void replay_mark_updated();
 
 #endif
 
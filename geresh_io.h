@@ -17,9 +17,17 @@
 #ifndef BDE_IO_H
 #define BDE_IO_H
 
+#include <vector>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#include <sys/types.h>
+
 #include "types.h"
 
 class EditBox;
+class Paragraph;
 
 bool xload_file(EditBox *editbox,
 		const char *filename,
@@ -27,7 +35,8 @@ bool xload_file(EditBox *editbox,
 		const char *default_encoding,
 		u8string &effective_encoding,
 		bool &is_new,
-		bool new_document);
+		bool new_document,
+		bool *looks_visual = NULL);
 
 bool xsave_file(EditBox *editbox,
 		const char *filename,
@@ -36,9 +45,136 @@ bool xsave_file(EditBox *editbox,
 		unichar &offending_char,
 		bool selection_only = false);
 
+bool xlog2vis_file(EditBox *editbox,
+		   const char *filename,
+		   const char *specified_encoding,
+		   const char *default_encoding,
+		   const char *output_encoding,
+		   const char *options,
+		   bool &output_failed);
+
+// ProgressiveLoader loads a big file, or the output of a command, into a
+// new document without blocking the user interface: other threads read,
+// decode, split into paragraphs and wrap the input, and the main thread
+// calls transfer(), between keystrokes, to append whatever is ready to the
+// EditBox. A big file in an encoding that allows it is split into chunks
+// that are decoded in parallel, as xload_file() does (see io.cc).
+//
+// The threads wrap paragraphs according to the EditBox's settings, so the
+// main thread has to suspend() them before it changes these settings.
+//
+// start() returns NULL when the input isn't worth (or can't be) loaded
+// progressively; xload_file() should be used then.
+
+class ProgressiveLoader {
+
+    struct Batch;
+    struct Chunk;
+
+    EditBox *editbox;
+    int fd;
+    pid_t child_pid;		// when loading the output of a command
+    size_t total_size;		// 0 when unknown
+    u8string specified_encoding;
+    u8string default_encoding;
+    const char *map;		// the mapped file, when loading in parallel
+
+#ifdef HAVE_PTHREAD
+    // The following are shared with the threads and guarded by "lock".
+    // "cond" is signalled whenever any of them changes.
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    std::vector<Chunk *> chunks; // the input, in order; one per thread
+    size_t current;		// the chunk transfer() takes batches from
+    size_t nread;		// bytes decoded so far
+    u8string encoding;		// the effective encoding
+    bool cancelled;
+    bool suspended;		// the threads may not wrap paragraphs
+    int active;			// threads that are wrapping paragraphs
+    Chunk *failed;		// the chunk whose reading or conversion failed
+    bool visual;		// the text seems to be in visual order
+
+    // The following are used by the main thread only.
+    bool finished;
+    double start_time;		// for the load statistics
+
+    ProgressiveLoader(EditBox *aEditbox, const char *aSpecified_encoding,
+		      const char *aDefault_encoding);
+    bool open(const char *filename, bool &is_new);
+    void plan_parallel_load();
+    bool start_threads();
+    void join_threads();
+    void close_input();
+    static void *reader_thread(void *arg);
+    static void *chunk_thread(void *arg);
+    void read_input(Chunk &chunk);
+    void decode_chunk(Chunk &chunk);
+    bool build(Chunk &chunk, const unichar *data, int len, bool at_end);
+    bool publish(Chunk &chunk, size_t bytes, bool at_end);
+    bool has_ready_batch();
+
+public:
+
+    static ProgressiveLoader *start(EditBox *editbox,
+				    const char *filename,
+				    const char *specified_encoding,
+				    const char *default_encoding,
+				    bool &is_new);
+    ~ProgressiveLoader();
+
+    bool transfer(int msecs);
+    bool has_pending_data();
+    void suspend();
+    void resume();
+    void cancel();
+    bool finish(u8string &effective_encoding);
+    u8string get_encoding();
+    bool looks_visual();
+    void get_progress(size_t &bytes_read, size_t &bytes_total);
+};
+
+// AsyncSaver saves a snapshot of an EditBox buffer to a file on a thread
+// of its own, so that the user can go on editing. The writing is done as
+// by xsave_file(), but the file is fsync()'ed before it's renamed over
+// the original.
+
+class SnapshotSource;
+
+class AsyncSaver {
+
+    SnapshotSource *snapshot;
+    u8string filename;
+    u8string encoding;
+    u8string backup_suffix;
+
+#ifdef HAVE_PTHREAD
+    pthread_t writer;
+    pthread_mutex_t lock;	// guards the following
+#endif
+    bool done;
+    bool result;
+    u8string error;
+    unichar offending_char;
+
+    static void *writer_thread(void *arg);
+
+public:
+
+    static AsyncSaver *start(EditBox *editbox,
+			     const char *filename,
+			     const char *encoding,
+			     const char *backup_suffix);
+    bool is_done();
+    bool finish(unichar &offending_char);
+    const char *get_filename() const { return filename.c_str(); }
+    const char *get_encoding() const { return encoding.c_str(); }
+};
+
 void set_last_error(const char *fmt, ...);
 void set_last_error(int err);
 const char *get_last_error();
+void set_command_hook(void (*hook)());
 
 bool has_prog(const char *progname);
 void expand_tilde(u8string &filename);
@@ -21,6 +21,7 @@
 #include "geresh_io.h"
 #include "pathnames.h"
 #include "themes.h"
+#include "curses_widget.h"
 
 std::vector<HelpBox::Position> HelpBox::positions_stack;
 
@@ -130,7 +131,7 @@ void HelpBox::exec()
 	statusmsg.update();
 	update();
 	doupdate();
-	get_next_event(evt, wnd);
+	get_next_event(evt, curses_window(this));
 	handle_event(evt);
     }
     push_position();
@@ -42,6 +42,7 @@
 #include "inputline.h"
 #include "geresh_io.h" // expand_tilde
 #include "themes.h"
+#include "curses_widget.h"
 #include "dbg.h"
 
 // A history is stored as a StringArray. There are usually several histories
@@ -139,12 +140,12 @@ void InputLine::redraw_paragraph(Paragraph &p,
     if (!only_cursor) {
 	// draw label
 	if (label_dir == dirRTL) {
-	    wmove(wnd, 0, window_width()
+	    canvas->move_to(0, window_width()
 			    - (p.is_rtl() ? margin_before : margin_after)
 			    + 1);
 	    draw_unistr(vis_label.begin(), vis_label.size());
 	} else {
-	    wmove(wnd, 0, 1);
+	    canvas->move_to(0, 1);
 	    draw_unistr(vis_label.begin(), vis_label.size());
 	}
 	// reposition the cursor
@@ -163,7 +164,7 @@ void InputLine::get_directory_files(u8string directory, const char *prefix)
 
     DIR *dir = opendir(directory.c_str());
     if (dir == NULL) {
-	signal_error();
+	CursesWidget::signal_error();
 	return;
     }
 
@@ -277,12 +278,12 @@ void InputLine::complete(bool forward)
 	// is 0. This means that we browse through _all_ the files in
 	// the directory.
 	if (prefix_len == 0)
-	   signal_error();
+	   CursesWidget::signal_error();
     }
 
     if (slice_begin == -1) {
 	// no filenames begin with the partial filename component.
-	signal_error();
+	CursesWidget::signal_error();
 	return;
     }
 
@@ -327,11 +328,24 @@ INTERACTIVE void InputLine::next_completion()
 	complete(true);
 }
 
+// insert_pasted_text() - an input line has a single paragraph, so the line
+// ends of pasted text become spaces.
+
+void InputLine::insert_pasted_text(const unistring &text)
+{
+    unistring str = text;
+    for (idx_t i = 0; i < str.len(); i++)
+	if (str[i] == '\r' || str[i] == '\n')
+	    str[i] = ' ';
+    insert_text(str);
+}
+
 bool InputLine::handle_event(const Event &evt)
 {
     // Emulate contemporary GUIs, where the input is
     // cleared on first letter typed.
-    if (event_num == 0 && evt.is_literal() && evt.ch != 13) {
+    if (event_num == 0 && ((evt.is_literal() && evt.ch != 13)
+			    || evt.type == evtPaste)) {
 	// we don't use new_document() because we want to
 	// be able to undo this operation.
 	delete_paragraph();
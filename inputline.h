@@ -140,6 +140,7 @@ public:
     virtual void redraw_paragraph(Paragraph &p,
 			    int window_start_line, bool only_cursor, int);
     
+    virtual void insert_pasted_text(const unistring &text);
     virtual bool handle_event(const Event &evt);
 };
 
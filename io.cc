@@ -24,18 +24,34 @@
 #include <errno.h>
 #include <string.h> // strerror
 #include <pwd.h>    // getpwuid
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+#if defined(HAVE_PTHREAD) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# include <pthread.h>
+#endif
 
 #include <map>
+#include <deque>
+#include <vector>
 
 #include "geresh_io.h"
 #include "editbox.h"
 #include "converters.h"
+#include "encdetect.h"
 #include "dbg.h"
-#include "speller.h" // for UNLOAD_SPELLER(), see TODO
+#include "stats.h"
+#include "trace.h"
+#include "mainloop.h"
+#include "univalues.h"
 
 #define CONVBUFSIZ 8192
 
-static u8string err_msg; 
+// each thread has its own last error, like errno: the background saver
+// reports errors through set_last_error() too.
+static thread_local u8string err_msg;
 
 void set_last_error(const char *fmt, ...)
 {
@@ -53,11 +69,58 @@ const char *get_last_error() {
     return err_msg.c_str();
 }
 
+static void (*command_hook)() = NULL;
+
+// set_command_hook() - sets a function to call before we run a command to
+// read from or write to. The speller uses it to unload itself (see TODO).
+
+void set_command_hook(void (*hook)())
+{
+    command_hook = hook;
+}
+
+static void before_command()
+{
+    if (command_hook)
+	command_hook();
+}
+
+// guess_file_encoding() - guesses the encoding of the file "fd", whose
+// first "len" bytes are at "head". Of a big regular file we look at pieces
+// of the middle and the tail as well; they're read with pread(), which
+// doesn't move the file offset. "default_encoding" wins a tie (see
+// detect_encoding()).
+
+static const char *guess_file_encoding(int fd, const char *head, int len,
+				       const char *default_encoding,
+				       bool &looks_visual)
+{
+    char buf[2 * ENCODING_SAMPLE_PART];
+    EncodingSample sample;
+    sample.add(head, len);
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+	    && st.st_size > 3 * ENCODING_SAMPLE_PART) {
+	off_t offsets[2] = { st.st_size / 2,
+			     st.st_size - ENCODING_SAMPLE_PART };
+	for (int i = 0; i < 2; i++) {
+	    char *piece = buf + i * ENCODING_SAMPLE_PART;
+	    ssize_t nread = pread(fd, piece, ENCODING_SAMPLE_PART,
+				  offsets[i] & ~(off_t)3);
+	    if (nread > 0)
+		sample.add(piece, (int)nread);
+	}
+    }
+    return detect_encoding(sample, default_encoding, looks_visual);
+}
+
 static bool xload_file(EditBox *editbox,
 		       int fd,
 		       const char *specified_encoding, 
 		       const char *default_encoding,
-		       u8string &effective_encoding)
+		       u8string &effective_encoding,
+		       bool &looks_visual)
 {
     unichar outbuf[CONVBUFSIZ+1];
     char inbuf[CONVBUFSIZ];
@@ -94,7 +157,9 @@ static bool xload_file(EditBox *editbox,
 	// instantiate a Converter object
 	if (!conv) {
 	    if (!specified_encoding || !*specified_encoding) {
-		const char *guess = guess_encoding(inbuf, insize);
+		const char *guess = guess_file_encoding(fd, inbuf, insize,
+							default_encoding,
+							looks_visual);
 		if (guess)
 		    encoding = guess;
 		else
@@ -139,7 +204,9 @@ static bool xload_file(EditBox *editbox,
 	} else {
 	    insize = 0;
 	}
-	buf_file_offset += nread;
+	// "buf_file_offset" is the file offset of inbuf[0], so bytes left
+	// over from an incomplete sequence are not counted twice.
+	buf_file_offset += inptr - inbuf;
     }
 
     if (conv)
@@ -148,6 +215,269 @@ static bool xload_file(EditBox *editbox,
     return result;
 }
 
+#if defined(HAVE_PTHREAD) && defined(HAVE_MMAP)
+
+// Parallel loading
+//
+// A big file is mapped into memory and split into chunks, one for each
+// processor. The chunks end right after a LF, so that no character, and no
+// CR+LF pair, straddles two chunks. Each chunk is decoded and split into
+// paragraphs on its own thread (see EditBox::build_paragraphs()), and
+// then the paragraph lists are handed over to EditBox in order.
+//
+// This is only possible for encodings that have no state and in which
+// we can spot LF without decoding the text.
+
+#define PARALLEL_MIN_CHUNK  (1024*1024)
+#define PARALLEL_MAX_CHUNKS 32
+
+struct parallel_encoding_t {
+    const char *name;	// upper-case, no dashes.
+    int unit;		// the size of a code unit, in bytes.
+    bool big_endian;
+};
+
+static const parallel_encoding_t parallel_encodings[] = {
+    { "UTF8",	     1, false },
+    { "ISO88598",    1, false },
+    { "ISO88591",    1, false },
+    { "CP1255",	     1, false },
+    { "WINDOWS1255", 1, false },
+    { "ASCII",	     1, false },
+    { "USASCII",     1, false },
+    { "UTF16LE",     2, false },
+    { "UTF16BE",     2, true  },
+    { "UTF32LE",     4, false },
+    { "UTF32BE",     4, true  },
+    { "UCS4LE",	     4, false },
+    { "UCS4BE",	     4, true  },
+    { NULL, 0, false }
+};
+
+static const parallel_encoding_t *get_parallel_encoding(const char *encoding)
+{
+    u8string name = u8string(encoding).erase_char('-').toupper_ascii();
+    for (int i = 0; parallel_encodings[i].name; i++)
+	if (name == parallel_encodings[i].name)
+	    return &parallel_encodings[i];
+    return NULL;
+}
+
+// find_chunk_end() - returns the offset following the first LF at or
+// after "offset", or "size" if there's none.
+
+static size_t find_chunk_end(const char *data, size_t size, size_t offset,
+			     const parallel_encoding_t *enc)
+{
+    if (enc->unit == 1) {
+	const char *lf = (const char *)memchr(data + offset, '\n',
+					      size - offset);
+	return lf ? (lf - data) + 1 : size;
+    }
+    offset -= offset % enc->unit;
+    for (; offset + enc->unit <= size; offset += enc->unit) {
+	const unsigned char *u = (const unsigned char *)data + offset;
+	int lf_pos = enc->big_endian ? enc->unit - 1 : 0;
+	if (u[lf_pos] != '\n')
+	    continue;
+	bool is_lf = true;
+	for (int i = 0; i < enc->unit; i++)
+	    if (i != lf_pos && u[i] != 0)
+		is_lf = false;
+	if (is_lf)
+	    return offset + enc->unit;
+    }
+    return size;
+}
+
+// count_parallel_chunks() - returns the number of chunks a regular file
+// of "size" bytes is split into, or 0 if it isn't worth loading it in
+// parallel.
+
+static int count_parallel_chunks(size_t size)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 2 || size < 2 * PARALLEL_MIN_CHUNK)
+	return 0;
+    return (int)MIN(MIN((size_t)ncpus, size / PARALLEL_MIN_CHUNK),
+		    (size_t)PARALLEL_MAX_CHUNKS);
+}
+
+// guess_mapped_encoding() - like guess_file_encoding(), for a file that is
+// mapped into memory.
+
+static const char *guess_mapped_encoding(const char *data, size_t size,
+					 const char *default_encoding,
+					 bool &looks_visual)
+{
+    EncodingSample sample;
+    sample.add(data, (int)MIN(size, (size_t)ENCODING_SAMPLE_PART));
+    sample.add(data + ((size / 2) & ~(size_t)3), ENCODING_SAMPLE_PART);
+    sample.add(data + ((size - ENCODING_SAMPLE_PART) & ~(size_t)3),
+	       ENCODING_SAMPLE_PART);
+    return detect_encoding(sample, default_encoding, looks_visual);
+}
+
+// split_into_chunks() - fills "ends" with the offsets at which the chunks
+// of a mapped file end.
+
+static void split_into_chunks(const char *data, size_t size, int nchunks,
+			      const parallel_encoding_t *enc,
+			      std::vector<size_t> &ends)
+{
+    size_t offset = 0;
+    for (int i = 0; i < nchunks && offset < size; i++) {
+	offset = (i == nchunks - 1) ? size
+		: find_chunk_end(data, size,
+				 MAX(offset, size / nchunks * (i + 1)), enc);
+	ends.push_back(offset);
+    }
+}
+
+struct load_chunk_t {
+    EditBox *editbox;
+    const char *encoding;
+    const char *data;
+    size_t start, end;			// file offsets
+    std::vector<Paragraph *> parags;
+    int err;				// errno of a failed conversion, or 0
+    size_t err_offset;
+};
+
+static void *load_chunk(void *arg)
+{
+    TRACE_SCOPE("load/chunk");
+    load_chunk_t &chunk = *(load_chunk_t *)arg;
+    unichar outbuf[CONVBUFSIZ+1];
+    bool prev_is_cr = false;
+
+    Converter *conv = ConverterFactory::get_converter_from(chunk.encoding);
+    if (!conv) {
+	chunk.err = EINVAL;
+	return NULL;
+    }
+
+    // converters don't modify their input.
+    char *inptr = const_cast<char *>(chunk.data) + chunk.start;
+    char *end = const_cast<char *>(chunk.data) + chunk.end;
+    while (inptr < end) {
+	int insize = (int)MIN(end - inptr, CONVBUFSIZ);
+	unichar *wrptr = outbuf;
+	int nconv = conv->convert(&wrptr, &inptr, insize);
+	chunk.editbox->build_paragraphs(chunk.parags, outbuf, wrptr - outbuf,
+					prev_is_cr);
+	if (nconv == -1 && errno != EINVAL) {
+	    chunk.err = errno;
+	    chunk.err_offset = inptr - chunk.data;
+	    break;
+	}
+	if (nconv == -1 && insize == end - inptr) {
+	    // an incomplete sequence at the end of the file; the serial
+	    // loader ignores it too.
+	    break;
+	}
+    }
+    // A chunk other than the last one ends in an EOP, so it leaves an
+    // empty open paragraph, which the next chunk continues.
+    chunk.editbox->finish_paragraphs(chunk.parags, prev_is_cr);
+
+    delete conv;
+    return NULL;
+}
+
+// xload_file_parallel() - returns false if the file isn't fit for parallel
+// loading, in which case nothing has been transferred; otherwise "result"
+// holds the result of loading.
+
+static bool xload_file_parallel(EditBox *editbox,
+				int fd,
+				const char *specified_encoding,
+				const char *default_encoding,
+				u8string &effective_encoding,
+				bool &looks_visual,
+				bool &result)
+{
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+	return false;
+    int nchunks = count_parallel_chunks(st.st_size);
+    if (!nchunks)
+	return false;
+
+    size_t size = st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	return false;
+    const char *data = (const char *)map;
+
+    const char *encoding = specified_encoding;
+    if (!encoding || !*encoding) {
+	encoding = guess_mapped_encoding(data, size, default_encoding,
+					 looks_visual);
+	if (!encoding)
+	    encoding = default_encoding;
+    }
+    const parallel_encoding_t *enc = get_parallel_encoding(encoding);
+    if (!enc) {
+	munmap(map, size);
+	return false;
+    }
+
+    std::vector<size_t> ends;
+    split_into_chunks(data, size, nchunks, enc, ends);
+    std::vector<load_chunk_t> chunks(ends.size());
+    for (size_t i = 0; i < ends.size(); i++) {
+	load_chunk_t &chunk = chunks[i];
+	chunk.editbox = editbox;
+	chunk.encoding = encoding;
+	chunk.data = data;
+	chunk.start = i ? ends[i - 1] : 0;
+	chunk.end = ends[i];
+	chunk.err = 0;
+	chunk.err_offset = 0;
+    }
+    DBG(1, ("parallel load: %d chunks\n", (int)chunks.size()));
+
+    TRACE_SCOPE("load/parallel");
+    std::vector<pthread_t> threads(chunks.size());
+    std::vector<bool> started(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++)
+	started[i] = (pthread_create(&threads[i], NULL,
+				     load_chunk, &chunks[i]) == 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+	if (started[i])
+	    pthread_join(threads[i], NULL);
+	else
+	    load_chunk(&chunks[i]); // couldn't create a thread; do it here.
+    }
+
+    effective_encoding = encoding;
+    result = true;
+    TRACE_BEGIN("load/merge");
+    for (size_t i = 0; i < chunks.size(); i++) {
+	if (result) {
+	    editbox->transfer_paragraphs_in(chunks[i].parags);
+	    if (chunks[i].err) {
+		if (chunks[i].err == EILSEQ)
+		    set_last_error(_("'%s' conversion failed at position %d"),
+				   encoding, (int)chunks[i].err_offset);
+		else
+		    set_last_error(_("'%s' conversion failed"), encoding);
+		result = false;
+	    }
+	}
+	// paragraphs past a failed chunk are discarded.
+	for (size_t j = 0; j < chunks[i].parags.size(); j++)
+	    delete chunks[i].parags[j];
+    }
+    TRACE_END("load/merge");
+
+    munmap(map, size);
+    return true;
+}
+
+#endif // HAVE_PTHREAD && HAVE_MMAP
+
 // xload_file() - loads a file into an EditBox buffer.
 
 bool xload_file(EditBox *editbox,
@@ -156,8 +486,10 @@ bool xload_file(EditBox *editbox,
 		const char *default_encoding,
 		u8string &effective_encoding,
 		bool &is_new,
-		bool new_document)
+		bool new_document,
+		bool *looks_visual)
 {
+    TRACE_SCOPE("load");
     int  fd;
     bool is_pipe = false;
     FILE *pipe_stream = NULL;
@@ -176,7 +508,7 @@ bool xload_file(EditBox *editbox,
     editbox->start_data_transfer(EditBox::dataTransferIn, new_document);
     
     if (is_pipe) {
-	UNLOAD_SPELLER(); // see TODO
+	before_command();
 	is_new = true;
 	pipe_stream = popen(filename, "r");
 	if (pipe_stream == NULL) {
@@ -203,9 +535,27 @@ bool xload_file(EditBox *editbox,
 	}
     }
 
-    bool result = xload_file(editbox, fd, specified_encoding,
-			     default_encoding, effective_encoding);
+    bool result;
+    bool visual = false;
+    double start_time = perf_now_msecs();
+#if defined(HAVE_PTHREAD) && defined(HAVE_MMAP)
+    // When inserting a file we need undo information, so we can't use the
+    // parallel loader, which bypasses insert_text().
+    if (!(new_document && !is_pipe && !is_stdin
+	    && xload_file_parallel(editbox, fd, specified_encoding,
+				   default_encoding, effective_encoding,
+				   visual, result)))
+#endif
+	result = xload_file(editbox, fd, specified_encoding,
+			    default_encoding, effective_encoding, visual);
     editbox->end_data_transfer();
+    if (looks_visual)
+	*looks_visual = visual;
+
+    // we don't know how many bytes a pipe gave us.
+    struct stat st;
+    if (result && fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+	record_load_time(st.st_size, perf_now_msecs() - start_time);
 
     if (is_pipe)
 	pclose(pipe_stream);
@@ -216,171 +566,1796 @@ bool xload_file(EditBox *editbox,
     return result;
 }
 
-static bool xsave_file(EditBox *editbox,
-		       int fd,
-		       const char *encoding,
-		       unichar &offending_char)
+// Progressive loading {{{
+
+// Files smaller than this are loaded in one go; it's fast enough.
+#define PROGRESSIVE_MIN_SIZE	(4*1024*1024)
+// The reader of a command's output (or of a file that isn't loaded in
+// parallel) stops reading when this many characters await transfer().
+#define PROGRESSIVE_MAX_QUEUE	(256*1024)
+// A thread hands its paragraphs over when they hold this many characters,
+// or sooner if transfer() has nothing else to do.
+#define PROGRESSIVE_BATCH_SIZE	(64*1024)
+// How often the reader checks whether it was cancelled.
+#define PROGRESSIVE_POLL_MSECS	100
+
+#ifdef HAVE_PTHREAD
+
+// A Batch is a list of paragraphs as made by EditBox::build_paragraphs():
+// the first paragraph continues the last one of the previous batch, and the
+// last paragraph is open.
+
+struct ProgressiveLoader::Batch {
+    std::vector<Paragraph *> parags;
+    unsigned long layout;	// EditBox::get_layout_stamp() when wrapped
+    int len;			// characters
+};
+
+// A Chunk is a part of the input and the thread that loads it: either the
+// whole input, which is read serially, or a part of a mapped file.
+
+struct ProgressiveLoader::Chunk {
+    ProgressiveLoader *loader;
+    pthread_t thread;
+    bool started;
+    size_t start, end;		// file offsets, when loading in parallel
+
+    // The following are used by the thread only.
+    Batch building;
+    bool prev_is_cr;
+
+    // The following are guarded by loader->lock. The errors are set before
+    // "done" is.
+    std::deque<Batch> batches;	// ready for transfer()
+    int queued;			// characters in "batches"
+    bool done;			// no more batches will come
+    int err;			// errno of a failed read() or conversion
+    size_t err_offset;		// file offset of an illegal sequence
+    bool no_converter;
+
+    Chunk(ProgressiveLoader *aLoader, size_t aStart, size_t aEnd);
+    ~Chunk();
+};
+
+ProgressiveLoader::Chunk::Chunk(ProgressiveLoader *aLoader,
+				size_t aStart, size_t aEnd)
 {
-    char outbuf[CONVBUFSIZ*6];
-    unichar inbuf[CONVBUFSIZ];
-    bool result = true;
-    Converter *conv = NULL;
-    
-    conv = ConverterFactory::get_converter_to(encoding);
-    
-    if (!conv) {
-	set_last_error(_("Conversion to '%s' not available"), encoding);
-	return false;
+    loader = aLoader;
+    started = false;
+    start = aStart;
+    end = aEnd;
+    building.layout = 0;
+    building.len = 0;
+    prev_is_cr = false;
+    queued = 0;
+    done = false;
+    err = 0;
+    err_offset = 0;
+    no_converter = false;
+}
+
+// The paragraphs that weren't transferred are discarded.
+
+ProgressiveLoader::Chunk::~Chunk()
+{
+    for (size_t i = 0; i < building.parags.size(); i++)
+	delete building.parags[i];
+    for (size_t b = 0; b < batches.size(); b++)
+	for (size_t i = 0; i < batches[b].parags.size(); i++)
+	    delete batches[b].parags[i];
+}
+
+ProgressiveLoader::ProgressiveLoader(EditBox *aEditbox,
+				     const char *aSpecified_encoding,
+				     const char *aDefault_encoding)
+{
+    editbox = aEditbox;
+    fd = -1;
+    child_pid = -1;
+    total_size = 0;
+    if (aSpecified_encoding)
+	specified_encoding = aSpecified_encoding;
+    default_encoding = aDefault_encoding;
+    map = NULL;
+    current = 0;
+    nread = 0;
+    cancelled = false;
+    suspended = false;
+    active = 0;
+    failed = NULL;
+    visual = false;
+    finished = false;
+    start_time = perf_now_msecs();
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&cond, NULL);
+}
+
+ProgressiveLoader::~ProgressiveLoader()
+{
+    if (fd != -1) {
+	cancel();
+	join_threads();
+	close_input();
     }
+    for (size_t i = 0; i < chunks.size(); i++)
+	delete chunks[i];
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&cond);
+}
 
-    int edit_buf_offset = 0;
-    while (1) {
-	int nread = editbox->transfer_data(inbuf, sizeof(inbuf)/sizeof(unichar));
-	if (nread == 0) {
-	    // We reached end of buffer.
-	    // :TODO: zero output state.
-	    break;
-	}
-	
-	char    *wrptr = outbuf;
-	unichar *inptr = inbuf;
-	// do the conversion
-	int nconv = conv->convert(&wrptr, &inptr, nread);
+// open() - opens the input. Like xload_file(), it treats "|command" and
+// "!command" as a command whose output we read (in UTF-8). We run the
+// command ourselves, instead of using popen(), because we need its pid to
+// kill it when the user cancels the loading.
 
-	if (write(fd, outbuf, wrptr - outbuf) == -1) {
-	    set_last_error(errno);
-	    result = false;
-	    break;
+bool ProgressiveLoader::open(const char *filename, bool &is_new)
+{
+    if (filename[0] == '|' || filename[0] == '!') {
+	int fds[2];
+	before_command();
+	if (pipe(fds) < 0)
+	    return false;
+	if ((child_pid = fork()) < 0) {
+	    ::close(fds[0]);
+	    ::close(fds[1]);
+	    return false;
 	}
-	
-	if (nconv == -1) {
-	    // Probably some unicode character couldn't be converted
-	    // to the requested encoding.
-	    if (errno == EILSEQ) {
-		int illegal_pos = inptr - inbuf;
-		offending_char = inbuf[illegal_pos];
-		set_last_error(_("'%s' conversion failed at position "
-				    "%d (char: U+%04X)"),
-				encoding, edit_buf_offset + illegal_pos,
-				offending_char);
-	    } else {
-		set_last_error(_("'%s' conversion failed"), encoding);
-	    }
-	    result = false;
-	    break;
+	if (child_pid == 0) {
+	    DISABLE_SIGTSTP();
+	    // we're in the child. put it in its own process group, so that
+	    // we can kill all of it.
+	    setpgid(0, 0);
+	    dup2(fds[1], STDOUT_FILENO);
+	    ::close(fds[0]);
+	    ::close(fds[1]);
+	    execlp("/bin/sh", "sh", "-c", filename + 1, NULL);
+	    _exit(127);
 	}
-	edit_buf_offset += nread;
+	// we do it in the parent too, so that the group exists whichever of
+	// us runs first, when cancel() kills it.
+	setpgid(child_pid, child_pid);
+	::close(fds[1]);
+	fd = fds[0];
+	specified_encoding = "UTF-8";
+	is_new = true;
+	return true;
     }
 
-    if (conv)
-	delete conv;
- 
-    return result;
+    if (filename[0] == '-' && filename[1] == '\0')
+	return false;
+    struct stat st;
+    if (stat(filename, &st) == -1 || !S_ISREG(st.st_mode)
+	    || st.st_size < PROGRESSIVE_MIN_SIZE)
+	return false;
+    if ((fd = ::open(filename, O_RDONLY)) == -1)
+	return false;
+    total_size = st.st_size;
+    is_new = false;
+    plan_parallel_load();
+    return true;
 }
 
-// xsave_file() - saves an EditBox buffer to a file.
+// plan_parallel_load() - maps the file into memory and splits it into
+// chunks, if it's fit for parallel loading (see xload_file_parallel()).
+// Otherwise the file is read serially, by a single chunk.
 
-bool xsave_file(EditBox *editbox,
-		const char *filename,
-		const char *specified_encoding,
-		const char *backup_suffix,
-		unichar &offending_char,
-		bool selection_only)
+void ProgressiveLoader::plan_parallel_load()
 {
-    offending_char = 0;
+#ifdef HAVE_MMAP
+    int nchunks = count_parallel_chunks(total_size);
+    if (!nchunks)
+	return;
+    void *addr = mmap(NULL, total_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+	return;
+    const char *data = (const char *)addr;
 
-    int  fd;
-    bool is_pipe = false;
-    FILE *pipe_stream = NULL;
-    u8string tmp_filename;
-    bool is_stdout = false;
-    
-    if (filename[0] == '-' && filename[1] == '\0')
-	is_stdout = true;
+    const char *enc = specified_encoding.c_str();
+    bool seems_visual = false;
+    if (!*enc) {
+	enc = guess_mapped_encoding(data, total_size,
+				    default_encoding.c_str(), seems_visual);
+	if (!enc)
+	    enc = default_encoding.c_str();
+    }
+    const parallel_encoding_t *penc = get_parallel_encoding(enc);
+    if (!penc) {
+	munmap(addr, total_size);
+	return;
+    }
 
-    if (filename[0] == '|' || filename[0] == '!') {
-	filename++;
-	// we use UTF-8 for pipe communication
-	specified_encoding = "UTF-8";
-	is_pipe = true;
+    std::vector<size_t> ends;
+    split_into_chunks(data, total_size, nchunks, penc, ends);
+    for (size_t i = 0; i < ends.size(); i++)
+	chunks.push_back(new Chunk(this, i ? ends[i - 1] : 0, ends[i]));
+    DBG(1, ("progressive parallel load: %d chunks\n", (int)chunks.size()));
+    map = data;
+    encoding = enc;
+    visual = seems_visual;
+#endif
+}
+
+// start() - opens the input and starts the threads. The EditBox is
+// cleared.
+
+ProgressiveLoader *ProgressiveLoader::start(EditBox *editbox,
+					    const char *filename,
+					    const char *specified_encoding,
+					    const char *default_encoding,
+					    bool &is_new)
+{
+    ProgressiveLoader *loader = new ProgressiveLoader(editbox,
+				    specified_encoding, default_encoding);
+    if (!loader->open(filename, is_new)) {
+	delete loader;
+	return NULL;
     }
+    if (loader->chunks.empty())
+	loader->chunks.push_back(new Chunk(loader, 0, 0));
 
-    if (is_pipe) {
-	UNLOAD_SPELLER(); // see TODO
-	pipe_stream = popen(filename, "w");
-	if (pipe_stream == NULL) {
-	    set_last_error(errno);
-	    return false;
-	}
-	fd = fileno(pipe_stream);
-    } else if (is_stdout) {
-	fd = STDOUT_FILENO;
-    } else {
-	// 1. Get filename's permissions, if exists.
-	struct stat file_info;
-	mode_t permissions;
-	if (stat(filename, &file_info) != -1)
-	    permissions = (file_info.st_mode & 0777);
-	else
-	    permissions = 0666;
-	
-	// 2. Create filename.tmp and write data into it.
-	//    Use filename's permissions.
-	tmp_filename = filename;
-	tmp_filename += ".tmp";
-	fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
-		      permissions);
-	if (fd == -1) {
-	    set_last_error(errno);
-	    return false;
-	}
+    editbox->new_document();
+
+    if (!loader->start_threads()) {
+	// the caller will fall back to xload_file().
+	delete loader;
+	return NULL;
     }
+    return loader;
+}
 
-    editbox->start_data_transfer(EditBox::dataTransferOut, false, selection_only);
-    bool result = xsave_file(editbox, fd, specified_encoding, offending_char);
-    editbox->end_data_transfer();
+// start_threads() - starts a thread for every chunk. Signals should be
+// handled by the main thread, so the threads start with all of them
+// blocked.
 
-    if (is_pipe) {
-	pclose(pipe_stream);
-    } else if (is_stdout) {
-	if (!result) {
-	    return false;
-	}
-    } else {
-	if (!result) {
-	    close(fd);
-	    unlink(tmp_filename.c_str());
-	    return false;
-	}
-	if (close(fd) == -1) {
-	    set_last_error(errno);
-	    unlink(tmp_filename.c_str());
-	    return false;
-	}
+bool ProgressiveLoader::start_threads()
+{
+    sigset_t all, orig;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &orig);
+    bool ok = true;
+    for (size_t i = 0; i < chunks.size() && ok; i++) {
+	Chunk *chunk = chunks[i];
+	chunk->started = (pthread_create(&chunk->thread, NULL,
+					 map ? chunk_thread : reader_thread,
+					 chunk) == 0);
+	ok = chunk->started;
+    }
+    pthread_sigmask(SIG_SETMASK, &orig, NULL);
+    return ok;
+}
 
-	// 3. if the user wants a backup,
-	//    mv filename -> filename${backup_extension}
-	//    We ignore errors, since filename may not exist.
-	if (backup_suffix && *backup_suffix) {
-	    u8string backup = filename;
-	    backup += backup_suffix;
-	    rename(filename, backup.c_str());
-	}
-	// Else, unlink filename
-	else {
-	    unlink(filename);
-	}
-      
-	// 4. rename filename.tmp to filename
-	if (rename(tmp_filename.c_str(), filename) == -1) {
-	    set_last_error(errno);
-	    return false;
+void ProgressiveLoader::join_threads()
+{
+    for (size_t i = 0; i < chunks.size(); i++) {
+	if (chunks[i]->started) {
+	    pthread_join(chunks[i]->thread, NULL);
+	    chunks[i]->started = false;
 	}
     }
-    
+}
+
+void ProgressiveLoader::close_input()
+{
+    ::close(fd);
+    fd = -1;
+#ifdef HAVE_MMAP
+    if (map) {
+	munmap(const_cast<char *>(map), total_size);
+	map = NULL;
+    }
+#endif
+    if (child_pid > 0)
+	waitpid(child_pid, NULL, 0);
+}
+
+void *ProgressiveLoader::reader_thread(void *arg)
+{
+    Chunk *chunk = (Chunk *)arg;
+    chunk->loader->read_input(*chunk);
+    return NULL;
+}
+
+void *ProgressiveLoader::chunk_thread(void *arg)
+{
+    Chunk *chunk = (Chunk *)arg;
+    chunk->loader->decode_chunk(*chunk);
+    return NULL;
+}
+
+// build() - splits "data" into paragraphs, and wraps them, for the
+// chunk's next batch; with "at_end", the last paragraph is finished too.
+// It waits while the threads are suspended. If the EditBox's settings
+// changed meanwhile, the paragraphs built so far are wrapped anew. Returns
+// false if the loading was cancelled.
+
+bool ProgressiveLoader::build(Chunk &chunk, const unichar *data, int len,
+			      bool at_end)
+{
+    pthread_mutex_lock(&lock);
+    while (suspended && !cancelled)
+	pthread_cond_wait(&cond, &lock);
+    bool stop = cancelled;
+    if (!stop)
+	active++;
+    pthread_mutex_unlock(&lock);
+    if (stop)
+	return false;
+
+    Batch &batch = chunk.building;
+    unsigned long layout = editbox->get_layout_stamp();
+    if (batch.layout != layout) {
+	editbox->rewrap_paragraphs(batch.parags);
+	batch.layout = layout;
+    }
+    editbox->build_paragraphs(batch.parags, data, len, chunk.prev_is_cr);
+    if (at_end)
+	editbox->finish_paragraphs(batch.parags, chunk.prev_is_cr);
+    batch.len += len;
+
+    pthread_mutex_lock(&lock);
+    active--;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
     return true;
 }
 
+// publish() - counts "bytes" as read, and hands the chunk's batch over to
+// transfer() if it's big enough, or if the chunk has no other batch ready.
+// When reading serially, it waits while too much text awaits transfer().
+// Returns false if the loading was cancelled.
+
+bool ProgressiveLoader::publish(Chunk &chunk, size_t bytes, bool at_end)
+{
+    pthread_mutex_lock(&lock);
+    nread += bytes;
+    bool was_empty = chunk.batches.empty();
+    if (at_end || was_empty || chunk.building.len >= PROGRESSIVE_BATCH_SIZE) {
+	chunk.batches.push_back(Batch());
+	Batch &batch = chunk.batches.back();
+	batch.parags.swap(chunk.building.parags);
+	batch.layout = chunk.building.layout;
+	batch.len = chunk.building.len;
+	chunk.queued += batch.len;
+	chunk.building.len = 0;
+    }
+    if (at_end)
+	chunk.done = true;
+    pthread_cond_broadcast(&cond);
+    while (!map && chunk.queued > PROGRESSIVE_MAX_QUEUE && !cancelled)
+	pthread_cond_wait(&cond, &lock);
+    bool stop = cancelled;
+    pthread_mutex_unlock(&lock);
+    if (was_empty || at_end)
+	MainLoop::wake(); // the loading task sleeps till there's a batch.
+    return !stop;
+}
+
+// read_input() - the thread of a serial input. The reading and conversion
+// are done as in xload_file(), but we poll() before reading so that we
+// notice that we've been cancelled even when a command doesn't print
+// anything.
+
+void ProgressiveLoader::read_input(Chunk &chunk)
+{
+    TRACE_SCOPE("load/read");
+    unichar outbuf[CONVBUFSIZ+1];
+    char inbuf[CONVBUFSIZ];
+    Converter *conv = NULL;
+    size_t insize = 0;
+    size_t buf_file_offset = 0;
+
+    while (1) {
+	pthread_mutex_lock(&lock);
+	bool stop = cancelled;
+	pthread_mutex_unlock(&lock);
+	if (stop)
+	    break;
+
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, PROGRESSIVE_POLL_MSECS) <= 0)
+	    continue; // timeout or EINTR; check "cancelled" again.
+
+	ssize_t nbytes = read(fd, inbuf + insize, sizeof(inbuf) - insize);
+	if (nbytes == 0)
+	    break;
+	if (nbytes == -1) {
+	    if (errno == EINTR || errno == EAGAIN)
+		continue;
+	    chunk.err = errno;
+	    break;
+	}
+	insize += nbytes;
+
+	if (!conv) {
+	    u8string enc = specified_encoding;
+	    bool seems_visual = false;
+	    if (enc.empty()) {
+		const char *guess = guess_file_encoding(fd, inbuf, insize,
+						default_encoding.c_str(),
+						seems_visual);
+		enc = guess ? guess : default_encoding.c_str();
+	    }
+	    pthread_mutex_lock(&lock);
+	    encoding = enc;
+	    visual = seems_visual;
+	    pthread_mutex_unlock(&lock);
+	    conv = ConverterFactory::get_converter_from(enc.c_str());
+	    if (!conv) {
+		chunk.no_converter = true;
+		break;
+	    }
+	}
+
+	char *inptr = inbuf;
+	unichar *wrptr = outbuf;
+	int nconv = conv->convert(&wrptr, &inptr, insize);
+	if (!build(chunk, outbuf, wrptr - outbuf, false)
+		|| !publish(chunk, nbytes, false))
+	    break;
+
+	if (nconv == -1) {
+	    insize = inbuf + insize - inptr;
+	    if (errno == EINVAL) {
+		memmove(inbuf, inptr, insize);
+	    } else {
+		chunk.err = errno;
+		chunk.err_offset = buf_file_offset + (inptr - inbuf);
+		break;
+	    }
+	} else {
+	    insize = 0;
+	}
+	buf_file_offset += inptr - inbuf;
+    }
+
+    if (conv)
+	delete conv;
+
+    // what was read before a failure is transferred too.
+    if (build(chunk, outbuf, 0, true))
+	publish(chunk, 0, true);
+}
+
+// decode_chunk() - the thread of a chunk of a mapped file; see
+// load_chunk().
+
+void ProgressiveLoader::decode_chunk(Chunk &chunk)
+{
+    TRACE_SCOPE("load/chunk");
+    unichar outbuf[CONVBUFSIZ+1];
+
+    // "encoding" doesn't change once the threads have started.
+    Converter *conv = ConverterFactory::get_converter_from(encoding.c_str());
+    if (!conv) {
+	chunk.no_converter = true;
+	if (build(chunk, outbuf, 0, true))
+	    publish(chunk, 0, true);
+	return;
+    }
+
+    // converters don't modify their input.
+    char *inptr = const_cast<char *>(map) + chunk.start;
+    char *end = const_cast<char *>(map) + chunk.end;
+    while (inptr < end) {
+	int insize = (int)MIN(end - inptr, CONVBUFSIZ);
+	char *block = inptr;
+	unichar *wrptr = outbuf;
+	int nconv = conv->convert(&wrptr, &inptr, insize);
+	if (!build(chunk, outbuf, wrptr - outbuf, false)
+		|| !publish(chunk, inptr - block, false)) {
+	    delete conv;
+	    return; // cancelled
+	}
+	if (nconv == -1 && errno != EINVAL) {
+	    chunk.err = errno;
+	    chunk.err_offset = inptr - map;
+	    break;
+	}
+	if (nconv == -1 && insize == end - inptr) {
+	    // an incomplete sequence at the end of the file; the serial
+	    // loader ignores it too.
+	    break;
+	}
+    }
+    delete conv;
+
+    // A chunk other than the last one ends in an EOP, so it leaves an
+    // empty open paragraph, which the next chunk continues.
+    if (build(chunk, outbuf, 0, true))
+	publish(chunk, 0, true);
+}
+
+// has_ready_batch() - tells whether transfer() has something to do (or
+// to find out); "lock" must be held.
+
+bool ProgressiveLoader::has_ready_batch()
+{
+    if (cancelled || current == chunks.size())
+	return true;
+    Chunk &chunk = *chunks[current];
+    return !chunk.batches.empty() || chunk.done;
+}
+
+// transfer() - appends the batches that are ready to the EditBox, in
+// order, for up to TASK_BUDGET_MSECS milliseconds. If there's none, it
+// waits up to "msecs" milliseconds for one. Batches that were wrapped
+// before the EditBox's settings changed are wrapped anew. Returns false
+// once the whole input has been transferred, or the loading was cancelled
+// or failed.
+
+bool ProgressiveLoader::transfer(int msecs)
+{
+    if (finished)
+	return false;
+    TRACE_SCOPE("load/transfer");
+
+    double start = perf_now_msecs();
+    pthread_mutex_lock(&lock);
+    if (msecs > 0 && !has_ready_batch()) {
+	timespec until;
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec  += msecs / 1000;
+	until.tv_nsec += (msecs % 1000) * 1000000L;
+	if (until.tv_nsec >= 1000000000L) {
+	    until.tv_sec++;
+	    until.tv_nsec -= 1000000000L;
+	}
+	pthread_cond_timedwait(&cond, &lock, &until);
+    }
+    while (!cancelled && current < chunks.size()) {
+	Chunk &chunk = *chunks[current];
+	if (chunk.batches.empty()) {
+	    if (!chunk.done)
+		break;
+	    if (chunk.err || chunk.no_converter) {
+		// the chunks that follow are discarded.
+		failed = &chunk;
+		current = chunks.size();
+	    } else {
+		current++;
+	    }
+	    continue;
+	}
+	Batch batch;
+	batch.parags.swap(chunk.batches.front().parags);
+	batch.layout = chunk.batches.front().layout;
+	chunk.queued -= chunk.batches.front().len;
+	chunk.batches.pop_front();
+	pthread_cond_broadcast(&cond); // there's room now
+	pthread_mutex_unlock(&lock);
+
+	if (batch.layout != editbox->get_layout_stamp())
+	    editbox->rewrap_paragraphs(batch.parags);
+	editbox->transfer_paragraphs_in(batch.parags);
+
+	pthread_mutex_lock(&lock);
+	if (perf_now_msecs() - start >= TASK_BUDGET_MSECS)
+	    break;
+    }
+    finished = (cancelled || current == chunks.size());
+    pthread_mutex_unlock(&lock);
+    return !finished;
+}
+
+bool ProgressiveLoader::has_pending_data()
+{
+    pthread_mutex_lock(&lock);
+    bool pending = has_ready_batch();
+    pthread_mutex_unlock(&lock);
+    return pending;
+}
+
+// suspend() - waits till no thread is wrapping paragraphs, and keeps them
+// from starting again till resume() is called. The main thread calls it
+// before changing the EditBox's settings.
+
+void ProgressiveLoader::suspend()
+{
+    pthread_mutex_lock(&lock);
+    suspended = true;
+    while (active > 0)
+	pthread_cond_wait(&cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+void ProgressiveLoader::resume()
+{
+    pthread_mutex_lock(&lock);
+    suspended = false;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+}
+
+// cancel() - stops the threads. If we're reading a command's output, the
+// command is killed.
+
+void ProgressiveLoader::cancel()
+{
+    pthread_mutex_lock(&lock);
+    cancelled = true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&lock);
+    if (child_pid > 0)
+	kill(-child_pid, SIGTERM);
+}
+
+// finish() - waits for the threads and closes the input. The text that
+// hasn't been transferred yet is discarded (after a cancel()) or
+// transferred. Returns false if the loading failed or was cancelled; the
+// error can be retrieved with get_last_error().
+
+bool ProgressiveLoader::finish(u8string &effective_encoding)
+{
+    if (fd != -1) {
+	bool user_cancelled = cancelled;
+	if (!user_cancelled)
+	    while (transfer(PROGRESSIVE_POLL_MSECS))
+		;
+	if (failed)
+	    cancel(); // stop the threads of the chunks that follow.
+	join_threads();
+	close_input();
+	cancelled = user_cancelled;
+	record_load_time(nread, perf_now_msecs() - start_time);
+    }
+    finished = true;
+
+    effective_encoding = get_encoding();
+    if (cancelled) {
+	set_last_error(_("Loading was cancelled"));
+	return false;
+    }
+    if (!failed)
+	return true;
+    if (failed->no_converter)
+	set_last_error(_("Conversion from '%s' not available"),
+		       encoding.c_str());
+    else if (failed->err == EILSEQ)
+	set_last_error(_("'%s' conversion failed at position %d"),
+		       encoding.c_str(), (int)failed->err_offset);
+    else
+	set_last_error(failed->err);
+    return false;
+}
+
+u8string ProgressiveLoader::get_encoding()
+{
+    pthread_mutex_lock(&lock);
+    u8string enc = encoding.empty() ? (specified_encoding.empty()
+				       ? default_encoding : specified_encoding)
+				    : encoding;
+    pthread_mutex_unlock(&lock);
+    return enc;
+}
+
+// looks_visual() - tells whether the text seems to be Hebrew in visual
+// order (see detect_encoding()).
+
+bool ProgressiveLoader::looks_visual()
+{
+    pthread_mutex_lock(&lock);
+    bool result = visual;
+    pthread_mutex_unlock(&lock);
+    return result;
+}
+
+// get_progress() - "bytes_total" is 0 when the size of the input isn't
+// known in advance.
+
+void ProgressiveLoader::get_progress(size_t &bytes_read, size_t &bytes_total)
+{
+    pthread_mutex_lock(&lock);
+    bytes_read = nread;
+    pthread_mutex_unlock(&lock);
+    bytes_total = total_size;
+}
+
+#else
+
+// Without threads there's no progressive loading; start() always fails,
+// so the other methods are never called.
+
+ProgressiveLoader *ProgressiveLoader::start(EditBox *editbox,
+					    const char *filename,
+					    const char *specified_encoding,
+					    const char *default_encoding,
+					    bool &is_new)
+{
+    return NULL;
+}
+
+ProgressiveLoader::~ProgressiveLoader() {}
+bool ProgressiveLoader::transfer(int msecs) { return false; }
+bool ProgressiveLoader::has_pending_data() { return false; }
+void ProgressiveLoader::suspend() {}
+void ProgressiveLoader::resume() {}
+void ProgressiveLoader::cancel() {}
+bool ProgressiveLoader::finish(u8string &effective_encoding) { return false; }
+u8string ProgressiveLoader::get_encoding() { return encoding; }
+bool ProgressiveLoader::looks_visual() { return false; }
+void ProgressiveLoader::get_progress(size_t &bytes_read, size_t &bytes_total)
+{
+    bytes_read = bytes_total = 0;
+}
+
+#endif // HAVE_PTHREAD
+
+// }}}
+
+// write_all() - write() that doesn't give up on short writes (pipes and
+// some network filesystems accept large buffers only partially).
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+	ssize_t nwritten = write(fd, buf, len);
+	if (nwritten == -1) {
+	    if (errno == EINTR)
+		continue;
+	    set_last_error(errno);
+	    return false;
+	}
+	buf += nwritten;
+	len -= nwritten;
+    }
+    return true;
+}
+
+// SaveSource is where the text we save comes from: either an EditBox in
+// the middle of a dataTransferOut transfer, or a snapshot of its text
+// (see AsyncSaver). get_text() works like EditBox::transfer_data_out_ref().
+
+class SaveSource {
+public:
+    virtual ~SaveSource() {}
+    virtual int get_text(const unichar **buf, int len) = 0;
+};
+
+class EditBoxSource : public SaveSource {
+    EditBox *editbox;
+public:
+    EditBoxSource(EditBox *aEditbox) { editbox = aEditbox; }
+    virtual int get_text(const unichar **buf, int len) {
+	return editbox->transfer_data_out_ref(buf, len);
+    }
+};
+
+// The text is encoded straight from the source's storage (see
+// EditBox::transfer_data_out_ref()) into a large output buffer that is
+// written out only when it fills up. Every segment we convert is at most
+// CONVBUFSIZ characters long, and a character never takes more than 6
+// bytes, so we flush whenever fewer than CONVBUFSIZ*6 bytes are free.
+
+#define SAVEBUFSIZ (CONVBUFSIZ*6*32)
+
+static bool write_text(SaveSource &source,
+		       int fd,
+		       const char *encoding,
+		       unichar &offending_char)
+{
+    bool result = true;
+    Converter *conv = NULL;
+    
+    conv = ConverterFactory::get_converter_to(encoding);
+    
+    if (!conv) {
+	set_last_error(_("Conversion to '%s' not available"), encoding);
+	return false;
+    }
+
+    char *outbuf = new char[SAVEBUFSIZ];
+    char *wrptr = outbuf;
+    int edit_buf_offset = 0;
+    while (1) {
+	const unichar *segment;
+	int nread = source.get_text(&segment, CONVBUFSIZ);
+	if (nread == 0) {
+	    // We reached end of buffer.
+	    // :TODO: zero output state.
+	    break;
+	}
+
+	if (outbuf + SAVEBUFSIZ - wrptr < CONVBUFSIZ*6) {
+	    if (!write_all(fd, outbuf, wrptr - outbuf)) {
+		result = false;
+		break;
+	    }
+	    wrptr = outbuf;
+	}
+	
+	// do the conversion (converters don't modify their input).
+	unichar *inptr = const_cast<unichar *>(segment);
+	int nconv = conv->convert(&wrptr, &inptr, nread);
+
+	if (nconv == -1) {
+	    // Probably some unicode character couldn't be converted
+	    // to the requested encoding.
+	    if (errno == EILSEQ) {
+		int illegal_pos = inptr - segment;
+		offending_char = segment[illegal_pos];
+		set_last_error(_("'%s' conversion failed at position "
+				    "%d (char: U+%04X)"),
+				encoding, edit_buf_offset + illegal_pos,
+				offending_char);
+	    } else {
+		set_last_error(_("'%s' conversion failed"), encoding);
+	    }
+	    // write what we've converted so far, as we did before.
+	    write_all(fd, outbuf, wrptr - outbuf);
+	    result = false;
+	    break;
+	}
+	edit_buf_offset += nread;
+    }
+
+    if (result && wrptr > outbuf)
+	result = write_all(fd, outbuf, wrptr - outbuf);
+
+    delete[] outbuf;
+    if (conv)
+	delete conv;
+ 
+    return result;
+}
+
+// sync_directory() - fsync()s the directory containing "filename", so that
+// a new directory entry survives a crash. Filesystems that can't sync
+// directories (EINVAL) are not considered an error.
+
+static bool sync_directory(const char *filename)
+{
+    u8string dirname = filename;
+    size_t slash = dirname.rfind('/');
+    if (slash == u8string::npos)
+	dirname = ".";
+    else
+	dirname.erase(slash == 0 ? 1 : slash);
+    int fd = open(dirname.c_str(), O_RDONLY);
+    if (fd == -1) {
+	set_last_error(errno);
+	return false;
+    }
+    bool result = true;
+    if (fsync(fd) == -1 && errno != EINVAL) {
+	set_last_error(errno);
+	result = false;
+    }
+    close(fd);
+    return result;
+}
+
+// write_file() - saves the text to a regular file: it writes the text to
+// "filename.tmp" and then renames it over "filename" (after making a
+// backup, if asked to).
+
+static bool write_file(SaveSource &source,
+		       const char *filename,
+		       const char *encoding,
+		       const char *backup_suffix,
+		       unichar &offending_char,
+		       bool do_fsync)
+{
+    // 1. Get filename's permissions, if exists.
+    struct stat file_info;
+    mode_t permissions;
+    if (stat(filename, &file_info) != -1)
+	permissions = (file_info.st_mode & 0777);
+    else
+	permissions = 0666;
+    
+    // 2. Create filename.tmp and write data into it.
+    //    Use filename's permissions.
+    u8string tmp_filename = filename;
+    tmp_filename += ".tmp";
+    int fd = open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+		  permissions);
+    if (fd == -1) {
+	set_last_error(errno);
+	return false;
+    }
+
+    if (!write_text(source, fd, encoding, offending_char)) {
+	close(fd);
+	unlink(tmp_filename.c_str());
+	return false;
+    }
+    // make sure the data is on the disk before we rename the file over
+    // the original.
+    if (do_fsync && fsync(fd) == -1) {
+	set_last_error(errno);
+	close(fd);
+	unlink(tmp_filename.c_str());
+	return false;
+    }
+    if (close(fd) == -1) {
+	set_last_error(errno);
+	unlink(tmp_filename.c_str());
+	return false;
+    }
+
+    // 3. if the user wants a backup,
+    //    mv filename -> filename${backup_extension}
+    //    We ignore errors, since filename may not exist.
+    if (backup_suffix && *backup_suffix) {
+	u8string backup = filename;
+	backup += backup_suffix;
+	rename(filename, backup.c_str());
+    }
+    // Else, unlink filename
+    else {
+	unlink(filename);
+    }
+  
+    // 4. rename filename.tmp to filename
+    if (rename(tmp_filename.c_str(), filename) == -1) {
+	set_last_error(errno);
+	return false;
+    }
+
+    // 5. make sure the rename itself is on the disk too.
+    if (do_fsync)
+	return sync_directory(filename);
+    return true;
+}
+
+// xsave_file() - saves an EditBox buffer to a file.
+
+bool xsave_file(EditBox *editbox,
+		const char *filename,
+		const char *specified_encoding,
+		const char *backup_suffix,
+		unichar &offending_char,
+		bool selection_only)
+{
+    TRACE_SCOPE("save");
+    offending_char = 0;
+
+    int  fd;
+    bool is_pipe = false;
+    FILE *pipe_stream = NULL;
+    bool is_stdout = false;
+    
+    if (filename[0] == '-' && filename[1] == '\0')
+	is_stdout = true;
+
+    if (filename[0] == '|' || filename[0] == '!') {
+	filename++;
+	// we use UTF-8 for pipe communication
+	specified_encoding = "UTF-8";
+	is_pipe = true;
+    }
+
+    EditBoxSource source(editbox);
+    bool result;
+
+    if (is_pipe || is_stdout) {
+	if (is_pipe) {
+	    before_command();
+	    pipe_stream = popen(filename, "w");
+	    if (pipe_stream == NULL) {
+		set_last_error(errno);
+		return false;
+	    }
+	    fd = fileno(pipe_stream);
+	} else {
+	    fd = STDOUT_FILENO;
+	}
+	editbox->start_data_transfer(EditBox::dataTransferOut, false,
+				     selection_only);
+	result = write_text(source, fd, specified_encoding, offending_char);
+	editbox->end_data_transfer();
+	if (is_pipe) {
+	    pclose(pipe_stream);
+	    result = true; // as before, we don't report pipe errors.
+	}
+    } else {
+	editbox->start_data_transfer(EditBox::dataTransferOut, false,
+				     selection_only);
+	result = write_file(source, filename, specified_encoding,
+			    backup_suffix, offending_char, false);
+	editbox->end_data_transfer();
+    }
+    return result;
+}
+
+// Streaming log2vis {{{
+
+// In contextual direction algorithms a neutral paragraph takes the
+// direction of the previous strong paragraph; neutral paragraphs at the
+// start of the text take the direction of the first strong one. We keep at
+// most this many of them waiting for it; if none comes, they're LTR.
+#define LOG2VIS_LOOKAHEAD 1024
+
+// On a multi-processor machine paragraphs are converted in worker threads,
+// in chunks of about this many characters.
+#define LOG2VIS_CHUNK_SIZE	(64*1024)
+#define LOG2VIS_MAX_THREADS	32
+// The reader stops reading when this many chunks per thread are waiting
+// to be converted or written.
+#define LOG2VIS_CHUNKS_PER_THREAD 2
+
+#ifdef HAVE_PTHREAD
+
+// Log2VisPool converts chunks of paragraphs to visual lines in worker
+// threads. The chunks may be done out of order, so the results wait in a
+// reorder buffer till take() hands them out in the order they were
+// submitted. The paragraphs' directions must be determined before they're
+// submitted: that's done sequentially, by Log2VisSource.
+
+class Log2VisPool {
+    struct chunk_t {
+	int seq;
+	std::vector<Paragraph *> parags;
+    };
+
+    EditBox *editbox;
+    const EditBox::Log2VisOptions &options;
+    std::vector<pthread_t> threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;	// signalled when a chunk is submitted
+    pthread_cond_t done_cond;	// signalled when a chunk is converted
+    std::deque<chunk_t *> queue;
+    std::map<int, std::vector<unistring> > results;
+    int next_seq;		// the number of the next chunk submitted
+    int next_out;		// the number of the next chunk handed out
+    bool quit;
+
+    static void *worker_thread(void *arg);
+    void work();
+
+public:
+    Log2VisPool(EditBox *aEditbox, const EditBox::Log2VisOptions &aOptions);
+    ~Log2VisPool();
+    bool start(int nthreads);
+    int threads_count() const { return threads.size(); }
+    void submit(std::vector<Paragraph *> &parags);
+    int in_flight() const { return next_seq - next_out; }
+    bool is_ready();
+    void take(std::vector<unistring> &lines);
+};
+
+Log2VisPool::Log2VisPool(EditBox *aEditbox,
+			 const EditBox::Log2VisOptions &aOptions)
+    : options(aOptions)
+{
+    editbox = aEditbox;
+    next_seq = 0;
+    next_out = 0;
+    quit = false;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+}
+
+Log2VisPool::~Log2VisPool()
+{
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&lock);
+    for (size_t i = 0; i < threads.size(); i++)
+	pthread_join(threads[i], NULL);
+
+    for (size_t i = 0; i < queue.size(); i++) {
+	for (size_t j = 0; j < queue[i]->parags.size(); j++)
+	    delete queue[i]->parags[j];
+	delete queue[i];
+    }
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&work_cond);
+    pthread_cond_destroy(&done_cond);
+}
+
+// start() - starts the workers. Returns false if none could be started.
+
+bool Log2VisPool::start(int nthreads)
+{
+    for (int i = 0; i < nthreads; i++) {
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, worker_thread, this) != 0)
+	    break;
+	threads.push_back(thread);
+    }
+    return !threads.empty();
+}
+
+void *Log2VisPool::worker_thread(void *arg)
+{
+    ((Log2VisPool *)arg)->work();
+    return NULL;
+}
+
+void Log2VisPool::work()
+{
+    EditBox::Log2VisBuffers bufs;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+	while (queue.empty() && !quit)
+	    pthread_cond_wait(&work_cond, &lock);
+	if (quit)
+	    break;
+	chunk_t *chunk = queue.front();
+	queue.pop_front();
+	pthread_mutex_unlock(&lock);
+
+	std::vector<unistring> visuals;
+	TRACE_BEGIN("log2vis/chunk");
+	for (size_t i = 0; i < chunk->parags.size(); i++) {
+	    editbox->log2vis_para(*chunk->parags[i], options, bufs, visuals);
+	    delete chunk->parags[i];
+	}
+	TRACE_END("log2vis/chunk");
+
+	pthread_mutex_lock(&lock);
+	results[chunk->seq].swap(visuals);
+	delete chunk;
+	pthread_cond_signal(&done_cond);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+// submit() - queues "parags" for conversion. The pool takes ownership of
+// the paragraphs; "parags" is emptied.
+
+void Log2VisPool::submit(std::vector<Paragraph *> &parags)
+{
+    chunk_t *chunk = new chunk_t;
+    chunk->parags.swap(parags);
+    pthread_mutex_lock(&lock);
+    chunk->seq = next_seq++;
+    queue.push_back(chunk);
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&lock);
+}
+
+// is_ready() - returns true if the next chunk in order is converted.
+
+bool Log2VisPool::is_ready()
+{
+    pthread_mutex_lock(&lock);
+    bool ready = results.find(next_out) != results.end();
+    pthread_mutex_unlock(&lock);
+    return ready;
+}
+
+// take() - waits for the next chunk in order and appends its visual lines
+// to "lines".
+
+void Log2VisPool::take(std::vector<unistring> &lines)
+{
+    pthread_mutex_lock(&lock);
+    std::map<int, std::vector<unistring> >::iterator it;
+    while ((it = results.find(next_out)) == results.end())
+	pthread_cond_wait(&done_cond, &lock);
+    std::vector<unistring> visuals;
+    visuals.swap(it->second);
+    results.erase(it);
+    next_out++;
+    pthread_mutex_unlock(&lock);
+
+    lines.insert(lines.end(), visuals.begin(), visuals.end());
+}
+
+#endif // HAVE_PTHREAD
+
+// Log2VisSource reads the text, splits it into paragraphs and converts them
+// to visual order, one paragraph at a time, as write_text() asks for more
+// text. So the memory we use doesn't depend on the size of the text.
+//
+// Like EditBox::log2vis(), we emit each visual line followed by a newline,
+// and we don't emit the last line if it's empty.
+
+class Log2VisPool;
+
+class Log2VisSource : public SaveSource {
+    EditBox *editbox;
+    EditBox::Log2VisOptions options;
+    EditBox::Log2VisBuffers bufs;
+    bool contextual;
+    Log2VisPool *pool;
+    std::vector<Paragraph *> chunk; // paragraphs not yet submitted to "pool"
+    idx_t chunk_size;
+
+    int fd;
+    FILE *pipe_stream;
+    bool is_stdin;
+    Converter *conv;
+    const char *encoding;
+    u8string effective_encoding;
+    char inbuf[CONVBUFSIZ];
+    size_t insize;
+    size_t buf_file_offset;
+    bool unconverted;	// inbuf holds data we haven't converted yet
+    bool at_end;	// no more input (or reading it failed)
+    bool failed;
+
+    std::vector<Paragraph *> parags;
+    bool prev_is_cr;
+    std::vector<Paragraph *> pending; // neutral paragraphs at the start
+    direction_t prev_strong;
+
+    std::vector<unistring> lines;
+    size_t cur_line;
+    idx_t line_pos;
+    bool done;		// "lines" holds the rest of the text
+
+    void fetch_lines();
+    void read_more();
+    void finish();
+    void add_paragraph(Paragraph *p);
+    void flush_pending(direction_t dir);
+    void emit(Paragraph *p);
+
+public:
+    Log2VisSource(EditBox *aEditbox, const char *aOptions);
+    virtual ~Log2VisSource();
+    bool open(const char *filename, const char *specified_encoding,
+	      const char *default_encoding);
+    void start_threads();
+    const char *get_encoding() const { return effective_encoding.c_str(); }
+    bool has_failed() const { return failed; }
+    virtual int get_text(const unichar **buf, int len);
+};
+
+Log2VisSource::Log2VisSource(EditBox *aEditbox, const char *aOptions)
+{
+    editbox = aEditbox;
+    EditBox::parse_log2vis_options(aOptions, options);
+    contextual = (editbox->get_dir_algo() == algoContextStrong
+		    || editbox->get_dir_algo() == algoContextRTL);
+    pool = NULL;
+    chunk_size = 0;
+    fd = -1;
+    pipe_stream = NULL;
+    is_stdin = false;
+    conv = NULL;
+    encoding = NULL;
+    insize = 0;
+    buf_file_offset = 0;
+    unconverted = false;
+    at_end = false;
+    failed = false;
+    prev_is_cr = false;
+    prev_strong = dirN;
+    cur_line = 0;
+    line_pos = 0;
+    done = false;
+}
+
+Log2VisSource::~Log2VisSource()
+{
+#ifdef HAVE_PTHREAD
+    if (pool)
+	delete pool;
+#endif
+    for (size_t i = 0; i < chunk.size(); i++)
+	delete chunk[i];
+    for (size_t i = 0; i < parags.size(); i++)
+	delete parags[i];
+    for (size_t i = 0; i < pending.size(); i++)
+	delete pending[i];
+    if (conv)
+	delete conv;
+    if (pipe_stream)
+	pclose(pipe_stream);
+    else if (fd != -1 && !is_stdin)
+	close(fd);
+}
+
+// start_threads() - converts the paragraphs in worker threads from now on,
+// if we have more than one processor.
+
+void Log2VisSource::start_threads()
+{
+#ifdef HAVE_PTHREAD
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 2)
+	return;
+    pool = new Log2VisPool(editbox, options);
+    if (!pool->start(MIN(ncpus, LOG2VIS_MAX_THREADS))) {
+	delete pool;
+	pool = NULL;
+    }
+#endif
+}
+
+// open() - opens the input, the way xload_file() does, and reads the first
+// chunk of it, from which we guess the encoding. The output encoding
+// defaults to the input encoding, so we have to know it before we start
+// writing.
+
+bool Log2VisSource::open(const char *filename,
+			 const char *specified_encoding,
+			 const char *default_encoding)
+{
+    if (filename[0] == '-' && filename[1] == '\0')
+	is_stdin = true;
+
+    if (filename[0] == '|' || filename[0] == '!') {
+	// we use UTF-8 for pipe communication
+	specified_encoding = "UTF-8";
+	pipe_stream = popen(filename + 1, "r");
+	if (pipe_stream == NULL) {
+	    set_last_error(errno);
+	    return false;
+	}
+	fd = fileno(pipe_stream);
+    } else {
+	if (is_stdin)
+	    fd = STDIN_FILENO;
+	else
+	    fd = ::open(filename, O_RDONLY);
+	if (fd == -1) {
+	    set_last_error(errno);
+	    return false;
+	}
+    }
+
+    if (specified_encoding && *specified_encoding)
+	effective_encoding = specified_encoding;
+    else
+	effective_encoding = default_encoding;
+
+    ssize_t nread;
+    do {
+	nread = read(fd, inbuf, sizeof(inbuf));
+    } while (nread == -1 && errno == EINTR);
+    if (nread == -1) {
+	set_last_error(errno);
+	return false;
+    }
+    if (nread == 0) {
+	finish();
+	return true;
+    }
+    insize = nread;
+    unconverted = true;
+
+    if (!specified_encoding || !*specified_encoding) {
+	bool looks_visual;
+	encoding = guess_file_encoding(fd, inbuf, insize, default_encoding,
+				       looks_visual);
+	if (!encoding)
+	    encoding = default_encoding;
+    } else {
+	encoding = specified_encoding;
+    }
+    conv = ConverterFactory::get_converter_from(encoding);
+    if (!conv) {
+	set_last_error(_("Conversion from '%s' not available"), encoding);
+	return false;
+    }
+    effective_encoding = encoding;
+    return true;
+}
+
+// read_more() - reads and converts the next chunk of input. This is the
+// loop body of xload_file(), but the text goes to build_paragraphs(), and
+// every paragraph that is complete is converted to visual lines.
+
+void Log2VisSource::read_more()
+{
+    unichar outbuf[CONVBUFSIZ+1];
+
+    if (!unconverted) {
+	ssize_t nread = read(fd, inbuf + insize, sizeof(inbuf) - insize);
+	if (nread == -1 && errno == EINTR)
+	    return;
+	if (nread == -1) {
+	    set_last_error(errno);
+	    failed = true;
+	    finish();
+	    return;
+	}
+	if (nread == 0) {
+	    // no more input
+	    finish();
+	    return;
+	}
+	insize += nread;
+    }
+    unconverted = false;
+
+    char *inptr = inbuf;
+    unichar *wrptr = outbuf;
+    int nconv = conv->convert(&wrptr, &inptr, insize);
+
+    editbox->build_paragraphs(parags, outbuf, wrptr - outbuf, prev_is_cr);
+    // the last paragraph may continue in the next chunk.
+    for (size_t i = 0; i + 1 < parags.size(); i++)
+	add_paragraph(parags[i]);
+    parags.erase(parags.begin(), parags.end() - 1);
+
+    if (nconv == -1) {
+	insize = inbuf + insize - inptr;
+	if (errno == EINVAL) {
+	    // incomplete byte sequence; the next read() will complete it.
+	    memmove(inbuf, inptr, insize);
+	} else {
+	    if (errno == EILSEQ)
+		set_last_error(_("'%s' conversion failed at position %d"),
+			encoding, buf_file_offset + (inptr - inbuf));
+	    else
+		set_last_error(_("'%s' conversion failed"), encoding);
+	    // we write the text up to the error.
+	    failed = true;
+	    finish();
+	}
+    } else {
+	insize = 0;
+    }
+    buf_file_offset += inptr - inbuf;
+}
+
+// finish() - converts the paragraphs left when the input ends (or when
+// reading it fails).
+
+void Log2VisSource::finish()
+{
+    at_end = true;
+    editbox->finish_paragraphs(parags, prev_is_cr);
+    for (size_t i = 0; i < parags.size(); i++)
+	add_paragraph(parags[i]);
+    parags.clear();
+    flush_pending(dirLTR);
+#ifdef HAVE_PTHREAD
+    if (pool && !chunk.empty())
+	pool->submit(chunk);
+#endif
+}
+
+// add_paragraph() - determines the contextual direction of a paragraph
+// and converts it, or puts it aside till we know its direction.
+
+void Log2VisSource::add_paragraph(Paragraph *p)
+{
+    if (!contextual) {
+	emit(p);
+    } else if (p->individual_base_dir != dirN) {
+	prev_strong = p->individual_base_dir;
+	flush_pending(prev_strong);
+	p->contextual_base_dir = prev_strong;
+	emit(p);
+    } else if (prev_strong != dirN) {
+	p->contextual_base_dir = prev_strong;
+	emit(p);
+    } else {
+	pending.push_back(p);
+	if (pending.size() > LOG2VIS_LOOKAHEAD) {
+	    prev_strong = dirLTR;
+	    flush_pending(prev_strong);
+	}
+    }
+}
+
+void Log2VisSource::flush_pending(direction_t dir)
+{
+    for (size_t i = 0; i < pending.size(); i++) {
+	pending[i]->contextual_base_dir = dir;
+	emit(pending[i]);
+    }
+    pending.clear();
+}
+
+void Log2VisSource::emit(Paragraph *p)
+{
+#ifdef HAVE_PTHREAD
+    if (pool) {
+	chunk.push_back(p);
+	chunk_size += p->str.len() + 1;
+	if (chunk_size >= LOG2VIS_CHUNK_SIZE) {
+	    pool->submit(chunk);
+	    chunk_size = 0;
+	}
+	return;
+    }
+#endif
+    editbox->log2vis_para(*p, options, bufs, lines);
+    delete p;
+}
+
+// fetch_lines() - appends more visual lines to "lines", or sets "done".
+
+void Log2VisSource::fetch_lines()
+{
+#ifdef HAVE_PTHREAD
+    if (pool) {
+	// we read on while the workers are busy, but we don't let too
+	// many chunks pile up.
+	if (pool->is_ready()) {
+	    pool->take(lines);
+	    return;
+	}
+	if (!at_end && pool->in_flight()
+		< LOG2VIS_CHUNKS_PER_THREAD * pool->threads_count()) {
+	    read_more();
+	    return;
+	}
+	if (pool->in_flight() > 0) {
+	    pool->take(lines);
+	    return;
+	}
+    }
+#endif
+    if (!at_end) {
+	read_more();
+	return;
+    }
+    done = true;
+    // skip the last empty line.
+    if (!lines.empty() && lines.back().empty())
+	lines.pop_back();
+}
+
+int Log2VisSource::get_text(const unichar **buf, int len)
+{
+    static const unichar newline = '\n';
+
+    while (1) {
+	// we hold back the last line till we know whether it's the last
+	// line of the text.
+	if (cur_line + 1 < lines.size()
+		|| (done && cur_line < lines.size())) {
+	    const unistring &line = lines[cur_line];
+	    if (line_pos < line.len()) {
+		len = MIN(len, line.len() - line_pos);
+		*buf = line.begin() + line_pos;
+		line_pos += len;
+		return len;
+	    }
+	    cur_line++;
+	    line_pos = 0;
+	    *buf = &newline;
+	    return 1;
+	}
+	if (done)
+	    return 0;
+	// drop the lines we've written.
+	lines.erase(lines.begin(), lines.begin() + cur_line);
+	cur_line = 0;
+	fetch_lines();
+    }
+}
+
+// xlog2vis_file() - the --log2vis mode: converts a file (or the standard
+// input, "-") to visual order and writes it to the standard output. Errors
+// in reading it are reported after we've written everything up to the
+// error; "output_failed" tells them apart from errors in writing.
+
+bool xlog2vis_file(EditBox *editbox,
+		   const char *filename,
+		   const char *specified_encoding,
+		   const char *default_encoding,
+		   const char *output_encoding,
+		   const char *options,
+		   bool &output_failed)
+{
+    TRACE_SCOPE("log2vis");
+    output_failed = false;
+    Log2VisSource source(editbox, options);
+    if (filename[0] == '|' || filename[0] == '!')
+	before_command();
+    if (!source.open(filename, specified_encoding, default_encoding))
+	return false;
+    source.start_threads();
+
+    if (!output_encoding || !*output_encoding)
+	output_encoding = source.get_encoding();
+    unichar offending_char;
+    if (!write_text(source, STDOUT_FILENO, output_encoding, offending_char)) {
+	output_failed = true;
+	return false;
+    }
+    return !source.has_failed();
+}
+
+// }}}
+
+// Background saving {{{
+
+#ifdef HAVE_PTHREAD
+
+// SnapshotSource is the TextSnapshot an AsyncSaver writes out. It refers
+// to the paragraphs of the buffer, which the writer thread reads while the
+// main thread may be modifying them, so both hold "lock": the main thread
+// while preserve() copies a paragraph it's about to modify, and the writer
+// thread while it copies a segment out of a paragraph. Paragraphs the
+// writer thread has already passed aren't copied.
+
+class SnapshotSource : public SaveSource, public TextSnapshot {
+
+    struct PreservedPara {
+	unistring str;
+	eop_t eop;
+    };
+
+    EditBox *editbox;
+    std::vector<const Paragraph *> parags;
+    std::map<int, PreservedPara> preserved;
+    pthread_mutex_t lock;	// guards the following
+    int curr;			// the paragraph the writer thread is at
+    idx_t pos;
+    unichar segment[CONVBUFSIZ];
+
+public:
+
+    SnapshotSource(EditBox *aEditbox) {
+	editbox = aEditbox;
+	curr = 0;
+	pos = 0;
+	pthread_mutex_init(&lock, NULL);
+	editbox->take_snapshot(this, parags);
+    }
+
+    virtual ~SnapshotSource() {
+	editbox->release_snapshot();
+	pthread_mutex_destroy(&lock);
+    }
+
+    virtual void preserve(int idx, const Paragraph &p) {
+	pthread_mutex_lock(&lock);
+	if (idx >= curr) {
+	    PreservedPara &copy = preserved[idx];
+	    copy.str = p.str;
+	    copy.eop = p.eop;
+	}
+	pthread_mutex_unlock(&lock);
+    }
+
+    virtual int get_text(const unichar **buf, int len);
+};
+
+// get_text() - copies the next segment of text, up to "len" characters of
+// the current paragraph or its EOP, into "segment".
+
+int SnapshotSource::get_text(const unichar **buf, int len)
+{
+    int n = 0;
+    pthread_mutex_lock(&lock);
+    while (n == 0 && curr < (int)parags.size()) {
+	std::map<int, PreservedPara>::iterator copy = preserved.find(curr);
+	const unistring &str = (copy != preserved.end())
+				    ? copy->second.str : parags[curr]->str;
+	eop_t eop = (copy != preserved.end())
+				    ? copy->second.eop : parags[curr]->eop;
+	if (pos < str.len()) {
+	    n = MIN(len, str.len() - pos);
+	    memcpy(segment, str.begin() + pos, n * sizeof(unichar));
+	    pos += n;
+	} else {
+	    switch (eop) {
+	    case eopDOS:	segment[n++] = '\r'; segment[n++] = '\n'; break;
+	    case eopMac:	segment[n++] = '\r'; break;
+	    case eopUnix:	segment[n++] = '\n'; break;
+	    case eopUnicode:	segment[n++] = UNICODE_PS; break;
+	    case eopNone:	break;
+	    }
+	    if (copy != preserved.end())
+		preserved.erase(copy);
+	    curr++;
+	    pos = 0;
+	}
+    }
+    pthread_mutex_unlock(&lock);
+    *buf = segment;
+    return n;
+}
+
+// start() - takes a snapshot of the buffer and starts writing it to
+// "filename" on a thread of its own. Returns NULL if the file can't be
+// saved in the background (pipes and stdout are written in the
+// foreground).
+//
+// The snapshot is copy-on-write (see SnapshotSource), so taking it costs a
+// pointer per paragraph; only the paragraphs the user modifies before the
+// writer thread gets to them are copied.
+
+AsyncSaver *AsyncSaver::start(EditBox *editbox,
+			      const char *filename,
+			      const char *encoding,
+			      const char *backup_suffix)
+{
+    if ((filename[0] == '-' && filename[1] == '\0')
+	    || filename[0] == '|' || filename[0] == '!')
+	return NULL;
+
+    AsyncSaver *saver = new AsyncSaver();
+    saver->filename = filename;
+    saver->encoding = encoding;
+    if (backup_suffix)
+	saver->backup_suffix = backup_suffix;
+    saver->done = false;
+    saver->result = false;
+    saver->offending_char = 0;
+
+    TRACE_BEGIN("save/snapshot");
+    saver->snapshot = new SnapshotSource(editbox);
+    TRACE_END("save/snapshot");
+
+    pthread_mutex_init(&saver->lock, NULL);
+
+    // Signals should be handled by the main thread.
+    sigset_t all, orig;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &orig);
+    int rslt = pthread_create(&saver->writer, NULL, writer_thread, saver);
+    pthread_sigmask(SIG_SETMASK, &orig, NULL);
+    if (rslt != 0) {
+	pthread_mutex_destroy(&saver->lock);
+	delete saver->snapshot;
+	delete saver;
+	return NULL;
+    }
+    return saver;
+}
+
+void *AsyncSaver::writer_thread(void *arg)
+{
+    TRACE_SCOPE("save/write");
+    AsyncSaver *saver = (AsyncSaver *)arg;
+    unichar offending_char = 0;
+    bool result = write_file(*saver->snapshot, saver->filename.c_str(),
+			     saver->encoding.c_str(),
+			     saver->backup_suffix.c_str(),
+			     offending_char, true);
+    pthread_mutex_lock(&saver->lock);
+    saver->result = result;
+    if (!result)
+	saver->error = get_last_error();
+    saver->offending_char = offending_char;
+    saver->done = true;
+    pthread_mutex_unlock(&saver->lock);
+    MainLoop::wake();
+    return NULL;
+}
+
+bool AsyncSaver::is_done()
+{
+    pthread_mutex_lock(&lock);
+    bool value = done;
+    pthread_mutex_unlock(&lock);
+    return value;
+}
+
+// finish() - waits for the writer thread. Returns false if saving failed;
+// the error can be retrieved with get_last_error().
+
+bool AsyncSaver::finish(unichar &offending_char)
+{
+    pthread_join(writer, NULL);
+    pthread_mutex_destroy(&lock);
+    delete snapshot;
+    snapshot = NULL;
+    offending_char = this->offending_char;
+    if (!result)
+	set_last_error("%s", error.c_str());
+    return result;
+}
+
+#else
+
+// Without threads start() always fails, so the other methods are never
+// called.
+
+AsyncSaver *AsyncSaver::start(EditBox *editbox,
+			      const char *filename,
+			      const char *encoding,
+			      const char *backup_suffix)
+{
+    return NULL;
+}
+
+bool AsyncSaver::is_done() { return true; }
+bool AsyncSaver::finish(unichar &offending_char) { return false; }
+
+#endif // HAVE_PTHREAD
+
+// }}}
+
 // has_prog() returns true if progname is in the PATH and is executable.
 
 bool has_prog(const char *progname)
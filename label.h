@@ -18,11 +18,11 @@
 #define BDE_LABEL_H
 
 #include "types.h"
-#include "widget.h"
+#include "curses_widget.h"
 
 // Label is a simple widget that displays a string
 
-class Label : public Widget {
+class Label : public CursesWidget {
 
     u8string text;
     bool dirty;
@@ -21,11 +21,16 @@
 #include "pathnames.h"
 #include "terminal.h"
 #include "editor.h"
+#include "event.h"  // record_events, replay_events
+#include "stats.h"
+#include "speller_broker.h"
+#include "trace.h"
 #include "themes.h"
 #include "directvect.h"
 #include "dbg.h"
 
 #include <string.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h> // strtol
 #include <ctype.h>  // isspace
@@ -64,6 +69,24 @@ static bool get_bool(const char *optname, const u8string &arg)
     return result;
 }
 
+// write_stats() - dumps the performance counters on exit, to the file
+// given with --stats-file.
+
+static const char *stats_file = NULL;
+
+static void write_stats()
+{
+    if (strcmp(stats_file, "-") == 0) {
+	dump_perf_stats(stderr);
+    } else {
+	FILE *fp = fopen(stats_file, "w");
+	if (fp) {
+	    dump_perf_stats(fp);
+	    fclose(fp);
+	}
+    }
+}
+
 static void help()
 {
     printf(_("Usage: %s [options] [[+LINE] file]\n"), PACKAGE);
@@ -154,7 +177,12 @@ static void help()
 	"                               communicate with the speller.\n"
 	"                               (default: ISO-8859-1)\n"
 	"  (if hspell is found, and no speller command is specified, Geresh\n"
-	"   will use it using the correct configuration automatically.)\n"));
+	"   will use it using the correct configuration automatically.)\n"
+	"  (use \"dict:FILE\" as the command to look the words up, in-process,\n"
+	"   in FILE, a word list with one word per line. -X gives its encoding.)\n"
+	"  -N, --speller-broker MINUTES Share one speller among all the Geresh\n"
+	"                               instances; it exits after MINUTES with\n"
+	"                               none. (default: 0, don't share)\n"));
 	
     printf(_("\nLog2Vis:\n"
 	"  -p, --log2vis                log2vis mode.\n"
@@ -187,6 +215,16 @@ static void help()
 	"  -L, --visual-cursor BOOL     Visual cursor movement\n"
 	"                               (default: off)\n"
 	"  +LINE                        Go to line LINE\n"
+	"  -r, --record-events FILE     Log the keys you press to FILE\n"
+	"  -y, --replay-events FILE     Replay the keys logged in FILE, then\n"
+	"                               print how long they took to handle\n"
+	"  -z, --replay-terminal COLSxLINES\n"
+	"                               Replay on a virtual terminal of this\n"
+	"                               size, not on the real one\n"
+	"  -O, --stats-file FILE        Write the performance counters to FILE\n"
+	"                               on exit (\"-\" means stderr)\n"
+	"  -K, --trace-file FILE        Write a timeline of the editor's work\n"
+	"                               to FILE, in Chrome's trace format\n"
 	"  -V, --version                Print version info and editor capabilities\n"
 	"  -h, --help                   Print usage information\n"));
 
@@ -246,6 +284,11 @@ static bool parse_rc_file(ArgsList &arguments, const char *filename)
 
 int main(int argc, char *argv[])
 {
+    // A speller broker is Geresh executed with these special arguments.
+    if (argc > 1 && strcmp(argv[1], SPELLER_BROKER_ARG) == 0)
+	return run_speller_broker(argc - 2, argv + 2);
+    set_speller_broker_program(argv[0]);
+
     set_debug_level(getenv("GERESH_DEBUG_LEVEL")
 			? atoi(getenv("GERESH_DEBUG_LEVEL")) : 0);
     
@@ -368,10 +411,17 @@ int main(int argc, char *argv[])
 	    *speller_cmd      = ""; // "ispell -a";
     const char
 	    *speller_encoding = ""; // "ISO-8859-1";
+    int	    speller_broker = 0;
     const char
 	    *external_editor  = "";
     const char
 	    *theme = NULL;
+    const char
+	    *record_events_file = NULL;
+    const char
+	    *replay_events_file = NULL;
+    const char
+	    *trace_file = NULL;
     bool syntax_auto_detection = true;
     bool underline = true;
     bool visual_cursor_movement = false;
@@ -415,6 +465,7 @@ int main(int argc, char *argv[])
 	{ "log2vis-options",  1, 0, 'E' },
 	{ "speller-cmd",      1, 0, 'Z' },
 	{ "speller-encoding", 1, 0, 'X' },
+	{ "speller-broker",   1, 0, 'N' },
 	{ "graphical-boxes",  1, 0, 'Y' },
 	{ "scrollbar",	      1, 0, 'Q' },
 	{ "bidi",	      1, 0, 'D' },
@@ -423,6 +474,11 @@ int main(int argc, char *argv[])
 	{ "visual-cursor",    1, 0, 'L' },
 	{ "theme",	      1, 0, 'g' },
 	{ "external-editor",  1, 0, 'x' },
+	{ "record-events",    1, 0, 'r' },
+	{ "replay-events",    1, 0, 'y' },
+	{ "replay-terminal",  1, 0, 'z' },
+	{ "stats-file",       1, 0, 'O' },
+	{ "trace-file",       1, 0, 'K' },
 	{0, 0, 0, 0}
     };
 #endif
@@ -430,7 +486,7 @@ int main(int argc, char *argv[])
     if (getenv("COLUMNS"))
 	non_interactive_text_width = atoi(getenv("COLUMNS"));
 
-    const char *short_options = "T:e:J:W:w:a:A:k:S:s:u:j:i:P:M:m:c:n:q:f:F:C:H:RvB:b:Vhpt:E:Z:X:Y:Q:D:G:g:U:L:x:";
+    const char *short_options = "T:e:J:W:w:a:A:k:S:s:u:j:i:P:M:m:c:n:q:f:F:C:H:RvB:b:Vhpt:E:Z:X:N:Y:Q:D:G:g:U:L:x:r:y:z:O:K:";
     int c;
 #ifdef HAVE_GETOPT_LONG
     int long_idx = -1;
@@ -611,8 +667,22 @@ int main(int argc, char *argv[])
 	case 'w': non_interactive_text_width = GET_NUM(0, 9999); break;	
 	case 'Z': speller_cmd = optarg; break;
 	case 'X': speller_encoding = optarg; break;
+	case 'N': speller_broker = GET_NUM(0, 99999); break;
 	case 'g': theme = optarg; break;
 	case 'x': external_editor = optarg; break;
+	case 'r': record_events_file = optarg; break;
+	case 'y': replay_events_file = optarg; break;
+	case 'O': stats_file = optarg; break;
+	case 'K': trace_file = optarg; break;
+	case 'z':
+		if (sscanf(optarg, "%dx%d", &terminal::virtual_columns,
+			   &terminal::virtual_lines) != 2
+			|| terminal::virtual_columns <= 0
+			|| terminal::virtual_lines <= 0)
+		    fatal(_("Invalid argument for option `%s'. "
+			    "Valid argument is of the form COLSxLINES\n"),
+			  optname.c_str());
+		break;
 	case 'V': print_version_flag = true; break;
 	case 'h': help(); break;
 	case '?':
@@ -694,7 +764,20 @@ int main(int argc, char *argv[])
 	exit(0);
     }
 
+    if (trace_file && !start_tracing(trace_file))
+	fatal(_("Can't open %s: %s\n"), trace_file, strerror(errno));
+
     if (!do_log2vis) {
+	if (record_events_file && !record_events(record_events_file))
+	    fatal(_("Can't open %s: %s\n"), record_events_file,
+		  strerror(errno));
+	if (replay_events_file && !replay_events(replay_events_file))
+	    fatal(_("Can't open %s: %s\n"), replay_events_file,
+		  strerror(errno));
+	if (!replay_events_file)
+	    terminal::virtual_lines = terminal::virtual_columns = 0;
+	if (stats_file)
+	    atexit(write_stats);
 	terminal::init();
 	if (bw_flag)
 	    terminal::is_color = false;
@@ -742,6 +825,7 @@ int main(int argc, char *argv[])
     bde.set_speller_cmd(speller_cmd);
     bde.set_speller_encoding(speller_encoding);
     bde.adjust_speller_cmd();
+    bde.set_speller_broker(speller_broker);
     bde.set_external_editor(external_editor);
     bde.set_scrollbar_pos(scrollbar_pos);
     bde.enable_bidi(enable_bidi);
@@ -778,18 +862,6 @@ int main(int argc, char *argv[])
 
     if (do_log2vis) {
 	bde.set_non_interactive_text_width(non_interactive_text_width);
-	if (filename) {
-	    bde.load_file(filename, file_encoding);
-	    if (bde.is_new()) {
-		// a crude method to print an error message
-		// when the file does not exist.
-		bde.insert_file(filename, file_encoding);
-	    }
-	} else {
-	    bde.load_file("-", file_encoding);
-	}
-	if (log2vis_output_encoding)
-	    bde.set_encoding(log2vis_output_encoding);
     } else {
 	if (filename)
 	    bde.load_file(filename, file_encoding);
@@ -806,9 +878,13 @@ int main(int argc, char *argv[])
 
     if (!do_log2vis) {
 	bde.exec();
+	if (is_replaying_events())
+	    end_event_replay(); // prints the latencies
     } else {
-	bde.log2vis(log2vis_options);
-	bde.save_file("-", bde.get_encoding());
+	// the text is converted as it's read, so we don't need to hold
+	// all of it in memory.
+	bde.log2vis(filename ? filename : "-", file_encoding,
+		    log2vis_output_encoding, log2vis_options);
     }
 
     if (!do_log2vis) {
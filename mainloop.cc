@@ -0,0 +1,248 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+
+#include <config.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <vector>
+
+#include "mainloop.h"
+#include "stats.h"
+
+struct FdSource {
+    int fd;
+    fd_func_t func;
+    void *data;
+};
+
+struct Task {
+    task_func_t func;
+    void *data;
+    double due;		// perf_now_msecs() time
+};
+
+static std::vector<FdSource> fd_sources;
+static std::vector<Task> tasks;
+
+// wake() writes to this pipe, and iterate() polls its other end. It's
+// created on first use (by the main thread).
+static int wake_pipe[2] = { -1, -1 };
+
+static void create_wake_pipe()
+{
+    if (wake_pipe[0] != -1 || pipe(wake_pipe) == -1)
+	return;
+    for (int i = 0; i < 2; i++) {
+	fcntl(wake_pipe[i], F_SETFL, fcntl(wake_pipe[i], F_GETFL) | O_NONBLOCK);
+	fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC); // not for the speller
+    }
+}
+
+void MainLoop::add_fd(int fd, fd_func_t func, void *data)
+{
+    create_wake_pipe();
+    remove_fd(fd);
+    FdSource src;
+    src.fd = fd;
+    src.func = func;
+    src.data = data;
+    fd_sources.push_back(src);
+}
+
+void MainLoop::remove_fd(int fd)
+{
+    for (size_t i = 0; i < fd_sources.size(); i++)
+	if (fd_sources[i].fd == fd) {
+	    fd_sources.erase(fd_sources.begin() + i);
+	    return;
+	}
+}
+
+static int find_task(task_func_t func, void *data)
+{
+    for (size_t i = 0; i < tasks.size(); i++)
+	if (tasks[i].func == func && tasks[i].data == data)
+	    return i;
+    return -1;
+}
+
+// add_task() - makes the task due in "msecs" milliseconds. If it's already
+// there and due sooner, it's left alone.
+
+void MainLoop::add_task(task_func_t func, void *data, int msecs)
+{
+    create_wake_pipe();
+    double due = perf_now_msecs() + msecs;
+    int i = find_task(func, data);
+    if (i != -1) {
+	if (due < tasks[i].due)
+	    tasks[i].due = due;
+    } else {
+	Task task;
+	task.func = func;
+	task.data = data;
+	task.due = due;
+	tasks.push_back(task);
+    }
+}
+
+void MainLoop::remove_task(task_func_t func, void *data)
+{
+    int i = find_task(func, data);
+    if (i != -1)
+	tasks.erase(tasks.begin() + i);
+}
+
+// wake() - may be called from any thread, and from signal handlers.
+
+void MainLoop::wake()
+{
+    if (wake_pipe[1] != -1) {
+	int serrno = errno;
+	char c = 0;
+	ssize_t n;
+	do {
+	    n = write(wake_pipe[1], &c, 1);
+	} while (n == -1 && errno == EINTR);
+	// EAGAIN means the pipe is full, so iterate() will wake up anyway.
+	// Nothing else is expected of our own pipe, and a signal handler
+	// couldn't report it.
+	errno = serrno;
+    }
+}
+
+// run_due_tasks() - calls the tasks that are due, till TASK_BUDGET_MSECS
+// have passed. A task that was called is moved to the end of the list, so
+// the ones left for the next round are called first then. Returns false if
+// none was due.
+
+static bool run_due_tasks()
+{
+    double start = perf_now_msecs();
+    std::vector<Task> due;
+    for (size_t i = 0; i < tasks.size(); i++)
+	if (tasks[i].due <= start)
+	    due.push_back(tasks[i]);
+
+    for (size_t i = 0; i < due.size(); i++) {
+	if (i > 0 && perf_now_msecs() - start >= TASK_BUDGET_MSECS)
+	    break;
+	// a task may add or remove tasks, so we look it up again.
+	if (find_task(due[i].func, due[i].data) == -1)
+	    continue;
+	int msecs = due[i].func(due[i].data);
+	PERF_COUNT(loop_tasks, 1);
+	int idx = find_task(due[i].func, due[i].data);
+	if (idx == -1)
+	    continue; // it has removed itself.
+	Task task = tasks[idx];
+	tasks.erase(tasks.begin() + idx);
+	if (msecs != TASK_DONE) {
+	    task.due = perf_now_msecs() + msecs;
+	    tasks.push_back(task);
+	}
+    }
+    return !due.empty();
+}
+
+// iterate() - waits till there's something to read on "input_fd" (the
+// terminal), or some background work to do, which it then does. Returns
+// true when there's input, and false after it has done some work (so that
+// the caller can update the screen). Input comes first: we don't start any
+// work once the user has typed.
+//
+// When "input_fd" is -1 (e.g. when replaying events), we wait only for
+// tasks. File descriptors are only checked, never waited for: the work
+// the replayed idle line stands for may have been done already, and the
+// speller, say, may have nothing more to send.
+//
+// A signal also makes us return false. In particular, curses turns a
+// SIGWINCH into KEY_RESIZE only when it's asked for a key.
+
+bool MainLoop::iterate(int input_fd)
+{
+    create_wake_pipe();
+    std::vector<struct pollfd> fds;
+
+    while (1) {
+	bool check_only = (input_fd == -1 && tasks.empty());
+
+	double now = perf_now_msecs();
+	int timeout = check_only ? 0 : -1;
+	for (size_t i = 0; i < tasks.size(); i++) {
+	    int msecs = (tasks[i].due > now) ? (int)(tasks[i].due - now) + 1 : 0;
+	    if (timeout == -1 || msecs < timeout)
+		timeout = msecs;
+	}
+
+	fds.clear();
+	struct pollfd pfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (input_fd != -1) {
+	    pfd.fd = input_fd;
+	    fds.push_back(pfd);
+	}
+	if (wake_pipe[0] != -1) {
+	    pfd.fd = wake_pipe[0];
+	    fds.push_back(pfd);
+	}
+	size_t first_source = fds.size();
+	for (size_t i = 0; i < fd_sources.size(); i++) {
+	    pfd.fd = fd_sources[i].fd;
+	    fds.push_back(pfd);
+	}
+
+	if (poll(&fds[0], fds.size(), timeout) == -1) {
+	    if (errno == EINTR)
+		return false; // e.g. SIGWINCH
+	    return input_fd != -1; // let the caller block in the read.
+	}
+
+	if (input_fd != -1 && fds[0].revents)
+	    return true;
+	if (wake_pipe[0] != -1 && fds[first_source - 1].revents) {
+	    char buf[64];
+	    while (read(wake_pipe[0], buf, sizeof(buf)) > 0)
+		;
+	    now = perf_now_msecs();
+	    for (size_t i = 0; i < tasks.size(); i++)
+		if (tasks[i].due > now)
+		    tasks[i].due = now;
+	}
+
+	bool worked = false;
+	for (size_t i = first_source; i < fds.size(); i++) {
+	    if (!fds[i].revents)
+		continue;
+	    // a handler may add or remove sources, so we look it up again.
+	    for (size_t j = 0; j < fd_sources.size(); j++)
+		if (fd_sources[j].fd == fds[i].fd) {
+		    fd_sources[j].func(fds[i].fd, fd_sources[j].data);
+		    worked = true;
+		    break;
+		}
+	}
+	if (run_due_tasks())
+	    worked = true;
+	if (worked || check_only)
+	    return false;
+    }
+}
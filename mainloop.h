@@ -0,0 +1,61 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+
+#ifndef BDE_MAINLOOP_H
+#define BDE_MAINLOOP_H
+
+// The main loop runs the editor's background work -- progressive loading,
+// background saving, background spell checking -- while it waits for the
+// user to type. Editor::exec() calls it (through wait_for_event(), see
+// event.cc) whenever it has nothing else to do.
+//
+// The work comes from two kinds of sources:
+//
+// - File descriptors (e.g. a speller's output), whose handler is called
+//   when there's something to read.
+//
+// - Tasks: a task is called when it's due and returns when it should be
+//   called again: 0 for as soon as possible, N for in N milliseconds, or
+//   TASK_DONE when it has no more work. A task should do a bounded amount
+//   of work each time; the loop calls no more tasks in a round than fit in
+//   TASK_BUDGET_MSECS, and then lets the user's keys and the screen update
+//   come first.
+//
+// wake() makes all the tasks due at once. Other threads, and signal
+// handlers, call it to tell us there's new work (e.g. new text to load).
+
+#define TASK_DONE	    -1
+#define TASK_BUDGET_MSECS   10
+
+typedef int (*task_func_t)(void *data);
+typedef void (*fd_func_t)(int fd, void *data);
+
+class MainLoop {
+
+public:
+
+    static void add_fd(int fd, fd_func_t func, void *data);
+    static void remove_fd(int fd);
+
+    static void add_task(task_func_t func, void *data, int msecs = 0);
+    static void remove_task(task_func_t func, void *data);
+
+    static void wake();
+    static bool iterate(int input_fd);
+};
+
+#endif
@@ -57,6 +57,8 @@
 #define STT_BIDI	    1013
 #define STT_UNDERLINE	    1014
 #define STT_SYNAUTO	    1015
+#define STT_STATSREPORT	    1016
+#define STT_BGSPELLING	    1017
 
 #define STT_EOPUNIX	    5001
 #define STT_EOPDOS	    5002
@@ -358,6 +360,7 @@ PulldownMenu CharactersUtilsMenu = {
     { "xxx", HELP_ITEM, 0, 0, CMD_HELP, 0, HELP_TOPIC_ENCODING_STR },
     { "-----------" },
     { "toggle_alt_kbd", N_("Toogle ~Hebrew keyboard emulation"), STT_ALTKBD },
+    { "retype_selection_alt_kbd", N_("~Retype the selection with the Hebrew keyboard") },
     { "toggle_smart_typing", N_("Toggle ~smart-typing mode"), STT_SMRT },
     { "set_translate_next_char", N_("~Translate next character") },
     { "-----------" },
@@ -397,6 +400,7 @@ PulldownMenu SpellerMenu = {
     { "spell_check_all", N_("Spell check all ~document") },
     { "spell_check_forward", N_("Spell check ~from cursor onward") },
     { "spell_check_word", N_("Spell check ~word under cursor") },
+    { "toggle_background_spelling", N_("Check spelling in the ~background"), STT_BGSPELLING },
     { "-----------" },
     { "load_unload_speller", N_("Explicitly ~load/unload the speller process..."), STT_SPELLERLOADED },
     { NULL }
@@ -474,6 +478,7 @@ PulldownMenu DisplayMenu = {
     { "toggle_wrap", N_("Change ~wrap style"), 0, WrapMenu },
     { "xxx", N_("~Scrollbar"), 0, ScrollbarMenu },
     { "toggle_cursor_position_report", N_("Toggle display of cursor p~osition"), STT_CURSORREPORT },
+    { "toggle_stats_report", N_("Toggle display of p~erformance counters"), STT_STATSREPORT },
     { "change_scroll_step", N_("Change the scroll step...") },
     { "-----------" },
     { "xxx", N_("~Color scheme"), 0, ColorScheme },
@@ -566,6 +571,7 @@ bool MMPopupMenu::get_item_state(int id)
     case STT_ARABICSHAPING: return terminal::do_arabic_shaping;
     case STT_FORMATMARKS:   return editbox->has_formatting_marks();
     case STT_CURSORREPORT:  return editor->is_cursor_position_report();
+    case STT_STATSREPORT:   return editor->is_stats_report();
     case STT_READONLY:	    return editbox->is_read_only();
 #ifdef HAVE_CURS_SET
     case STT_BIGCURSOR:	    return editor->is_big_cursor();
@@ -598,6 +604,7 @@ bool MMPopupMenu::get_item_state(int id)
     case STT_DIRALGOFRTL:	return editbox->get_dir_algo() == algoForceRTL;
 
     case STT_SPELLERLOADED:	return editor->is_speller_loaded();
+    case STT_BGSPELLING:	return editor->is_background_spelling();
 
     case STT_SCRLBRNONE:    return editor->get_scrollbar_pos() == Editor::scrlbrNone;
     case STT_SCRLBRLEFT:    return editor->get_scrollbar_pos() == Editor::scrlbrLeft;
@@ -17,6 +17,7 @@
 #include <config.h>
 
 #include "scrollbar.h"
+#include "editbox.h"
 #include "themes.h"
 
 Scrollbar::Scrollbar()
@@ -53,6 +54,15 @@ void Scrollbar::set_page_pos(int pos)
     }
 }
 
+// sync_to() - makes the scrollbar show the position of the EditBox.
+
+void Scrollbar::sync_to(const EditBox &editbox)
+{
+    set_total_size(editbox.get_number_of_paragraphs());
+    set_page_size(editbox.window_height());
+    set_page_pos(editbox.get_top_paragraph());
+}
+
 void Scrollbar::update()
 {
     if (!dirty)
@@ -18,9 +18,11 @@
 #define BDE_SCROLLBAR_H
 
 #include "types.h"
-#include "widget.h"
+#include "curses_widget.h"
 
-class Scrollbar : public Widget {
+class EditBox;
+
+class Scrollbar : public CursesWidget {
 
 protected:
 
@@ -35,6 +37,7 @@ public:
     void set_total_size(int sz);
     void set_page_size(int sz);
     void set_page_pos(int pos);
+    void sync_to(const EditBox &editbox);
     
     virtual void update();
     virtual void invalidate_view() { dirty = true; }
@@ -18,7 +18,7 @@
 #define BDE_SHAPING_H
 
 #include "types.h"
-#include "widget.h" // typedef attribute_t
+#include "canvas.h" // typedef attribute_t
 
 int shape(unichar *s, int len, attribute_t *attributes = NULL);
 
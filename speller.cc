@@ -1,13 +1,47 @@
 #include <unistd.h>	// exec, pipe, fork...
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <wctype.h>
 #include <algorithm>	// std::sort
+#include <deque>
+#include <set>
 
 #include "speller.h"
 #include "mk_wcwidth.h"
 #include "converters.h"
 #include "editor.h"
 #include "dialogline.h"
+#include "geresh_io.h" // set_command_hook
+#include "trace.h"
+#include "stats.h"
+#include "dictionary.h"
+#include "speller_broker.h"
+#include "bidi.h"
+#include "mainloop.h"
 #include "dbg.h"
 
+// The most paragraphs, and bytes, we send the speller ahead of the
+// paragraph we're checking.
+#define SPELLER_MAX_IN_FLIGHT	256
+#define SPELLER_MAX_OUTPUT	(64*1024)
+// How much we read from the speller at once.
+#define SPELLER_READ_SIZE	16384
+// The progress message is updated every this many paragraphs.
+#define SPELLER_PROGRESS_STEP	64
+// How many paragraphs the background spell checker looks at in one go.
+#define SPELLER_SWEEP_STEP	4096
+// While the background spell checker waits for replies, it's woken up as
+// they come, but it also checks every this many milliseconds.
+#define SPELLER_WAIT_MSECS	100
+// The most words, and characters, we send the speller on one line.
+#define SPELLER_BATCH_WORDS	64
+#define SPELLER_BATCH_CHARS	1024
+// The word cache is cleared when it holds more words than this.
+#define SPELLER_CACHE_MAX	200000
+// The most suggestions the built-in speller offers for a word.
+#define SPELLER_MAX_SUGGESTIONS	12
+
 // A Correction class encapsulates an incorrect word, its position
 // in the text, and a list of seggested corrections.
 
@@ -333,7 +367,7 @@ MenuResult SpellerWnd::exec_correction_menu(Correction &crctn)
     while (!finished) {
 	Event evt;
 	app.update_terminal();
-	get_next_event(evt, editbox.wnd);
+	get_next_event(evt, curses_window(&editbox));
 	handle_event(evt);
     }
     return menu_result;
@@ -365,11 +399,22 @@ Speller::Speller(Editor &aApp, DialogLine &aDialog) :
     dialog(aDialog)
 {
     loaded = false;
+    broker_idle_minutes = 0;
+    dict = NULL;
+    background = false;
+    bg_editbox = NULL;
+    bg_idle = true;
+    bg_lost = false;
+    bg_sweep = 0;
+    bg_clean = 0;
+    cache_gen = 0;
     global_speller_instance = this;
+    set_command_hook(UNLOAD_SPELLER);
 }
 
-// load() - loads the speller. it forks and execs the speller. it setups
-// pipes for communication.
+// load() - loads the speller. it forks and execs the speller, or
+// connects to the speller broker that runs it. it setups pipes for
+// communication.
 //
 // Warning: the code is not foolproof! it expects the child process to
 // print an identity string. if the child prints nothing, this function
@@ -390,36 +435,32 @@ bool Speller::load(const char *cmd, const char *encoding)
     }
     conv_to_speller->enable_ilseq_repr();
 
+    if (strncmp(cmd, BUILTIN_SPELLER_PREFIX,
+		strlen(BUILTIN_SPELLER_PREFIX)) == 0)
+	return load_dictionary(cmd + strlen(BUILTIN_SPELLER_PREFIX));
+
     dialog.show_message(_("Loading speller..."));
     dialog.immediate_update();
 
-    if (pipe(fd_to_spl) < 0 || pipe(fd_from_spl) < 0) {
-	dialog.show_message(_("pipe() error"));
+    int sock = -1;
+    if (broker_idle_minutes > 0)
+	sock = connect_speller_broker(cmd, broker_idle_minutes);
+    if (sock >= 0) {
+	fd_to_spl = fd_from_spl = sock;
+    } else if (spawn_speller(cmd, fd_to_spl, fd_from_spl) < 0) {
+	dialog.show_message_fmt(_("Can't start the speller: %s"),
+				strerror(errno));
 	return false;
     }
-    pid_t pid;
-    if ((pid = fork()) < 0) {
-	dialog.show_message(_("fork() error"));
-	return false;
-    }
-    if (pid == 0) {
-	DISABLE_SIGTSTP();
-	// we're in the child.
-	dup2(fd_to_spl[0],   STDIN_FILENO);
-	dup2(fd_from_spl[1], STDOUT_FILENO);
-	dup2(fd_from_spl[1], STDERR_FILENO);
-
-	close(fd_from_spl[0]); close(fd_to_spl[0]);
-	close(fd_from_spl[1]); close(fd_to_spl[1]);
 
-	execlp("/bin/sh", "sh", "-c", cmd, NULL);
-
-	// write the error back to the parent
-	u8string err;
-	err.cformat(_("Error %d (%s)\n"), errno, strerror(errno));
-	write(STDOUT_FILENO, err.c_str(), err.size());
-	exit(1);
-    }
+    fcntl(fd_to_spl,   F_SETFL, fcntl(fd_to_spl,   F_GETFL) | O_NONBLOCK);
+    fcntl(fd_from_spl, F_SETFL, fcntl(fd_from_spl, F_GETFL) | O_NONBLOCK);
+    MainLoop::add_fd(fd_from_spl, speller_output_handler, this);
+    input.clear();
+    input_pos = 0;
+    output.clear();
+    bg_terse = false;
+    wake_background();
 
     dialog.show_message(_("Waiting for the speller to finish loading..."));
     dialog.immediate_update();
@@ -429,15 +470,14 @@ bool Speller::load(const char *cmd, const char *encoding)
     if (identity.c_str()[0] != '@') {
 	dialog.show_message_fmt(_("Error: Not a speller: %s"),
 				identity.c_str());
+	loaded = true; // so that unload() closes the pipes.
 	unload();
 	return false;
     } else {   
-	// display the speller identity for a brief moment.
-	dialog.show_message(identity.c_str());
-	dialog.immediate_update();
-	sleep(1);
 	write_line("@ActivateExtendedProtocol\n"); // for future extensions :-)
-	dialog.show_message(_("Speller loaded OK."));
+	// display the speller identity instead of pausing to show it.
+	dialog.show_message_fmt(_("Speller loaded OK: %s"),
+		identity.c_str() + strspn(identity.c_str(), "@(#) "));
 	loaded = true;
 	return true;
     }
@@ -446,8 +486,26 @@ bool Speller::load(const char *cmd, const char *encoding)
 void Speller::unload()
 {
     if (loaded) {
-	close(fd_from_spl[0]); close(fd_to_spl[0]);
-	close(fd_from_spl[1]); close(fd_to_spl[1]);
+	if (!dict)
+	    flush_output(); // e.g. the "save the dictionary" command.
+	if (!bg_in_flight.empty()) {
+	    bg_in_flight.clear();
+	    bg_stamps.clear();
+	    bg_lost = true;
+	}
+	// another speller may judge the words differently.
+	word_cache.clear();
+	batch = Batch();
+	batches.clear();
+	if (dict) {
+	    delete dict;
+	    dict = NULL;
+	} else {
+	    MainLoop::remove_fd(fd_from_spl);
+	    close(fd_from_spl);
+	    if (fd_to_spl != fd_from_spl)
+		close(fd_to_spl);
+	}
 	delete conv_to_speller;
 	delete conv_from_speller;
 	loaded = false;
@@ -480,6 +538,8 @@ void convert_to_unistr(unistring &str, const cstring &cstr,
 void Speller::add_to_dictionary(Correction &correction)
 {
     replace_table[correction.incorrect] = unistring(); // "Ignore All"
+    // the verdicts on other words (e.g. with prefixes) may change too.
+    clear_word_cache();
     cstring cstr;
     cstr.cformat("*%s\n", correction.incorrect_original.c_str());
     write_line(cstr.c_str());
@@ -519,6 +579,11 @@ bool Speller::interactive_correct(Corrections &corrections,
 	    for (int i = 0; i < correction.incorrect.len(); i++)
 		wedit.move_forward_char();
 
+	    // the built-in speller doesn't send suggestions with its
+	    // replies; they're built only for the words the user sees.
+	    if (dict && correction.suggestions.empty())
+		dict_suggest(correction.incorrect, correction.suggestions);
+
 	    menu_result = splwnd.exec_correction_menu(correction);
 
 	    if (menu_result == splChoice) {
@@ -688,6 +753,11 @@ void Speller::spell_check(splRng range, EditBox &wedit, SpellerWnd &splwnd)
     }
 
     bool cancel_spelling = false;
+    size_t replace_table_size = replace_table.size();
+
+    // the replies to the background checker come first.
+    finish_background(wedit);
+    trim_word_cache();
 
     if (range == splRngWord)
 	write_line("%\n"); // exit terse mode
@@ -717,82 +787,112 @@ void Speller::spell_check(splRng range, EditBox &wedit, SpellerWnd &splwnd)
 
     bool restore_cursor = true;
 
+    // We look at paragraphs ahead of the one we're checking and send the
+    // speller the words it hasn't seen, so that it doesn't wait for us
+    // while we wait for it. "ahead" holds the texts of these paragraphs.
+    // The paragraphs can't change meanwhile: a correction only modifies
+    // the paragraph being checked. When checking a sole word, we send the
+    // paragraph itself, as we need the speller's non-terse reply.
+    std::deque<unistring> ahead;
+    int next_para = start_para;
+
     for (int i = start_para; i <= end_para && !cancel_spelling; i++)
     {
-	dialog.show_message_fmt(_("Spell checking... %d/%d"),
-				  i+1, wedit.get_number_of_paragraphs());
-	dialog.immediate_update();
-	
-	unistring para = wedit.get_paragraph_text(i);
-
-	// erase/modify some characters/words
-	erase_special_characters_words(para,
-		(wedit.get_syn_hlt() == EditBox::synhltEmail) && (range != splRngWord));
+	if ((i - start_para) % SPELLER_PROGRESS_STEP == 0) {
+	    dialog.show_message_fmt(_("Spell checking... %d/%d"),
+				      i+1, wedit.get_number_of_paragraphs());
+	    dialog.immediate_update();
+	}
 
-	if (i == start_para) {
-	    if (range != splRngAll) {
-		// erase text we're not supposed to check.
-		erase_before_after_word(para, cursor_origin.pos,
-			true, range != splRngForward);
+	while (next_para <= end_para
+		&& (ahead.empty()
+		    || (ahead.size() < SPELLER_MAX_IN_FLIGHT
+			&& output.size() < SPELLER_MAX_OUTPUT))) {
+	    unistring para = wedit.get_paragraph_text(next_para);
+
+	    // erase/modify some characters/words
+	    erase_special_characters_words(para,
+		    (wedit.get_syn_hlt() == EditBox::synhltEmail) && (range != splRngWord));
+
+	    if (next_para == start_para) {
+		if (range != splRngAll) {
+		    // erase text we're not supposed to check.
+		    erase_before_after_word(para, cursor_origin.pos,
+			    true, range != splRngForward);
+
+		    // after finishing checking splRgnForward/splRgnWord,
+		    // we restore the cursor to the start of the word on
+		    // which it stood.
+		    int wbeg, wend;
+		    get_word_boundaries(para, cursor_origin.pos, wbeg, wend);
+		    cursor_origin.pos = wbeg;
+
+		    // also, when checking a sole word, keep it because
+		    // we need to display it later in the dialog-line.
+		    if (range == splRngWord)
+			sole_word = para.substr(wbeg, wend - wbeg);
+		} else {
+		    // after finishing checking the whole document, we
+		    // restore cursor position to the first column of
+		    // the paragraph.
+		    cursor_origin.pos = 0;
+		}
+	    }
 
-		// after finishing checking splRgnForward/splRgnWord,
-		// we restore the cursor to the start of the word on
-		// which it stood.
-		int wbeg, wend;
-		get_word_boundaries(para, cursor_origin.pos, wbeg, wend);
-		cursor_origin.pos = wbeg;
+	    if (range == splRngWord) {
+		// Convert the text to the speller encoding
+		// :TODO: special treatment for UTF-8.
+		cstring cstr;
+		convert_from_unistr(cstr, para, conv_to_speller);
 
-		// also, when checking a sole word, keep it because
-		// we need to display it later in the dialog-line.
-		if (range == splRngWord)
-		    sole_word = para.substr(wbeg, wend - wbeg);
+		// Send "^text" to speller
+		cstr.insert(0, "^");
+		cstr += "\n";
+		write_line(cstr.c_str());
 	    } else {
-		// after finishing checking the whole document, we
-		// restore cursor position to the first column of
-		// the paragraph.
-		cursor_origin.pos = 0;
+		queue_words(para);
 	    }
+
+	    ahead.push_back(para);
+	    next_para++;
 	}
-    
-	// Convert the text to the speller encoding
-	// :TODO: special treatment for UTF-8.
-	cstring cstr;
-	convert_from_unistr(cstr, para, conv_to_speller);
 
-	// Send "^text" to speller
-	cstr.insert(0, "^");
-	cstr += "\n";
-	write_line(cstr.c_str());
-	
-	// Read the speller reply, till encountering the empty string,
-	// and construct a Corrections collection.
+	unistring para = ahead.front();
+	ahead.pop_front();
 	Corrections corrections;
-	Correction *last_corretion = NULL;
-	do {
-	    cstr = read_line();
-	    if (cstr.size() != 0) {
-		unistring ustr;
-		convert_to_unistr(ustr, cstr, conv_from_speller);
-		Correction *c = new Correction(u8string(ustr).c_str(), i);
-		if (c->is_valid()) {
-		    // store the speller-encoded word too, in case
-		    // we need to feed it back (like in the "*<<word>>"
-		    // command).
-		    convert_from_unistr(c->incorrect_original, c->incorrect,
-					conv_to_speller);
-		    adjust_word_offset(*c, para);
-		    corrections.add(c);
-		    last_corretion = c;
-		} else {
-		    delete c;
-    
-		    // Special support for hspell's hints.
-		    if ((ustr[0] == ' ' || ustr[0] == 'H') && last_corretion)
-			last_corretion->add_hint(ustr.substr(1));
 
-		    // When spell-checking a sole word, we're in
-		    // non-terse mode.
-		    if (range == splRngWord) {
+	TRACE_BEGIN("speller/reply");
+	if (range != splRngWord) {
+	    wait_for_words(para);
+	    get_corrections(para, i, corrections);
+	} else {
+	    // Read the speller reply, till encountering the empty string,
+	    // and construct a Corrections collection.
+	    cstring cstr;
+	    Correction *last_corretion = NULL;
+	    do {
+		cstr = read_line();
+		if (cstr.size() != 0) {
+		    unistring ustr;
+		    convert_to_unistr(ustr, cstr, conv_from_speller);
+		    Correction *c = new Correction(u8string(ustr).c_str(), i);
+		    if (c->is_valid()) {
+			// store the speller-encoded word too, in case
+			// we need to feed it back (like in the "*<<word>>"
+			// command).
+			convert_from_unistr(c->incorrect_original, c->incorrect,
+					    conv_to_speller);
+			adjust_word_offset(*c, para);
+			corrections.add(c);
+			last_corretion = c;
+		    } else {
+			delete c;
+
+			// Special support for hspell's hints.
+			if ((ustr[0] == ' ' || ustr[0] == 'H') && last_corretion)
+			    last_corretion->add_hint(ustr.substr(1));
+
+			// We're in non-terse mode.
 			if (ustr[0] == '*' || ustr[0] == '+') {
 			    sole_word_correct = true;
 			    if (ustr[0] == '+' && ustr.len() > 2)
@@ -800,8 +900,9 @@ void Speller::spell_check(splRng range, EditBox &wedit, SpellerWnd &splwnd)
 			}
 		    }
 		}
-	    }
-	} while (cstr.size() != 0);
+	    } while (cstr.size() != 0);
+	}
+	TRACE_END("speller/reply");
 
 	corrections.sort();
 
@@ -820,8 +921,21 @@ void Speller::spell_check(splRng range, EditBox &wedit, SpellerWnd &splwnd)
 	}
     }
 
+    // read the replies to the words we've sent but won't check now; they
+    // go into the cache anyway.
+    send_batch();
+    while (!batches.empty())
+	read_batch_reply();
+
     wedit.unset_primary_mark();
 
+    // words the user has added to the dictionary, or ignored, are no
+    // longer misspelled.
+    if (background && replace_table.size() != replace_table_size) {
+	wedit.invalidate_misspellings();
+	wake_background();
+    }
+
     if (restore_cursor && range != splRngWord)
 	wedit.set_cursor_position(cursor_origin);
 
@@ -838,25 +952,754 @@ void Speller::spell_check(splRng range, EditBox &wedit, SpellerWnd &splwnd)
     }
 }
 
+// set_background() - turns the background spell checker on or off. When
+// it's on, the main loop calls continue_background() while the user isn't
+// typing (see background_task()), and the editor calls wake_background()
+// after the user has done something.
+
+void Speller::set_background(bool value, EditBox &wedit)
+{
+    background = value;
+    bg_editbox = &wedit;
+    if (background)
+	wake_background();
+    else
+	wedit.invalidate_misspellings(); // remove the underlines.
+}
+
+bool Speller::bg_has_room() const
+{
+    return bg_in_flight.size() < SPELLER_MAX_IN_FLIGHT
+	    && output.size() < SPELLER_MAX_OUTPUT;
+}
+
+// bg_slice_spent() - the built-in speller answers as we send, on this
+// thread, so the background checker stops sending once it has used up its
+// slice of the main loop (see mainloop.h); the rest is sent next time.
+
+bool Speller::bg_slice_spent(double start) const
+{
+    return dict && perf_now_msecs() - start >= TASK_BUDGET_MSECS;
+}
+
+// bg_needs_check() - has paragraph "para" changed since it was last
+// checked, and isn't it being checked already?
+
+bool Speller::bg_needs_check(EditBox &wedit, int para) const
+{
+    return wedit.needs_spell_check(para)
+	    && bg_stamps.find(wedit.get_paragraph_stamp(para))
+		    == bg_stamps.end();
+}
+
+// send_background_paragraph() - sends the speller the words of a
+// paragraph to check in the background.
+
+void Speller::send_background_paragraph(EditBox &wedit, int para)
+{
+    BackgroundCheck chk;
+    chk.para = para;
+    chk.stamp = wedit.get_paragraph_stamp(para);
+    chk.sent = wedit.get_paragraph_text(para);
+    erase_special_characters_words(chk.sent,
+	    wedit.get_syn_hlt() == EditBox::synhltEmail);
+    queue_words(chk.sent);
+
+    bg_in_flight.push_back(chk);
+    bg_stamps.insert(chk.stamp);
+}
+
+// apply_background_checks() - hands the EditBox the misspellings of the
+// paragraphs in flight whose words have all been replied to. If the
+// paragraph has changed meanwhile, or paragraphs were inserted or deleted
+// before it, the results are dropped: the paragraph still needs a check,
+// so the sweep sends it again, from where it is now. Its words are in the
+// cache by then, so it costs little.
+
+void Speller::apply_background_checks(EditBox &wedit)
+{
+    std::deque<BackgroundCheck>::iterator chk = bg_in_flight.begin();
+    while (chk != bg_in_flight.end()) {
+	if (!has_words(chk->sent)) {
+	    queue_words(chk->sent); // in case the cache has been cleared.
+	    ++chk;
+	    continue;
+	}
+
+	Corrections corrections;
+	get_corrections(chk->sent, chk->para, corrections);
+	EditBox::IdxArray misspellings;
+	for (int i = 0; i < corrections.size(); i++) {
+	    Correction &c = *corrections[i];
+	    std::map<unistring, unistring>::iterator it =
+				    replace_table.find(c.incorrect);
+	    if (it != replace_table.end() && it->second.empty())
+		continue; // "Ignore All"
+	    misspellings.push_back(c.offset);
+	    misspellings.push_back(c.incorrect.len());
+	}
+
+	if (background && chk->para < wedit.get_number_of_paragraphs()
+		&& wedit.get_paragraph_stamp(chk->para) == chk->stamp) {
+	    wedit.set_misspellings(chk->para, misspellings);
+	} else {
+	    bg_idle = false;
+	    bg_clean = 0;
+	}
+	bg_stamps.erase(chk->stamp);
+	chk = bg_in_flight.erase(chk);
+    }
+}
+
+// finish_background() - waits for the replies to all the paragraphs in
+// flight, so that the speller can be used for something else.
+
+void Speller::finish_background(EditBox &wedit)
+{
+    while (!bg_in_flight.empty()) {
+	send_batch();
+	while (!batches.empty())
+	    read_batch_reply();
+	apply_background_checks(wedit);
+    }
+    bg_terse = false; // the caller may change the mode.
+}
+
+// wake_background() - tells the background spell checker that paragraphs
+// may have changed, and has the main loop call it.
+
+void Speller::wake_background()
+{
+    bg_idle = false;
+    bg_clean = 0;
+    if (background)
+	MainLoop::add_task(background_task, this);
+}
+
+// background_task() - the main loop's task for the background spell
+// checker (see mainloop.h).
+
+int Speller::background_task(void *data)
+{
+    Speller *speller = (Speller *)data;
+    if (!speller->has_background_work())
+	return TASK_DONE;
+    speller->continue_background(*speller->bg_editbox);
+    if (!speller->has_background_work())
+	return TASK_DONE;
+    return speller->is_background_waiting() ? SPELLER_WAIT_MSECS : 0;
+}
+
+// speller_output_handler() - called by the main loop when the speller has
+// sent something. We read it now, lest the main loop find it again and
+// again, and have the background spell checker look at it.
+
+void Speller::speller_output_handler(int, void *data)
+{
+    Speller *speller = (Speller *)data;
+    if (!speller->pump(0)) {
+	speller->unload();
+	speller->dialog.show_message(_("The speller has exited"));
+	return;
+    }
+    if (speller->background)
+	MainLoop::add_task(background_task, speller);
+}
+
+// continue_background() - does a bit of background spell checking: reads
+// the replies that have come, then sends the words of the paragraphs that
+// have changed since they were last checked, the visible ones first. It
+// never waits for the speller.
+
+void Speller::continue_background(EditBox &wedit)
+{
+    if (bg_lost) {
+	// some paragraphs were sent but never checked.
+	wedit.invalidate_misspellings();
+	bg_lost = false;
+    }
+    if (!has_background_work())
+	return;
+
+    TRACE_SCOPE("speller/background");
+
+    while (!batches.empty()) {
+	if (!has_reply()) {
+	    if (!pump(0)) {
+		// the speller has exited.
+		unload();
+		dialog.show_message(_("The speller has exited"));
+		return;
+	    }
+	    if (!has_reply())
+		break;
+	}
+	read_batch_reply();
+    }
+
+    if (bg_in_flight.empty() && batches.empty())
+	trim_word_cache();
+
+    if (!bg_terse) {
+	write_line("!\n"); // enter terse mode
+	bg_terse = true;
+    }
+
+    double start = perf_now_msecs();
+    int first, last;
+    wedit.get_visible_paragraphs(first, last);
+    for (int i = first; i <= last && bg_has_room() && !bg_slice_spent(start);
+	    i++)
+	if (bg_needs_check(wedit, i))
+	    send_background_paragraph(wedit, i);
+
+    int count = wedit.get_number_of_paragraphs();
+    for (int step = 0; step < SPELLER_SWEEP_STEP && bg_clean < count
+			    && bg_has_room() && !bg_slice_spent(start); step++) {
+	if (bg_sweep >= count)
+	    bg_sweep = 0;
+	if (bg_needs_check(wedit, bg_sweep)) {
+	    send_background_paragraph(wedit, bg_sweep);
+	    bg_clean = 0;
+	} else {
+	    bg_clean++;
+	}
+	bg_sweep++;
+    }
+    bg_idle = (bg_clean >= count);
+
+    apply_background_checks(wedit);
+    send_batch();
+}
+
+// find_run() - finds the next run of non-blank characters, starting at
+// "pos". Returns false if there's none.
+
+static bool find_run(const unistring &str, idx_t &pos, idx_t &end)
+{
+    while (pos < str.len() && (str[pos] == ' ' || str[pos] == '\t'))
+	pos++;
+    if (pos == str.len())
+	return false;
+    end = pos;
+    while (end < str.len() && str[end] != ' ' && str[end] != '\t')
+	end++;
+    return true;
+}
+
+// queue_words() - queues the words of "text" the speller hasn't seen for
+// sending. A batch is sent when it's full; see also send_batch().
+
+void Speller::queue_words(const unistring &text)
+{
+    idx_t pos = 0, end;
+    for (; find_run(text, pos, end); pos = end) {
+	unistring word = text.substr(pos, end - pos);
+	if (word_cache.find(word) != word_cache.end()) {
+	    PERF_COUNT(speller_word_hits, 1);
+	    continue;
+	}
+	PERF_COUNT(speller_word_misses, 1);
+	word_cache[word].pending = true;
+	if (!batch.words.empty())
+	    batch.line.push_back(' ');
+	batch.offsets.push_back(batch.line.len());
+	batch.line.append(word);
+	batch.words.push_back(word);
+	if (batch.words.size() >= SPELLER_BATCH_WORDS
+		|| batch.line.len() >= SPELLER_BATCH_CHARS)
+	    send_batch();
+    }
+}
+
+// send_batch() - sends the speller the words queued.
+
+void Speller::send_batch()
+{
+    if (batch.words.empty())
+	return;
+
+    // Convert the text to the speller encoding
+    // :TODO: special treatment for UTF-8.
+    cstring cstr;
+    convert_from_unistr(cstr, batch.line, conv_to_speller);
+
+    // Send "^text" to speller
+    cstr.insert(0, "^");
+    cstr += "\n";
+    write_line(cstr.c_str());
+
+    batch.cache_gen = cache_gen;
+    batches.push_back(batch);
+    batch = Batch();
+}
+
+// read_batch_reply() - reads the speller reply to the oldest batch, till
+// encountering the empty string, and records the verdicts in the cache.
+// The reply to a batch sent before the cache was cleared is dropped: its
+// verdicts may be stale, and the words have been queued again anyway.
+
+void Speller::read_batch_reply()
+{
+    Batch b = batches.front();
+    batches.pop_front();
+
+    if (b.cache_gen != cache_gen) {
+	while (read_line().size() != 0)
+	    ;
+	return;
+    }
+
+    std::vector<CachedWord *> words;
+    for (int k = 0; k < (int)b.words.size(); k++) {
+	CachedWord &cw = word_cache[b.words[k]];
+	cw.pending = false;
+	cw.corrections.clear();
+	words.push_back(&cw);
+    }
+
+    // Some spellers (like hspell) report incorrect offsets, so we look for
+    // the misspelled word in the run at the reported offset first, then in
+    // the runs around it. "claimed" holds the places already reported.
+    std::set< std::pair<int, int> > claimed;
+    CachedWord *last_word = NULL;
+    cstring cstr;
+    while ((cstr = read_line()).size() != 0) {
+	unistring ustr;
+	convert_to_unistr(ustr, cstr, conv_from_speller);
+	Correction c(u8string(ustr).c_str(), 0);
+	if (c.is_valid()) {
+	    int nruns = (int)b.words.size();
+	    int k = std::upper_bound(b.offsets.begin(), b.offsets.end(),
+				     (idx_t)MAX(c.offset, 0))
+			- b.offsets.begin() - 1;
+	    int run = -1, pos = -1;
+	    for (int d = 0; d < 2 * nruns && run == -1; d++) {
+		int r = (d % 2) ? k - (d + 1) / 2 : k + d / 2;
+		if (r < 0 || r >= nruns)
+		    continue;
+		pos = b.words[r].index(c.incorrect, 0);
+		while (pos != -1 && claimed.count(std::make_pair(r, pos)))
+		    pos = b.words[r].index(c.incorrect, pos + 1);
+		if (pos != -1)
+		    run = r;
+	    }
+	    if (run == -1)
+		continue; // not in what we've sent?!
+	    claimed.insert(std::make_pair(run, pos));
+	    CachedCorrection cc;
+	    cc.offset = pos;
+	    cc.line = ustr;
+	    words[run]->corrections.push_back(cc);
+	    last_word = words[run];
+	} else if ((ustr[0] == ' ' || ustr[0] == 'H') && last_word) {
+	    // Special support for hspell's hints.
+	    last_word->corrections.back().hints.push_back(ustr.substr(1));
+	}
+    }
+}
+
+// has_words() - has the speller replied about all the words of "text"?
+
+bool Speller::has_words(const unistring &text) const
+{
+    idx_t pos = 0, end;
+    for (; find_run(text, pos, end); pos = end) {
+	std::map<unistring, CachedWord>::const_iterator it =
+			word_cache.find(text.substr(pos, end - pos));
+	if (it == word_cache.end() || it->second.pending)
+	    return false;
+    }
+    return true;
+}
+
+// wait_for_words() - waits till the speller replies about all the words
+// of "text".
+
+void Speller::wait_for_words(const unistring &text)
+{
+    send_batch();
+    while (!has_words(text)) {
+	if (batches.empty()) {
+	    // some words have been dropped from the cache.
+	    queue_words(text);
+	    send_batch();
+	}
+	read_batch_reply();
+    }
+}
+
+// get_corrections() - constructs the Corrections collection of "text"
+// from the cache.
+
+void Speller::get_corrections(const unistring &text, int para,
+			      Corrections &corrections)
+{
+    idx_t pos = 0, end;
+    for (; find_run(text, pos, end); pos = end) {
+	std::map<unistring, CachedWord>::iterator it =
+			word_cache.find(text.substr(pos, end - pos));
+	if (it == word_cache.end())
+	    continue;
+	std::vector<CachedCorrection> &ccs = it->second.corrections;
+	for (int k = 0; k < (int)ccs.size(); k++) {
+	    Correction *c = new Correction(u8string(ccs[k].line).c_str(), para);
+	    c->offset = pos + ccs[k].offset;
+	    for (int h = 0; h < (int)ccs[k].hints.size(); h++)
+		c->add_hint(ccs[k].hints[h]);
+	    // store the speller-encoded word too, in case we need to feed
+	    // it back (like in the "*<<word>>" command).
+	    convert_from_unistr(c->incorrect_original, c->incorrect,
+				conv_to_speller);
+	    adjust_word_offset(*c, text);
+	    corrections.add(c);
+	}
+    }
+}
+
+// trim_word_cache() - the cache grows with every new word the user
+// writes. We clear it when it gets too big; it must not be done while
+// some words are pending.
+
+void Speller::trim_word_cache()
+{
+    if (word_cache.size() > SPELLER_CACHE_MAX)
+	word_cache.clear();
+}
+
+// clear_word_cache() - forgets all the verdicts, e.g. when a word is added
+// to the dictionary. Unlike trim_word_cache(), it may be called while
+// words are pending: the words queued but not yet sent are kept, and the
+// replies to the batches in flight are dropped (see read_batch_reply()).
+
+void Speller::clear_word_cache()
+{
+    word_cache.clear();
+    cache_gen++;
+    for (int k = 0; k < (int)batch.words.size(); k++)
+	word_cache[batch.words[k]].pending = true;
+}
+
+// pump() - waits till the speller sends something, but at most "msecs"
+// milliseconds (-1 means forever), and appends it to "input". Meanwhile
+// it sends the speller as much of "output" as the pipe takes: writing and
+// reading at the same time is what lets us send many paragraphs ahead
+// without both of us getting stuck on full pipes. Returns false when the
+// speller has closed its output.
+
+bool Speller::pump(int msecs)
+{
+    if (dict)
+	return true; // the built-in speller has answered already.
+
+    struct pollfd fds[2];
+    fds[0].fd = fd_from_spl;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd_to_spl;
+    fds[1].events = POLLOUT;
+    int nfds = output.empty() ? 1 : 2;
+
+    int ready = poll(fds, nfds, msecs);
+    if (ready <= 0)
+	return ready == 0 || errno == EINTR;
+
+    if (nfds == 2 && fds[1].revents) {
+	ssize_t nwritten = write(fd_to_spl, output.data(), output.size());
+	if (nwritten > 0)
+	    output.erase(0, nwritten);
+	else if (nwritten < 0 && errno != EAGAIN && errno != EINTR)
+	    output.clear(); // the speller is gone; what it sends is all.
+    }
+
+    if (fds[0].revents) {
+	char buf[SPELLER_READ_SIZE];
+	ssize_t nread = read(fd_from_spl, buf, sizeof(buf));
+	if (nread == 0)
+	    return false;
+	if (nread < 0)
+	    return errno == EAGAIN || errno == EINTR;
+	if (input_pos > input.size() / 2) {
+	    input.erase(0, input_pos);
+	    input_pos = 0;
+	}
+	input.append(buf, nread);
+    }
+    return true;
+}
+
+// has_reply() - do we have a whole reply to a paragraph, which ends with
+// an empty line, in "input"?
+
+bool Speller::has_reply() const
+{
+    if (input_pos < input.size() && input[input_pos] == '\n')
+	return true;
+    return input.find("\n\n", input_pos) != cstring::npos;
+}
+
+// flush_output() - sends the speller all of "output".
+
+void Speller::flush_output()
+{
+    while (!output.empty()) {
+	struct pollfd fd;
+	fd.fd = fd_to_spl;
+	fd.events = POLLOUT;
+	if (poll(&fd, 1, -1) < 0 && errno != EINTR)
+	    break;
+	ssize_t nwritten = write(fd_to_spl, output.data(), output.size());
+	if (nwritten > 0)
+	    output.erase(0, nwritten);
+	else if (nwritten < 0 && errno != EAGAIN && errno != EINTR)
+	    break;
+    }
+    output.clear();
+}
+
 // read_line() - read a line from the speller
 
 cstring Speller::read_line()
 {
-    u8string str;
-    char ch;
-    while (read(fd_from_spl[0], &ch, 1)) {
-	if (ch != '\n')
-	    str += ch;
-	else
-	    break;
+    size_t eol;
+    while ((eol = input.find('\n', input_pos)) == cstring::npos) {
+	if (dict || !pump()) {
+	    // the speller is gone; return what's left.
+	    cstring rest(input, input_pos);
+	    input.clear();
+	    input_pos = 0;
+	    return rest;
+	}
     }
+    cstring str(input, input_pos, eol - input_pos);
+    input_pos = eol + 1;
     return str;
 }
 
-// write_line() - write a line to the speller
+// write_line() - write a line to the speller. The line is queued, and
+// sent right away if the pipe has room for it; the rest goes out in
+// pump().
 
 void Speller::write_line(const char *s)
 {
-    write(fd_to_spl[1], s, strlen(s));
+    PERF_COUNT(speller_bytes, strlen(s));
+    if (dict) {
+	const char *eol;
+	while ((eol = strchr(s, '\n')) != NULL) {
+	    dict_answer(cstring(s, eol));
+	    s = eol + 1;
+	}
+	return;
+    }
+    output += s;
+    ssize_t nwritten = write(fd_to_spl, output.data(), output.size());
+    if (nwritten > 0)
+	output.erase(0, nwritten);
+}
+
+
+///////////////////////////// Built-in speller ///////////////////////////
+
+// load_dictionary() - "loads" the built-in speller: maps the word list
+// into memory. There's no process to wait for.
+
+bool Speller::load_dictionary(const char *filename)
+{
+    dict = new Dictionary;
+    if (!dict->load(filename)) {
+	dialog.show_message_fmt(_("Can't load dictionary %s: %s"),
+				filename, get_last_error());
+	delete dict;
+	dict = NULL;
+	delete conv_to_speller;
+	delete conv_from_speller;
+	return false;
+    }
+    input.clear();
+    input_pos = 0;
+    output.clear();
+    dict_terse = false;
+    bg_terse = false;
+    wake_background();
+    dialog.show_message_fmt(_("Dictionary loaded OK (%lu words)."),
+			    dict->words_count());
+    loaded = true;
+    return true;
+}
+
+// is_word_joiner() - characters that may stand between the letters of a
+// word, as in "don't" and in Hebrew acronyms.
+
+static inline bool is_word_joiner(unichar ch)
+{
+    return ch == '\'' || ch == '"'
+	    || ch == UNI_HEB_GERESH || ch == UNI_HEB_GERSHAYIM;
+}
+
+// find_word() - finds the next word in "str", starting at "pos".
+
+static bool find_word(const unistring &str, idx_t pos, idx_t &wbeg, idx_t &wend)
+{
+    idx_t len = str.len();
+    while (pos < len && !BiDi::is_wordch(str[pos]))
+	pos++;
+    if (pos == len)
+	return false;
+    wbeg = pos;
+    while (pos < len) {
+	if (BiDi::is_wordch(str[pos]))
+	    pos++;
+	else if (is_word_joiner(str[pos])
+		&& pos + 1 < len && BiDi::is_wordch(str[pos + 1]))
+	    pos++;
+	else
+	    break;
+    }
+    wend = pos;
+    return true;
+}
+
+static void append_ascii(unistring &us, const char *s)
+{
+    while (*s)
+	us.push_back((unsigned char)*s++);
+}
+
+// dict_answer() - answers a line the way "ispell -a" does, appending the
+// reply to "input".
+
+void Speller::dict_answer(const cstring &line)
+{
+    const char *s = line.c_str();
+    switch (*s) {
+    case '!':
+	dict_terse = true;
+	return;
+    case '%':
+	dict_terse = false;
+	return;
+    case '*':	// add to the personal dictionary
+    case '&':
+    case '@':	// accept for this session
+	dict->add(cstring(s + 1));
+	return;
+    case '#':	// save the personal dictionary
+    case '+':	// TeX mode
+    case '-':
+    case '~':
+	return;
+    case '^':
+	s++;
+	break;
+    }
+
+    unistring text;
+    convert_to_unistr(text, cstring(s), conv_from_speller);
+
+    idx_t pos = 0, wbeg, wend;
+    while (find_word(text, pos, wbeg, wend)) {
+	pos = wend;
+	unistring word = text.substr(wbeg, wend - wbeg);
+	bool has_digits = false;
+	for (idx_t i = 0; i < word.len(); i++)
+	    if (word[i] >= '0' && word[i] <= '9')
+		has_digits = true;
+	if (has_digits || dict_is_correct(word)) {
+	    if (!dict_terse)
+		input += "*\n";
+	    continue;
+	}
+
+	// We don't offer suggestions here: most replies are to the
+	// background checker, which doesn't need them. interactive_correct()
+	// asks dict_suggest() for them. The offsets count the "^" too.
+	char buf[64];
+	unistring reply;
+	append_ascii(reply, "# ");
+	reply.append(word);
+	sprintf(buf, " %d", (int)wbeg + 1);
+	append_ascii(reply, buf);
+
+	cstring cstr;
+	convert_from_unistr(cstr, reply, conv_to_speller);
+	input += cstr;
+	input += "\n";
+    }
+    input += "\n";
+}
+
+// dict_is_correct() - looks a word up in the dictionary. Like ispell, we
+// accept "Hello" and "HELLO" if "hello" is in the dictionary, and "PARIS"
+// if "Paris" is.
+
+bool Speller::dict_is_correct(const unistring &word)
+{
+    cstring cstr;
+    convert_from_unistr(cstr, word, conv_to_speller);
+    if (dict->contains(cstr.data(), cstr.size()))
+	return true;
+
+    unistring lower = word, capitalized = word;
+    for (idx_t i = 0; i < word.len(); i++)
+	lower[i] = capitalized[i] = towlower(word[i]);
+    capitalized[0] = towupper(word[0]);
+    if (lower != word) {
+	convert_from_unistr(cstr, lower, conv_to_speller);
+	if (dict->contains(cstr.data(), cstr.size()))
+	    return true;
+    }
+    if (capitalized != word && capitalized != lower) {
+	convert_from_unistr(cstr, capitalized, conv_to_speller);
+	if (dict->contains(cstr.data(), cstr.size()))
+	    return true;
+    }
+    return false;
 }
 
+// dict_suggest() - suggests the correct words one edit away: a letter
+// swapped with its neighbour, deleted, replaced, or inserted. It's called
+// for the correction the user is shown, not for every misspelling.
+
+void Speller::dict_suggest(const unistring &word,
+			   std::vector<unistring> &suggestions)
+{
+    const std::vector<unichar> &alphabet =
+			dict->get_alphabet(conv_from_speller);
+    idx_t len = word.len();
+    std::vector<unistring> candidates;
+
+    for (idx_t i = 0; i + 1 < len; i++) {
+	unistring cand = word;
+	cand[i] = word[i + 1];
+	cand[i + 1] = word[i];
+	candidates.push_back(cand);
+    }
+    for (idx_t i = 0; i < len && len > 1; i++) {
+	unistring cand = word;
+	cand.erase(cand.begin() + i, cand.begin() + i + 1);
+	candidates.push_back(cand);
+    }
+    for (idx_t i = 0; i < len; i++) {
+	for (int k = 0; k < (int)alphabet.size(); k++) {
+	    if (alphabet[k] == word[i])
+		continue;
+	    unistring cand = word;
+	    cand[i] = alphabet[k];
+	    candidates.push_back(cand);
+	}
+    }
+    for (idx_t i = 0; i <= len; i++) {
+	for (int k = 0; k < (int)alphabet.size(); k++) {
+	    unistring cand = word;
+	    cand.insert(cand.begin() + i, alphabet[k]);
+	    candidates.push_back(cand);
+	}
+    }
+
+    std::set<unistring> seen;
+    for (int i = 0; i < (int)candidates.size()
+		    && suggestions.size() < SPELLER_MAX_SUGGESTIONS; i++) {
+	if (seen.insert(candidates[i]).second
+		&& dict_is_correct(candidates[i]))
+	    suggestions.push_back(candidates[i]);
+    }
+}
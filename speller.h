@@ -1,6 +1,11 @@
 #ifndef BDE_SPELLER_H
 #define BDE_SPELLER_H
 
+#include <deque>
+#include <map>
+#include <set>
+#include <vector>
+
 #include "editbox.h"
 #include "label.h"
 
@@ -18,7 +23,7 @@ enum MenuResult {
     splIgnore, splAdd, splEdit, splChoice
 };
 
-class SpellerWnd : public Widget {
+class SpellerWnd : public CursesWidget {
 
     Label   label;
     EditBox editbox;
@@ -74,21 +79,121 @@ public:
 
 class DialogLine;
 class Converter;
+class Dictionary;
+
+// A speller command of the form "dict:FILE" selects the built-in speller,
+// which looks the words up in the word list FILE (see Dictionary).
+#define BUILTIN_SPELLER_PREFIX "dict:"
 
 class Speller {
 
-    // pipes for communication with the speller process.
-    int fd_to_spl[2];
-    int fd_from_spl[2];
+    // our ends of the pipes to the speller process, or the socket to the
+    // speller broker (then both are the same). They're non-blocking; see
+    // pump().
+    int fd_to_spl;
+    int fd_from_spl;
+    // when not zero, we share a speller broker's speller (see
+    // speller_broker.h), which exits after that many idle minutes.
+    int broker_idle_minutes;
+    cstring input;	    // what the speller sent us and we haven't read yet
+    size_t input_pos;	    // the unread part of "input" starts here
+    cstring output;	    // what we have yet to send the speller
     
     Editor &app; // for update_terminal()
     DialogLine &dialog;
     bool loaded;
     Converter *conv_to_speller, *conv_from_speller;
 
+    // The built-in speller, when not NULL, answers the lines we write
+    // right away, in the same protocol ispell speaks, so nothing else
+    // needs to know which speller we use.
+    Dictionary *dict;
+    bool dict_terse;
+
+    bool load_dictionary(const char *filename);
+    void dict_answer(const cstring &line);
+    bool dict_is_correct(const unistring &word);
+    void dict_suggest(const unistring &word,
+		      std::vector<unistring> &suggestions);
+
+    bool    pump(int msecs = -1);
+    void    flush_output();
+    bool    has_reply() const;
     cstring read_line();
     void    write_line(const char *s);
 
+    // The word cache. We don't send the speller whole paragraphs but only
+    // the words it hasn't seen yet, several on one line (a "batch"), and
+    // remember its verdict on each. Actually, we send runs of non-blank
+    // characters, so that it's still the speller that decides what a
+    // word is; a run may hold several misspelled words.
+
+    struct CachedCorrection {
+	int	  offset;	// of the word within the run
+	unistring line;		// the speller's "&" (or "#", "?") line
+	std::vector<unistring> hints;
+    };
+    struct CachedWord {
+	bool pending;		// sent, but the reply hasn't come yet
+	std::vector<CachedCorrection> corrections;
+    };
+    struct Batch {
+	unistring line;
+	std::vector<unistring> words;
+	std::vector<idx_t> offsets;
+	unsigned long cache_gen; // the cache_gen it was sent in.
+    };
+    std::map<unistring, CachedWord> word_cache;
+    // cache_gen is bumped whenever the verdicts in the cache become
+    // stale (see clear_word_cache()); the replies to batches sent before
+    // are dropped.
+    unsigned long cache_gen;
+    Batch batch;		// what we're about to send
+    std::deque<Batch> batches;	// what we've sent and wait for replies to
+
+    void queue_words(const unistring &text);
+    void send_batch();
+    void read_batch_reply();
+    bool has_words(const unistring &text) const;
+    void wait_for_words(const unistring &text);
+    void get_corrections(const unistring &text, int para,
+			 Corrections &corrections);
+    void trim_word_cache();
+    void clear_word_cache();
+
+    // The background spell checker sends the speller the words of the
+    // paragraphs that changed, and reads the replies as they come, while
+    // the user isn't typing. "bg_in_flight" holds the paragraphs whose
+    // words haven't all been replied to yet, and "bg_stamps" their stamps
+    // (see Paragraph); "bg_sweep" is where the sweep over the document has
+    // got to.
+
+    struct BackgroundCheck {
+	int	  para;
+	unsigned long stamp; // the stamp of the paragraph, to tell whether
+			    // it has changed (or moved) by the time the
+			    // reply comes.
+	unistring sent;	    // the text as the speller checks it.
+    };
+    bool background;
+    EditBox *bg_editbox;    // what the background spell checker checks
+    bool bg_terse;	    // have we put the speller in terse mode?
+    bool bg_idle;	    // has the sweep found nothing more to send?
+    bool bg_lost;	    // were replies lost when the speller unloaded?
+    std::deque<BackgroundCheck> bg_in_flight;
+    std::set<unsigned long> bg_stamps;
+    int  bg_sweep;
+    int  bg_clean;	    // paragraphs the sweep found needing no check.
+
+    bool bg_has_room() const;
+    bool bg_slice_spent(double start) const;
+    bool bg_needs_check(EditBox &wedit, int para) const;
+    void send_background_paragraph(EditBox &wedit, int para);
+    void apply_background_checks(EditBox &wedit);
+    void finish_background(EditBox &wedit);
+    static int background_task(void *speller);
+    static void speller_output_handler(int fd, void *speller);
+
     void add_to_dictionary(Correction &correction);
 
     bool interactive_correct(Corrections &corrections,
@@ -105,10 +210,21 @@ public:
     
     bool    load(const char *cmd, const char *encoding);
     void    unload();
+    void    set_broker_idle_minutes(int minutes)
+		{ broker_idle_minutes = minutes; }
 
     void spell_check(splRng range,
 		     EditBox &wedit,
 		     SpellerWnd &splwnd);
+
+    void set_background(bool value, EditBox &wedit);
+    bool is_background() const { return background; }
+    bool has_background_work() const
+	{ return background && loaded && (!bg_idle || !bg_in_flight.empty()); }
+    bool is_background_waiting() const
+	{ return !bg_in_flight.empty() && (bg_idle || !bg_has_room()); }
+    void wake_background();
+    void continue_background(EditBox &wedit);
 };
 
 void UNLOAD_SPELLER();
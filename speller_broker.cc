@@ -0,0 +1,536 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+
+#include <config.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_SYS_UN_H
+# include <sys/socket.h>
+# include <sys/un.h>
+#endif
+#include <vector>
+#include <deque>
+#include <list>
+
+#include "speller_broker.h"
+#include "types.h"
+#include "terminal.h" // DISABLE_SIGTSTP
+#include "dbg.h"
+
+// How long, at most, we wait for a broker we've just started to create
+// its socket.
+#define BROKER_CONNECT_TRIES	50
+#define BROKER_CONNECT_MSECS	20
+// How much the broker reads from a client, or from the speller, at once.
+#define BROKER_READ_SIZE	16384
+
+static const char *broker_program = PACKAGE;
+
+void set_speller_broker_program(const char *argv0)
+{
+    broker_program = argv0;
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+pid_t spawn_speller(const char *cmd, int &fd_to, int &fd_from)
+{
+    int to_spl[2], from_spl[2];
+    if (pipe(to_spl) < 0)
+	return -1;
+    if (pipe(from_spl) < 0) {
+	close(to_spl[0]); close(to_spl[1]);
+	return -1;
+    }
+
+    pid_t pid;
+    if ((pid = fork()) < 0) {
+	int err = errno;
+	close(to_spl[0]);   close(to_spl[1]);
+	close(from_spl[0]); close(from_spl[1]);
+	errno = err;
+	return -1;
+    }
+    if (pid == 0) {
+	DISABLE_SIGTSTP();
+	// we're in the child.
+	dup2(to_spl[0],   STDIN_FILENO);
+	dup2(from_spl[1], STDOUT_FILENO);
+	dup2(from_spl[1], STDERR_FILENO);
+
+	close(from_spl[0]); close(to_spl[0]);
+	close(from_spl[1]); close(to_spl[1]);
+
+	execlp("/bin/sh", "sh", "-c", cmd, NULL);
+
+	// write the error back to the parent
+	u8string err;
+	err.cformat(_("Error %d (%s)\n"), errno, strerror(errno));
+	write(STDOUT_FILENO, err.c_str(), err.size());
+	exit(1);
+    }
+
+    // close the child's ends, so that we see EOF when it exits.
+    close(to_spl[0]);
+    close(from_spl[1]);
+    fd_to   = to_spl[1];
+    fd_from = from_spl[0];
+    fcntl(fd_to,   F_SETFD, FD_CLOEXEC);
+    fcntl(fd_from, F_SETFD, FD_CLOEXEC);
+    return pid;
+}
+
+#ifdef HAVE_SYS_UN_H
+
+// get_socket_name() - the name of the socket of the broker that runs
+// "cmd". Returns false if it's too long for a socket name.
+
+static bool get_socket_name(u8string &name, const char *cmd)
+{
+    unsigned long hash = 5381;
+    for (const char *p = cmd; *p; p++)
+	hash = (hash * 33 + (unsigned char)*p) & 0xFFFFFFFFUL;
+
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    if (dir && *dir)
+	name.cformat("%s/%s-speller-%08lx", dir, PACKAGE, hash);
+    else
+	name.cformat("/tmp/%s-speller-%d-%08lx", PACKAGE, (int)getuid(), hash);
+
+    struct sockaddr_un addr;
+    return name.size() < sizeof(addr.sun_path);
+}
+
+static void make_address(struct sockaddr_un &addr, const char *name)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, name);
+}
+
+// connect_socket() - connects to the socket "name". We only talk to
+// sockets of our own; in /tmp anybody could have created one.
+
+static int connect_socket(const char *name)
+{
+    struct stat st;
+    if (lstat(name, &st) < 0 || !S_ISSOCK(st.st_mode)
+	    || st.st_uid != getuid())
+	return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	return -1;
+    struct sockaddr_un addr;
+    make_address(addr, name);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+	close(fd);
+	return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// start_broker() - executes ourselves as a broker. The broker is detached
+// from our terminal and session, and isn't our child, so it outlives us
+// and we needn't wait() for it.
+
+static bool start_broker(const char *cmd, const char *name, int idle_minutes)
+{
+    char idle[16];
+    sprintf(idle, "%d", idle_minutes);
+
+    pid_t pid;
+    if ((pid = fork()) < 0)
+	return false;
+    if (pid == 0) {
+	setsid();
+	if (fork() != 0)
+	    _exit(0);
+	int null_fd = open("/dev/null", O_RDWR);
+	dup2(null_fd, STDIN_FILENO);
+	dup2(null_fd, STDOUT_FILENO);
+	dup2(null_fd, STDERR_FILENO);
+	for (int fd = STDERR_FILENO + 1; fd < 256; fd++)
+	    close(fd);
+	// We exec rather than run the broker in this process, which would
+	// keep a copy of our memory (the text we edit) alive for long.
+	execl("/proc/self/exe", PACKAGE, SPELLER_BROKER_ARG,
+		cmd, name, idle, NULL);
+	execlp(broker_program, PACKAGE, SPELLER_BROKER_ARG,
+		cmd, name, idle, NULL);
+	_exit(1);
+    }
+    waitpid(pid, NULL, 0);
+    return true;
+}
+
+#endif // HAVE_SYS_UN_H
+
+int connect_speller_broker(const char *cmd, int idle_minutes)
+{
+#ifdef HAVE_SYS_UN_H
+    u8string name;
+    if (!get_socket_name(name, cmd))
+	return -1;
+
+    int fd = connect_socket(name.c_str());
+    if (fd >= 0)
+	return fd;
+
+    if (!start_broker(cmd, name.c_str(), idle_minutes))
+	return -1;
+    // The broker creates its socket before it starts the speller, so we
+    // don't wait for the speller here.
+    for (int i = 0; i < BROKER_CONNECT_TRIES && fd < 0; i++) {
+	poll(NULL, 0, BROKER_CONNECT_MSECS);
+	fd = connect_socket(name.c_str());
+    }
+    DBG(1, ("speller broker %s: %s\n", name.c_str(),
+		fd >= 0 ? "connected" : "failed"));
+    return fd;
+#else
+    return -1;
+#endif
+}
+
+///////////////////////////////// The broker ///////////////////////////////
+
+#ifdef HAVE_SYS_UN_H
+
+// A BrokerClient is a Geresh connected to the broker.
+
+struct BrokerClient {
+    int fd;
+    cstring in;		// what the client sent and we haven't handled yet
+    cstring out;	// what we have yet to send the client
+    bool terse;		// has the client asked for the terse mode?
+};
+
+// The speller answers each line to check with some lines and an empty
+// one, in the order it got them, so we remember who sent each line and
+// route the answers back accordingly. The clients' commands, which have
+// no answers, are passed on as is, except for the terse mode ("!" and
+// "%"), which is a client's own: we switch the speller to the client's
+// mode before each of its lines.
+
+class SpellerBroker {
+
+    const char *cmd;
+    const char *name;
+    int idle_secs;
+
+    int listen_fd;
+    int fd_to_spl, fd_from_spl;
+    cstring spl_in, spl_out;
+    bool spl_terse;
+
+    bool has_identity;
+    cstring identity;	// the speller's first line, which every client gets
+
+    std::list<BrokerClient *> clients;
+    std::deque<BrokerClient *> waiting; // NULL: the client has gone
+    time_t idle_since;
+
+    bool listen_socket();
+    void accept_client();
+    void remove_client(BrokerClient *cl);
+    bool read_from(int fd, cstring &buf);
+    void write_to(int fd, cstring &buf);
+    void client_line(BrokerClient *cl, const cstring &line);
+    void speller_line(const cstring &line);
+
+public:
+
+    SpellerBroker(const char *aCmd, const char *aName, int idle_minutes);
+    int run();
+};
+
+SpellerBroker::SpellerBroker(const char *aCmd, const char *aName,
+			     int idle_minutes)
+{
+    cmd = aCmd;
+    name = aName;
+    idle_secs = idle_minutes * 60;
+    listen_fd = fd_to_spl = fd_from_spl = -1;
+    spl_terse = false;
+    has_identity = false;
+    idle_since = time(NULL);
+}
+
+// listen_socket() - creates our socket. If there's already a socket by
+// that name, and a broker behind it, we leave it to that broker.
+
+bool SpellerBroker::listen_socket()
+{
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+	return false;
+    struct sockaddr_un addr;
+    make_address(addr, name);
+
+    mode_t old_mask = umask(077);
+    int result = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (result < 0 && errno == EADDRINUSE) {
+	int other = connect_socket(name);
+	if (other >= 0) {
+	    close(other);
+	} else {
+	    // a broker that was killed left it behind.
+	    unlink(name);
+	    result = bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr));
+	}
+    }
+    umask(old_mask);
+
+    if (result < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+	close(listen_fd);
+	return false;
+    }
+    set_nonblocking(listen_fd);
+    return true;
+}
+
+void SpellerBroker::accept_client()
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+	return;
+    set_nonblocking(fd);
+    BrokerClient *cl = new BrokerClient;
+    cl->fd = fd;
+    cl->terse = false;
+    if (has_identity) {
+	cl->out = identity;
+	cl->out += '\n';
+    }
+    clients.push_back(cl);
+}
+
+void SpellerBroker::remove_client(BrokerClient *cl)
+{
+    for (int i = 0; i < (int)waiting.size(); i++)
+	if (waiting[i] == cl)
+	    waiting[i] = NULL;
+    clients.remove(cl);
+    close(cl->fd);
+    delete cl;
+    if (clients.empty())
+	idle_since = time(NULL);
+}
+
+// read_from() - appends what's waiting in "fd" to "buf". Returns false
+// on EOF.
+
+bool SpellerBroker::read_from(int fd, cstring &buf)
+{
+    char tmp[BROKER_READ_SIZE];
+    ssize_t nread = read(fd, tmp, sizeof(tmp));
+    if (nread > 0)
+	buf.append(tmp, nread);
+    return nread > 0 || (nread < 0 && (errno == EAGAIN || errno == EINTR));
+}
+
+void SpellerBroker::write_to(int fd, cstring &buf)
+{
+    ssize_t nwritten = write(fd, buf.data(), buf.size());
+    if (nwritten > 0)
+	buf.erase(0, nwritten);
+    else if (nwritten < 0 && errno != EAGAIN && errno != EINTR)
+	buf.clear(); // the other side is gone; we'll see its EOF.
+}
+
+void SpellerBroker::client_line(BrokerClient *cl, const cstring &line)
+{
+    switch (line.empty() ? '\0' : line[0]) {
+    case '!':
+	cl->terse = true;
+	break;
+    case '%':
+	cl->terse = false;
+	break;
+    case '*': case '&': case '@': case '#':
+    case '+': case '-': case '~':
+	spl_out += line;
+	spl_out += '\n';
+	break;
+    default:
+	if (cl->terse != spl_terse) {
+	    spl_out += cl->terse ? "!\n" : "%\n";
+	    spl_terse = cl->terse;
+	}
+	spl_out += line;
+	spl_out += '\n';
+	waiting.push_back(cl);
+	break;
+    }
+}
+
+void SpellerBroker::speller_line(const cstring &line)
+{
+    if (!has_identity) {
+	identity = line;
+	has_identity = true;
+	for (std::list<BrokerClient *>::iterator it = clients.begin();
+		it != clients.end(); ++it) {
+	    (*it)->out += identity;
+	    (*it)->out += '\n';
+	}
+	return;
+    }
+    if (waiting.empty())
+	return; // nobody asked for it (a warning, perhaps).
+    if (BrokerClient *cl = waiting.front()) {
+	cl->out += line;
+	cl->out += '\n';
+    }
+    if (line.empty())
+	waiting.pop_front();
+}
+
+// run() - the broker's event loop. Returns when the speller exits or
+// when we've been idle long enough.
+
+int SpellerBroker::run()
+{
+    if (!listen_socket())
+	return 1;
+    if (spawn_speller(cmd, fd_to_spl, fd_from_spl) < 0) {
+	unlink(name);
+	return 1;
+    }
+    set_nonblocking(fd_to_spl);
+    set_nonblocking(fd_from_spl);
+
+    std::vector<struct pollfd> fds;
+    std::vector<BrokerClient *> fd_clients;
+    while (true) {
+	int timeout = -1;
+	if (clients.empty()) {
+	    int idle = (int)(time(NULL) - idle_since);
+	    if (idle >= idle_secs)
+		break;
+	    timeout = (idle_secs - idle) * 1000;
+	}
+
+	fds.clear();
+	fd_clients.clear();
+	struct pollfd pfd;
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+	fds.push_back(pfd);
+	pfd.fd = fd_from_spl;
+	fds.push_back(pfd);
+	pfd.fd = fd_to_spl;
+	pfd.events = spl_out.empty() ? 0 : POLLOUT;
+	fds.push_back(pfd);
+	for (std::list<BrokerClient *>::iterator it = clients.begin();
+		it != clients.end(); ++it) {
+	    pfd.fd = (*it)->fd;
+	    pfd.events = POLLIN | ((*it)->out.empty() ? 0 : POLLOUT);
+	    fds.push_back(pfd);
+	    fd_clients.push_back(*it);
+	}
+
+	if (poll(&fds[0], fds.size(), timeout) < 0) {
+	    if (errno == EINTR)
+		continue;
+	    break;
+	}
+
+	if (fds[2].revents)
+	    write_to(fd_to_spl, spl_out);
+	if (fds[1].revents) {
+	    if (!read_from(fd_from_spl, spl_in))
+		break; // the speller has exited.
+	    size_t pos = 0, eol;
+	    while ((eol = spl_in.find('\n', pos)) != cstring::npos) {
+		speller_line(cstring(spl_in, pos, eol - pos));
+		pos = eol + 1;
+	    }
+	    spl_in.erase(0, pos);
+	}
+	for (int i = 0; i < (int)fd_clients.size(); i++) {
+	    BrokerClient *cl = fd_clients[i];
+	    short revents = fds[3 + i].revents;
+	    if (revents & POLLOUT)
+		write_to(cl->fd, cl->out);
+	    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		if (!read_from(cl->fd, cl->in)) {
+		    remove_client(cl);
+		    continue;
+		}
+		size_t pos = 0, eol;
+		while ((eol = cl->in.find('\n', pos)) != cstring::npos) {
+		    client_line(cl, cstring(cl->in, pos, eol - pos));
+		    pos = eol + 1;
+		}
+		cl->in.erase(0, pos);
+	    }
+	}
+	// the answers may fit in the sockets right away.
+	for (std::list<BrokerClient *>::iterator it = clients.begin();
+		it != clients.end(); ++it)
+	    if (!(*it)->out.empty())
+		write_to((*it)->fd, (*it)->out);
+	if (!spl_out.empty())
+	    write_to(fd_to_spl, spl_out);
+
+	if (fds[0].revents)
+	    accept_client();
+    }
+
+    DBG(1, ("speller broker %s: exiting\n", name));
+    unlink(name);
+    close(listen_fd);
+    while (!clients.empty())
+	remove_client(clients.front());
+    // the speller exits when its input is closed.
+    close(fd_to_spl);
+    close(fd_from_spl);
+    return 0;
+}
+
+#endif // HAVE_SYS_UN_H
+
+int run_speller_broker(int argc, char *argv[])
+{
+#ifdef HAVE_SYS_UN_H
+    if (argc != 3)
+	return 1;
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+    signal(SIGINT, SIG_IGN);
+    SpellerBroker broker(argv[0], argv[1], atoi(argv[2]));
+    return broker.run();
+#else
+    return 1;
+#endif
+}
@@ -0,0 +1,63 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+
+#ifndef BDE_SPELLER_BROKER_H
+#define BDE_SPELLER_BROKER_H
+
+#include <sys/types.h>
+
+// Loading a speller's dictionaries takes time, and we used to pay it each
+// time a speller was loaded. A speller broker is a small daemon that runs
+// one speller and lets several Geresh instances, one after the other or
+// at the same time, share it through a Unix-domain socket. It speaks the
+// ispell protocol on the socket, so to Speller the socket is just another
+// speller process.
+//
+// The broker is Geresh itself, executed with SPELLER_BROKER_ARG as its
+// first argument. It exits when the speller does, or when no client has
+// been connected for the idle timeout.
+//
+// The socket is created in $XDG_RUNTIME_DIR (or in /tmp), and its name
+// is derived from the speller command, so different commands get
+// different brokers.
+
+#define SPELLER_BROKER_ARG "--run-speller-broker"
+
+// spawn_speller() - forks and execs the speller command "cmd". Returns
+// its pid, and our ends of its stdin and stdout, or -1 (and errno).
+
+pid_t spawn_speller(const char *cmd, int &fd_to, int &fd_from);
+
+// connect_speller_broker() - connects to the broker running "cmd",
+// starting it first if there's none. Returns the socket, or -1 if no
+// broker could be reached. "idle_minutes" is the idle timeout of a
+// broker we start.
+
+int connect_speller_broker(const char *cmd, int idle_minutes);
+
+// set_speller_broker_program() - tells us our argv[0], which we execute
+// if we can't execute /proc/self/exe.
+
+void set_speller_broker_program(const char *argv0);
+
+// run_speller_broker() - the broker's main(). Takes the arguments that
+// follow SPELLER_BROKER_ARG: the command, the socket name and the idle
+// timeout.
+
+int run_speller_broker(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,106 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include <sys/time.h>
+
+#include "stats.h"
+#include "editbox.h"  // EditBox::region
+
+PerfStats perf_stats;
+#ifdef HAVE_PTHREAD
+// The counters belong to the thread that starts the program.
+pthread_t perf_stats_thread = pthread_self();
+#endif
+
+double perf_now_msecs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// record_update_time() - called at the end of EditBox::update(). The kind
+// of update is the biggest region that was drawn.
+
+void record_update_time(int update_region, double msecs)
+{
+    int kind;
+    if (update_region & EditBox::rgnAll)
+	kind = PerfStats::updAll;
+    else if (update_region & EditBox::rgnRange)
+	kind = PerfStats::updRange;
+    else if (update_region & EditBox::rgnCurrent)
+	kind = PerfStats::updCurrent;
+    else
+	kind = PerfStats::updCursor;
+
+    perf_stats.updates++;
+    perf_stats.updates_by_kind[kind]++;
+    perf_stats.update_msecs += msecs;
+    if (msecs > perf_stats.max_update_msecs)
+	perf_stats.max_update_msecs = msecs;
+    perf_stats.last_update_msecs = msecs;
+    perf_stats.last_update_kind = kind;
+}
+
+void record_load_time(size_t bytes, double msecs)
+{
+    perf_stats.loaded_bytes += bytes;
+    perf_stats.load_msecs += msecs;
+}
+
+const char *update_kind_name(int kind)
+{
+    static const char *names[] = { "cursor", "current", "range", "all" };
+    return names[kind];
+}
+
+// dump_perf_stats() - prints the counters as "name value" lines.
+
+void dump_perf_stats(FILE *fp)
+{
+    const PerfStats &s = perf_stats;
+    fprintf(fp, "updates %lu\n", s.updates);
+    for (int i = 0; i < PerfStats::updKinds; i++)
+	fprintf(fp, "updates_%s %lu\n", update_kind_name(i),
+		s.updates_by_kind[i]);
+    fprintf(fp, "update_msecs_total %.3f\n", s.update_msecs);
+    fprintf(fp, "update_msecs_avg %.3f\n",
+	    s.updates ? s.update_msecs / s.updates : 0.0);
+    fprintf(fp, "update_msecs_max %.3f\n", s.max_update_msecs);
+    fprintf(fp, "redraw_paragraph %lu\n", s.redrawn_paragraphs);
+    fprintf(fp, "kept_paragraphs %lu\n", s.kept_paragraphs);
+    fprintf(fp, "scrolled_lines %lu\n", s.scrolled_lines);
+    fprintf(fp, "skipped_updates %lu\n", s.skipped_updates);
+    fprintf(fp, "loop_tasks %lu\n", s.loop_tasks);
+    fprintf(fp, "layout_cache_hits %lu\n", s.cache_hits);
+    fprintf(fp, "layout_cache_misses %lu\n", s.cache_misses);
+    fprintf(fp, "wrap_para %lu\n", s.wrapped_paragraphs);
+    fprintf(fp, "wrap_para_chars %lu\n", s.wrapped_chars);
+    fprintf(fp, "get_embedding_levels %lu\n", s.embedding_levels);
+    fprintf(fp, "get_embedding_levels_chars %lu\n", s.embedding_levels_chars);
+    fprintf(fp, "undo_bytes %lu\n", s.undo_bytes);
+    fprintf(fp, "loaded_bytes %lu\n", s.loaded_bytes);
+    fprintf(fp, "load_msecs %.3f\n", s.load_msecs);
+    fprintf(fp, "load_mb_per_sec %.2f\n", s.load_msecs > 0
+	    ? s.loaded_bytes / (s.load_msecs * 1000.0) : 0.0);
+    fprintf(fp, "speller_bytes %lu\n", s.speller_bytes);
+    fprintf(fp, "speller_word_cache_hits %lu\n", s.speller_word_hits);
+    fprintf(fp, "speller_word_cache_misses %lu\n", s.speller_word_misses);
+}
+
@@ -0,0 +1,89 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_STATS_H
+#define BDE_STATS_H
+
+#include <config.h>
+
+#include <stdio.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+// PerfStats holds counters and timers for the hot paths of the editor, so
+// that we can tell why a buffer feels slow without attaching a profiler.
+// They're always on: bumping a counter costs nothing next to the work
+// being counted, and the clock is read only once per update() or loading.
+//
+// Work done on other threads (the parallel loader, the log2vis workers)
+// is not counted, so the counters need no locking.
+
+struct PerfStats {
+    enum { updCursor, updCurrent, updRange, updAll, updKinds };
+
+    unsigned long updates;		// EditBox::update() calls
+    unsigned long updates_by_kind[updKinds];
+    double update_msecs;		// total time in update()
+    double max_update_msecs;
+    double last_update_msecs;
+    int last_update_kind;
+
+    unsigned long redrawn_paragraphs;	// redraw_paragraph() calls
+    unsigned long kept_paragraphs;	// visible ones update() didn't repaint
+    unsigned long scrolled_lines;	// window lines moved with wscrl()
+    unsigned long skipped_updates;	// screen updates put off for typeahead
+    unsigned long loop_tasks;		// background tasks run by the main loop
+    unsigned long cache_hits;		// the BiDi layout cache
+    unsigned long cache_misses;
+    unsigned long wrapped_paragraphs;	// wrap_para() calls
+    unsigned long wrapped_chars;
+    unsigned long embedding_levels;	// get_embedding_levels() calls
+    unsigned long embedding_levels_chars;
+    unsigned long undo_bytes;		// bytes recorded on the undo stack
+    unsigned long loaded_bytes;
+    double load_msecs;
+    unsigned long speller_bytes;	// bytes sent to the speller
+    unsigned long speller_word_hits;	// the speller's word cache
+    unsigned long speller_word_misses;
+};
+
+extern PerfStats perf_stats;
+
+#ifdef HAVE_PTHREAD
+extern pthread_t perf_stats_thread;
+# define PERF_STATS_THREAD() pthread_equal(pthread_self(), perf_stats_thread)
+#else
+# define PERF_STATS_THREAD() true
+#endif
+
+// PERF_COUNT() adds "n" to one of the counters, unless we're on some
+// worker thread.
+
+#define PERF_COUNT(counter, n) \
+    do { \
+	if (PERF_STATS_THREAD()) \
+	    perf_stats.counter += (n); \
+    } while (0)
+
+double perf_now_msecs();
+void record_update_time(int update_region, double msecs);
+void record_load_time(size_t bytes, double msecs);
+const char *update_kind_name(int kind);
+void dump_perf_stats(FILE *fp);
+
+#endif
+
@@ -21,6 +21,7 @@
 #include "statusline.h"
 #include "editor.h"
 #include "themes.h"
+#include "stats.h"
 #include "dbg.h"
 
 StatusLine::StatusLine(const Editor *aBde, EditBox *aEditbox)
@@ -30,6 +31,7 @@ StatusLine::StatusLine(const Editor *aBde, EditBox *aEditbox)
     editbox = aEditbox;
     bde = aBde;
     cursor_position_report = false;
+    stats_report = false;
     update_region = rgnAll;
 }
 
@@ -55,6 +57,36 @@ void StatusLine::toggle_cursor_position_report()
     request_update(rgnAll);
 }
 
+void StatusLine::toggle_stats_report()
+{
+    stats_report = !stats_report;
+    request_update(rgnAll);
+}
+
+// draw_stats() - prints the time the last EditBox::update() took, and
+// the region it drew, followed by the counters (which count from the
+// start of the program).
+
+void StatusLine::draw_stats()
+{
+    const PerfStats &s = perf_stats;
+    u8string report;
+    report.cformat(" upd %.2fms/%s max %.2fms para %lu cache %lu/%lu "
+		   "wrap %lu bidi %lu undo %lu",
+		   s.last_update_msecs, update_kind_name(s.last_update_kind),
+		   s.max_update_msecs, s.redrawn_paragraphs,
+		   s.cache_hits, s.cache_hits + s.cache_misses,
+		   s.wrapped_paragraphs, s.embedding_levels,
+		   s.undo_bytes);
+    if (s.load_msecs > 0) {
+	u8string load;
+	load.cformat(" load %.1fMB/s",
+		     s.loaded_bytes / (s.load_msecs * 1000.0));
+	report += load;
+    }
+    draw_string(report.c_str());
+}
+
 void StatusLine::update()
 {
     if (update_region & rgnFilename)
@@ -132,7 +164,9 @@ void StatusLine::update()
 	waddch(wnd, ']');
     }
 
-    if (update_region & (rgnAll | rgnFilename)) {
+    if (stats_report && (update_region & (rgnAll | rgnFilename))) {
+	draw_stats();
+    } else if (update_region & (rgnAll | rgnFilename)) {
 	unistring tmp;
 	tmp.init_from_filename(bde->get_filename());
 	u8string filename;
@@ -148,11 +182,26 @@ void StatusLine::update()
 	}
 	if (bde->is_new())
 	    draw_string(_(" [New File]"));
+	if (bde->is_loading()) {
+	    size_t bytes_read, bytes_total;
+	    bde->get_load_progress(bytes_read, bytes_total);
+	    u8string progress;
+	    if (bytes_total)
+		progress.cformat(_(" [Loading %d%%]"),
+				 (int)(bytes_read * 100.0 / bytes_total));
+	    else
+		progress.cformat(_(" [Loading %luK]"),
+				 (unsigned long)(bytes_read / 1024));
+	    draw_string(progress.c_str());
+	}
+	if (bde->is_saving())
+	    draw_string(_(" [Saving]"));
 	wmove(wnd, 0, window_width() - strlen(bde->get_encoding()) - (2+5));
 	wprintw(wnd, "[disk:%s]", bde->get_encoding());
     }
 
-    if (cursor_position_report && (update_region & (rgnAll | rgnCursorPos))) {
+    if (cursor_position_report && !stats_report
+	    && (update_region & (rgnAll | rgnCursorPos))) {
 	// we use 16 columns for the cursor position.
 	int x = window_width() - strlen(bde->get_encoding()) - (2+5) - 16;
 	wmove(wnd, 0, x);
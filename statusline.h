@@ -18,10 +18,11 @@
 #define BDE_STATUSLINE_H
 
 #include "editbox.h"
+#include "curses_widget.h"
 
 class Editor;
 
-class StatusLine : public Widget, public EditBoxStatusListener {
+class StatusLine : public CursesWidget, public EditBoxStatusListener {
 
     const EditBox *editbox;
     const Editor *bde;
@@ -31,6 +32,9 @@ class StatusLine : public Widget, public EditBoxStatusListener {
     int update_region;
 
     bool cursor_position_report; // report cursor position?
+    bool stats_report;		 // show the PerfStats instead of the filename?
+
+    void draw_stats();
 
 public:
 
@@ -41,6 +45,11 @@ public:
 	return cursor_position_report;
     }
 
+    void toggle_stats_report();
+    bool is_stats_report() const {
+	return stats_report;
+    }
+
     void request_update(region rgn);
     virtual void update();
     virtual void invalidate_view();
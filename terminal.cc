@@ -16,16 +16,11 @@
 
 #include <config.h>
 
-// Baruch says to put editor.h first.
-#include "editor.h" // for SIGHUP's emergency_save
 #include "terminal.h"
 #include "dbg.h"
 
-#include <unistd.h> // _POSIX_VDISABLE
-#include <sys/wait.h>   // wait()
+#include <unistd.h>
 #include <signal.h>
-#include <errno.h>
-#include <termios.h>
 #include <stdlib.h>   // getenv
 #include <sys/time.h> // timeval
 #include <string.h>   // strstr
@@ -41,39 +36,12 @@ bool terminal::is_color;
 bool terminal::use_default_colors;
 bool terminal::do_arabic_shaping;
 bool terminal::graphical_boxes;
+void (*terminal::hangup_handler)() = NULL;
+int terminal::virtual_lines = 0;
+int terminal::virtual_columns = 0;
 
-static termios oldterm;
-
-void terminal::finish()
-{
-    endwin();
-    tcsetattr(0, TCSANOW, &oldterm);
-    DBG(1, ("Bailing out\n"));
-}
-
-static RETSIGTYPE sigint_hndlr(int sig)
-{
-}
-
-static RETSIGTYPE sigterm_hndlr(int sig)
-{
-    terminal::finish();
-    exit(0);
-}
-
-static RETSIGTYPE sighup_hndlr(int sig)
-{
-    Editor::get_global_instance()->emergency_save();
-    DBG(1, ("SIGHUP HANDLER\n"));
-    exit(0);
-}
-
-static RETSIGTYPE sigchld_hndlr(int sig)
-{
-    int serrno = errno;
-    wait(NULL);
-    errno = serrno;
-}
+// init() and finish(), which set up the terminal with curses, are in
+// terminal_curses.cc.
 
 // was_ctrl_c_pressed() - is a crude method to check if ^C was pressed
 // while in a non-interactive segment, like when receiving data from
@@ -114,66 +82,6 @@ void DISABLE_SIGTSTP()
     signal(SIGTSTP, SIG_IGN);
 }
 
-void terminal::init()
-{
-    tcgetattr(0, &oldterm);
-
-#ifdef _POSIX_VDISABLE
-    termios term;
-    term = oldterm;
-    term.c_cc[VINTR] = _POSIX_VDISABLE;
-    term.c_cc[VQUIT] = _POSIX_VDISABLE;
-    term.c_cc[VSTOP] = _POSIX_VDISABLE;
-    term.c_cc[VSTART] = _POSIX_VDISABLE;
-    tcsetattr(0, TCSANOW, &term);
-#else
-    termios term;
-    term = oldterm;
-    term.c_lflag &= ~ISIG;
-    term.c_iflag &= ~(IXON | IXOFF);
-    tcsetattr(0, TCSANOW, &term);
-#endif
-
-    signal(SIGINT, sigint_hndlr);
-    signal(SIGTERM, sigterm_hndlr);
-    signal(SIGHUP, sighup_hndlr);
-    signal(SIGCHLD, sigchld_hndlr);
-
-    // it's important to ignore SIGPIPE because the editor has the ability
-    // to write to a pipe.
-    signal(SIGPIPE, SIG_IGN);
-
-    initscr();
-    keypad(stdscr, TRUE);
-    nonl();
-    cbreak();
-    noecho();
-
-#ifdef HAVE_COLOR
-    if (has_colors()) {
-	is_color = true;
-	start_color();
-#ifdef HAVE_USE_DEFAULT_COLORS
-	terminal::use_default_colors = (::use_default_colors() == OK);
-#else
-	terminal::use_default_colors = false;
-#endif
-    } else {
-	is_color = false;
-    }
-#else
-    is_color = false;
-#endif
-
-    terminal::do_arabic_shaping = false;
-    terminal::initialized = true;
-
-    if (under_x11())
-	terminal::graphical_boxes = true;
-    else
-	terminal::graphical_boxes = false;
-}
-
 bool terminal::is_interactive()
 {
     return initialized;
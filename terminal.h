@@ -45,6 +45,11 @@
 # define bindtextdomain(Package, Directory)
 #endif
 
+// Keycodes curses returns for the sequences a terminal in "bracketed paste"
+// mode puts around pasted text (see terminal::init() and event.cc).
+#define KEY_PASTE_BEGIN	(KEY_MAX + 1)
+#define KEY_PASTE_END	(KEY_MAX + 2)
+
 class terminal {
 private:
     static bool initialized;
@@ -66,8 +71,15 @@ public:
 
     static bool graphical_boxes;   // Use graphical chars for the menu, scrollbar.
 
+    static void (*hangup_handler)(); // Called on SIGHUP (the editor saves
+				     // the buffer).
+
+    static int virtual_lines;	// If set, init() draws on a terminal of
+    static int virtual_columns;	// this size whose output is discarded.
+
     static void init();
     static void finish();
+    static void set_bracketed_paste(bool on);
     static bool was_ctrl_c_pressed();
     static bool is_interactive();
     static void determine_locale();
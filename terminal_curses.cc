@@ -0,0 +1,159 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include "terminal.h"
+#include "curses_widget.h"
+#include "dbg.h"
+
+#include <unistd.h> // _POSIX_VDISABLE
+#include <sys/wait.h>   // wait()
+#include <signal.h>
+#include <errno.h>
+#include <termios.h>
+#include <stdlib.h>   // getenv
+#include <stdio.h>    // sprintf
+
+// Setting up the terminal with curses. The flags of the "terminal" class,
+// which the core consults too, are in terminal.cc.
+
+static termios oldterm;
+
+void terminal::finish()
+{
+    set_bracketed_paste(false);
+    endwin();
+    tcsetattr(0, TCSANOW, &oldterm);
+    DBG(1, ("Bailing out\n"));
+}
+
+static RETSIGTYPE sigint_hndlr(int sig)
+{
+}
+
+static RETSIGTYPE sigterm_hndlr(int sig)
+{
+    terminal::finish();
+    exit(0);
+}
+
+static RETSIGTYPE sighup_hndlr(int sig)
+{
+    if (terminal::hangup_handler)
+	terminal::hangup_handler();
+    DBG(1, ("SIGHUP HANDLER\n"));
+    exit(0);
+}
+
+static RETSIGTYPE sigchld_hndlr(int sig)
+{
+    int serrno = errno;
+    wait(NULL);
+    errno = serrno;
+}
+
+// set_bracketed_paste() - asks the terminal to send "ESC [ 200 ~" before
+// pasted text and "ESC [ 201 ~" after it. Terminals that don't know this
+// xterm mode ignore the request, and then a paste is simply "typed".
+
+void terminal::set_bracketed_paste(bool on)
+{
+    if (virtual_lines && virtual_columns)
+	return; // nobody pastes into a virtual terminal
+    putp(on ? "\033[?2004h" : "\033[?2004l");
+    fflush(stdout);
+}
+
+void terminal::init()
+{
+    tcgetattr(0, &oldterm);
+
+#ifdef _POSIX_VDISABLE
+    termios term;
+    term = oldterm;
+    term.c_cc[VINTR] = _POSIX_VDISABLE;
+    term.c_cc[VQUIT] = _POSIX_VDISABLE;
+    term.c_cc[VSTOP] = _POSIX_VDISABLE;
+    term.c_cc[VSTART] = _POSIX_VDISABLE;
+    tcsetattr(0, TCSANOW, &term);
+#else
+    termios term;
+    term = oldterm;
+    term.c_lflag &= ~ISIG;
+    term.c_iflag &= ~(IXON | IXOFF);
+    tcsetattr(0, TCSANOW, &term);
+#endif
+
+    signal(SIGINT, sigint_hndlr);
+    signal(SIGTERM, sigterm_hndlr);
+    signal(SIGHUP, sighup_hndlr);
+    signal(SIGCHLD, sigchld_hndlr);
+
+    // it's important to ignore SIGPIPE because the editor has the ability
+    // to write to a pipe.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (virtual_lines && virtual_columns) {
+	// curses takes the size from LINES and COLUMNS when they're set.
+	char num[16];
+	sprintf(num, "%d", virtual_lines);
+	setenv("LINES", num, 1);
+	sprintf(num, "%d", virtual_columns);
+	setenv("COLUMNS", num, 1);
+	FILE *null_output = fopen("/dev/null", "w");
+	const char *term = getenv("TERM");
+	if (!null_output || !newterm(term ? term : "xterm", null_output, stdin))
+	    initscr(); // we'll use the real terminal, then.
+    } else {
+	initscr();
+    }
+    keypad(stdscr, TRUE);
+#ifdef NCURSES_VERSION
+    define_key("\033[200~", KEY_PASTE_BEGIN);
+    define_key("\033[201~", KEY_PASTE_END);
+    set_bracketed_paste(true);
+#endif
+    nonl();
+    cbreak();
+    noecho();
+
+#ifdef HAVE_COLOR
+    if (has_colors()) {
+	is_color = true;
+	start_color();
+#ifdef HAVE_USE_DEFAULT_COLORS
+	terminal::use_default_colors = (::use_default_colors() == OK);
+#else
+	terminal::use_default_colors = false;
+#endif
+    } else {
+	is_color = false;
+    }
+#else
+    is_color = false;
+#endif
+
+    terminal::do_arabic_shaping = false;
+    terminal::initialized = true;
+    Widget::canvas_factory = CursesCanvas::create;
+
+    if (under_x11())
+	terminal::graphical_boxes = true;
+    else
+	terminal::graphical_boxes = false;
+}
+
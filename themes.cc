@@ -2,7 +2,7 @@
 
 #include "geresh_io.h"     // get_cfg_filename
 #include "pathnames.h"
-#include "widget.h"
+#include "curses_widget.h"
 #include "themes.h"
 
 #include <errno.h>
@@ -107,6 +107,8 @@ ATTR attr_table[] = {
 	MISSING_COLOR, MISSING_COLOR, 0, 0 },
     { EDIT_LINKS_ATTR, "edit.links", EDIT_EMPHASIZED_ATTR, EDIT_EMPHASIZED_ATTR,
 	MISSING_COLOR, MISSING_COLOR, 0, 0 },
+    { EDIT_MISSPELLED_ATTR, "edit.misspelled", EDIT_ATTR, EDIT_ATTR,
+	MISSING_COLOR, MISSING_COLOR, 0, 0 },
     { EDIT_EMAIL_QUOTE1_ATTR, "edit.email-quote1", EDIT_ATTR, EDIT_ATTR,
 	MISSING_COLOR, MISSING_COLOR, 0, 0 },
     { EDIT_EMAIL_QUOTE2_ATTR, "edit.email-quote2", EDIT_EMAIL_QUOTE1_ATTR, EDIT_EMAIL_QUOTE1_ATTR,
@@ -156,6 +158,7 @@ static const char *default_color_theme[] =
 "edit.html-tag = bold",
 "edit.email-quote1 = bold",
 "edit.emphasized = underline, +bold",
+"edit.misspelled = underline",
 NULL
 };
 
@@ -185,6 +188,7 @@ static const char *default_bw_theme[] =
 "edit.html-tag = bold",
 "edit.email-quote1 = bold",
 "edit.emphasized = underline, +bold",
+"edit.misspelled = underline",
 NULL
 };
 
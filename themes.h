@@ -34,6 +34,7 @@
 #define EDIT_HTML_TAG_ATTR	    38
 #define EDIT_EMPHASIZED_ATTR	    39
 #define EDIT_LINKS_ATTR		    40
+#define EDIT_MISSPELLED_ATTR	    41
 #define EDIT_EMAIL_QUOTE1_ATTR	    101
 #define EDIT_EMAIL_QUOTE2_ATTR	    102
 #define EDIT_EMAIL_QUOTE3_ATTR	    103
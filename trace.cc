@@ -0,0 +1,199 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>  // atexit
+#include <unistd.h>  // getpid
+#include <sched.h>   // sched_yield
+#include <sys/time.h>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include "trace.h"
+
+// The number of events each ring keeps.
+#define TRACE_RING_SIZE 32768
+
+struct TraceRecord {
+    const char *name;
+    char phase;		// 'B' or 'E'
+    int tid;		// the thread that recorded it
+    double usecs;	// since start_tracing()
+};
+
+// A ring belongs to one thread at a time. When the thread exits, its ring
+// is handed to the next new thread, so short-lived threads (e.g. the
+// workers of the parallel loaders) don't each cost a ring. The events of
+// the old thread are kept till the new one overwrites them.
+
+struct TraceRing {
+    int tid;		// the thread that owns it, or 0 when free
+    unsigned long count; // events recorded; the last TRACE_RING_SIZE are kept
+    std::atomic<bool> busy; // is the owner recording an event?
+    TraceRecord records[TRACE_RING_SIZE];
+    TraceRing *next;
+};
+
+std::atomic<bool> tracing_enabled(false);
+
+static FILE *trace_file = NULL;
+static double start_usecs;
+static TraceRing *rings = NULL; // all the rings, newest first
+static int threads_count = 0;
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t ring_key;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static TraceRing *the_ring = NULL;
+#endif
+
+static double now_usecs()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000000.0 + tv.tv_usec;
+}
+
+// new_ring() - gives the calling thread a ring: a free one if there is,
+// else a new one. This is the only place where a lock is taken, once per
+// thread.
+
+static TraceRing *new_ring()
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&rings_lock);
+#endif
+    TraceRing *ring = rings;
+    while (ring && ring->tid != 0)
+	ring = ring->next;
+    if (!ring) {
+	ring = new TraceRing;
+	ring->count = 0;
+	ring->busy = false;
+	ring->next = rings;
+	rings = ring;
+    }
+    ring->tid = ++threads_count;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&rings_lock);
+    pthread_setspecific(ring_key, ring);
+#else
+    the_ring = ring;
+#endif
+    return ring;
+}
+
+#ifdef HAVE_PTHREAD
+
+// release_ring() - the destructor of ring_key: frees the ring of an
+// exiting thread for the next new thread.
+
+static void release_ring(void *data)
+{
+    TraceRing *ring = (TraceRing *)data;
+    pthread_mutex_lock(&rings_lock);
+    ring->tid = 0;
+    pthread_mutex_unlock(&rings_lock);
+}
+
+#endif
+
+// start_tracing() - opens the trace file and arranges for flush_trace()
+// to be called on exit. The file is opened right away so that we can
+// report an error before the terminal is taken over.
+
+bool start_tracing(const char *filename)
+{
+    if (!(trace_file = fopen(filename, "w")))
+	return false;
+#ifdef HAVE_PTHREAD
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
+	fclose(trace_file);
+	return false;
+    }
+#endif
+    start_usecs = now_usecs();
+    new_ring(); // the main thread is the first
+    tracing_enabled = true;
+    atexit(flush_trace);
+    return true;
+}
+
+void trace_event(const char *name, char phase)
+{
+#ifdef HAVE_PTHREAD
+    TraceRing *ring = (TraceRing *)pthread_getspecific(ring_key);
+#else
+    TraceRing *ring = the_ring;
+#endif
+    if (!ring)
+	ring = new_ring();
+    // flush_trace() reads the ring once it has disabled tracing and seen
+    // it not busy, so we check again after marking it busy.
+    ring->busy = true;
+    if (tracing_enabled) {
+	TraceRecord &rec = ring->records[ring->count++ % TRACE_RING_SIZE];
+	rec.name  = name;
+	rec.phase = phase;
+	rec.tid   = ring->tid;
+	rec.usecs = now_usecs() - start_usecs;
+    }
+    ring->busy = false;
+}
+
+// flush_trace() - writes the recorded events as a Chrome trace JSON file.
+// It's called on exit. Other threads may still be running: once tracing
+// is disabled they record nothing more, and we wait for the events they
+// are in the middle of recording.
+
+void flush_trace()
+{
+    if (!tracing_enabled.exchange(false))
+	return;
+
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&rings_lock);
+#endif
+    for (TraceRing *ring = rings; ring; ring = ring->next)
+	while (ring->busy)
+	    sched_yield();
+
+    int pid = (int)getpid();
+    fprintf(trace_file, "{\"traceEvents\":[\n");
+    fprintf(trace_file, "{\"name\":\"thread_name\",\"ph\":\"M\","
+	    "\"pid\":%d,\"tid\":1,\"args\":{\"name\":\"main\"}}", pid);
+    for (TraceRing *ring = rings; ring; ring = ring->next) {
+	unsigned long start = (ring->count > TRACE_RING_SIZE)
+				? ring->count - TRACE_RING_SIZE : 0;
+	for (unsigned long i = start; i < ring->count; i++) {
+	    const TraceRecord &rec = ring->records[i % TRACE_RING_SIZE];
+	    fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"%c\","
+		    "\"ts\":%.1f,\"pid\":%d,\"tid\":%d}",
+		    rec.name, rec.phase, rec.usecs, pid, rec.tid);
+	}
+    }
+    fprintf(trace_file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    fclose(trace_file);
+    trace_file = NULL;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&rings_lock);
+#endif
+}
+
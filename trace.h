@@ -0,0 +1,71 @@
+// Copyright (C) 2003 Mooffie <mooffie@typo.co.il>
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA.
+
+#ifndef BDE_TRACE_H
+#define BDE_TRACE_H
+
+#include <config.h>
+
+#include <atomic>
+
+// The tracer records when the main parts of the editor begin and end, and
+// writes the events on exit in the Chrome trace format, which can be
+// viewed in chrome://tracing or in Perfetto. Every thread records into a
+// ring buffer of its own, so recording takes no locks; when a buffer is
+// full, its oldest events are overwritten. Tracing may be disabled (by
+// flush_trace()) while other threads run, hence the atomic flag.
+//
+// Event names must be string literals: only the pointers are recorded.
+
+extern std::atomic<bool> tracing_enabled;
+
+bool start_tracing(const char *filename);
+void trace_event(const char *name, char phase);
+void flush_trace();
+
+#define TRACE_BEGIN(name) \
+    do { \
+	if (tracing_enabled) \
+	    trace_event(name, 'B'); \
+    } while (0)
+
+#define TRACE_END(name) \
+    do { \
+	if (tracing_enabled) \
+	    trace_event(name, 'E'); \
+    } while (0)
+
+// TraceScope traces the block it's declared in.
+
+class TraceScope {
+    const char *name;
+
+public:
+    TraceScope(const char *aName) {
+	name = tracing_enabled ? aName : 0;
+	if (name)
+	    trace_event(name, 'B');
+    }
+    ~TraceScope() {
+	if (name)
+	    trace_event(name, 'E');
+    }
+};
+
+#define TRACE_SCOPE(name) TraceScope trace_scope__(name)
+
+#endif
+
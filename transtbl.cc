@@ -20,6 +20,7 @@
 #include <errno.h>
 
 #include "transtbl.h"
+#include "univalues.h"
 #include "geresh_io.h" // set_last_error
 #include "dbg.h"
 #include <cstring>
@@ -92,7 +93,8 @@ static char *parse_next_char(char *s, unichar &ch)
 bool TranslationTable::load(const char *filename)
 {
 #define MAX_LINE_LEN 1024
-    charmap.clear();
+    pages.clear();
+    count = 0;
 
     FILE *fp = fopen(filename, "r");
     if (!fp) {
@@ -113,7 +115,7 @@ bool TranslationTable::load(const char *filename)
 	char *s = line;
 	if ((s = parse_next_char(s, ch1)))
 	    if ((s = parse_next_char(s, ch2)))
-		charmap[ch1] = ch2;
+		add(ch1, ch2);
     }
     fclose(fp);
 
@@ -121,17 +123,35 @@ bool TranslationTable::load(const char *filename)
 #undef MAX_LINE_LEN
 }
 
-// translate_char() - matches a character with another, in-place. returns
-// false if no match exists.
+// add() - adds a mapping, replacing any previous mapping of "from".
+// Characters beyond Unicode are ignored, so that a bogus table won't make
+// us allocate a huge index.
 
-bool TranslationTable::translate_char(unichar &ch) const
+void TranslationTable::add(unichar from, unichar to)
 {
-    std::map<unichar, unichar>::const_iterator
-		    it = charmap.find(ch);
-    if (it != charmap.end()) {
-	ch = it->second;
-	return true;
-    } else
-	return false;
+    if (from > UNICODE_MAX || to == TRANSTBL_NO_MAPPING)
+	return;
+    size_t page = from >> TRANSTBL_PAGE_BITS;
+    if (page >= pages.size())
+	pages.resize(page + 1);
+    if (pages[page].empty())
+	pages[page].resize(TRANSTBL_PAGE_SIZE, TRANSTBL_NO_MAPPING);
+    unichar &entry = pages[page][from & (TRANSTBL_PAGE_SIZE - 1)];
+    if (entry == TRANSTBL_NO_MAPPING)
+	count++;
+    entry = to;
+}
+
+// translate() - translates a string in-place, in one pass. Characters
+// that have no match are left alone. Returns the number of characters
+// translated.
+
+int TranslationTable::translate(unichar *str, idx_t len) const
+{
+    int translated = 0;
+    for (idx_t i = 0; i < len; i++)
+	if (translate_char(str[i]))
+	    translated++;
+    return translated;
 }
 
@@ -17,7 +17,7 @@
 #ifndef BDE_TRANSTBL_H
 #define BDE_TRANSTBL_H
 
-#include <map>
+#include <vector>
 
 #include "types.h"
 
@@ -27,18 +27,47 @@
 // For example, the hebrew keyboard emulation is implemented as a
 // TranslationTable that maps english characters to the hebrew characters
 // that sit in their place on the keyboard.
+//
+// translate_char() is called for every key typed and for every character
+// drawn, so the table is indexed directly, in two levels: the high bits
+// of a character select a page, and the low bits an entry in it. Only
+// pages that have mappings are allocated; a keyboard table takes a page
+// or two.
+
+#define TRANSTBL_PAGE_BITS 8
+#define TRANSTBL_PAGE_SIZE (1 << TRANSTBL_PAGE_BITS)
+// an entry that maps to nothing holds TRANSTBL_NO_MAPPING.
+#define TRANSTBL_NO_MAPPING ((unichar)-1)
 
 class TranslationTable {
     
-    std::map<unichar, unichar> charmap;
+    std::vector< std::vector<unichar> > pages; // unallocated pages are empty
+    int count;
+
+    void add(unichar from, unichar to);
     
 public:
 
-    TranslationTable() { }
+    TranslationTable() { count = 0; }
   
-    bool empty() const { return charmap.empty(); }
+    bool empty() const { return count == 0; }
     bool load(const char *);
-    bool translate_char(unichar &ch) const;
+
+    // translate_char() - matches a character with another, in-place.
+    // returns false if no match exists.
+    bool translate_char(unichar &ch) const {
+	size_t page = ch >> TRANSTBL_PAGE_BITS;
+	if (page < pages.size() && !pages[page].empty()) {
+	    unichar to = pages[page][ch & (TRANSTBL_PAGE_SIZE - 1)];
+	    if (to != TRANSTBL_NO_MAPPING) {
+		ch = to;
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    int translate(unichar *str, idx_t len) const;
 };
 
 #endif
@@ -16,6 +16,7 @@
 
 #include "undo.h"
 #include "dbg.h"
+#include "stats.h"
 
 #define DEFAULT_LIMIT	4000
 #define RESERVE		1000
@@ -65,11 +66,13 @@ void UndoStack::set_size_limit(size_t limit)
 void UndoStack::update_size_up(int chars_count)
 {
     bytes_size += chars_count * sizeof(unichar);
+    PERF_COUNT(undo_bytes, chars_count * sizeof(unichar));
 }
 
 void UndoStack::update_size_up(const UndoOp &op)
 {
     bytes_size += op.calc_size();
+    PERF_COUNT(undo_bytes, op.calc_size());
 }
 
 void UndoStack::update_size_down(const UndoOp &op)
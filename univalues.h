@@ -17,6 +17,10 @@
 #ifndef BDE_UNIVALUES_H
 #define BDE_UNIVALUES_H
 
+// The last code point
+
+#define UNICODE_MAX	0x10FFFF
+
 // Line Separator and Paragraph Separator
 
 #define UNICODE_LS	0x2028
@@ -92,6 +96,7 @@
 #define UNI_REPLACEMENT		    0xFFFD
 #define UNI_NS_UNDERSCORE	    0x0332
 #define UNI_NO_BREAK_SPACE	    0x00A0
+#define UNI_BOM			    0xFEFF
 
 // Arabic
 
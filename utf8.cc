@@ -16,81 +16,201 @@
 
 #include <config.h>
 
+#include <string.h> // memcpy
+
+#if defined(__SSE2__)
+# include <emmintrin.h>
+# define HAVE_SSE2_KERNEL 1
+#endif
+
 #include "utf8.h"
 #include "univalues.h"
 #include "dbg.h"
 
-// utf8_to_unicode() - converts a UTF-8 string to unichars. When an
-// incomplete sequence is encountered, *problem will point to its head (it's
-// similar to what iconv does).
-//
-// This function converts UTF-8 to UCS-4 (not to UTF-32) -- that's why it
-// recognizes 5- and 6-byte sequences.
+#ifndef MIN
+# define MIN(x,y) ((x)<(y)?(x):(y))
+#endif
 
-int utf8_to_unicode(unichar *dest, const char *s, int len, const char **problem)
+// Most of the text we read is ASCII, or ASCII interspersed with short runs
+// of Hebrew. The decoder below first consumes whole blocks of ASCII bytes
+// (16 bytes at a time with SSE2, 8 bytes at a time otherwise) and widens
+// them to unichars; only when a block contains a byte with the high bit set
+// do we fall back to decoding one sequence at a time.
+
+#define IS_CONT(c)  (((c) & 0xC0) == 0x80)
+
+// seq_len() - returns the length of the sequence whose head is 'c', or 0 if
+// 'c' can't start a sequence.
+
+static inline int seq_len(unsigned char c)
+{
+    return (c & 0xE0) == 0xC0 ? 2 :
+	   (c & 0xF0) == 0xE0 ? 3 :
+	   (c & 0xF8) == 0xF0 ? 4 :
+	   (c & 0xFC) == 0xF8 ? 5 :
+	   (c & 0xFE) == 0xFC ? 6 : 0;
+}
+
+#ifdef HAVE_SSE2_KERNEL
+// the SSE2 code widens bytes into 32-bit lanes.
+typedef char unichar_is_32_bit[sizeof(unichar) == 4 ? 1 : -1];
+#endif
+
+#ifdef __GNUC__
+# define FIRST_SET_BIT(mask) __builtin_ctz(mask)
+#else
+static inline int FIRST_SET_BIT(unsigned mask)
+{
+    int i = 0;
+    while (!(mask & 1)) {
+	mask >>= 1;
+	i++;
+    }
+    return i;
+}
+#endif
+
+// decode_ascii_run() - consumes the ASCII bytes at the head of [s, end),
+// storing them as unichars in dest (if dest isn't NULL). It returns the
+// number of bytes consumed; s[return value] is either 'end' or the first
+// byte with the high bit set.
+
+static inline int decode_ascii_run(unichar *dest, const unsigned char *s,
+				   const unsigned char *end)
 {
+    const unsigned char *start = s;
+#ifdef HAVE_SSE2_KERNEL
+    const __m128i zero = _mm_setzero_si128();
+    while (end - s >= 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)s);
+	unsigned mask = (unsigned)_mm_movemask_epi8(v);
+	if (mask)
+	    break;
+	if (dest) {
+	    __m128i lo = _mm_unpacklo_epi8(v, zero);
+	    __m128i hi = _mm_unpackhi_epi8(v, zero);
+	    _mm_storeu_si128((__m128i *)(dest + 0),  _mm_unpacklo_epi16(lo, zero));
+	    _mm_storeu_si128((__m128i *)(dest + 4),  _mm_unpackhi_epi16(lo, zero));
+	    _mm_storeu_si128((__m128i *)(dest + 8),  _mm_unpacklo_epi16(hi, zero));
+	    _mm_storeu_si128((__m128i *)(dest + 12), _mm_unpackhi_epi16(hi, zero));
+	    dest += 16;
+	}
+	s += 16;
+    }
+    if (end - s >= 16) {
+	// The block has a non-ASCII byte; copy the bytes preceding it.
+	unsigned mask = (unsigned)_mm_movemask_epi8(
+				_mm_loadu_si128((const __m128i *)s));
+	int n = FIRST_SET_BIT(mask);
+	if (dest)
+	    for (int i = 0; i < n; i++)
+		dest[i] = s[i];
+	return (s - start) + n;
+    }
+#else
+    while (end - s >= 8) {
+	unsigned long long word;
+	memcpy(&word, s, 8);
+	if (word & 0x8080808080808080ULL)
+	    break;
+	if (dest) {
+	    for (int i = 0; i < 8; i++)
+		dest[i] = s[i];
+	    dest += 8;
+	}
+	s += 8;
+    }
+#endif
+    // the tail (or the head of the block that has a non-ASCII byte).
+    while (s < end && !(*s & 0x80)) {
+	if (dest)
+	    *dest++ = *s;
+	s++;
+    }
+    return s - start;
+}
+
+// utf8_decode() - the decoding kernel shared by utf8_to_unicode() and
+// utf8_to_unicode_strict(). When 'strict' is true it stops at the first
+// illegal sequence (a byte that can't start a sequence, or a missing
+// continuation byte) and sets *illegal; otherwise it emits
+// UNI_REPLACEMENT for bytes that can't start a sequence and, like the
+// original decoder, doesn't check the continuation bytes. 'dest' may be
+// NULL, in which case we only validate.
+
+static int utf8_decode(unichar *dest, const char *str, int len,
+		       const char **problem, bool strict, bool *illegal)
+{
+    const unsigned char *s   = (const unsigned char *)str;
+    const unsigned char *end = s + len;
     int length = 0;
-    const char *end = s + len;
-    
+
     if (problem)
 	*problem = NULL;
+    if (illegal)
+	*illegal = false;
 
 // constant expressions are evaluated at compile time, of course.
 #define FRST(t)  ((*s & ((1 << (8-t-1)) - 1)) << (t-1)*6)
 #define UC(t,n)  (*(s+n-1) & 0x3F) << ((t-n)*6)
     while (s < end) {
-	if (!(*s & 0x80)) {
-	    *dest++ = *s;
-	    s++;
-	} else if ((*s & 0xE0) == 0xC0) {
-	    if ((end - s) >= 2) {
-		*dest++ = FRST(2) | UC(2,2);
-		s += 2;
-	    } else {
-		if (problem)
-		    *problem = s;
-		break;
-	    }
-	} else if ((*s & 0xF0) == 0xE0) {
-	    if ((end - s) >= 3) {
-		*dest++ = FRST(3) | UC(3,2) | UC(3,3);
-		s += 3;
-	    } else {
-		if (problem)
-		    *problem = s;
-		break;
-	    }
-	} else if ((*s & 0xF8) == 0xF0) {
-	    if ((end - s) >= 4) {
-		*dest++ = FRST(4) | UC(4,2) | UC(4,3) | UC(4,4);
-		s += 4;
-	    } else {
+	int nascii = decode_ascii_run(dest, s, end);
+	s += nascii;
+	length += nascii;
+	if (dest)
+	    dest += nascii;
+	if (s == end)
+	    break;
+
+	int t = seq_len(*s);
+	if (t == 0) {
+	    if (strict) {
 		if (problem)
-		    *problem = s;
+		    *problem = (const char *)s;
+		if (illegal)
+		    *illegal = true;
 		break;
 	    }
-	} else if ((*s & 0xFC) == 0xF8) {
-	    if ((end - s) >= 5) {
-		*dest++ = FRST(5) | UC(5,2) | UC(5,3) | UC(5,4) | UC(5,5);
-		s += 5;
-	    } else {
+	    if (dest)
+		*dest++ = UNI_REPLACEMENT;
+	    s++;
+	    length++;
+	    continue;
+	}
+
+	int avail = MIN(t, end - s);
+	if (strict) {
+	    int i;
+	    for (i = 1; i < avail; i++)
+		if (!IS_CONT(s[i]))
+		    break;
+	    if (i < avail) {
 		if (problem)
-		    *problem = s;
+		    *problem = (const char *)s;
+		if (illegal)
+		    *illegal = true;
 		break;
 	    }
-	} else if ((*s & 0xFE) == 0xFC) {
-	    if ((end - s) >= 6) {
-		*dest++ = FRST(6) | UC(6,2) | UC(6,3) | UC(6,4) | UC(6,5) | UC(6,6);
-		s += 6;
-	    } else {
-		if (problem)
-		    *problem = s;
-		break;
+	}
+	if (avail < t) {
+	    // incomplete sequence.
+	    if (problem)
+		*problem = (const char *)s;
+	    break;
+	}
+
+	if (dest) {
+	    switch (t) {
+	    case 2: *dest = FRST(2) | UC(2,2); break;
+	    case 3: *dest = FRST(3) | UC(3,2) | UC(3,3); break;
+	    case 4: *dest = FRST(4) | UC(4,2) | UC(4,3) | UC(4,4); break;
+	    case 5: *dest = FRST(5) | UC(5,2) | UC(5,3) | UC(5,4) | UC(5,5); break;
+	    case 6: *dest = FRST(6) | UC(6,2) | UC(6,3) | UC(6,4) | UC(6,5)
+				    | UC(6,6); break;
 	    }
-	} else {
-	    *dest++ = UNI_REPLACEMENT;
-	    s++;
+	    dest++;
 	}
+	s += t;
 	length++;
     }
     return length;
@@ -98,18 +218,86 @@ int utf8_to_unicode(unichar *dest, const char *s, int len, const char **problem)
 #undef UC
 }
 
-// unicode_to_utf8() - converts unichars to UTF-8.
+// utf8_to_unicode() - converts a UTF-8 string to unichars. When an
+// incomplete sequence is encountered, *problem will point to its head (it's
+// similar to what iconv does).
+//
+// This function converts UTF-8 to UCS-4 (not to UTF-32) -- that's why it
+// recognizes 5- and 6-byte sequences.
+
+int utf8_to_unicode(unichar *dest, const char *s, int len, const char **problem)
+{
+    return utf8_decode(dest, s, len, problem, false, NULL);
+}
+
+// utf8_to_unicode_strict() - like utf8_to_unicode(), but validates the
+// input as well. It stops at the first illegal or incomplete sequence and
+// makes *problem point to its head; 'illegal' tells the two cases apart.
+// When 'dest' is NULL the input is only validated.
+//
+// Returns the number of characters decoded (or that would have been
+// decoded) before *problem.
+
+int utf8_to_unicode_strict(unichar *dest, const char *s, int len,
+			   const char **problem, bool &illegal)
+{
+    return utf8_decode(dest, s, len, problem, true, &illegal);
+}
+
+// encode_ascii_run() - the encoder's counterpart of decode_ascii_run(): it
+// narrows the ASCII unichars at the head of [us, us + len) into dest and
+// returns how many it has consumed.
+
+static inline int encode_ascii_run(char *dest, const unichar *us, int len)
+{
+    int n = 0;
+#ifdef HAVE_SSE2_KERNEL
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i high = _mm_set1_epi32(~0x7F);
+    while (len - n >= 16) {
+	__m128i a = _mm_loadu_si128((const __m128i *)(us + n + 0));
+	__m128i b = _mm_loadu_si128((const __m128i *)(us + n + 4));
+	__m128i c = _mm_loadu_si128((const __m128i *)(us + n + 8));
+	__m128i d = _mm_loadu_si128((const __m128i *)(us + n + 12));
+	__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high), zero))
+		!= 0xFFFF)
+	    break;
+	// all values are below 0x80, so the saturating packs are exact.
+	__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b),
+					 _mm_packs_epi32(c, d));
+	_mm_storeu_si128((__m128i *)(dest + n), bytes);
+	n += 16;
+    }
+#endif
+    while (n < len && us[n] < 0x80) {
+	dest[n] = (char)us[n];
+	n++;
+    }
+    return n;
+}
+
+// unicode_to_utf8() - converts unichars to UTF-8. "dest" must have room
+// for 6 bytes per character.
+//
+// Runs of ASCII are handled by encode_ascii_run(); Hebrew (and everything
+// else below U+0800) is the first case of the per-character code.
 
 int unicode_to_utf8(char *dest, const unichar *us, int len)
 {
 #define UC(n)	((*us >> 6*n) & 0x3F)
 #define CNT(n)	(((1 << n) - 1) << (8 - n))
     int nbytes = 0;
-    while (len--) {
-	if (*us < 0x80) {
-	    *dest++ = *us;
-	    nbytes += 1;
-	} else if (*us < 0x800) {
+    while (len > 0) {
+	int nascii = encode_ascii_run(dest, us, len);
+	dest   += nascii;
+	us     += nascii;
+	nbytes += nascii;
+	len    -= nascii;
+	if (len == 0)
+	    break;
+	len--;
+	if (*us < 0x800) {
 	    *dest++ = UC(1) | CNT(2);
 	    *dest++ = UC(0) | 0x80;
 	    nbytes += 2;
@@ -147,3 +335,18 @@ int unicode_to_utf8(char *dest, const unichar *us, int len)
 #undef CNT
 }
 
+// ascii_to_unicode() and unicode_to_ascii() expose the ASCII kernels to
+// the other converters (see converters.cc). They return the number of
+// leading ASCII characters converted.
+
+int ascii_to_unicode(unichar *dest, const char *s, int len)
+{
+    const unsigned char *us = (const unsigned char *)s;
+    return decode_ascii_run(dest, us, us + len);
+}
+
+int unicode_to_ascii(char *dest, const unichar *us, int len)
+{
+    return encode_ascii_run(dest, us, len);
+}
+
@@ -20,7 +20,11 @@
 #include "types.h"
 
 int utf8_to_unicode(unichar *dest, const char *s, int len, const char **problem = NULL);
+int utf8_to_unicode_strict(unichar *dest, const char *s, int len,
+			   const char **problem, bool &illegal);
 int unicode_to_utf8(char *dest, const unichar *us, int len);
+int ascii_to_unicode(unichar *dest, const char *s, int len);
+int unicode_to_ascii(char *dest, const unichar *us, int len);
 
 #endif
 
@@ -17,14 +17,13 @@
 #include <config.h>
 
 #include "widget.h"
-#include "mk_wcwidth.h"
-#include "bidi.h"
-#include "shaping.h"
 #include "my_wctob.h"
 
+Canvas *(*Widget::canvas_factory)(int lines, int cols) = NULL;
+
 Widget::Widget()
 {
-    wnd = NULL;
+    canvas = NULL;
     modal = false;
 }
 
@@ -35,84 +34,36 @@ Widget::~Widget()
 
 bool Widget::create_window(int lines, int cols)
 {
-    if (terminal::is_interactive()) {
-	wnd = newwin(lines, cols, 0, 0);
-	enable_keypad();
-    }
-    return wnd != NULL;
+    if (canvas_factory)
+	canvas = canvas_factory(lines, cols);
+    return canvas != NULL;
+}
+
+void Widget::destroy_window()
+{
+    delete canvas;
+    canvas = NULL;
 }
 
 void Widget::resize(int lines, int columns, int y, int x)
 {
-    wresize(wnd, lines, columns);
-    mvwin(wnd, y, x);
+    if (canvas)
+	canvas->resize(lines, columns, y, x);
 }
 
+// put_unichar() - draws a character, or "bad_repr" if the terminal can't
+// show it.
+
 void Widget::put_unichar(unichar ch, unichar bad_repr)
 {
 #ifdef HAVE_WIDE_CURSES
     if (!terminal::is_utf8 && WCTOB(ch) == EOF)
 	ch = bad_repr;
-    waddnwstr(wnd, (wchar_t*)&ch, 1);
+    canvas->put_char(ch);
 #else
     int ich = terminal::force_iso88598 ? unicode_to_iso88598(ch) : WCTOB(ch);
     if (ich == EOF)
 	ich = bad_repr;
-    waddch(wnd, (unsigned char)ich);
+    canvas->put_char((unsigned char)ich);
 #endif
 }
-
-// draw_string() - draws a UTF-8 string. This is a very simple routine and
-// it's used by the most simple widgets only (like Label).
-
-void Widget::draw_string(const char *u8, bool align_right)
-{
-    unistring text, vis_text;
-    text.init_from_utf8(u8);
-
-    // trim string to fit window width
-    int wnd_x, dummy;
-    getyx(wnd, dummy, wnd_x);
-    int swidth = wnd_x;
-    unichar *trim_pos = text.begin();
-    while (trim_pos < text.end()) {
-	int char_width = mk_wcwidth(*trim_pos);
-	if (swidth + char_width > window_width())
-	    break;
-	swidth += char_width;
-	trim_pos++;
-    }
-    text.erase(trim_pos, text.end());
-   
-    // convert to visual
-    direction_t dir = BiDi::determine_base_dir(text.begin(), text.size(),
-					       algoUnicode);
-    BiDi::simple_log2vis(text, dir, vis_text);
-
-    if (terminal::do_arabic_shaping) {
-	int new_len = shape(vis_text.begin(), vis_text.len());
-	swidth -= vis_text.len() - new_len;
-	vis_text.resize(new_len);
-    }
-
-    // draw the string
-    if (align_right && dir == dirRTL)
-	wmove(wnd, 0, window_width() - swidth);
-    for (int i = 0; i < vis_text.len(); i++) {
-	put_unichar(vis_text[i], '?');
-    }
-
-    // reposition the cursor
-    if (align_right && dir == dirRTL)
-	wmove(wnd, 0, window_width() - swidth - 1);
-}
-
-void Widget::signal_error()
-{
-    // I don't like those awful beeps,
-    // but people may not be familiar with flashes.
-
-    //flash();
-    beep();
-}
-
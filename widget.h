@@ -18,9 +18,10 @@
 #define BDE_WIDGET_H
 
 #include "dispatcher.h"
-#include "terminal.h"
+#include "canvas.h"
 
-typedef int attribute_t;
+// Widget draws on a Canvas (see canvas.h). The widgets of the frontend,
+// which draw with curses directly, derive from CursesWidget.
 
 class Widget : public Dispatcher {
 
@@ -28,55 +29,35 @@ class Widget : public Dispatcher {
 
 public:
 
-    WINDOW *wnd; // public
+    Canvas *canvas; // public; NULL when there's no terminal.
+
+    // creates the canvases; set by the frontend when the terminal is
+    // initialized.
+    static Canvas *(*canvas_factory)(int lines, int cols);
 
     Widget();
     virtual ~Widget();
 
     bool create_window(int lines = 1, int cols = 5);
-
-    void destroy_window() {
-	if (wnd) {
-	    delwin(wnd);
-	    wnd = NULL;
-	}
-    }
+    void destroy_window();
 
     bool is_valid_window() const {
-	return wnd != NULL;
-    }
-
-    void enable_keypad() {
-	if (is_valid_window())
-	    keypad(wnd, TRUE);
+	return canvas != NULL;
     }
 
     int window_width() const {
-	int x, y;
-	getmaxyx(wnd, y, x);
-	return x;
+	return canvas ? canvas->width() : -1;
     }
 
     int window_height() const {
-	int x, y;
-	getmaxyx(wnd, y, x);
-	return y;
+	return canvas ? canvas->height() : -1;
     }
 
-    int window_begx() const {
-	int x, y;
-	getbegyx(wnd, y, x);
-	return x;
+    attribute_t get_attr(int ident) const {
+	return canvas->get_attr(ident);
     }
 
-    int window_begy() const { 
-	int x, y;
-	getbegyx(wnd, y, x);
-	return y;
-    }
-  
     void put_unichar(unichar ch, unichar bad_repr);
-    void draw_string(const char *u8, bool align_right = false);
 
     virtual void resize(int lines, int columns, int y, int x);
     virtual void update() = 0;
@@ -86,9 +67,6 @@ public:
     virtual void end_modal() { modal = false; }
     virtual void set_modal() { modal = true; }
     virtual bool is_modal() const { return modal; }
-    
-    static void signal_error();
 };
 
 #endif
-